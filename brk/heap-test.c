@@ -6,15 +6,42 @@
  *
  * Note: Modern allocators (Scudo/jemalloc/glibc) often use mmap
  * for allocations, so sbrk(0) may not move strictly with malloc.
+ *
+ * Modes:
+ *   maps     - print malloc/calloc/realloc addresses and sbrk(0) (default)
+ *   realloc  - repeated realloc growth (x1.5, x2, +4 KiB) with an
+ *              mremap(MREMAP_MAYMOVE) baseline
+ *   alloc    - malloc vs. a bump-pointer arena and a per-thread slab pool
+ *              under size-class and cross-thread workloads
+ *   trim     - build a large heap, free most of it, then time how long the
+ *              libc purge knobs and raw madvise() take to return it to the OS
+ *   sizes    - per-size usable size, address stride and RSS per object for
+ *              malloc, posix_memalign and aligned_alloc
  */
 
-/* Required for sbrk on some libc implementations */
-#define _DEFAULT_SOURCE 
+/* Required for sbrk and mremap on some libc implementations */
+#define _GNU_SOURCE
 
+#include <errno.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <getopt.h>
+#include <malloc.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "../common/bench.h"
 
 /* Utility macro for error checking */
 #define CHECK_PTR(ptr) do { \
@@ -24,7 +51,94 @@
     } \
 } while (0)
 
-int main(void) {
+#define NS_PER_SEC 1000000000LL
+#define KIB 1024UL
+#define MIB (1024UL * KIB)
+#define GIB (1024UL * MIB)
+
+#define REALLOC_START_DEFAULT (4 * KIB)
+/* A 32-bit process rarely finds 1 GiB of contiguous address space */
+#define REALLOC_MAX_DEFAULT (sizeof(void *) == 4 ? 256 * MIB : GIB)
+#define REALLOC_BUDGET_DEFAULT 10
+
+#define ALLOC_COUNT_DEFAULT 200000
+#define ALLOC_CLASS_BYTES_MAX (64 * MIB)
+
+#define TRIM_HEAP_DEFAULT 256
+#define TRIM_OBJ_DEFAULT 1024
+#define TRIM_FREE_PCT_DEFAULT 90
+
+#define SIZES_MAX (64 * KIB)
+#define SIZES_CLASS_BYTES (16 * MIB)
+#define SIZES_COUNT_MIN 64
+#define SIZES_COUNT_MAX 16384
+
+static long page_size;
+
+static long minor_faults(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_minflt;
+}
+
+/* Resident set size from /proc/self/statm, or -1 if unavailable */
+static long long rss_bytes(void) {
+    long long size, resident;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f)
+        return -1;
+    if (fscanf(f, "%lld %lld", &size, &resident) != 2)
+        resident = -1;
+    fclose(f);
+    return resident < 0 ? -1 : resident * page_size;
+}
+
+/*
+ * Run fn(arg, out) in a forked child so every measurement starts from a
+ * fresh heap, and copy its result back through a pipe.
+ */
+static bool run_isolated(void (*fn)(void *arg, void *out), void *arg,
+                         void *out, size_t out_len) {
+    int fds[2];
+    if (pipe(fds))
+        return false;
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (!pid) {
+        close(fds[0]);
+        fn(arg, out);
+        if (write(fds[1], out, out_len) != (ssize_t)out_len)
+            _exit(1);
+        _exit(0);
+    }
+
+    close(fds[1]);
+    ssize_t got = read(fds[0], out, out_len);
+    close(fds[0]);
+
+    int status;
+    waitpid(pid, &status, 0);
+    return got == (ssize_t)out_len && WIFEXITED(status) && !WEXITSTATUS(status);
+}
+
+/* Touch one byte per page so the block is resident, like a filled buffer */
+static void touch_range(char *p, size_t from, size_t to) {
+    for (size_t off = from; off < to; off += page_size)
+        p[off] = (char)off;
+    if (to > from)
+        p[to - 1] = 1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Mode: maps                                                          */
+/* ------------------------------------------------------------------ */
+
+static void run_maps(void) {
     printf("PID: %d\n", getpid());
 
     /* Check program break before allocation */
@@ -53,13 +167,1303 @@ int main(void) {
 
     printf("\nTo inspect maps, run in another terminal:\n");
     printf("  cat /proc/%d/maps | grep heap\n", getpid());
-    
+
     printf("\nPress ENTER to free memory and exit...");
     getchar();
 
     /* Cleanup */
     free(realloc_ptr); /* malloc_ptr is invalidated by realloc success */
     free(calloc_ptr);
+}
+
+/* ------------------------------------------------------------------ */
+/* Mode: realloc                                                       */
+/* ------------------------------------------------------------------ */
+
+enum growth { GROW_X1_5, GROW_X2, GROW_ADD_4K };
+
+static const char *growth_name[] = {
+    [GROW_X1_5] = "x1.5",
+    [GROW_X2] = "x2",
+    [GROW_ADD_4K] = "+4KiB",
+};
+
+struct realloc_stats {
+    unsigned long steps;
+    unsigned long in_place;
+    unsigned long moved;
+    unsigned long remapped;     /* moved without faulting in the old data */
+    unsigned long long copied;  /* bytes moved by copying */
+    long long total_ns;
+    long long worst_ns;
+    size_t reached;
+    bool out_of_budget;
+};
+
+static size_t next_size(enum growth g, size_t cur) {
+    switch (g) {
+    case GROW_X1_5: return cur + cur / 2;
+    case GROW_X2: return cur * 2;
+    case GROW_ADD_4K: return cur + 4 * KIB;
+    }
+    return cur;
+}
+
+/*
+ * A move that copies has to fault in every destination page, whereas a
+ * move done with mremap() only rewires page tables. A moved block whose
+ * realloc took fewer faults than 1/8 of its old pages is counted as remapped.
+ */
+static void account_step(struct realloc_stats *st, bool moved, size_t old_size,
+                         long faults, long long ns) {
+    long old_pages = old_size / page_size;
+
+    st->steps++;
+    st->total_ns += ns;
+    if (ns > st->worst_ns)
+        st->worst_ns = ns;
+
+    if (!moved) {
+        st->in_place++;
+    } else {
+        st->moved++;
+        if (old_pages >= 16 && faults < old_pages / 8)
+            st->remapped++;
+        else
+            st->copied += old_size;
+    }
+}
+
+static void bench_realloc_growth(enum growth g, size_t start, size_t max,
+                                 long long budget_ns, struct realloc_stats *st) {
+    size_t cur = start;
+    char *p = malloc(cur);
+    CHECK_PTR(p);
+    touch_range(p, 0, cur);
+
+    memset(st, 0, sizeof(*st));
+    long long deadline = bench_now_ns() + budget_ns;
+
+    while (cur < max) {
+        size_t next = next_size(g, cur);
+        if (next > max)
+            next = max;
+
+        long f0 = minor_faults();
+        long long t0 = bench_now_ns();
+        char *np = realloc(p, next);
+        long long t1 = bench_now_ns();
+        long f1 = minor_faults();
+        if (!np) {
+            fprintf(stderr, "realloc to %lu MiB failed, try a smaller --max\n",
+                    (unsigned long)(next / MIB));
+            exit(1);
+        }
+
+        account_step(st, np != p, cur, f1 - f0, t1 - t0);
+        touch_range(np, cur, next);
+        p = np;
+        cur = next;
+
+        if (t1 > deadline) {
+            st->out_of_budget = cur < max;
+            break;
+        }
+    }
+
+    st->reached = cur;
+    free(p);
+}
+
+static void bench_mremap_growth(enum growth g, size_t start, size_t max,
+                                long long budget_ns, struct realloc_stats *st) {
+    size_t cur = (start + page_size - 1) & ~((size_t)page_size - 1);
+    char *p = mmap(NULL, cur, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    touch_range(p, 0, cur);
+
+    memset(st, 0, sizeof(*st));
+    long long deadline = bench_now_ns() + budget_ns;
+
+    while (cur < max) {
+        size_t next = next_size(g, cur);
+        next = (next + page_size - 1) & ~((size_t)page_size - 1);
+        if (next > max)
+            next = max;
+
+        long long t0 = bench_now_ns();
+        char *np = mremap(p, cur, next, MREMAP_MAYMOVE);
+        long long t1 = bench_now_ns();
+        if (np == MAP_FAILED) {
+            fprintf(stderr, "mremap to %lu MiB: %s, try a smaller --max\n",
+                    (unsigned long)(next / MIB), strerror(errno));
+            exit(1);
+        }
+
+        /* mremap never copies, so every move is a remap */
+        st->steps++;
+        st->total_ns += t1 - t0;
+        if (t1 - t0 > st->worst_ns)
+            st->worst_ns = t1 - t0;
+        if (np == p) {
+            st->in_place++;
+        } else {
+            st->moved++;
+            st->remapped++;
+        }
+
+        touch_range(np, cur, next);
+        p = np;
+        cur = next;
+
+        if (t1 > deadline) {
+            st->out_of_budget = cur < max;
+            break;
+        }
+    }
+
+    st->reached = cur;
+    munmap(p, cur);
+}
+
+static void print_realloc_row(const char *impl, enum growth g,
+                              const struct realloc_stats *st) {
+    printf("  %-8s %-6s %8lu %8lu %8lu %8lu %10.1f %10.3f %10.1f %9.1f%s\n",
+           impl, growth_name[g], st->steps, st->in_place, st->moved,
+           st->remapped, (double)st->copied / MIB,
+           (double)st->total_ns / 1e6,
+           st->steps ? (double)st->total_ns / st->steps / 1e3 : 0.0,
+           (double)st->worst_ns / 1e3,
+           st->out_of_budget ? "  (budget hit)" : "");
+}
+
+static void run_realloc(size_t max, int budget_sec) {
+    long long budget_ns = budget_sec * NS_PER_SEC;
+    const char *thp = bench_env_get(bench_env_self(), "thp.enabled");
+    bool thp_off = false;
+    struct realloc_stats st;
+
+    /*
+     * A copy into huge pages takes one fault per 2 MiB and would pass for
+     * a remap, so the blocks are kept on small pages.
+     */
+#ifdef PR_SET_THP_DISABLE
+    thp_off = !prctl(PR_SET_THP_DISABLE, 1, 0, 0, 0);
+#endif
+
+    printf("realloc growth from %lu B to %lu MiB (budget %d s per pattern)\n",
+           REALLOC_START_DEFAULT, (unsigned long)(max / MIB), budget_sec);
+    printf("remap = moved without faulting in the old data (inferred from minor faults)\n");
+    if (!thp || !strcmp(thp, "never"))
+        printf("THP: %s\n\n", thp ? thp : "not available");
+    else if (thp_off)
+        printf("THP: %s, disabled for this run\n\n", thp);
+    else
+        printf("THP: %s and could not be disabled, huge-page copies may count as remaps\n\n",
+               thp);
+    printf("  %-8s %-6s %8s %8s %8s %8s %10s %10s %10s %9s\n",
+           "impl", "growth", "steps", "inplace", "moved", "remap",
+           "copiedMiB", "total_ms", "avg_us", "worst_us");
+
+    for (int g = GROW_X1_5; g <= GROW_ADD_4K; g++) {
+        bench_realloc_growth(g, REALLOC_START_DEFAULT, max, budget_ns, &st);
+        print_realloc_row("realloc", g, &st);
+        if (st.out_of_budget)
+            printf("  %-8s %-6s stopped at %lu MiB\n", "", "",
+                   (unsigned long)(st.reached / MIB));
+
+        bench_mremap_growth(g, REALLOC_START_DEFAULT, max, budget_ns, &st);
+        print_realloc_row("mremap", g, &st);
+        if (st.out_of_budget)
+            printf("  %-8s %-6s stopped at %lu MiB\n", "", "",
+                   (unsigned long)(st.reached / MIB));
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Mode: alloc                                                         */
+/* ------------------------------------------------------------------ */
+
+/*
+ * Bump-pointer arena: one lazily-faulted reservation, allocation is an
+ * add and a compare, and the only way to free is to reset the whole arena.
+ * The reservation is sized to the live objects, and capped so a 32-bit
+ * process can still find the address space for it.
+ */
+#define ARENA_ALIGN 16
+#define ARENA_HEADROOM (1 * MIB)
+#define ARENA_RESERVE_MAX (sizeof(void *) == 4 ? 256 * MIB : 1 * GIB)
+
+struct arena {
+    char *base;
+    size_t size;
+    size_t used;
+};
+
+static bool arena_init(struct arena *a, size_t size) {
+    a->base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (a->base == MAP_FAILED)
+        return false;
+    a->size = size;
+    a->used = 0;
+    return true;
+}
+
+/* Room for count objects of size bytes, each padded to ARENA_ALIGN */
+static size_t arena_reserve_size(size_t size, size_t count) {
+    size_t per = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    if (count > (ARENA_RESERVE_MAX - ARENA_HEADROOM) / per)
+        return ARENA_RESERVE_MAX;
+    return count * per + ARENA_HEADROOM;
+}
+
+static inline void *arena_alloc(struct arena *a, size_t n) {
+    size_t off = (a->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (off + n > a->size)
+        return NULL;
+    a->used = off + n;
+    return a->base + off;
+}
+
+static inline void arena_reset(struct arena *a) {
+    a->used = 0;
+}
+
+static void arena_destroy(struct arena *a) {
+    munmap(a->base, a->size);
+}
+
+/*
+ * Fixed-size slab pool, one per thread. Slabs are SLAB_SIZE-aligned so the
+ * owning pool is found by masking the object address. The owner allocates
+ * and frees through a private list without atomics; other threads push
+ * frees onto a lock-free stack which the owner takes whole with one
+ * exchange once the private list runs dry. Push-only plus take-all is
+ * ABA-free, so a plain CAS loop suffices.
+ */
+#define SLAB_SIZE (64 * KIB)
+
+struct slab_pool;
+
+struct slab {
+    struct slab_pool *owner;
+    struct slab *next;
+};
+
+struct free_obj {
+    struct free_obj *next;
+};
+
+struct slab_pool {
+    size_t obj_size;
+    struct free_obj *local_free;
+    _Atomic(struct free_obj *) remote_free;
+    char *bump;
+    char *bump_end;
+    struct slab *slabs;
+    size_t reserved;
+};
+
+static void pool_init(struct slab_pool *pool, size_t obj_size) {
+    memset(pool, 0, sizeof(*pool));
+    pool->obj_size = (obj_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    if (pool->obj_size < sizeof(struct free_obj))
+        pool->obj_size = sizeof(struct free_obj);
+    atomic_init(&pool->remote_free, NULL);
+}
+
+static struct slab *slab_map(void) {
+    /* Over-map and trim to get SLAB_SIZE alignment */
+    char *raw = mmap(NULL, 2 * SLAB_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+        return NULL;
+
+    char *aligned = (char *)(((uintptr_t)raw + SLAB_SIZE - 1) & ~(uintptr_t)(SLAB_SIZE - 1));
+    if (aligned > raw)
+        munmap(raw, aligned - raw);
+    if (aligned + SLAB_SIZE < raw + 2 * SLAB_SIZE)
+        munmap(aligned + SLAB_SIZE, raw + 2 * SLAB_SIZE - (aligned + SLAB_SIZE));
+    return (struct slab *)aligned;
+}
+
+static void *pool_refill(struct slab_pool *pool) {
+    /* Reclaim everything other threads have freed back to us */
+    struct free_obj *remote = atomic_exchange_explicit(&pool->remote_free, NULL,
+                                                       memory_order_acquire);
+    if (remote) {
+        pool->local_free = remote->next;
+        return remote;
+    }
+
+    if (pool->obj_size > SLAB_SIZE - sizeof(struct slab))
+        return NULL;
+
+    struct slab *slab = slab_map();
+    if (!slab)
+        return NULL;
+    slab->owner = pool;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->reserved += SLAB_SIZE;
+
+    size_t hdr = (sizeof(struct slab) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    pool->bump = (char *)slab + hdr;
+    pool->bump_end = (char *)slab + SLAB_SIZE;
+
+    void *p = pool->bump;
+    pool->bump += pool->obj_size;
+    return p;
+}
+
+static inline void *pool_alloc(struct slab_pool *pool) {
+    struct free_obj *obj = pool->local_free;
+    if (obj) {
+        pool->local_free = obj->next;
+        return obj;
+    }
+    if (pool->bump + pool->obj_size <= pool->bump_end) {
+        void *p = pool->bump;
+        pool->bump += pool->obj_size;
+        return p;
+    }
+    return pool_refill(pool);
+}
+
+/* self is the calling thread's own pool */
+static inline void pool_free(struct slab_pool *self, void *p) {
+    struct slab *slab = (struct slab *)((uintptr_t)p & ~(uintptr_t)(SLAB_SIZE - 1));
+    struct slab_pool *owner = slab->owner;
+    struct free_obj *obj = p;
+
+    if (owner == self) {
+        obj->next = self->local_free;
+        self->local_free = obj;
+        return;
+    }
+
+    struct free_obj *head = atomic_load_explicit(&owner->remote_free, memory_order_relaxed);
+    do {
+        obj->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&owner->remote_free, &head, obj,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+}
+
+static void pool_destroy(struct slab_pool *pool) {
+    struct slab *slab = pool->slabs;
+    while (slab) {
+        struct slab *next = slab->next;
+        munmap(slab, SLAB_SIZE);
+        slab = next;
+    }
+    pool->slabs = NULL;
+}
+
+/* Per-thread allocator state behind a common interface */
+enum alloc_impl { IMPL_MALLOC, IMPL_ARENA, IMPL_POOL, IMPL_COUNT };
+
+static const char *impl_name[] = {
+    [IMPL_MALLOC] = "malloc",
+    [IMPL_ARENA] = "arena",
+    [IMPL_POOL] = "pool",
+};
+
+struct alloc_ctx {
+    enum alloc_impl impl;
+    size_t size;
+    struct arena arena;
+    struct slab_pool pool;
+};
+
+/* count: most objects live at once, which the arena has to hold */
+static bool ctx_init(struct alloc_ctx *ctx, enum alloc_impl impl, size_t size, size_t count) {
+    ctx->impl = impl;
+    ctx->size = size;
+    if (impl == IMPL_ARENA)
+        return arena_init(&ctx->arena, arena_reserve_size(size, count));
+    if (impl == IMPL_POOL)
+        pool_init(&ctx->pool, size);
+    return true;
+}
+
+static inline void *ctx_alloc(struct alloc_ctx *ctx) {
+    switch (ctx->impl) {
+    case IMPL_ARENA: return arena_alloc(&ctx->arena, ctx->size);
+    case IMPL_POOL: return pool_alloc(&ctx->pool);
+    default: return malloc(ctx->size);
+    }
+}
+
+static inline void ctx_free(struct alloc_ctx *ctx, void *p) {
+    switch (ctx->impl) {
+    case IMPL_ARENA: break; /* reclaimed by ctx_release_all */
+    case IMPL_POOL: pool_free(&ctx->pool, p); break;
+    default: free(p); break;
+    }
+}
+
+/* Drop every live object: per-object frees, or one arena reset */
+static void ctx_release_all(struct alloc_ctx *ctx, void **objs, size_t n) {
+    if (ctx->impl == IMPL_ARENA) {
+        arena_reset(&ctx->arena);
+        return;
+    }
+    for (size_t i = 0; i < n; i++)
+        ctx_free(ctx, objs[i]);
+}
+
+static void ctx_destroy(struct alloc_ctx *ctx) {
+    if (ctx->impl == IMPL_ARENA)
+        arena_destroy(&ctx->arena);
+    else if (ctx->impl == IMPL_POOL)
+        pool_destroy(&ctx->pool);
+}
+
+struct alloc_job {
+    enum alloc_impl impl;
+    size_t size;
+    size_t count;
+    int rounds;
+};
+
+struct alloc_result {
+    double mops;                /* alloc+free pairs per second, millions */
+    long long rss_delta;        /* RSS growth with count objects live */
+    unsigned long long payload; /* count * size */
+};
+
+/*
+ * Size-class workload: allocate count objects, touch each, then release
+ * them all; repeat for several rounds. RSS is sampled with the first
+ * round's objects live.
+ */
+static void size_class_worker(void *arg, void *out) {
+    struct alloc_job *job = arg;
+    struct alloc_result *res = out;
+    struct alloc_ctx ctx;
+    void **objs = calloc(job->count, sizeof(void *));
+
+    memset(res, 0, sizeof(*res));
+    if (!objs || !ctx_init(&ctx, job->impl, job->size, job->count))
+        _exit(1);
+
+    long long rss0 = rss_bytes();
+    long long total_ns = 0;
+
+    for (int r = 0; r < job->rounds; r++) {
+        long long t0 = bench_now_ns();
+        for (size_t i = 0; i < job->count; i++) {
+            char *p = ctx_alloc(&ctx);
+            if (!p)
+                _exit(1);
+            p[0] = (char)i;
+            objs[i] = p;
+        }
+        long long t1 = bench_now_ns();
+
+        if (r == 0)
+            res->rss_delta = rss_bytes() - rss0;
+
+        long long t2 = bench_now_ns();
+        ctx_release_all(&ctx, objs, job->count);
+        long long t3 = bench_now_ns();
+
+        total_ns += (t1 - t0) + (t3 - t2);
+    }
+
+    res->payload = (unsigned long long)job->count * job->size;
+    res->mops = (double)job->count * job->rounds / ((double)total_ns / 1e3);
+    ctx_destroy(&ctx);
+    free(objs);
+}
+
+/*
+ * Cross-thread workload: the producer allocates, hands each object over a
+ * single-producer/single-consumer ring, and the consumer frees it. For the
+ * pool this exercises the remote-free path back to the producer's slabs.
+ */
+#define XRING_SIZE 1024
+
+struct xthread {
+    struct alloc_job *job;
+    struct alloc_ctx prod;
+    struct alloc_ctx cons;
+    void *ring[XRING_SIZE];
+    _Atomic size_t head;
+    _Atomic size_t tail;
+};
+
+static void *xthread_consumer(void *arg) {
+    struct xthread *x = arg;
+    size_t tail = 0;
+
+    for (size_t n = 0; n < x->job->count * x->job->rounds; n++) {
+        while (atomic_load_explicit(&x->head, memory_order_acquire) == tail)
+            sched_yield();
+        void *p = x->ring[tail % XRING_SIZE];
+        atomic_store_explicit(&x->tail, ++tail, memory_order_release);
+        ctx_free(&x->cons, p);
+    }
+    return NULL;
+}
+
+static void cross_thread_worker(void *arg, void *out) {
+    struct alloc_result *res = out;
+    struct xthread *x = calloc(1, sizeof(*x));
+    pthread_t tid;
+
+    memset(res, 0, sizeof(*res));
+    if (!x)
+        _exit(1);
+    x->job = arg;
+    if (!ctx_init(&x->prod, x->job->impl, x->job->size, XRING_SIZE) ||
+        !ctx_init(&x->cons, x->job->impl, x->job->size, XRING_SIZE))
+        _exit(1);
+
+    long long rss0 = rss_bytes();
+    long long t0 = bench_now_ns();
+    if (pthread_create(&tid, NULL, xthread_consumer, x))
+        _exit(1);
+
+    size_t head = 0;
+    for (size_t n = 0; n < x->job->count * x->job->rounds; n++) {
+        char *p = ctx_alloc(&x->prod);
+        if (!p)
+            _exit(1);
+        p[0] = (char)n;
+        while (head - atomic_load_explicit(&x->tail, memory_order_acquire) == XRING_SIZE)
+            sched_yield();
+        x->ring[head % XRING_SIZE] = p;
+        atomic_store_explicit(&x->head, ++head, memory_order_release);
+    }
+
+    pthread_join(tid, NULL);
+    long long t1 = bench_now_ns();
+
+    res->rss_delta = rss_bytes() - rss0;
+    res->payload = 0;
+    res->mops = (double)x->job->count * x->job->rounds / ((double)(t1 - t0) / 1e3);
+    ctx_destroy(&x->prod);
+    ctx_destroy(&x->cons);
+    free(x);
+}
+
+/* Overhead is relative to the payload, or absolute RSS growth without one */
+static void print_alloc_cell(bool ok, const struct alloc_result *res) {
+    if (!ok) {
+        printf(" %9s %8s", "fail", "");
+        return;
+    }
+    if (res->payload)
+        printf(" %9.2f %7.0f%%", res->mops,
+               100.0 * ((double)res->rss_delta - (double)res->payload) / res->payload);
+    else
+        printf(" %9.2f %8lld", res->mops, res->rss_delta / (long long)KIB);
+}
+
+static void run_alloc(size_t count, int rounds) {
+    static const size_t sizes[] = { 16, 32, 64, 128, 256, 512, 1024, 2048, 4096 };
+    struct alloc_result res;
+
+    printf("Size-class workload: allocate N, touch, release all; %d rounds\n", rounds);
+    printf("Mops = alloc+free pairs per second; ovh = (RSS growth - payload) / payload\n\n");
+    printf("  %6s %8s", "size", "N");
+    for (int i = 0; i < IMPL_COUNT; i++)
+        printf(" %9s %8s", impl_name[i], "ovh");
+    printf("\n");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        struct alloc_job job = {
+            .size = sizes[s],
+            .count = count,
+            .rounds = rounds,
+        };
+        if (job.count * job.size > ALLOC_CLASS_BYTES_MAX)
+            job.count = ALLOC_CLASS_BYTES_MAX / job.size;
+
+        printf("  %6zu %8zu", job.size, job.count);
+        for (int i = 0; i < IMPL_COUNT; i++) {
+            job.impl = i;
+            bool ok = run_isolated(size_class_worker, &job, &res, sizeof(res));
+            print_alloc_cell(ok, &res);
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+
+    printf("\nCross-thread workload: producer allocates, consumer frees\n");
+    printf("rssKiB = RSS growth over the run (at most %d objects in flight)\n\n", XRING_SIZE);
+    printf("  %6s %8s", "size", "N");
+    for (int i = 0; i < IMPL_COUNT; i++)
+        printf(" %9s %8s", impl_name[i], "rssKiB");
+    printf("\n");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        struct alloc_job job = {
+            .size = sizes[s],
+            .count = count,
+            .rounds = rounds,
+        };
+
+        printf("  %6zu %8zu", job.size, job.count);
+        for (int i = 0; i < IMPL_COUNT; i++) {
+            /* An arena cannot free individual objects, let alone remotely */
+            if (i == IMPL_ARENA) {
+                printf(" %9s %8s", "n/a", "");
+                continue;
+            }
+            job.impl = i;
+            bool ok = run_isolated(cross_thread_worker, &job, &res, sizeof(res));
+            print_alloc_cell(ok, &res);
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Mode: trim                                                          */
+/* ------------------------------------------------------------------ */
+
+enum free_pattern { PAT_ALL, PAT_HEAD, PAT_TAIL, PAT_STRIDE, PAT_RANDOM, PAT_COUNT };
+
+static const char *pattern_name[] = {
+    [PAT_ALL] = "all",
+    [PAT_HEAD] = "head",
+    [PAT_TAIL] = "tail",
+    [PAT_STRIDE] = "stride",
+    [PAT_RANDOM] = "random",
+};
+
+/*
+ * Reclaim methods. The libc knobs act on a malloc heap; the madvise ones
+ * act on a plain mapping with the same objects "freed", as a lower bound.
+ * M_DECAY_TIME=0 makes free() itself return pages, so its cost shows in
+ * free_ms rather than in a reclaim call.
+ */
+enum reclaim { RC_NONE, RC_TRIM, RC_PURGE, RC_PURGE_ALL, RC_DECAY0,
+               RC_DONTNEED, RC_FREE, RC_COUNT };
+
+static const char *reclaim_name[] = {
+    [RC_NONE] = "none",
+    [RC_TRIM] = "malloc_trim",
+    [RC_PURGE] = "M_PURGE",
+    [RC_PURGE_ALL] = "M_PURGE_ALL",
+    [RC_DECAY0] = "M_DECAY_TIME=0",
+    [RC_DONTNEED] = "MADV_DONTNEED",
+    [RC_FREE] = "MADV_FREE",
+};
+
+static bool reclaim_supported(enum reclaim rc) {
+    switch (rc) {
+#ifndef __GLIBC__
+    case RC_TRIM: return false;
+#endif
+#ifndef M_PURGE
+    case RC_PURGE: return false;
+#endif
+#ifndef M_PURGE_ALL
+    case RC_PURGE_ALL: return false;
+#endif
+#ifndef M_DECAY_TIME
+    case RC_DECAY0: return false;
+#endif
+#ifndef MADV_FREE
+    case RC_FREE: return false;
+#endif
+    default: return true;
+    }
+}
+
+static bool reclaim_is_madvise(enum reclaim rc) {
+    return rc == RC_DONTNEED || rc == RC_FREE;
+}
+
+struct trim_job {
+    enum free_pattern pattern;
+    enum reclaim method;
+    size_t heap;
+    size_t obj_size;
+    int free_pct;
+};
+
+struct trim_result {
+    long long rss_base;
+    long long rss_peak;
+    long long rss_freed;    /* after free(), before the reclaim call */
+    long long rss_after;    /* after the reclaim call */
+    long long free_ns;
+    long long reclaim_ns;   /* -1: no separate reclaim call */
+    unsigned long long freed_bytes;
+    int madvise_errno;      /* madvise() failed, the row has no result */
+    bool free_fallback;     /* kernel rejected MADV_FREE, MADV_DONTNEED ran */
+};
+
+static uint64_t xorshift64(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/* Mark which of n objects the pattern frees; returns how many */
+static size_t select_victims(enum free_pattern pat, int pct, bool *victim, size_t n) {
+    size_t k = pat == PAT_ALL ? n : n * pct / 100;
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+
+    memset(victim, 0, n * sizeof(bool));
+    switch (pat) {
+    case PAT_ALL:
+        memset(victim, 1, n * sizeof(bool));
+        break;
+    case PAT_HEAD:
+        memset(victim, 1, k * sizeof(bool));
+        break;
+    case PAT_TAIL:
+        memset(victim + (n - k), 1, k * sizeof(bool));
+        break;
+    case PAT_STRIDE:
+        /* Victims spread evenly at the exact ratio: worst case for returning whole pages */
+        k = 0;
+        for (size_t i = 0; i < n; i++) {
+            victim[i] = i * pct / 100 != (i + 1) * pct / 100;
+            k += victim[i];
+        }
+        break;
+    case PAT_RANDOM: {
+        size_t *perm = malloc(n * sizeof(size_t));
+        CHECK_PTR(perm);
+        for (size_t i = 0; i < n; i++)
+            perm[i] = i;
+        for (size_t i = n - 1; i > 0; i--) {
+            size_t j = xorshift64(&seed) % (i + 1);
+            size_t t = perm[i];
+            perm[i] = perm[j];
+            perm[j] = t;
+        }
+        for (size_t i = 0; i < k; i++)
+            victim[perm[i]] = true;
+        free(perm);
+        break;
+    }
+    default:
+        break;
+    }
+    return k;
+}
+
+static void trim_malloc_worker(void *arg, void *out) {
+    struct trim_job *job = arg;
+    struct trim_result *res = out;
+    size_t n = job->heap / job->obj_size;
+    void **objs = mmap(NULL, n * sizeof(void *), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    bool *victim = mmap(NULL, n, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    /* Bookkeeping lives outside the heap so it does not pin any of it */
+    if (objs == MAP_FAILED || victim == MAP_FAILED)
+        _exit(1);
+
+    memset(res, 0, sizeof(*res));
+    size_t k = select_victims(job->pattern, job->free_pct, victim, n);
+    res->freed_bytes = (unsigned long long)k * job->obj_size;
+
+#ifdef M_DECAY_TIME
+    /* Set before the heap is built so every free() below purges */
+    if (job->method == RC_DECAY0)
+        mallopt(M_DECAY_TIME, 0);
+#endif
+
+    res->rss_base = rss_bytes();
+    for (size_t i = 0; i < n; i++) {
+        objs[i] = malloc(job->obj_size);
+        if (!objs[i])
+            _exit(1);
+        memset(objs[i], 0x5a, job->obj_size);
+    }
+    res->rss_peak = rss_bytes();
+
+    long long t0 = bench_now_ns();
+    for (size_t i = 0; i < n; i++) {
+        if (victim[i]) {
+            free(objs[i]);
+            objs[i] = NULL;
+        }
+    }
+    long long t1 = bench_now_ns();
+    res->free_ns = t1 - t0;
+    res->rss_freed = rss_bytes();
+
+    if (job->method == RC_DECAY0) {
+        res->reclaim_ns = -1;
+        res->rss_after = res->rss_freed;
+        return;
+    }
+
+    t0 = bench_now_ns();
+    switch (job->method) {
+#ifdef __GLIBC__
+    case RC_TRIM: malloc_trim(0); break;
+#endif
+#ifdef M_PURGE
+    case RC_PURGE: mallopt(M_PURGE, 0); break;
+#endif
+#ifdef M_PURGE_ALL
+    case RC_PURGE_ALL: mallopt(M_PURGE_ALL, 0); break;
+#endif
+    default: break;
+    }
+    t1 = bench_now_ns();
+    res->reclaim_ns = t1 - t0;
+    res->rss_after = rss_bytes();
+}
+
+/* Same layout on a bare mapping; madvise only the pages fully covered by freed runs */
+static void trim_madvise_worker(void *arg, void *out) {
+    struct trim_job *job = arg;
+    struct trim_result *res = out;
+    size_t n = job->heap / job->obj_size;
+    size_t len = n * job->obj_size;
+    bool *victim = mmap(NULL, n, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    int advice = MADV_DONTNEED;
+
+    if (victim == MAP_FAILED)
+        _exit(1);
+
+    memset(res, 0, sizeof(*res));
+#ifdef MADV_FREE
+    /* The headers may know MADV_FREE while the kernel (before 4.5) does not */
+    if (job->method == RC_FREE) {
+        char *probe = mmap(NULL, page_size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (probe == MAP_FAILED)
+            _exit(1);
+        if (!madvise(probe, page_size, MADV_FREE))
+            advice = MADV_FREE;
+        else if (errno == EINVAL)
+            res->free_fallback = true;
+        else
+            res->madvise_errno = errno;
+        munmap(probe, page_size);
+    }
+#endif
+
+    size_t k = select_victims(job->pattern, job->free_pct, victim, n);
+    res->freed_bytes = (unsigned long long)k * job->obj_size;
+
+    res->rss_base = rss_bytes();
+    char *base = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+        _exit(1);
+    memset(base, 0x5a, len);
+    res->rss_peak = rss_bytes();
+    res->rss_freed = res->rss_peak;
+
+    long long t0 = bench_now_ns();
+    for (size_t i = 0; i < n;) {
+        if (!victim[i]) {
+            i++;
+            continue;
+        }
+        size_t j = i;
+        while (j < n && victim[j])
+            j++;
+
+        uintptr_t lo = (uintptr_t)base + i * job->obj_size;
+        uintptr_t hi = (uintptr_t)base + j * job->obj_size;
+        lo = (lo + page_size - 1) & ~(uintptr_t)(page_size - 1);
+        hi &= ~(uintptr_t)(page_size - 1);
+        if (hi > lo && madvise((void *)lo, hi - lo, advice)) {
+            res->madvise_errno = errno;
+            break;
+        }
+        i = j;
+    }
+    long long t1 = bench_now_ns();
+    res->reclaim_ns = t1 - t0;
+    res->rss_after = rss_bytes();
+}
+
+static void run_trim(size_t heap, size_t obj_size, int free_pct, int only_pattern) {
+    struct trim_result res;
+
+    printf("Heap of %lu MiB in %zu-byte objects, freeing %d%% (pattern 'all' frees 100%%)\n",
+           (unsigned long)(heap / MIB), obj_size, free_pct);
+    printf("returned = RSS drop after free+reclaim / bytes freed\n");
+    printf("MADV_FREE pages stay counted in RSS until the kernel is under memory pressure\n");
+    printf("M_DECAY_TIME=0 purges inside free(): compare its free_ms with 'none'\n\n");
+    printf("  %-7s %-15s %8s %8s %8s %9s %11s %8s %9s\n",
+           "pattern", "method", "peakMiB", "freeMiB", "free_ms",
+           "freedMiB", "reclaim_ms", "afterMiB", "returned");
+
+    for (int pat = 0; pat < PAT_COUNT; pat++) {
+        if (only_pattern >= 0 && pat != only_pattern)
+            continue;
+
+        for (int rc = 0; rc < RC_COUNT; rc++) {
+            struct trim_job job = {
+                .pattern = pat,
+                .method = rc,
+                .heap = heap,
+                .obj_size = obj_size,
+                .free_pct = free_pct,
+            };
+
+            printf("  %-7s %-15s", pattern_name[pat], reclaim_name[rc]);
+            if (!reclaim_supported(rc)) {
+                printf(" %8s\n", "unsupported by this libc/kernel");
+                continue;
+            }
+
+            bool ok = run_isolated(reclaim_is_madvise(rc) ? trim_madvise_worker
+                                                          : trim_malloc_worker,
+                                   &job, &res, sizeof(res));
+            if (!ok) {
+                printf(" %8s\n", "fail");
+                continue;
+            }
+            if (res.madvise_errno) {
+                printf(" madvise: %s\n", strerror(res.madvise_errno));
+                continue;
+            }
+
+            long long grown = res.rss_peak - res.rss_base;
+            char reclaim_ms[16] = "-";
+            if (res.reclaim_ns >= 0)
+                snprintf(reclaim_ms, sizeof(reclaim_ms), "%.3f", (double)res.reclaim_ns / 1e6);
+            printf(" %8.1f %8.1f %8.2f %9.1f %11s %8.1f %8.0f%%%s\n",
+                   (double)grown / MIB,
+                   (double)(res.rss_freed - res.rss_base) / MIB,
+                   (double)res.free_ns / 1e6,
+                   (double)res.freed_bytes / MIB,
+                   reclaim_ms,
+                   (double)(res.rss_after - res.rss_base) / MIB,
+                   res.freed_bytes ? 100.0 * (res.rss_peak - res.rss_after) / res.freed_bytes : 0.0,
+                   res.free_fallback ? "  (kernel rejects MADV_FREE, ran MADV_DONTNEED)" : "");
+            fflush(stdout);
+        }
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Mode: sizes                                                         */
+/* ------------------------------------------------------------------ */
+
+enum align_fn { FN_MALLOC, FN_POSIX_MEMALIGN, FN_ALIGNED_ALLOC };
+
+static const char *align_fn_name[] = {
+    [FN_MALLOC] = "malloc",
+    [FN_POSIX_MEMALIGN] = "posix_memalign",
+    [FN_ALIGNED_ALLOC] = "aligned_alloc",
+};
+
+struct sizes_job {
+    enum align_fn fn;
+    size_t size;
+    size_t align;
+};
+
+struct sizes_result {
+    size_t count;
+    size_t usable;
+    long long stride;       /* median distance between consecutive objects */
+    double rss_per_obj;
+    size_t misaligned;
+};
+
+static int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static void *sizes_alloc(const struct sizes_job *job) {
+    void *p = NULL;
+
+    switch (job->fn) {
+    case FN_POSIX_MEMALIGN:
+        if (posix_memalign(&p, job->align, job->size))
+            p = NULL;
+        return p;
+    case FN_ALIGNED_ALLOC:
+        /* C11 (and bionic) require size to be a multiple of the alignment */
+        return aligned_alloc(job->align, (job->size + job->align - 1) & ~(job->align - 1));
+    default:
+        return malloc(job->size);
+    }
+}
+
+/*
+ * Allocate enough objects of one size to cover ~SIZES_CLASS_BYTES, touch
+ * each, and derive the per-object footprint from the RSS growth.
+ */
+static void sizes_worker(void *arg, void *out) {
+    struct sizes_job *job = arg;
+    struct sizes_result *res = out;
+    size_t n = SIZES_CLASS_BYTES / job->size;
+
+    if (n < SIZES_COUNT_MIN)
+        n = SIZES_COUNT_MIN;
+    if (n > SIZES_COUNT_MAX)
+        n = SIZES_COUNT_MAX;
+
+    /* Bookkeeping lives outside the heap so it does not skew the RSS delta */
+    size_t book = n * (sizeof(char *) + sizeof(long long));
+    char *mem = mmap(NULL, book, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        _exit(1);
+    memset(mem, 0, book);
+    char **objs = (char **)mem;
+    long long *gaps = (long long *)(mem + n * sizeof(char *));
+
+    memset(res, 0, sizeof(*res));
+    res->count = n;
+
+    /* Warm up libc internals so their first-use cost is not charged here */
+    free(sizes_alloc(job));
+
+    long long rss0 = rss_bytes();
+    for (size_t i = 0; i < n; i++) {
+        objs[i] = sizes_alloc(job);
+        if (!objs[i])
+            _exit(1);
+        memset(objs[i], 0x5a, job->size);
+        if (job->align && ((uintptr_t)objs[i] & (job->align - 1)))
+            res->misaligned++;
+    }
+    long long rss1 = rss_bytes();
+
+    res->usable = malloc_usable_size(objs[0]);
+    for (size_t i = 1; i < n; i++) {
+        long long d = (long long)((intptr_t)objs[i] - (intptr_t)objs[i - 1]);
+        gaps[i - 1] = d < 0 ? -d : d;
+    }
+    qsort(gaps, n - 1, sizeof(long long), cmp_ll);
+    res->stride = gaps[(n - 1) / 2];
+    res->rss_per_obj = (double)(rss1 - rss0) / n;
+}
+
+static void print_sizes_row(const struct sizes_job *job, bool ok,
+                            const struct sizes_result *res) {
+    if (!ok) {
+        printf(" %10s\n", "fail");
+        return;
+    }
+    printf(" %8zu %8lld %10.1f %7.0f%% %6zu%s\n",
+           res->usable, res->stride, res->rss_per_obj,
+           100.0 * (res->rss_per_obj - (double)job->size) / job->size,
+           res->count,
+           res->misaligned ? "  MISALIGNED" : "");
+}
+
+static void run_sizes(size_t step) {
+    static const size_t align_sizes[] = { 1, 24, 64, 100, 256, 1000, 4096, 10000, 65536 };
+    static const size_t aligns[] = { 16, 64, 256, 4096 };
+    struct sizes_result res;
+
+    printf("Per-size footprint, each size in a fresh process\n");
+    printf("stride = median distance between consecutive allocations\n");
+    printf("waste = (RSS per object - requested) / requested\n\n");
+    printf("  %-14s %6s %6s %8s %8s %10s %8s %6s\n",
+           "function", "align", "size", "usable", "stride", "rss/obj", "waste", "N");
+
+    /*
+     * With --step, sweep linearly. Otherwise walk every size up to 64 B,
+     * then each power of two, its quarter points, and one byte past it.
+     */
+    for (size_t size = 1; size <= SIZES_MAX;) {
+        struct sizes_job job = { .fn = FN_MALLOC, .size = size };
+
+        printf("  %-14s %6s %6zu", align_fn_name[job.fn], "-", size);
+        bool ok = run_isolated(sizes_worker, &job, &res, sizeof(res));
+        print_sizes_row(&job, ok, &res);
+        fflush(stdout);
+
+        if (step) {
+            size = size == 1 && step > 1 ? step : size + step;
+        } else if (size < 64) {
+            size++;
+        } else {
+            size_t pow2 = 64;
+            while (pow2 * 2 <= size)
+                pow2 *= 2;
+            size_t q = pow2 / 4;
+            if (size == pow2)
+                size = pow2 + 1;
+            else if (size == pow2 + 1)
+                size = pow2 + q;
+            else
+                size += q;
+        }
+    }
+
+    printf("\n");
+    for (size_t a = 0; a < sizeof(aligns) / sizeof(aligns[0]); a++) {
+        for (int fn = FN_POSIX_MEMALIGN; fn <= FN_ALIGNED_ALLOC; fn++) {
+            for (size_t s = 0; s < sizeof(align_sizes) / sizeof(align_sizes[0]); s++) {
+                struct sizes_job job = {
+                    .fn = fn,
+                    .size = align_sizes[s],
+                    .align = aligns[a],
+                };
+
+                printf("  %-14s %6zu %6zu", align_fn_name[fn], job.align, job.size);
+                bool ok = run_isolated(sizes_worker, &job, &res, sizeof(res));
+                print_sizes_row(&job, ok, &res);
+                fflush(stdout);
+            }
+        }
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Command line                                                        */
+/* ------------------------------------------------------------------ */
+
+static char *short_options = "hm:M:b:n:r:H:o:f:p:s:";
+static struct option long_options[] = {
+        {"help", no_argument, 0, 'h'},
+        {"mode", required_argument, 0, 'm'},
+        {"max", required_argument, 0, 'M'},
+        {"budget", required_argument, 0, 'b'},
+        {"count", required_argument, 0, 'n'},
+        {"rounds", required_argument, 0, 'r'},
+        {"heap", required_argument, 0, 'H'},
+        {"objsize", required_argument, 0, 'o'},
+        {"free-pct", required_argument, 0, 'f'},
+        {"pattern", required_argument, 0, 'p'},
+        {"step", required_argument, 0, 's'},
+        {0, 0, 0, 0}
+};
+
+static void print_help(char *prog_name) {
+    printf("Usage: %s [options]\n"
+           "\n"
+           "Visualize and benchmark heap allocator behavior\n"
+           "\n"
+           "Options:\n"
+           "  -h, --help\tshow usage help\n"
+           "  -m, --mode\tmaps, realloc, alloc, trim or sizes (default: maps)\n"
+           "  -M, --max\tlargest block in MiB for realloc (default: %lu)\n"
+           "  -b, --budget\tseconds per realloc pattern (default: %d)\n"
+           "  -n, --count\tobjects per size class for alloc (default: %d)\n"
+           "  -r, --rounds\trounds per alloc workload (default: 5)\n"
+           "  -H, --heap\theap size in MiB for trim (default: %d)\n"
+           "  -o, --objsize\tobject size for trim (default: %d)\n"
+           "  -f, --free-pct\tpercent of objects trim frees (default: %d)\n"
+           "  -p, --pattern\ttrim free pattern: all, head, tail, stride, random\n"
+           "\t\t(default: every pattern)\n"
+           "  -s, --step\tlinear size step for sizes (default: log-spaced)\n",
+           prog_name, (unsigned long)(REALLOC_MAX_DEFAULT / MIB), REALLOC_BUDGET_DEFAULT,
+           ALLOC_COUNT_DEFAULT,
+           TRIM_HEAP_DEFAULT, TRIM_OBJ_DEFAULT, TRIM_FREE_PCT_DEFAULT);
+
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    const char *mode = "maps";
+    size_t max = REALLOC_MAX_DEFAULT;
+    int budget = REALLOC_BUDGET_DEFAULT;
+    size_t count = ALLOC_COUNT_DEFAULT;
+    int rounds = 5;
+    size_t heap = TRIM_HEAP_DEFAULT * MIB;
+    size_t obj_size = TRIM_OBJ_DEFAULT;
+    int free_pct = TRIM_FREE_PCT_DEFAULT;
+    int pattern = -1;
+    size_t step = 0;
+
+    while (1) {
+        int c = getopt_long(argc, argv, short_options, long_options, NULL);
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case 'm':
+                mode = optarg;
+                break;
+            case 'M':
+                max = strtoul(optarg, NULL, 0) * MIB;
+                break;
+            case 'b':
+                budget = atoi(optarg);
+                break;
+            case 'n':
+                count = strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                rounds = atoi(optarg);
+                break;
+            case 'H':
+                heap = strtoul(optarg, NULL, 0) * MIB;
+                break;
+            case 'o':
+                obj_size = strtoul(optarg, NULL, 0);
+                break;
+            case 'f':
+                free_pct = atoi(optarg);
+                break;
+            case 'p':
+                for (pattern = 0; pattern < PAT_COUNT; pattern++)
+                    if (!strcmp(optarg, pattern_name[pattern]))
+                        break;
+                if (pattern == PAT_COUNT) {
+                    fprintf(stderr, "%s: invalid pattern -- '%s'\n", argv[0], optarg);
+                    print_help(argv[0]);
+                }
+                break;
+            case 's':
+                step = strtoul(optarg, NULL, 0);
+                break;
+            case '?':
+            case 'h':
+            default:
+                print_help(argv[0]);
+                break;
+        }
+    }
+
+    page_size = sysconf(_SC_PAGESIZE);
+    bench_clock_init();
+
+    if (!strcmp(mode, "maps")) {
+        run_maps();
+    } else if (!strcmp(mode, "realloc")) {
+        if (max <= REALLOC_START_DEFAULT) {
+            fprintf(stderr, "%s: --max must be at least 1 MiB\n", argv[0]);
+            return 1;
+        }
+        run_realloc(max, budget);
+    } else if (!strcmp(mode, "alloc")) {
+        if (!count || rounds <= 0) {
+            fprintf(stderr, "%s: --count and --rounds must be positive\n", argv[0]);
+            return 1;
+        }
+        run_alloc(count, rounds);
+    } else if (!strcmp(mode, "trim")) {
+        if (!obj_size || heap < obj_size || free_pct < 0 || free_pct > 100) {
+            fprintf(stderr, "%s: invalid --heap, --objsize or --free-pct\n", argv[0]);
+            return 1;
+        }
+        run_trim(heap, obj_size, free_pct, pattern);
+    } else if (!strcmp(mode, "sizes")) {
+        run_sizes(step);
+    } else {
+        fprintf(stderr, "%s: invalid mode -- '%s'\n", argv[0], mode);
+        print_help(argv[0]);
+    }
 
     return 0;
 }
@@ -7,7 +7,7 @@
  * Licensed under the MIT License.
  */
 
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE /* the CPU_* affinity macros */
 
 #include <sys/syscall.h>
 #include <sys/time.h>
@@ -22,12 +22,16 @@
 #include <ctype.h>
 #include <getopt.h>
 #include <stdbool.h>
+#include <errno.h>
+
+#include "../common/bench.h"
+#include "../common/perfctr.h"
+#include "../common/runctl.h"
+#include "../common/topo.h"
 
 #define TEST_READ_PATH "/dev/zero"
 #define TEST_READ_LEN 65536
 
-#define NS_PER_SEC 1000000000
-
 #if defined(__linux__)
 #define CLOCK_GETTIME_SYSCALL_NR __NR_clock_gettime
 #elif defined(__APPLE__)
@@ -44,9 +48,19 @@ typedef void (*bench_impl)(void);
 
 static char test_read_buf[TEST_READ_LEN];
 
-static long ts_to_ns(struct timespec ts) {
-    return ts.tv_nsec + (ts.tv_sec * NS_PER_SEC);
-}
+static enum bench_format format = BENCH_FMT_TEXT;
+static struct bench_out out;
+static char row_prefix[32];  /* "cpuN." while sweeping CPUs */
+static struct runctl rc;
+static bool counters;        /* -e: perf counters per call */
+static struct perfctr pc;
+
+/* Best time and counters of one benchmark */
+struct result {
+    long best_ns;               /* -1 if every round was discarded */
+    double calls;               /* in kept rounds */
+    struct perfctr_counts counts;
+};
 
 #ifndef NO_DIRECT_SYSCALL
 static void time_syscall_mb(void) {
@@ -86,42 +100,129 @@ static void file_mb(void) {
     close(fd);
 }
 
-static long run_bench_ns(bench_impl inner_call, int calls, int loops, int rounds) {
-    long best_ns1 = LONG_MAX;
-    struct timespec req = {0, 125000000}; /* 125ms delay */
+/* One round of run_bench(): loops of calls, each loop a sample */
+struct bench_round {
+    bench_impl inner_call;
+    int calls, loops;
+    long long *samples;
+    int n, round_start;
+    long long round_best;
+};
 
-    for (int round = 0; round < rounds; round++) {
-        long best_ns2 = LONG_MAX;
+static int bench_round(void *arg) {
+    struct bench_round *r = arg;
 
-        for (int loop = 0; loop < loops; loop++) {
-            struct timespec before;
-            clock_gettime(CLOCK_MONOTONIC, &before);
+    r->round_start = r->n;
+    r->round_best = -1;
+    if (counters)
+        perfctr_begin(&pc);
 
-            for (int call = 0; call < calls; call++) {
-                inner_call();
-            }
+    for (int loop = 0; loop < r->loops; loop++) {
+        uint64_t before = bench_ticks();
 
-            struct timespec after;
-            clock_gettime(CLOCK_MONOTONIC, &after);
+        for (int call = 0; call < r->calls; call++) {
+            r->inner_call();
+        }
 
-            long elapsed_ns = ts_to_ns(after) - ts_to_ns(before);
-            if (elapsed_ns < best_ns2) {
-                best_ns2 = elapsed_ns;
-            }
+        long long elapsed = bench_ticks() - before;
+        if (r->round_best < 0 || elapsed < r->round_best) {
+            r->round_best = elapsed;
         }
+        r->samples[r->n++] = (long long)(bench_ticks_to_ns(elapsed) / r->calls);
+    }
 
-        best_ns2 /= calls;
+    if (counters)
+        perfctr_end(&pc);
+    return 0;
+}
 
-        if (best_ns2 < best_ns1) {
-            best_ns1 = best_ns2;
-        }
+static void bench_discard(void *arg) {
+    struct bench_round *r = arg;
 
-        putchar('.');
+    r->n = r->round_start;
+    if (counters)
+        perfctr_discard(&pc);
+    if (format == BENCH_FMT_TEXT) {
+        putchar('x');
         fflush(stdout);
-        nanosleep(&req, NULL);
     }
+}
+
+/*
+ * Best per-call time over every loop of every round. Each loop's per-call
+ * time is also a sample for the statistics that CSV and JSON report.
+ * Rounds discarded as throttled are run again, see runctl_run(); best_ns
+ * is -1 if none was kept.
+ */
+static struct result run_bench(const char *name, bench_impl inner_call, int calls, int loops,
+                               int rounds) {
+    struct result res = { .best_ns = -1 };
+    struct bench_round r = { .inner_call = inner_call, .calls = calls, .loops = loops };
+    long long best_ticks = -1;
+    int kept = 0, throttled = 0;
+
+    r.samples = calloc((size_t)loops * rounds, sizeof(long long));
+    if (!r.samples) {
+        perror("calloc");
+        exit(1);
+    }
+
+    if (counters)
+        perfctr_reset(&pc);
 
-    return best_ns1;
+    for (int round = 0; round < rounds; round++) {
+        enum runctl_verdict verdict;
+
+        /* Cool down, or the old fixed 125 ms pause */
+        runctl_run(&rc, 125, bench_round, bench_discard, &r, &verdict);
+        if (verdict == RUNCTL_DISCARD)
+            continue;
+        if (format == BENCH_FMT_TEXT) {
+            putchar(verdict == RUNCTL_KEEP ? '.' : '!');
+            fflush(stdout);
+        }
+        throttled += verdict == RUNCTL_THROTTLED;
+        kept++;
+        if (best_ticks < 0 || r.round_best < best_ticks) {
+            best_ticks = r.round_best;
+        }
+    }
+
+    if (format != BENCH_FMT_TEXT && r.n) {
+        struct bench_stats st;
+        char row[96];
+
+        snprintf(row, sizeof(row), "%s%s", row_prefix, name);
+        bench_stats_compute(r.samples, r.n, &st);
+        bench_out_stats(&out, row, "ns", &st);
+        if (throttled) {
+            snprintf(row, sizeof(row), "%s%s.throttled", row_prefix, name);
+            bench_out_value(&out, row, "rounds", throttled);
+        }
+    }
+    free(r.samples);
+
+    res.calls = (double)calls * loops * kept;
+    if (counters) {
+        res.counts = pc.total;
+        if (format != BENCH_FMT_TEXT) {
+            char prefix[96];
+
+            snprintf(prefix, sizeof(prefix), "%s%s.", row_prefix, name);
+            perfctr_out(&res.counts, &out, prefix, res.calls, "call");
+        }
+    }
+    if (best_ticks >= 0)
+        res.best_ns = (long)(bench_ticks_to_ns(best_ticks) / calls);
+    return res;
+}
+
+static void print_best(const char *label, const struct result *res) {
+    if (res->best_ns < 0)
+        printf("    %s:\t<throttled>\n", label);
+    else
+        printf("    %s:\t%ld ns\n", label, res->best_ns);
+    perfctr_print(&res->counts, stdout, res->calls, "call", "      ");
 }
 
 static int default_arg(int arg, int def) {
@@ -133,24 +234,33 @@ static void bench_time(int calls, int loops, int rounds) {
     loops = default_arg(loops, 32);
     rounds = default_arg(rounds, 5);
 
+    if (format != BENCH_FMT_TEXT) {
+#ifndef NO_DIRECT_SYSCALL
+        run_bench("clock_gettime.syscall", time_syscall_mb, calls, loops, rounds);
+        run_bench("clock_gettime.getpid", getpid_syscall_mb, calls, loops, rounds);
+#endif
+        run_bench("clock_gettime.libc", time_libc_mb, calls, loops, rounds);
+        return;
+    }
+
     printf("clock_gettime: ");
     fflush(stdout);
 
 #ifndef NO_DIRECT_SYSCALL
-    long best_ns_syscall = run_bench_ns(time_syscall_mb, calls, loops, rounds);
-    long best_ns_getpid = run_bench_ns(getpid_syscall_mb, calls, loops, rounds);
+    struct result syscall_res = run_bench("clock_gettime.syscall", time_syscall_mb, calls, loops, rounds);
+    struct result getpid_res = run_bench("clock_gettime.getpid", getpid_syscall_mb, calls, loops, rounds);
 #endif
-    long best_ns_libc = run_bench_ns(time_libc_mb, calls, loops, rounds);
+    struct result libc_res = run_bench("clock_gettime.libc", time_libc_mb, calls, loops, rounds);
 
     putchar('\n');
 
 #ifdef NO_DIRECT_SYSCALL
     printf("    syscall:\t<unsupported>\n");
 #else
-    printf("    syscall:\t%ld ns\n", best_ns_syscall);
-    printf("    getpid:\t%ld ns\n", best_ns_getpid);
+    print_best("syscall", &syscall_res);
+    print_best("getpid", &getpid_res);
 #endif
-    printf("    libc:\t%ld ns\n", best_ns_libc);
+    print_best("libc", &libc_res);
 }
 
 static void bench_file(int calls, int loops, int rounds) {
@@ -158,23 +268,34 @@ static void bench_file(int calls, int loops, int rounds) {
     loops = default_arg(loops, 128);
     rounds = default_arg(rounds, 5);
 
+    if (format != BENCH_FMT_TEXT) {
+        run_bench("read_file.mmap", mmap_mb, calls, loops, rounds);
+        run_bench("read_file.read", file_mb, calls, loops, rounds);
+        return;
+    }
+
     printf("read file: ");
     fflush(stdout);
 
-    long best_ns_mmap = run_bench_ns(mmap_mb, calls, loops, rounds);
-    long best_ns_read = run_bench_ns(file_mb, calls, loops, rounds);
+    struct result mmap_res = run_bench("read_file.mmap", mmap_mb, calls, loops, rounds);
+    struct result read_res = run_bench("read_file.read", file_mb, calls, loops, rounds);
 
-    printf("\n    mmap:\t%ld ns\n", best_ns_mmap);
-    printf("    read:\t%ld ns\n", best_ns_read);
+    putchar('\n');
+    print_best("mmap", &mmap_res);
+    print_best("read", &read_res);
 }
 
-static char *short_options = "hm:c:l:r:";
+static char *short_options = "hm:c:l:r:o:C:Se";
 static struct option long_options[] = {
         {"help", no_argument, 0, 'h'},
         {"mode", required_argument, 0, 'm'},
         {"calls", required_argument, 0, 'c'},
         {"loops", required_argument, 0, 'l'},
         {"rounds", required_argument, 0, 'r'},
+        {"format", required_argument, 0, 'o'},
+        {"cpu", required_argument, 0, 'C'},
+        {"sweep", no_argument, 0, 'S'},
+        {"counters", no_argument, 0, 'e'},
         {0, 0, 0, 0}
 };
 
@@ -188,13 +309,24 @@ static void print_help(char *prog_name) {
            "  -m, --mode\ttests to run: time, file, or all (default: all)\n"
            "  -c, --calls\tsyscalls per loop\n"
            "  -l, --loops\tloops per round\n"
-           "  -r, --rounds\tbenchmark rounds (default: 5)\n",
+           "  -r, --rounds\tbenchmark rounds (default: 5)\n"
+           "  -o, --format\toutput: text, csv or json (default: text)\n"
+           "  -C, --cpu\trun on the first CPU of a cpulist, little, big,\n"
+           "           \tprime, clusterN, domainN or llcN\n"
+           "  -S, --sweep\trun on the first CPU of every cluster in turn\n"
+           "  -e, --counters\tcount cycles, instructions, misses, context\n"
+           "           \tswitches, migrations and page faults per call\n"
+           "\n"
+           "Rounds are '.', '!' if throttled, 'x' if throttled and discarded.\n"
+           "BENCH_COOL=<degrees C> waits for the CPUs to cool down before each\n"
+           "round; BENCH_THROTTLED=discard reruns throttled rounds.\n",
            prog_name);
 
     exit(1);
 }
 
-static void parse_args(int argc, char **argv, bool *do_time, bool *do_file, int *calls, int *loops, int *rounds) {
+static void parse_args(int argc, char **argv, bool *do_time, bool *do_file, int *calls, int *loops, int *rounds,
+                       const char **cpu_spec, bool *sweep) {
     while (1) {
         int c = getopt_long(argc, argv, short_options, long_options, NULL);
         if (c == -1)
@@ -229,8 +361,66 @@ static void parse_args(int argc, char **argv, bool *do_time, bool *do_file, int
             case 'r':
                 *rounds = atoi(optarg);
                 break;
+            case 'o':
+                if (bench_format_parse(optarg, &format)) {
+                    fprintf(stderr, "%s: invalid format -- '%s'\n", argv[0], optarg);
+                    print_help(argv[0]);
+                }
+                break;
+            case 'C':
+                *cpu_spec = optarg;
+                break;
+            case 'S':
+                *sweep = 1;
+                break;
+            case 'e':
+                counters = 1;
+                break;
+        }
+    }
+}
+
+static void run_modes(bool do_time, bool do_file, int calls, int loops, int rounds) {
+    if (do_time) {
+        bench_time(calls, loops, rounds);
+    }
+
+    if (do_time && do_file && format == BENCH_FMT_TEXT) {
+        putchar('\n');
+    }
+
+    if (do_file) {
+        bench_file(calls, loops, rounds);
+    }
+
+    /* What the rounds ran at, next to the results */
+    if (format == BENCH_FMT_TEXT && runctl_active(&rc)) {
+        putchar('\n');
+        runctl_print(&rc, stdout);
+    } else {
+        runctl_out(&rc, &out, row_prefix);
+    }
+    runctl_reset(&rc);
+}
+
+/* The same benchmarks on the first CPU of each cluster, slowest first */
+static int run_sweep(const struct topo *t, bool do_time, bool do_file, int calls, int loops,
+                     int rounds) {
+    for (int c = 0; c < t->nr_clusters; c++) {
+        int cpu = t->clusters[c].first;
+
+        if (bench_pin_cpu(cpu)) {
+            fprintf(stderr, "cpu %d: %s\n", cpu, strerror(errno));
+            continue;
+        }
+        if (format == BENCH_FMT_TEXT) {
+            printf("%s== cpu %d (%s, capacity %d) ==\n", c ? "\n" : "", cpu,
+                   topo_cluster_name(t, c), t->clusters[c].capacity);
         }
+        snprintf(row_prefix, sizeof(row_prefix), "cpu%d.", cpu);
+        run_modes(do_time, do_file, calls, loops, rounds);
     }
+    return 0;
 }
 
 int main(int argc, char** argv) {
@@ -239,20 +429,55 @@ int main(int argc, char** argv) {
     int calls = -1;
     int loops = -1;
     int rounds = -1;
+    const char *cpu_spec = NULL;
+    bool sweep = 0;
+    struct topo *t = NULL;
 
-    parse_args(argc, argv, &do_time, &do_file, &calls, &loops, &rounds);
+    parse_args(argc, argv, &do_time, &do_file, &calls, &loops, &rounds, &cpu_spec, &sweep);
 
-    if (do_time) {
-        bench_time(calls, loops, rounds);
+    if (cpu_spec || sweep) {
+        t = topo_load();
+        if (!t) {
+            perror("topo_load");
+            return 1;
+        }
     }
+    if (cpu_spec) {
+        cpu_set_t set;
 
-    if (do_time && do_file) {
-        putchar('\n');
+        if (topo_parse_spec(t, cpu_spec, &set)) {
+            fprintf(stderr, "%s: no online CPU in '%s'\n", argv[0], cpu_spec);
+            return 1;
+        }
+        if (bench_pin_cpu(topo_nth_cpu(&set, 0))) {
+            perror("sched_setaffinity");
+            return 1;
+        }
     }
 
-    if (do_file) {
-        bench_file(calls, loops, rounds);
+    if (runctl_init(&rc)) {
+        fprintf(stderr, "%s: BENCH_THROTTLED must be tag or discard\n", argv[0]);
+        return 1;
     }
-
+    if (counters && perfctr_open(&pc, 0) < 0) {
+        fprintf(stderr, "%s: no perf counters: %s\n", argv[0], strerror(errno));
+        counters = 0;
+    }
+    bench_clock_init();
+    if (format != BENCH_FMT_TEXT)
+        bench_out_begin(&out, stdout, format, "callbench");
+
+    if (sweep)
+        run_sweep(t, do_time, do_file, calls, loops, rounds);
+    else
+        run_modes(do_time, do_file, calls, loops, rounds);
+
+    if (format != BENCH_FMT_TEXT)
+        bench_out_end(&out);
+
+    if (counters)
+        perfctr_close(&pc);
+    runctl_close(&rc);
+    topo_free(t);
     return 0;
 }
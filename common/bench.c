@@ -0,0 +1,694 @@
+/*
+ * bench.c
+ *
+ * Benchmark support shared by every tool, see bench.h.
+ */
+
+#define _GNU_SOURCE
+
+#include "bench.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <math.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#if defined(__GLIBC__)
+#include <gnu/libc-version.h>
+#endif
+#if defined(__ANDROID__)
+#include <sys/system_properties.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+/* Cycle counters coarser than this are no better than clock_gettime */
+#define BENCH_COUNTER_MIN_HZ 100000000.0
+#define BENCH_CALIBRATE_NS 5000000LL
+
+struct bench_clock bench_clock;
+static uint64_t bench_base;
+
+static long long raw_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ts.tv_sec * BENCH_NS_PER_SEC + ts.tv_nsec;
+}
+
+/* Ticks per second of src against CLOCK_MONOTONIC_RAW, 0 if it does not advance */
+static double calibrate(enum bench_clock_src src) {
+    long long t0 = raw_ns(), t1;
+    uint64_t c0 = bench_ticks_raw(src), c1;
+
+    do {
+        t1 = raw_ns();
+    } while (t1 - t0 < BENCH_CALIBRATE_NS);
+    c1 = bench_ticks_raw(src);
+
+    return c1 > c0 ? (double)(c1 - c0) * 1e9 / (double)(t1 - t0) : 0;
+}
+
+/* The counter the architecture offers userspace, with its frequency */
+static enum bench_clock_src counter_src(double *freq) {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+
+    /* Only an invariant TSC ticks at a constant rate across P/C-states */
+    if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8))) {
+        *freq = calibrate(BENCH_CLOCK_TSC);
+        return BENCH_CLOCK_TSC;
+    }
+#elif defined(__aarch64__)
+    uint64_t hz;
+
+    /* Linux enables EL0 access to the virtual counter; vDSO uses it too */
+    __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(hz));
+    *freq = (double)hz;
+    return BENCH_CLOCK_CNTVCT;
+#endif
+    *freq = 0;
+    return BENCH_CLOCK_MONO;
+}
+
+const struct bench_clock *bench_clock_init(void) {
+    const char *env = getenv("BENCH_CLOCK");
+    enum bench_clock_src src = BENCH_CLOCK_MONO;
+    double freq = 0;
+
+    if (bench_clock.src != BENCH_CLOCK_NONE)
+        return &bench_clock;
+
+    if (!env || strcmp(env, "mono"))
+        src = counter_src(&freq);
+    if (src == BENCH_CLOCK_MONO || freq < BENCH_COUNTER_MIN_HZ) {
+        src = BENCH_CLOCK_MONO;
+        freq = 1e9;
+    }
+
+    bench_clock.ns_per_tick = 1e9 / freq;
+    bench_clock.freq_hz = freq;
+    bench_clock.name = src == BENCH_CLOCK_TSC ? "tsc" :
+                       src == BENCH_CLOCK_CNTVCT ? "cntvct" : "monotonic";
+    bench_base = bench_ticks_raw(src);
+    bench_clock.src = src;
+    return &bench_clock;
+}
+
+long long bench_now_ns(void) {
+    uint64_t t = bench_ticks();
+    return (long long)bench_ticks_to_ns(t - bench_base);
+}
+
+/* ------------------------------------------------------------------ */
+/* Histograms                                                          */
+/* ------------------------------------------------------------------ */
+
+int bench_hist_init(struct bench_hist *h, uint64_t max_value) {
+    memset(h, 0, sizeof(*h));
+    h->nbuckets = bench_hist_index(max_value) + 1;
+    h->buckets = malloc(h->nbuckets * sizeof(*h->buckets));
+    if (!h->buckets)
+        return -1;
+    /* Fault the pages in now rather than during the measurement */
+    memset(h->buckets, 0, h->nbuckets * sizeof(*h->buckets));
+    return 0;
+}
+
+void bench_hist_reset(struct bench_hist *h) {
+    uint64_t *buckets = h->buckets;
+    unsigned int nbuckets = h->nbuckets;
+
+    memset(buckets, 0, nbuckets * sizeof(*buckets));
+    memset(h, 0, sizeof(*h));
+    h->buckets = buckets;
+    h->nbuckets = nbuckets;
+}
+
+void bench_hist_free(struct bench_hist *h) {
+    free(h->buckets);
+    memset(h, 0, sizeof(*h));
+}
+
+uint64_t bench_hist_quantile(const struct bench_hist *h, double q) {
+    uint64_t rank, seen = 0;
+
+    if (!h->count)
+        return 0;
+    rank = (uint64_t)((double)(h->count - 1) * q);
+
+    for (unsigned int i = 0; i < h->nbuckets; i++) {
+        seen += h->buckets[i];
+        if (seen <= rank)
+            continue;
+
+        uint64_t lo = i, width = 1;
+        if (i >= BENCH_HIST_SUB) {
+            unsigned int shift = (i >> BENCH_HIST_SUB_BITS) - 1;
+            lo = (uint64_t)((i & (BENCH_HIST_SUB - 1)) + BENCH_HIST_SUB) << shift;
+            width = 1ULL << shift;
+        }
+        /* Middle of the bucket, but never outside what was seen */
+        uint64_t v = lo + width / 2;
+        return v < h->min ? h->min : v > h->max ? h->max : v;
+    }
+    return h->max;
+}
+
+/* ------------------------------------------------------------------ */
+/* Statistics                                                          */
+/* ------------------------------------------------------------------ */
+
+void bench_hist_stats(const struct bench_hist *h, struct bench_stats *s) {
+    memset(s, 0, sizeof(*s));
+    if (!h->count)
+        return;
+
+    double n = (double)h->count;
+    s->n = h->count;
+    s->mean = h->shift + h->sum / n;
+    if (h->count > 1) {
+        double var = (h->sumsq - h->sum * h->sum / n) / (n - 1);
+        s->stddev = var > 0 ? sqrt(var) : 0;
+    }
+    s->min = (double)h->min;
+    s->max = (double)h->max;
+    s->p50 = (double)bench_hist_quantile(h, 0.50);
+    s->p90 = (double)bench_hist_quantile(h, 0.90);
+    s->p99 = (double)bench_hist_quantile(h, 0.99);
+    s->p999 = (double)bench_hist_quantile(h, 0.999);
+}
+
+static int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+void bench_stats_compute(long long *samples, size_t n, struct bench_stats *s) {
+    double mean = 0, m2 = 0;
+
+    memset(s, 0, sizeof(*s));
+    if (!n)
+        return;
+
+    qsort(samples, n, sizeof(*samples), cmp_ll);
+    for (size_t i = 0; i < n; i++) {
+        double d = (double)samples[i] - mean;
+        mean += d / (double)(i + 1);
+        m2 += d * ((double)samples[i] - mean);
+    }
+
+    s->n = n;
+    s->mean = mean;
+    s->stddev = n > 1 ? sqrt(m2 / (double)(n - 1)) : 0;
+    s->min = (double)samples[0];
+    s->max = (double)samples[n - 1];
+    s->p50 = (double)bench_sorted_quantile(samples, n, 0.50);
+    s->p90 = (double)bench_sorted_quantile(samples, n, 0.90);
+    s->p99 = (double)bench_sorted_quantile(samples, n, 0.99);
+    s->p999 = (double)bench_sorted_quantile(samples, n, 0.999);
+}
+
+/* ------------------------------------------------------------------ */
+/* CPU affinity and scheduling                                         */
+/* ------------------------------------------------------------------ */
+
+int bench_nr_cpus(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+int bench_pin_cpu(int cpu) {
+    cpu_set_t set;
+
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        errno = EINVAL;
+        return -1;
+    }
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    /* pid 0 is the calling thread, not the whole process */
+    return sched_setaffinity(0, sizeof(set), &set);
+}
+
+int bench_set_fifo(int prio) {
+    struct sched_param sp = { .sched_priority = prio };
+    return sched_setscheduler(0, SCHED_FIFO, &sp);
+}
+
+/* ------------------------------------------------------------------ */
+/* Environment fingerprint                                             */
+/* ------------------------------------------------------------------ */
+
+#define ENV_VALUE_MAX 4096
+#define BENCH_STR_(x) #x
+#define BENCH_STR(x) BENCH_STR_(x)
+
+int bench_env_set(struct bench_env *env, const char *key, const char *value) {
+    char *v = strdup(value);
+
+    if (!v)
+        return -1;
+    for (size_t i = 0; i < env->count; i++) {
+        if (!strcmp(env->items[i].key, key)) {
+            free(env->items[i].value);
+            env->items[i].value = v;
+            return 0;
+        }
+    }
+    if (env->count == env->cap) {
+        size_t cap = env->cap ? env->cap * 2 : 64;
+        struct bench_env_item *items = realloc(env->items, cap * sizeof(*items));
+        if (!items) {
+            free(v);
+            return -1;
+        }
+        env->items = items;
+        env->cap = cap;
+    }
+    env->items[env->count].key = strdup(key);
+    env->items[env->count].value = v;
+    if (!env->items[env->count].key) {
+        free(v);
+        return -1;
+    }
+    env->count++;
+    return 0;
+}
+
+const char *bench_env_get(const struct bench_env *env, const char *key) {
+    for (size_t i = 0; i < env->count; i++)
+        if (!strcmp(env->items[i].key, key))
+            return env->items[i].value;
+    return NULL;
+}
+
+void bench_env_free(struct bench_env *env) {
+    for (size_t i = 0; i < env->count; i++) {
+        free(env->items[i].key);
+        free(env->items[i].value);
+    }
+    free(env->items);
+    memset(env, 0, sizeof(*env));
+}
+
+/* Whole file with newlines folded to sep and trailing space dropped */
+static int read_value(const char *path, char *buf, size_t len, char sep) {
+    FILE *f = fopen(path, "re");
+    size_t n;
+
+    if (!f)
+        return -1;
+    n = fread(buf, 1, len - 1, f);
+    fclose(f);
+    while (n && (buf[n - 1] == '\n' || buf[n - 1] == ' ' || buf[n - 1] == '\0'))
+        n--;
+    buf[n] = '\0';
+    for (size_t i = 0; i < n; i++)
+        if (buf[i] == '\n' || buf[i] == '\0')
+            buf[i] = sep;
+    return 0;
+}
+
+static void env_file(struct bench_env *env, const char *key, const char *path) {
+    char buf[ENV_VALUE_MAX];
+
+    if (!read_value(path, buf, sizeof(buf), ';'))
+        bench_env_set(env, key, buf);
+}
+
+/* "always [madvise] never" -> "madvise" */
+static void env_choice(struct bench_env *env, const char *key, const char *path) {
+    char buf[256], *open, *close;
+
+    if (read_value(path, buf, sizeof(buf), ' '))
+        return;
+    open = strchr(buf, '[');
+    close = open ? strchr(open, ']') : NULL;
+    if (close) {
+        *close = '\0';
+        bench_env_set(env, key, open + 1);
+    } else {
+        bench_env_set(env, key, buf);
+    }
+}
+
+static int cmp_name(const void *a, const void *b) {
+    return strverscmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Sorted names in dir that start with prefix; free each and the array */
+static char **list_dir(const char *dir, const char *prefix, size_t *count) {
+    DIR *d = opendir(dir);
+    struct dirent *de;
+    char **names = NULL;
+    size_t n = 0, cap = 0;
+
+    *count = 0;
+    if (!d)
+        return NULL;
+    while ((de = readdir(d))) {
+        if (de->d_name[0] == '.' || strncmp(de->d_name, prefix, strlen(prefix)))
+            continue;
+        if (n == cap) {
+            char **nn = realloc(names, (cap = cap * 2 + 16) * sizeof(*nn));
+            if (!nn)
+                break;
+            names = nn;
+        }
+        if (!(names[n] = strdup(de->d_name)))
+            break;
+        n++;
+    }
+    closedir(d);
+    qsort(names, n, sizeof(*names), cmp_name);
+    *count = n;
+    return names;
+}
+
+/* Every file dir/prefix* as keyprefix.name */
+static void env_dir(struct bench_env *env, const char *keyprefix, const char *dir,
+                    const char *prefix) {
+    size_t n;
+    char **names = list_dir(dir, prefix, &n);
+    char key[256], path[512];
+
+    for (size_t i = 0; i < n; i++) {
+        snprintf(key, sizeof(key), "%s.%s", keyprefix, names[i]);
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        env_file(env, key, path);
+        free(names[i]);
+    }
+    free(names);
+}
+
+static void env_cpufreq(struct bench_env *env) {
+    static const char *const files[][2] = {
+        { "governor", "scaling_governor" },
+        { "min", "scaling_min_freq" },
+        { "max", "scaling_max_freq" },
+        { "cpus", "related_cpus" },
+    };
+    const char *dir = "/sys/devices/system/cpu/cpufreq";
+    size_t n;
+    char **names = list_dir(dir, "policy", &n);
+    char key[256], path[512];
+
+    for (size_t i = 0; i < n; i++) {
+        for (size_t k = 0; k < sizeof(files) / sizeof(files[0]); k++) {
+            snprintf(key, sizeof(key), "cpufreq.%s.%s", names[i], files[k][0]);
+            snprintf(path, sizeof(path), "%s/%s/%s", dir, names[i], files[k][1]);
+            env_file(env, key, path);
+        }
+        free(names[i]);
+    }
+    free(names);
+}
+
+static void env_libc(struct bench_env *env) {
+    char buf[64];
+
+#if defined(__ANDROID__)
+    bench_env_set(env, "libc.name", "bionic");
+    snprintf(buf, sizeof(buf), "%d", __ANDROID_API__);
+    bench_env_set(env, "libc.api", buf);
+#elif defined(__GLIBC__)
+    bench_env_set(env, "libc.name", "glibc");
+    bench_env_set(env, "libc.version", gnu_get_libc_version());
+#else
+    bench_env_set(env, "libc.name", "unknown");     /* musl has no version macro or call */
+#endif
+    (void)buf;
+}
+
+static void env_android(struct bench_env *env) {
+#if defined(__ANDROID__)
+    static const char *const props[][2] = {
+        { "android.fingerprint", "ro.build.fingerprint" },
+        { "android.sdk", "ro.build.version.sdk" },
+        { "android.model", "ro.product.model" },
+    };
+    char value[PROP_VALUE_MAX];
+
+    for (size_t i = 0; i < sizeof(props) / sizeof(props[0]); i++)
+        if (__system_property_get(props[i][1], value) > 0)
+            bench_env_set(env, props[i][0], value);
+#else
+    (void)env;
+#endif
+}
+
+static void env_build(struct bench_env *env) {
+#if defined(__clang__)
+    bench_env_set(env, "build.compiler", __VERSION__);     /* "Clang 19.0.1 ..." */
+#elif defined(__GNUC__)
+    bench_env_set(env, "build.compiler", "gcc " __VERSION__);
+#endif
+#ifdef BENCH_CFLAGS
+    bench_env_set(env, "build.cflags", BENCH_CFLAGS);
+#else
+    char flags[256];
+
+    snprintf(flags, sizeof(flags), "%s%s%s%s",
+#if defined(__OPTIMIZE_SIZE__)
+             "-Os",
+#elif defined(__OPTIMIZE__)
+             "-O2+",
+#else
+             "-O0",
+#endif
+#if defined(__PIE__)
+             " -fPIE",
+#else
+             "",
+#endif
+#if defined(__ANDROID_API__)
+             " api" BENCH_STR(__ANDROID_API__),
+#else
+             "",
+#endif
+#if defined(__AVX2__)
+             " avx2"
+#elif defined(__ARM_NEON)
+             " neon"
+#else
+             ""
+#endif
+             );
+    bench_env_set(env, "build.cflags", flags);
+#endif
+#if defined(__aarch64__)
+    bench_env_set(env, "build.arch", "arm64");
+#elif defined(__arm__)
+    bench_env_set(env, "build.arch", "arm");
+#elif defined(__x86_64__)
+    bench_env_set(env, "build.arch", "x86_64");
+#elif defined(__i386__)
+    bench_env_set(env, "build.arch", "x86");
+#else
+    bench_env_set(env, "build.arch", "unknown");
+#endif
+}
+
+/* cgroup v1 lists a path per hierarchy, v2 a single "0::/path" line */
+static void env_run(struct bench_env *env) {
+    char buf[ENV_VALUE_MAX], out[ENV_VALUE_MAX], *line, *save = NULL;
+    size_t pos = 0;
+
+    snprintf(out, sizeof(out), "%u", (unsigned)geteuid());
+    bench_env_set(env, "run.euid", out);
+    bench_env_set(env, "run.root", geteuid() == 0 ? "yes" : "no");
+
+    if (read_value("/proc/self/cgroup", buf, sizeof(buf), '\n'))
+        return;
+    out[0] = '\0';
+    for (line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        char *ctrl = strchr(line, ':'), *path = ctrl ? strchr(ctrl + 1, ':') : NULL;
+
+        if (!path)
+            continue;
+        *path++ = '\0';
+        ctrl++;
+        pos += snprintf(out + pos, sizeof(out) - pos, "%s%s%s%s", pos ? " " : "",
+                        *ctrl ? ctrl : "", *ctrl ? "=" : "", path);
+        if (pos >= sizeof(out))
+            break;
+    }
+    bench_env_set(env, "run.cgroup", out);
+}
+
+static void env_collect(struct bench_env *env) {
+    struct utsname uts;
+
+    if (!uname(&uts)) {
+        bench_env_set(env, "uname.sysname", uts.sysname);
+        bench_env_set(env, "uname.release", uts.release);
+        bench_env_set(env, "uname.version", uts.version);
+        bench_env_set(env, "uname.machine", uts.machine);
+    }
+    env_file(env, "kernel.cmdline", "/proc/cmdline");
+    env_dir(env, "vuln", "/sys/devices/system/cpu/vulnerabilities", "");
+    env_cpufreq(env);
+    env_dir(env, "sysctl.kernel", "/proc/sys/kernel", "sched_");
+    env_choice(env, "thp.enabled", "/sys/kernel/mm/transparent_hugepage/enabled");
+    env_choice(env, "thp.defrag", "/sys/kernel/mm/transparent_hugepage/defrag");
+    env_libc(env);
+    env_android(env);
+    env_build(env);
+    env_run(env);
+}
+
+const struct bench_env *bench_env_self(void) {
+    static struct bench_env env;
+    static bool collected;
+
+    if (!collected) {
+        env_collect(&env);
+        collected = true;
+    }
+    return &env;
+}
+
+int bench_env_diff(const struct bench_env *a, const struct bench_env *b, FILE *f,
+                   const char *prefix) {
+    int changed = 0;
+
+    for (size_t i = 0; i < a->count; i++) {
+        const char *vb = bench_env_get(b, a->items[i].key);
+
+        if (!vb || strcmp(a->items[i].value, vb)) {
+            fprintf(f, "%s%s: %s -> %s\n", prefix, a->items[i].key, a->items[i].value,
+                    vb ? vb : "(none)");
+            changed++;
+        }
+    }
+    for (size_t i = 0; i < b->count; i++) {
+        if (!bench_env_get(a, b->items[i].key)) {
+            fprintf(f, "%s%s: (none) -> %s\n", prefix, b->items[i].key, b->items[i].value);
+            changed++;
+        }
+    }
+    return changed;
+}
+
+/* ------------------------------------------------------------------ */
+/* Result emitter                                                      */
+/* ------------------------------------------------------------------ */
+
+static const char *format_name[] = {
+    [BENCH_FMT_TEXT] = "text",
+    [BENCH_FMT_CSV] = "csv",
+    [BENCH_FMT_JSON] = "json",
+};
+
+int bench_format_parse(const char *name, enum bench_format *fmt) {
+    for (int i = 0; i < (int)(sizeof(format_name) / sizeof(format_name[0])); i++) {
+        if (!strcmp(name, format_name[i])) {
+            *fmt = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Names are ours, but keep the output valid whatever they contain */
+static void put_json_str(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+            fprintf(f, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(f, "\\u%04x", c);
+        else
+            fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+void bench_env_write_json(const struct bench_env *env, FILE *f, const char *indent) {
+    fputc('{', f);
+    for (size_t i = 0; i < env->count; i++) {
+        fprintf(f, "%s\n%s  ", i ? "," : "", indent);
+        put_json_str(f, env->items[i].key);
+        fprintf(f, ": ");
+        put_json_str(f, env->items[i].value);
+    }
+    fprintf(f, "\n%s}", indent);
+}
+
+void bench_out_begin(struct bench_out *o, FILE *f, enum bench_format fmt, const char *tool) {
+    o->f = f;
+    o->fmt = fmt;
+    o->tool = tool;
+    o->rows = 0;
+
+    if (fmt == BENCH_FMT_CSV) {
+        fprintf(f, "tool,name,unit,n,mean,stddev,min,p50,p90,p99,p999,max\n");
+    } else if (fmt == BENCH_FMT_JSON) {
+        fprintf(f, "{\"tool\": ");
+        put_json_str(f, tool);
+        fprintf(f, ", \"clock\": \"%s\", \"env\": ",
+                bench_clock.name ? bench_clock.name : "monotonic");
+        bench_env_write_json(bench_env_self(), f, "");
+        fprintf(f, ", \"results\": [");
+    }
+}
+
+static void json_row_start(struct bench_out *o, const char *name, const char *unit) {
+    fprintf(o->f, "%s\n  {\"name\": ", o->rows ? "," : "");
+    put_json_str(o->f, name);
+    fprintf(o->f, ", \"unit\": ");
+    put_json_str(o->f, unit);
+}
+
+void bench_out_stats(struct bench_out *o, const char *name, const char *unit,
+                     const struct bench_stats *s) {
+    switch (o->fmt) {
+    case BENCH_FMT_TEXT:
+        fprintf(o->f, "%-28s %10.1f %-4s sd %.1f  min %.1f  p50 %.1f  p99 %.1f  max %.1f  (n=%llu)\n",
+                name, s->mean, unit, s->stddev, s->min, s->p50, s->p99, s->max,
+                (unsigned long long)s->n);
+        break;
+    case BENCH_FMT_CSV:
+        fprintf(o->f, "%s,%s,%s,%llu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n", o->tool, name,
+                unit, (unsigned long long)s->n, s->mean, s->stddev, s->min, s->p50, s->p90,
+                s->p99, s->p999, s->max);
+        break;
+    case BENCH_FMT_JSON:
+        json_row_start(o, name, unit);
+        fprintf(o->f, ", \"n\": %llu, \"mean\": %.3f, \"stddev\": %.3f, \"min\": %.3f, "
+                "\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"p999\": %.3f, \"max\": %.3f}",
+                (unsigned long long)s->n, s->mean, s->stddev, s->min, s->p50, s->p90, s->p99,
+                s->p999, s->max);
+        break;
+    }
+    o->rows++;
+}
+
+void bench_out_value(struct bench_out *o, const char *name, const char *unit, double v) {
+    switch (o->fmt) {
+    case BENCH_FMT_TEXT:
+        fprintf(o->f, "%-28s %10.3f %s\n", name, v, unit);
+        break;
+    case BENCH_FMT_CSV:
+        fprintf(o->f, "%s,%s,%s,1,%.6f,,,,,,,\n", o->tool, name, unit, v);
+        break;
+    case BENCH_FMT_JSON:
+        json_row_start(o, name, unit);
+        fprintf(o->f, ", \"value\": %.6f}", v);
+        break;
+    }
+    o->rows++;
+}
+
+void bench_out_end(struct bench_out *o) {
+    if (o->fmt == BENCH_FMT_JSON)
+        fprintf(o->f, "%s]}\n", o->rows ? "\n" : "");
+    fflush(o->f);
+}
@@ -0,0 +1,259 @@
+/*
+ * bench.h
+ *
+ * Benchmark support shared by every tool: a high-resolution clock that
+ * reads the CPU's counter directly where that is safe, preallocated
+ * latency histograms, summary statistics, CPU affinity and scheduling
+ * helpers, an environment fingerprint, and a result emitter for text,
+ * CSV and JSON.
+ *
+ * Timestamps are taken in ticks with bench_ticks() and converted with
+ * bench_ticks_to_ns(); only differences between two ticks are meaningful.
+ * The clock is picked and calibrated on first use (a few milliseconds),
+ * or up front with bench_clock_init(), which multithreaded tools must call
+ * before starting threads. BENCH_CLOCK=mono in the environment forces
+ * CLOCK_MONOTONIC.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_NS_PER_SEC 1000000000LL
+
+/* ------------------------------------------------------------------ */
+/* Clock                                                               */
+/* ------------------------------------------------------------------ */
+
+enum bench_clock_src {
+    BENCH_CLOCK_NONE,       /* not initialized yet */
+    BENCH_CLOCK_MONO,       /* clock_gettime(CLOCK_MONOTONIC), ticks are ns */
+    BENCH_CLOCK_TSC,        /* x86 invariant TSC */
+    BENCH_CLOCK_CNTVCT,     /* arm64 generic timer virtual count */
+};
+
+struct bench_clock {
+    enum bench_clock_src src;
+    double ns_per_tick;
+    double freq_hz;         /* ticks per second */
+    const char *name;
+};
+
+extern struct bench_clock bench_clock;
+
+/* Pick and calibrate the clock (idempotent); returns bench_clock */
+const struct bench_clock *bench_clock_init(void);
+
+/* Plain CLOCK_MONOTONIC in ns, for coarse timing that needs no calibration */
+static inline long long bench_mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * BENCH_NS_PER_SEC + ts.tv_nsec;
+}
+
+static inline uint64_t bench_ticks_raw(enum bench_clock_src src) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (src == BENCH_CLOCK_TSC) {
+        uint32_t lo, hi;
+        /* lfence keeps earlier instructions from drifting past the read */
+        __asm__ __volatile__("lfence\n\trdtsc" : "=a"(lo), "=d"(hi) :: "memory");
+        return (uint64_t)hi << 32 | lo;
+    }
+#elif defined(__aarch64__)
+    if (src == BENCH_CLOCK_CNTVCT) {
+        uint64_t v;
+        __asm__ __volatile__("isb\n\tmrs %0, cntvct_el0" : "=r"(v) :: "memory");
+        return v;
+    }
+#endif
+    (void)src;
+    return (uint64_t)bench_mono_ns();
+}
+
+static inline uint64_t bench_ticks(void) {
+    if (__builtin_expect(bench_clock.src == BENCH_CLOCK_NONE, 0))
+        bench_clock_init();
+    return bench_ticks_raw(bench_clock.src);
+}
+
+static inline double bench_ticks_to_ns(uint64_t ticks) {
+    return (double)ticks * bench_clock.ns_per_tick;
+}
+
+/* Nanoseconds since an arbitrary start, on the benchmark clock */
+long long bench_now_ns(void);
+
+/* ------------------------------------------------------------------ */
+/* Histograms                                                          */
+/* ------------------------------------------------------------------ */
+
+/*
+ * Log-linear buckets: values below 2^SUB_BITS are exact, above that
+ * every power of two is split into 2^SUB_BITS buckets, so a bucket is
+ * at most 1/32 (about 3%) wide relative to its value. Buckets are
+ * allocated and touched up front; adding a sample never allocates.
+ */
+#define BENCH_HIST_SUB_BITS 5
+#define BENCH_HIST_SUB (1u << BENCH_HIST_SUB_BITS)
+
+struct bench_hist {
+    uint64_t *buckets;
+    unsigned int nbuckets;
+    uint64_t count;
+    uint64_t overflow;      /* samples above the last bucket */
+    uint64_t min, max;
+    double shift;           /* first sample, keeps the sums well conditioned */
+    double sum, sumsq;      /* of (value - shift) */
+};
+
+static inline unsigned int bench_hist_index(uint64_t v) {
+    if (v < BENCH_HIST_SUB)
+        return (unsigned int)v;
+    unsigned int e = 63 - __builtin_clzll(v);
+    unsigned int shift = e - BENCH_HIST_SUB_BITS;
+    return ((shift + 1) << BENCH_HIST_SUB_BITS) + (unsigned int)((v >> shift) - BENCH_HIST_SUB);
+}
+
+/* Covers values up to max_value; returns 0, or -1 with errno set */
+int bench_hist_init(struct bench_hist *h, uint64_t max_value);
+void bench_hist_reset(struct bench_hist *h);
+void bench_hist_free(struct bench_hist *h);
+
+static inline void bench_hist_add(struct bench_hist *h, uint64_t v) {
+    unsigned int i = bench_hist_index(v);
+
+    if (!h->count) {
+        h->min = h->max = v;
+        h->shift = (double)v;
+    }
+    if (v < h->min)
+        h->min = v;
+    if (v > h->max)
+        h->max = v;
+    h->count++;
+    double d = (double)v - h->shift;
+    h->sum += d;
+    h->sumsq += d * d;
+    if (i < h->nbuckets)
+        h->buckets[i]++;
+    else
+        h->overflow++;
+}
+
+/* Value at quantile q in [0, 1], to bucket precision */
+uint64_t bench_hist_quantile(const struct bench_hist *h, double q);
+
+/* ------------------------------------------------------------------ */
+/* Statistics                                                          */
+/* ------------------------------------------------------------------ */
+
+struct bench_stats {
+    uint64_t n;
+    double mean;
+    double stddev;          /* sample standard deviation */
+    double min;
+    double p50;
+    double p90;
+    double p99;
+    double p999;
+    double max;
+};
+
+void bench_hist_stats(const struct bench_hist *h, struct bench_stats *s);
+
+/* Exact statistics of raw samples; sorts them in place */
+void bench_stats_compute(long long *samples, size_t n, struct bench_stats *s);
+
+/* Element at quantile q of sorted samples (nearest rank, rounding down) */
+static inline long long bench_sorted_quantile(const long long *sorted, size_t n, double q) {
+    return sorted[(size_t)((double)(n - 1) * q)];
+}
+
+/* ------------------------------------------------------------------ */
+/* CPU affinity and scheduling                                         */
+/* ------------------------------------------------------------------ */
+
+int bench_nr_cpus(void);
+
+/* Pin the calling thread to one CPU; returns 0, or -1 with errno set */
+int bench_pin_cpu(int cpu);
+
+/* Move the calling thread to SCHED_FIFO at prio; returns 0, or -1 */
+int bench_set_fifo(int prio);
+
+/* ------------------------------------------------------------------ */
+/* Environment fingerprint                                             */
+/* ------------------------------------------------------------------ */
+
+/*
+ * What a result depends on besides the code under test, as ordered
+ * key/value strings: uname.*, kernel.cmdline, vuln.* (cpu/vulnerabilities),
+ * cpufreq.policyN.{governor,min,max,cpus}, sysctl.kernel.sched_*, thp.*,
+ * libc.*, build.* (compiler and the flags it was given), android.* and
+ * run.* (euid, root, cgroup). Files that cannot be read are left out.
+ * Build with -DBENCH_CFLAGS='"..."' to record the exact flags; without
+ * it build.cflags is pieced together from predefined macros.
+ */
+struct bench_env_item {
+    char *key;
+    char *value;
+};
+
+struct bench_env {
+    struct bench_env_item *items;
+    size_t count, cap;
+};
+
+/* This process's fingerprint, collected on first use */
+const struct bench_env *bench_env_self(void);
+
+/* Add or replace key; returns 0, or -1 if out of memory */
+int bench_env_set(struct bench_env *env, const char *key, const char *value);
+const char *bench_env_get(const struct bench_env *env, const char *key);
+void bench_env_free(struct bench_env *env);
+
+/* As a JSON object, one key per line after indent */
+void bench_env_write_json(const struct bench_env *env, FILE *f, const char *indent);
+
+/* Print "prefix key: a -> b" for every key that differs; returns the count */
+int bench_env_diff(const struct bench_env *a, const struct bench_env *b, FILE *f,
+                   const char *prefix);
+
+/* ------------------------------------------------------------------ */
+/* Result emitter                                                      */
+/* ------------------------------------------------------------------ */
+
+enum bench_format {
+    BENCH_FMT_TEXT,
+    BENCH_FMT_CSV,
+    BENCH_FMT_JSON,
+};
+
+/* "text", "csv" or "json"; returns 0, or -1 for anything else */
+int bench_format_parse(const char *name, enum bench_format *fmt);
+
+/*
+ * One result set per run. CSV and JSON rows share the columns
+ * tool,name,unit,n,mean,stddev,min,p50,p90,p99,p999,max; single values
+ * only fill mean. JSON also records the clock the tool used and the
+ * environment fingerprint ("env").
+ */
+struct bench_out {
+    FILE *f;
+    enum bench_format fmt;
+    const char *tool;
+    int rows;
+};
+
+void bench_out_begin(struct bench_out *o, FILE *f, enum bench_format fmt, const char *tool);
+void bench_out_stats(struct bench_out *o, const char *name, const char *unit,
+                     const struct bench_stats *s);
+void bench_out_value(struct bench_out *o, const char *name, const char *unit, double v);
+void bench_out_end(struct bench_out *o);
+
+#endif /* BENCH_H */
@@ -0,0 +1,624 @@
+/*
+ * isolate.c
+ *
+ * CPU isolation, see isolate.h.
+ */
+
+#define _GNU_SOURCE
+
+#include "isolate.h"
+#include "topo.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __ANDROID__
+#define JOURNAL_DEFAULT "/data/local/tmp/bench-isolate.state"
+#else
+#define JOURNAL_DEFAULT "/tmp/bench-isolate.state"
+#endif
+
+/* cpusets nest a few levels at most (Android: /dev/cpuset/foreground/boost) */
+#define MAX_DEPTH 8
+
+static const int held_signals[] = { SIGINT, SIGTERM, SIGHUP, SIGQUIT };
+
+static const char *cpu_root(void) {
+    const char *env = getenv("TOPO_SYSFS");
+    return env && *env ? env : TOPO_SYSFS;
+}
+
+const char *isolate_journal_path(void) {
+    const char *env = getenv("BENCH_ISOLATE_STATE");
+    return env && *env ? env : JOURNAL_DEFAULT;
+}
+
+static void hold_signals(sigset_t *old) {
+    sigset_t set;
+
+    sigemptyset(&set);
+    for (size_t i = 0; i < sizeof(held_signals) / sizeof(held_signals[0]); i++)
+        sigaddset(&set, held_signals[i]);
+    sigprocmask(SIG_BLOCK, &set, old);
+}
+
+/* First line of a small file without the newline; 0, or -1 */
+static int read_str(const char *path, char *buf, size_t len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    ssize_t n;
+
+    if (fd < 0)
+        return -1;
+    n = read(fd, buf, len - 1);
+    close(fd);
+    if (n < 0)
+        return -1;
+    buf[n] = '\0';
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+static int write_str(const char *path, const char *value) {
+    int fd = open(path, O_WRONLY | O_TRUNC | O_CLOEXEC);
+    ssize_t len = (ssize_t)strlen(value), n;
+    int err;
+
+    if (fd < 0)
+        return -1;
+    n = write(fd, value, (size_t)len);
+    err = errno;
+    close(fd);
+    errno = err;
+    return n == len ? 0 : -1;
+}
+
+static bool has_word(const char *list, const char *word, const char *seps) {
+    size_t len = strlen(word);
+
+    for (const char *p = list; (p = strstr(p, word)); p += len) {
+        if ((p == list || strchr(seps, p[-1])) && (!p[len] || strchr(seps, p[len])))
+            return true;
+    }
+    return false;
+}
+
+/* ------------------------------------------------------------------ */
+/* Undo log                                                            */
+/* ------------------------------------------------------------------ */
+
+/*
+ * Records a change before it is made, in memory and in the journal;
+ * returns the entry to fill in (NULL if out of memory, and the change
+ * must not be made).
+ */
+static struct isolate_undo *push_undo(struct isolate *iso, char kind, const char *path,
+                                      const char *old, pid_t tid, const char *new) {
+    struct isolate_undo *u;
+    char line[4 * ISOLATE_PATH_MAX];
+    int len;
+
+    if (iso->nr_undo == iso->cap_undo) {
+        size_t cap = iso->cap_undo ? iso->cap_undo * 2 : 64;
+        struct isolate_undo *undo = realloc(iso->undo, cap * sizeof(*undo));
+
+        if (!undo)
+            return NULL;
+        iso->undo = undo;
+        iso->cap_undo = cap;
+    }
+    u = &iso->undo[iso->nr_undo++];
+    memset(u, 0, sizeof(*u));
+    u->kind = kind;
+    u->tid = tid;
+    snprintf(u->path, sizeof(u->path), "%s", path ? path : "");
+    snprintf(u->old, sizeof(u->old), "%s", old ? old : "");
+    snprintf(u->new, sizeof(u->new), "%s", new ? new : "");
+
+    if (iso->journal_fd >= 0) {
+        iso->journal_last = lseek(iso->journal_fd, 0, SEEK_END);
+        len = snprintf(line, sizeof(line), "%c\t%d\t%s\t%s\t%s\n", u->kind, (int)u->tid, u->path,
+                       u->old, u->new);
+        if (write(iso->journal_fd, line, (size_t)len) != len) {
+            /* Still undone in memory; only a later crash would miss it */
+        }
+    }
+    return u;
+}
+
+/* Forget the last entry when its change did not happen, in the journal too */
+static void pop_undo(struct isolate *iso) {
+    iso->nr_undo--;
+    if (iso->journal_fd >= 0 && iso->journal_last >= 0 &&
+        ftruncate(iso->journal_fd, iso->journal_last)) {
+        /* Nothing better to do; push_undo() lives with a broken journal too */
+    }
+}
+
+/* Moves whatever is left in a created cpuset to procs, then removes it */
+static int remove_cpuset(const char *dir, const char *procs) {
+    char path[ISOLATE_PATH_MAX + 16], line[32];
+    FILE *f;
+
+    if (!rmdir(dir) || errno == ENOENT)
+        return 0;
+    if (errno != EBUSY)
+        return -1;
+
+    snprintf(path, sizeof(path), "%s/cgroup.procs", dir);
+    f = fopen(path, "re");
+    if (!f)
+        return -1;
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = '\0';
+        write_str(procs, line);
+    }
+    fclose(f);
+    return rmdir(dir);
+}
+
+static int undo_one(const struct isolate_undo *u) {
+    cpu_set_t cur, set;
+
+    switch (u->kind) {
+    case 'w':
+        return write_str(u->path, u->old);
+    case 'a':
+        /* Gone, or changed by someone else since: leave it alone */
+        if (sched_getaffinity(u->tid, sizeof(cur), &cur))
+            return errno == ESRCH ? 0 : -1;
+        if (topo_parse_cpulist(u->new, &set) || !CPU_EQUAL(&cur, &set))
+            return 0;
+        if (topo_parse_cpulist(u->old, &set))
+            return -1;
+        if (sched_setaffinity(u->tid, sizeof(set), &set))
+            return errno == ESRCH ? 0 : -1;
+        return 0;
+    case 'd':
+        return remove_cpuset(u->path, u->old);
+    }
+    return -1;
+}
+
+/* Newest first; returns the number of failures */
+static int undo_all(const struct isolate_undo *undo, size_t n) {
+    int failed = 0;
+
+    for (size_t i = n; i-- > 0;) {
+        if (undo_one(&undo[i])) {
+            if (undo[i].kind == 'a')
+                fprintf(stderr, "isolate: thread %d: %s\n", (int)undo[i].tid, strerror(errno));
+            else
+                fprintf(stderr, "isolate: %s: %s\n", undo[i].path, strerror(errno));
+            failed++;
+        }
+    }
+    return failed;
+}
+
+/* ------------------------------------------------------------------ */
+/* cpusets                                                             */
+/* ------------------------------------------------------------------ */
+
+/* The cpuset hierarchy: v1 wherever it is mounted (Android: /dev/cpuset), else v2 */
+static int find_hierarchy(struct isolate *iso) {
+    const char *env = getenv("BENCH_CGROUP");
+    char line[1024], v2root[ISOLATE_PATH_MAX] = "", path[ISOLATE_PATH_MAX + 32];
+    FILE *f;
+
+    if (env && *env) {
+        snprintf(iso->root, sizeof(iso->root), "%s", env);
+        snprintf(path, sizeof(path), "%s/cgroup.controllers", env);
+        iso->v2 = !access(path, F_OK);
+    } else if ((f = fopen("/proc/self/mountinfo", "re"))) {
+        while (fgets(line, sizeof(line), f)) {
+            char mnt[ISOLATE_PATH_MAX], type[32], opts[512];
+            const char *sep = strstr(line, " - ");
+
+            if (!sep || sscanf(line, "%*s %*s %*s %*s %255s", mnt) != 1 ||
+                sscanf(sep + 3, "%31s %*s %511s", type, opts) != 2)
+                continue;
+            if (!strcmp(type, "cgroup") && has_word(opts, "cpuset", ",")) {
+                snprintf(iso->root, sizeof(iso->root), "%s", mnt);
+                break;
+            }
+            if (!strcmp(type, "cgroup2") && !*v2root)
+                snprintf(v2root, sizeof(v2root), "%s", mnt);
+        }
+        fclose(f);
+        if (!*iso->root && *v2root) {
+            snprintf(iso->root, sizeof(iso->root), "%s", v2root);
+            iso->v2 = true;
+        }
+    }
+    if (!*iso->root) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    if (iso->v2) {
+        char controllers[256];
+
+        snprintf(path, sizeof(path), "%s/cgroup.controllers", iso->root);
+        if (read_str(path, controllers, sizeof(controllers)) ||
+            !has_word(controllers, "cpuset", " ")) {
+            errno = ENOTSUP;
+            return -1;
+        }
+        iso->prefix = "cpuset.";
+    } else {
+        /* Android mounts it with noprefix: cpus, mems, cpu_exclusive */
+        snprintf(path, sizeof(path), "%s/cpuset.cpus", iso->root);
+        iso->prefix = access(path, F_OK) ? "" : "cpuset.";
+    }
+    return 0;
+}
+
+static void cpuset_file(const struct isolate *iso, const char *dir, const char *name,
+                        char *path, size_t len) {
+    snprintf(path, len, "%s/%s%s", dir, iso->prefix, name);
+}
+
+/* Creates the reserved cpuset; 0, or -1 with errno set and nothing left behind */
+static int create_cpuset(struct isolate *iso) {
+    char path[ISOLATE_PATH_MAX + 32], procs[ISOLATE_PATH_MAX + 16], value[256], cpus[256];
+    size_t mark;
+    int err;
+
+    if (find_hierarchy(iso))
+        return -1;
+    mark = iso->nr_undo;
+
+    if (iso->v2) {
+        snprintf(path, sizeof(path), "%s/cgroup.subtree_control", iso->root);
+        if (read_str(path, value, sizeof(value)))
+            return -1;
+        if (!has_word(value, "cpuset", " ")) {
+            if (!push_undo(iso, 'w', path, "-cpuset", 0, NULL))
+                return -1;
+            if (write_str(path, "+cpuset"))
+                goto fail;
+        }
+    }
+
+    if (snprintf(iso->dir, sizeof(iso->dir), "%s/%s", iso->root, ISOLATE_CPUSET_NAME) >=
+        (int)sizeof(iso->dir)) {
+        errno = ENAMETOOLONG;
+        goto fail;
+    }
+    snprintf(procs, sizeof(procs), "%s/cgroup.procs", iso->root);
+    if (!push_undo(iso, 'd', iso->dir, procs, 0, NULL))
+        goto fail;
+    /* An existing one is someone else's, or a leftover: never use or remove it */
+    if (mkdir(iso->dir, 0755)) {
+        err = errno;
+        pop_undo(iso);
+        errno = err;
+        goto fail;
+    }
+
+    /* v1 wants memory nodes before it takes a task; v2 inherits them */
+    if (!iso->v2) {
+        cpuset_file(iso, iso->root, "mems", path, sizeof(path));
+        if (read_str(path, value, sizeof(value)))
+            goto fail;
+        cpuset_file(iso, iso->dir, "mems", path, sizeof(path));
+        if (write_str(path, value))
+            goto fail;
+    }
+    cpuset_file(iso, iso->dir, "cpus", path, sizeof(path));
+    if (write_str(path, topo_format_cpulist(&iso->cpus, cpus, sizeof(cpus))))
+        goto fail;
+    return 0;
+
+fail:
+    err = errno;
+    undo_all(iso->undo + mark, iso->nr_undo - mark);
+    iso->nr_undo = mark;
+    iso->dir[0] = '\0';
+    errno = err;
+    return -1;
+}
+
+/* Takes the reserved CPUs out of one cpuset, unless nothing would be left */
+static void narrow_cpuset(struct isolate *iso, const char *dir) {
+    char path[ISOLATE_PATH_MAX + 32], old[256], new[256];
+    cpu_set_t set, overlap;
+
+    cpuset_file(iso, dir, "cpus", path, sizeof(path));
+    /* v2 cpusets without their own list follow the parent */
+    if (read_str(path, old, sizeof(old)) || !*old || topo_parse_cpulist(old, &set))
+        return;
+    CPU_AND(&overlap, &set, &iso->cpus);
+    if (!CPU_COUNT(&overlap))
+        return;
+    CPU_XOR(&set, &set, &overlap);
+    if (!CPU_COUNT(&set))
+        return;
+
+    if (!push_undo(iso, 'w', path, old, 0, NULL))
+        return;
+    if (write_str(path, topo_format_cpulist(&set, new, sizeof(new)))) {
+        pop_undo(iso);
+        return;
+    }
+    iso->sets_narrowed++;
+}
+
+/* Children before parents, which v1 requires when shrinking */
+static void narrow_tree(struct isolate *iso, const char *dir, int depth) {
+    DIR *d = opendir(dir);
+    struct dirent *de;
+
+    if (!d)
+        return;
+    while ((de = readdir(d))) {
+        char path[ISOLATE_PATH_MAX];
+
+        if (de->d_name[0] == '.' || (de->d_type != DT_DIR && de->d_type != DT_UNKNOWN))
+            continue;
+        if (snprintf(path, sizeof(path), "%s/%s", dir, de->d_name) >= (int)sizeof(path) ||
+            !strcmp(path, iso->dir))
+            continue;
+        if (depth < MAX_DEPTH)
+            narrow_tree(iso, path, depth + 1);
+        narrow_cpuset(iso, path);
+    }
+    closedir(d);
+}
+
+/* A v2 partition or a v1 exclusive set, once nothing else overlaps */
+static void make_exclusive(struct isolate *iso) {
+    char path[ISOLATE_PATH_MAX + 32], value[128];
+
+    if (iso->v2) {
+        static const char *modes[] = { "isolated", "root" };
+
+        cpuset_file(iso, iso->dir, "cpus.partition", path, sizeof(path));
+        if (!push_undo(iso, 'w', path, "member", 0, NULL))
+            return;
+        for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+            /* An invalid partition is accepted and reads back as such */
+            if (!write_str(path, modes[i]) && !read_str(path, value, sizeof(value)) &&
+                !strstr(value, "invalid")) {
+                iso->exclusive = true;
+                return;
+            }
+        }
+    } else {
+        cpuset_file(iso, iso->dir, "cpu_exclusive", path, sizeof(path));
+        if (!push_undo(iso, 'w', path, "0", 0, NULL))
+            return;
+        if (!write_str(path, "1")) {
+            iso->exclusive = true;
+            return;
+        }
+    }
+    write_str(path, iso->v2 ? "member" : "0");
+    pop_undo(iso);
+}
+
+/* ------------------------------------------------------------------ */
+/* Threads and idle states                                             */
+/* ------------------------------------------------------------------ */
+
+static void move_thread(struct isolate *iso, pid_t tid) {
+    cpu_set_t old, rest, overlap;
+    char old_list[256], new_list[256];
+
+    if (sched_getaffinity(tid, sizeof(old), &old))
+        return;
+    CPU_AND(&overlap, &old, &iso->cpus);
+    if (!CPU_COUNT(&overlap))
+        return;
+    CPU_XOR(&rest, &old, &overlap);
+    /* Pinned to the reserved CPUs: moving it could break it */
+    if (!CPU_COUNT(&rest)) {
+        iso->tasks_left++;
+        return;
+    }
+
+    topo_format_cpulist(&old, old_list, sizeof(old_list));
+    topo_format_cpulist(&rest, new_list, sizeof(new_list));
+    if (!push_undo(iso, 'a', NULL, old_list, tid, new_list))
+        return;
+    if (sched_setaffinity(tid, sizeof(rest), &rest)) {
+        pop_undo(iso);
+        iso->tasks_left++;
+        return;
+    }
+    iso->tasks_moved++;
+}
+
+/* Every thread of every process but this one */
+static void move_threads(struct isolate *iso) {
+    DIR *proc = opendir("/proc");
+    struct dirent *de;
+    pid_t self = getpid();
+
+    if (!proc)
+        return;
+    while ((de = readdir(proc))) {
+        char path[sizeof("/proc//task") + sizeof(de->d_name)];
+        DIR *tasks;
+        struct dirent *te;
+
+        if (!isdigit((unsigned char)de->d_name[0]) || atoi(de->d_name) == self)
+            continue;
+        snprintf(path, sizeof(path), "/proc/%s/task", de->d_name);
+        if (!(tasks = opendir(path)))
+            continue;
+        while ((te = readdir(tasks))) {
+            if (isdigit((unsigned char)te->d_name[0]))
+                move_thread(iso, atoi(te->d_name));
+        }
+        closedir(tasks);
+    }
+    closedir(proc);
+}
+
+/* State 0 (WFI, or polling on x86) stays: with nothing enabled some drivers busy-loop */
+static void disable_idle(struct isolate *iso) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &iso->cpus))
+            continue;
+        for (int state = 1;; state++) {
+            char path[ISOLATE_PATH_MAX], value[16];
+
+            snprintf(path, sizeof(path), "%s/cpu%d/cpuidle/state%d/disable", cpu_root(), cpu,
+                     state);
+            if (read_str(path, value, sizeof(value)))
+                break;
+            if (strcmp(value, "0"))
+                continue;
+            if (!push_undo(iso, 'w', path, "0", 0, NULL))
+                return;
+            if (write_str(path, "1")) {
+                pop_undo(iso);
+                continue;
+            }
+            iso->idle_disabled++;
+        }
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Interface                                                           */
+/* ------------------------------------------------------------------ */
+
+static int check_cpus(const cpu_set_t *cpus) {
+    char path[ISOLATE_PATH_MAX], list[256];
+    cpu_set_t online, both;
+
+    if (!CPU_COUNT(cpus))
+        return -1;
+    snprintf(path, sizeof(path), "%s/online", cpu_root());
+    if (read_str(path, list, sizeof(list)) || topo_parse_cpulist(list, &online))
+        return 0;
+    CPU_AND(&both, cpus, &online);
+    /* Offline CPUs, or nowhere left for everything else */
+    if (!CPU_EQUAL(&both, cpus) || CPU_EQUAL(cpus, &online))
+        return -1;
+    return 0;
+}
+
+int isolate_begin(struct isolate *iso, const cpu_set_t *cpus, unsigned int flags) {
+    sigset_t old;
+
+    memset(iso, 0, sizeof(*iso));
+    iso->cpus = *cpus;
+    iso->flags = flags;
+    iso->journal_fd = -1;
+    iso->prefix = "";
+    if (check_cpus(cpus)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    snprintf(iso->journal, sizeof(iso->journal), "%s", isolate_journal_path());
+    iso->journal_fd = open(iso->journal, O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0600);
+    if (iso->journal_fd < 0)
+        return -1;
+
+    hold_signals(&old);
+    if (create_cpuset(iso))
+        iso->cpuset_err = errno;
+    if (*iso->root)
+        narrow_tree(iso, iso->root, 1);
+    if (*iso->dir)
+        make_exclusive(iso);
+    move_threads(iso);
+    if (flags & ISOLATE_IDLE)
+        disable_idle(iso);
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    return 0;
+}
+
+int isolate_enter(struct isolate *iso, pid_t pid) {
+    char path[ISOLATE_PATH_MAX + 16], value[16];
+
+    if (*iso->dir) {
+        snprintf(path, sizeof(path), "%s/cgroup.procs", iso->dir);
+        snprintf(value, sizeof(value), "%d", pid ? (int)pid : (int)getpid());
+        if (write_str(path, value))
+            fprintf(stderr, "isolate: %s: %s\n", path, strerror(errno));
+    }
+    return sched_setaffinity(pid, sizeof(iso->cpus), &iso->cpus);
+}
+
+int isolate_end(struct isolate *iso) {
+    sigset_t old;
+    int failed;
+
+    hold_signals(&old);
+    failed = undo_all(iso->undo, iso->nr_undo);
+    if (iso->journal_fd >= 0) {
+        close(iso->journal_fd);
+        /* Kept for isolate_restore() if anything is still in place */
+        if (!failed)
+            unlink(iso->journal);
+    }
+    free(iso->undo);
+    iso->undo = NULL;
+    iso->nr_undo = iso->cap_undo = 0;
+    iso->journal_fd = -1;
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    return failed;
+}
+
+int isolate_restore(const char *journal) {
+    struct isolate iso;
+    char line[4 * ISOLATE_PATH_MAX];
+    FILE *f = fopen(journal, "re");
+
+    if (!f)
+        return -1;
+    memset(&iso, 0, sizeof(iso));
+    iso.journal_fd = -1;
+    while (fgets(line, sizeof(line), f)) {
+        char *p = line, *kind, *tid, *path, *old, *new;
+
+        line[strcspn(line, "\n")] = '\0';
+        kind = strsep(&p, "\t");
+        tid = strsep(&p, "\t");
+        path = strsep(&p, "\t");
+        old = strsep(&p, "\t");
+        new = strsep(&p, "\t");
+        if (!new || strlen(kind) != 1 || !strchr("wad", *kind))
+            continue;
+        if (!push_undo(&iso, *kind, path, old, (pid_t)atoi(tid), new)) {
+            fclose(f);
+            free(iso.undo);
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+    fclose(f);
+
+    snprintf(iso.journal, sizeof(iso.journal), "%s", journal);
+    iso.journal_fd = open(journal, O_RDONLY | O_CLOEXEC);
+    return isolate_end(&iso);
+}
+
+void isolate_print(const struct isolate *iso, FILE *f) {
+    char cpus[256];
+
+    fprintf(f, "Isolated CPUs %s: ", topo_format_cpulist(&iso->cpus, cpus, sizeof(cpus)));
+    if (*iso->dir)
+        fprintf(f, "cpuset %s%s", iso->dir, iso->exclusive ? " (exclusive)" : "");
+    else if (iso->cpuset_err == EEXIST)
+        fprintf(f, "no cpuset (%s/%s already exists)", iso->root, ISOLATE_CPUSET_NAME);
+    else
+        fprintf(f, "no cpuset (%s)", strerror(iso->cpuset_err));
+    fprintf(f, ", %d cpusets narrowed, %d threads moved off, %d left", iso->sets_narrowed,
+            iso->tasks_moved, iso->tasks_left);
+    if (iso->flags & ISOLATE_IDLE)
+        fprintf(f, ", %d idle states disabled", iso->idle_disabled);
+    fputc('\n', f);
+}
@@ -0,0 +1,103 @@
+/*
+ * isolate.h
+ *
+ * CPU isolation for low-noise measurement: reserve some CPUs for the
+ * benchmark and keep everything else off them for as long as it runs.
+ * isolate_begin() does what the system permits, in this order:
+ *
+ *   1. creates a cpuset "bench-isolate" holding the CPUs, exclusive
+ *      where the kernel agrees (a v2 partition, or cpu_exclusive on v1);
+ *      one that already exists is left alone and no cpuset is used;
+ *   2. removes the CPUs from every other cpuset that has more than them;
+ *   3. moves every other thread still allowed on them off by affinity,
+ *      leaving threads that would have nowhere else to run and those the
+ *      kernel refuses (per-CPU kthreads, or anything without privileges);
+ *   4. with ISOLATE_IDLE, disables all but the shallowest cpuidle state
+ *      of the CPUs.
+ *
+ * isolate_enter() puts a task into the reserved CPUs, and isolate_end()
+ * undoes every step in reverse. Each step is appended to a journal
+ * before it is made, so a run that dies without isolate_end() (SIGKILL,
+ * a crash) is undone later by isolate_restore(); isolate_begin() refuses
+ * to start while a journal exists. Callers must not die from SIGINT,
+ * SIGTERM, SIGHUP or SIGQUIT between the two calls: isolate_begin() and
+ * isolate_end() block them while they work, and bench-isolate forwards
+ * them to the benchmark in between.
+ *
+ * Environment:
+ *   BENCH_ISOLATE_STATE  journal (/data/local/tmp or /tmp/bench-isolate.state)
+ *   BENCH_CGROUP         cpuset hierarchy to use instead of the mounted one
+ *   TOPO_SYSFS           CPU directory, as in topo.h
+ */
+
+#ifndef ISOLATE_H
+#define ISOLATE_H
+
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#define ISOLATE_CPUSET_NAME "bench-isolate"
+#define ISOLATE_PATH_MAX 256
+
+/* Disable the deeper cpuidle states of the reserved CPUs */
+#define ISOLATE_IDLE 0x1
+
+/* One change, with what undoes it */
+struct isolate_undo {
+    char kind;                      /* 'w'rite a file, 'a'ffinity, 'd'irectory created */
+    pid_t tid;                      /* 'a' */
+    char path[ISOLATE_PATH_MAX];    /* 'w', 'd' */
+    char old[ISOLATE_PATH_MAX];     /* 'w', 'a': value to put back; 'd': procs file for leftovers */
+    char new[ISOLATE_PATH_MAX];     /* 'a': affinity set, only restored while still in place */
+};
+
+struct isolate {
+    cpu_set_t cpus;
+    unsigned int flags;
+
+    char root[ISOLATE_PATH_MAX];    /* cpuset hierarchy, "" without one */
+    char dir[ISOLATE_PATH_MAX];     /* the reserved cpuset, "" if not created */
+    bool v2;
+    const char *prefix;             /* "cpuset." unless v1 is mounted noprefix */
+    int cpuset_err;                 /* why there is no cpuset */
+
+    struct isolate_undo *undo;
+    size_t nr_undo, cap_undo;
+    int journal_fd;
+    off_t journal_last;             /* journal size before the last entry */
+    char journal[ISOLATE_PATH_MAX];
+
+    /* What was done */
+    bool exclusive;
+    int sets_narrowed;
+    int tasks_moved;
+    int tasks_left;
+    int idle_disabled;
+};
+
+/* Path of the journal, from BENCH_ISOLATE_STATE or the default */
+const char *isolate_journal_path(void);
+
+/*
+ * Reserve cpus (online, and not all of them); 0, or -1 with errno set:
+ * EEXIST if a journal is left over, EINVAL for an unusable set.
+ * Steps the system does not permit are skipped, not errors.
+ */
+int isolate_begin(struct isolate *iso, const cpu_set_t *cpus, unsigned int flags);
+
+/* Move pid (0: the caller) into the cpuset and onto the reserved CPUs */
+int isolate_enter(struct isolate *iso, pid_t pid);
+
+/* Undo everything; returns the number of steps that failed (0: journal removed) */
+int isolate_end(struct isolate *iso);
+
+/* Undo a journal left by a run that never reached isolate_end(); like
+ * isolate_end(), or -1 with errno set if it cannot be read */
+int isolate_restore(const char *journal);
+
+/* One line: the CPUs, the cpuset and how much was moved */
+void isolate_print(const struct isolate *iso, FILE *f);
+
+#endif /* ISOLATE_H */
@@ -0,0 +1,407 @@
+/*
+ * perfctr.c
+ *
+ * perf_event counters, see perfctr.h.
+ */
+
+#define _GNU_SOURCE
+
+#include "perfctr.h"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+#define USER_READ
+#endif
+
+/* arm64 PMU format "rdpmc": config1 bit 1 asks for EL0 counter access */
+#define ARM64_CONFIG1_RDPMC (1ULL << 1)
+
+#define barrier() __asm__ __volatile__("" ::: "memory")
+
+static const struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} events[PERFCTR_NR_EVENTS] = {
+    [PERFCTR_CYCLES] = { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    [PERFCTR_INSTRUCTIONS] = { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    [PERFCTR_BRANCH_MISSES] = { "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    [PERFCTR_CACHE_MISSES] = { "cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    [PERFCTR_CONTEXT_SWITCHES] = { "context-switches", PERF_TYPE_SOFTWARE,
+                                   PERF_COUNT_SW_CONTEXT_SWITCHES },
+    [PERFCTR_CPU_MIGRATIONS] = { "cpu-migrations", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS },
+    [PERFCTR_PAGE_FAULTS] = { "page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+
+const char *perfctr_name(enum perfctr_event e) {
+    return events[e].name;
+}
+
+static bool is_hw(int e) {
+    return events[e].type == PERF_TYPE_HARDWARE;
+}
+
+/*
+ * The first event decides whether kernel time is counted: when
+ * perf_event_paranoid refuses it, everything is opened user-only so the
+ * events stay comparable.
+ */
+static int open_event(struct perfctr *pc, int e, int group_fd, bool first) {
+    struct perf_event_attr attr;
+    int fd;
+
+    for (;;) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[e].type;
+        attr.config = events[e].config;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.inherit = pc->inherit;
+        attr.exclude_kernel = attr.exclude_hv = pc->user_only;
+#ifdef __aarch64__
+        if (is_hw(e) && !pc->inherit)
+            attr.config1 = ARM64_CONFIG1_RDPMC;
+#endif
+
+        fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+        if (fd >= 0 || pc->user_only || !first || (errno != EACCES && errno != EPERM))
+            return fd;
+        pc->user_only = true;
+    }
+}
+
+int perfctr_open(struct perfctr *pc, unsigned int flags) {
+    int n = 0, err = ENOENT;
+
+    memset(pc, 0, sizeof(*pc));
+    pc->hw_leader = pc->sw_leader = -1;
+    pc->inherit = flags & PERFCTR_INHERIT;
+    for (int e = 0; e < PERFCTR_NR_EVENTS; e++)
+        pc->fd[e] = -1;
+
+    for (int e = 0; e < PERFCTR_NR_EVENTS; e++) {
+        int *leader = is_hw(e) ? &pc->hw_leader : &pc->sw_leader;
+        int fd = open_event(pc, e, *leader, !n);
+
+        if (fd < 0) {
+            err = errno;
+            continue;
+        }
+        pc->fd[e] = fd;
+        if (*leader < 0)
+            *leader = fd;
+        if (is_hw(e)) {
+            pc->hw_events[pc->nr_hw++] = e;
+            /* Inherited counts never reach the page, only read() sums them */
+            if (!pc->inherit) {
+                void *page = mmap(NULL, (size_t)sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+                pc->page[e] = page == MAP_FAILED ? NULL : page;
+            }
+        } else {
+            pc->sw_events[pc->nr_sw++] = e;
+        }
+        n++;
+    }
+
+    if (!n) {
+        errno = err;
+        return -1;
+    }
+    return n;
+}
+
+void perfctr_close(struct perfctr *pc) {
+    for (int e = 0; e < PERFCTR_NR_EVENTS; e++) {
+        if (pc->page[e])
+            munmap(pc->page[e], (size_t)sysconf(_SC_PAGESIZE));
+        if (pc->fd[e] >= 0)
+            close(pc->fd[e]);
+        pc->page[e] = NULL;
+        pc->fd[e] = -1;
+    }
+    pc->hw_leader = pc->sw_leader = -1;
+}
+
+#ifdef USER_READ
+static uint64_t read_pmc(uint32_t counter) {
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+
+    __asm__ __volatile__("rdpmc" : "=a"(lo), "=d"(hi) : "c"(counter));
+    return (uint64_t)hi << 32 | lo;
+#else
+    uint64_t v;
+
+    /* Counter 31 is the cycle counter, the rest go through the selector */
+    if (counter == 31) {
+        __asm__ __volatile__("mrs %0, pmccntr_el0" : "=r"(v));
+    } else {
+        __asm__ __volatile__("msr pmselr_el0, %1\n\tisb\n\tmrs %0, pmxevcntr_el0"
+                             : "=r"(v) : "r"((uint64_t)counter));
+    }
+    return v;
+#endif
+}
+
+static uint64_t read_timestamp(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return bench_ticks_raw(BENCH_CLOCK_TSC);
+#else
+    return bench_ticks_raw(BENCH_CLOCK_CNTVCT);
+#endif
+}
+#endif
+
+/*
+ * One event through its mmap page, following the protocol documented
+ * in linux/perf_event.h. False when the kernel does not allow user
+ * access or the event is not on a counter right now.
+ */
+static bool user_read(const void *mapped, uint64_t *count, uint64_t *enabled,
+                      uint64_t *running) {
+#ifdef USER_READ
+    const volatile struct perf_event_mmap_page *pg = mapped;
+    uint32_t seq, idx;
+    uint64_t cnt, en, run;
+
+    do {
+        seq = pg->lock;
+        barrier();
+
+        idx = pg->index;
+        if (!pg->cap_user_rdpmc || !idx)
+            return false;
+        en = pg->time_enabled;
+        run = pg->time_running;
+        if (pg->cap_user_time) {
+            /* Bring the times up to date from the timestamp counter */
+            uint64_t cyc = read_timestamp(), quot, rem, delta;
+            uint16_t shift = pg->time_shift;
+            uint32_t mult = pg->time_mult;
+
+            if (pg->cap_user_time_short)
+                cyc = pg->time_cycles + ((cyc - pg->time_cycles) & pg->time_mask);
+            quot = cyc >> shift;
+            rem = cyc & (((uint64_t)1 << shift) - 1);
+            delta = pg->time_offset + quot * mult + ((rem * mult) >> shift);
+            en += delta;
+            run += delta;
+        }
+
+        unsigned int width = pg->pmc_width;
+        if (!width || width > 64)
+            width = 64;
+        uint64_t pmc = read_pmc(idx - 1) << (64 - width);
+        cnt = pg->offset + (uint64_t)((int64_t)pmc >> (64 - width));
+
+        barrier();
+    } while (pg->lock != seq);
+
+    *count = cnt;
+    *enabled = en;
+    *running = run;
+    return true;
+#else
+    (void)mapped, (void)count, (void)enabled, (void)running;
+    return false;
+#endif
+}
+
+/* The hardware group in user space; false if it has to go through read() */
+static bool read_hw_user(const struct perfctr *pc, uint64_t *values, uint64_t *enabled,
+                         uint64_t *running) {
+    for (int i = 0; i < pc->nr_hw; i++) {
+        int e = pc->hw_events[i];
+        uint64_t en, run;
+
+        if (!pc->page[e] || !user_read(pc->page[e], &values[e], &en, &run))
+            return false;
+        if (!i) {
+            *enabled = en;
+            *running = run;
+        }
+    }
+    return pc->nr_hw > 0;
+}
+
+/* A whole group with one read(); 0, or -1 */
+static int read_group(int leader, const int *members, int nr, uint64_t *values,
+                      uint64_t *enabled, uint64_t *running) {
+    uint64_t buf[3 + PERFCTR_NR_EVENTS];
+    ssize_t len = read(leader, buf, sizeof(buf));
+
+    if (len < (ssize_t)((3 + nr) * sizeof(uint64_t)) || buf[0] != (uint64_t)nr)
+        return -1;
+    *enabled = buf[1];
+    *running = buf[2];
+    for (int i = 0; i < nr; i++)
+        values[members[i]] = buf[3 + i];
+    return 0;
+}
+
+static unsigned int members_mask(const int *members, int nr) {
+    unsigned int mask = 0;
+
+    for (int i = 0; i < nr; i++)
+        mask |= 1u << members[i];
+    return mask;
+}
+
+/* Reads the hardware group; returns its mask, or 0 if it could not be read */
+static unsigned int read_hw(const struct perfctr *pc, uint64_t *values, uint64_t *enabled,
+                            uint64_t *running, bool *user) {
+    *user = false;
+    if (pc->hw_leader < 0)
+        return 0;
+    if (!pc->inherit && read_hw_user(pc, values, enabled, running))
+        *user = true;
+    else if (read_group(pc->hw_leader, pc->hw_events, pc->nr_hw, values, enabled, running))
+        return 0;
+    return members_mask(pc->hw_events, pc->nr_hw);
+}
+
+static unsigned int read_sw(const struct perfctr *pc, uint64_t *values) {
+    uint64_t en, run;
+
+    if (pc->sw_leader < 0 ||
+        read_group(pc->sw_leader, pc->sw_events, pc->nr_sw, values, &en, &run))
+        return 0;
+    return members_mask(pc->sw_events, pc->nr_sw);
+}
+
+/* The software group first, so its read() stays outside the hardware window */
+void perfctr_begin(struct perfctr *pc) {
+    pc->start_mask = read_sw(pc, pc->start);
+    pc->start_mask |= read_hw(pc, pc->start, &pc->start_enabled, &pc->start_running,
+                              &pc->start_user);
+}
+
+static void add_counts(struct perfctr_counts *to, const struct perfctr_counts *c, double sign) {
+    for (int e = 0; e < PERFCTR_NR_EVENTS; e++)
+        to->value[e] += sign * c->value[e];
+    to->intervals += (int)sign * c->intervals;
+    to->user_reads += (int)sign * c->user_reads;
+    to->hw_enabled += sign * c->hw_enabled;
+    to->hw_running += sign * c->hw_running;
+}
+
+void perfctr_end(struct perfctr *pc) {
+    struct perfctr_counts *c = &pc->last;
+    uint64_t now[PERFCTR_NR_EVENTS], en = 0, run = 0;
+    unsigned int mask;
+    bool user;
+
+    mask = read_hw(pc, now, &en, &run, &user);
+    mask |= read_sw(pc, now);
+    mask &= pc->start_mask;
+
+    memset(c, 0, sizeof(*c));
+    c->mask = mask;
+    c->user_only = pc->user_only;
+    c->intervals = 1;
+    c->user_reads = user && pc->start_user;
+
+    if (mask & members_mask(pc->hw_events, pc->nr_hw)) {
+        uint64_t de = en - pc->start_enabled, dr = run - pc->start_running;
+        /* Multiplexed (or off its PMU's cores) part of the time: extrapolate */
+        double scale = dr && dr < de ? (double)de / dr : 1.0;
+
+        c->hw_enabled = (double)de;
+        c->hw_running = (double)(dr < de ? dr : de);
+        for (int i = 0; i < pc->nr_hw; i++) {
+            int e = pc->hw_events[i];
+            c->value[e] = (double)(now[e] - pc->start[e]) * scale;
+        }
+    }
+    for (int i = 0; i < pc->nr_sw; i++) {
+        int e = pc->sw_events[i];
+        if (mask & 1u << e)
+            c->value[e] = (double)(now[e] - pc->start[e]);
+    }
+
+    add_counts(&pc->total, c, 1);
+    pc->total.mask |= mask;
+    pc->total.user_only = pc->user_only;
+}
+
+void perfctr_discard(struct perfctr *pc) {
+    add_counts(&pc->total, &pc->last, -1);
+    memset(&pc->last, 0, sizeof(pc->last));
+}
+
+void perfctr_reset(struct perfctr *pc) {
+    memset(&pc->last, 0, sizeof(pc->last));
+    memset(&pc->total, 0, sizeof(pc->total));
+}
+
+static bool has_hw(const struct perfctr_counts *c) {
+    return c->mask & (1u << PERFCTR_CYCLES | 1u << PERFCTR_INSTRUCTIONS |
+                      1u << PERFCTR_BRANCH_MISSES | 1u << PERFCTR_CACHE_MISSES);
+}
+
+static bool partly_counted(const struct perfctr_counts *c) {
+    return c->hw_enabled > 0 && c->hw_running < c->hw_enabled;
+}
+
+static bool has_ipc(const struct perfctr_counts *c) {
+    return (c->mask & 1u << PERFCTR_CYCLES) && (c->mask & 1u << PERFCTR_INSTRUCTIONS) &&
+           c->value[PERFCTR_CYCLES] > 0;
+}
+
+void perfctr_print(const struct perfctr_counts *c, FILE *f, double ops, const char *per,
+                   const char *indent) {
+    if (!c->mask || ops <= 0)
+        return;
+
+    fprintf(f, "%sCounters per %s (%s", indent, per,
+            c->user_only ? "user only" : "user and kernel");
+    if (has_hw(c)) {
+        fprintf(f, ", %s", !c->user_reads ? "read()" :
+                c->user_reads == c->intervals ? "rdpmc" : "rdpmc and read()");
+        if (partly_counted(c))
+            fprintf(f, ", scaled from %.0f%% of the time",
+                    100.0 * c->hw_running / c->hw_enabled);
+    }
+    fputs("):\n", f);
+
+    for (int e = 0; e < PERFCTR_NR_EVENTS; e++) {
+        if (!(c->mask & 1u << e))
+            continue;
+        fprintf(f, "%s  %-17s %14.2f", indent, events[e].name, c->value[e] / ops);
+        if (e == PERFCTR_INSTRUCTIONS && has_ipc(c))
+            fprintf(f, "  (IPC %.2f)", c->value[e] / c->value[PERFCTR_CYCLES]);
+        fputc('\n', f);
+    }
+}
+
+void perfctr_out(const struct perfctr_counts *c, struct bench_out *o, const char *prefix,
+                 double ops, const char *per) {
+    char name[128], unit[32];
+
+    if (!c->mask || ops <= 0)
+        return;
+
+    snprintf(unit, sizeof(unit), "/%s", per);
+    for (int e = 0; e < PERFCTR_NR_EVENTS; e++) {
+        if (!(c->mask & 1u << e))
+            continue;
+        snprintf(name, sizeof(name), "%s%s", prefix, events[e].name);
+        bench_out_value(o, name, unit, c->value[e] / ops);
+    }
+    if (has_ipc(c)) {
+        snprintf(name, sizeof(name), "%sipc", prefix);
+        bench_out_value(o, name, "insn/cycle",
+                        c->value[PERFCTR_INSTRUCTIONS] / c->value[PERFCTR_CYCLES]);
+    }
+    if (partly_counted(c)) {
+        snprintf(name, sizeof(name), "%scounted", prefix);
+        bench_out_value(o, name, "%", 100.0 * c->hw_running / c->hw_enabled);
+    }
+}
@@ -0,0 +1,110 @@
+/*
+ * perfctr.h
+ *
+ * Hardware and software event counters through perf_event_open, for
+ * attributing a result: cycles, instructions, branch and cache misses,
+ * context switches, CPU migrations and page faults. A tool opens the
+ * counters once and brackets its timed region:
+ *
+ *   perfctr_open(&pc, 0);
+ *   perfctr_begin(&pc);
+ *   ... measure ...
+ *   perfctr_end(&pc);              // adds the interval to pc.total
+ *   perfctr_print(&pc.total, stdout, ops, "op", "");
+ *
+ * The hardware events form one group and the software events another,
+ * so each group is read atomically and the read() of the software group
+ * happens outside the hardware window. Without PERFCTR_INHERIT the
+ * hardware counters are read in user space (rdpmc on x86, PMU registers
+ * on arm64) through each event's mmap page whenever the kernel allows
+ * it, and with read() otherwise. arm64 needs kernel.perf_user_access=1
+ * for that.
+ *
+ * PERFCTR_INHERIT also counts threads and processes created after
+ * perfctr_open(); those counts are only visible to read(). Kernel events
+ * are excluded when perf_event_paranoid forbids counting them. Android
+ * allows perf_event_open to root only unless security.perf_harden is 0.
+ * On heterogeneous SoCs a hardware event counts only on the cores of
+ * the PMU that took it, and the running fraction shows how much was
+ * missed. Pin the tool to one cluster for complete counts.
+ */
+
+#ifndef PERFCTR_H
+#define PERFCTR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "bench.h"
+
+enum perfctr_event {
+    PERFCTR_CYCLES,
+    PERFCTR_INSTRUCTIONS,
+    PERFCTR_BRANCH_MISSES,
+    PERFCTR_CACHE_MISSES,
+    PERFCTR_CONTEXT_SWITCHES,
+    PERFCTR_CPU_MIGRATIONS,
+    PERFCTR_PAGE_FAULTS,
+    PERFCTR_NR_EVENTS
+};
+
+/* Count threads and processes created later, read() only */
+#define PERFCTR_INHERIT 0x1
+
+/* Counts over one or more intervals, scaled when the PMU multiplexed */
+struct perfctr_counts {
+    double value[PERFCTR_NR_EVENTS];
+    unsigned int mask;              /* 1 << event for every event counted */
+    bool user_only;                 /* kernel excluded */
+    int intervals;
+    int user_reads;                 /* intervals whose hardware group was read with rdpmc */
+    double hw_enabled, hw_running;  /* ns the hardware group was enabled and on the PMU */
+};
+
+struct perfctr {
+    int fd[PERFCTR_NR_EVENTS];      /* -1 when the event is not counted */
+    void *page[PERFCTR_NR_EVENTS];  /* mmap page of hardware events, or NULL */
+    int hw_leader, sw_leader;       /* group leader fds, -1 without the group */
+    int hw_events[PERFCTR_NR_EVENTS], nr_hw;    /* group members in read() order */
+    int sw_events[PERFCTR_NR_EVENTS], nr_sw;
+    bool inherit;
+    bool user_only;
+
+    /* Readings at perfctr_begin() */
+    uint64_t start[PERFCTR_NR_EVENTS];
+    uint64_t start_enabled, start_running;  /* hardware group */
+    unsigned int start_mask;        /* events read successfully */
+    bool start_user;                /* hardware group read with rdpmc */
+
+    struct perfctr_counts last;     /* the latest interval */
+    struct perfctr_counts total;
+};
+
+/* Open every event that can be counted; their number, or -1 with errno set */
+int perfctr_open(struct perfctr *pc, unsigned int flags);
+void perfctr_close(struct perfctr *pc);
+
+static inline bool perfctr_active(const struct perfctr *pc) {
+    return pc->hw_leader >= 0 || pc->sw_leader >= 0;
+}
+
+/* "cycles", "instructions", "branch-misses", ... as perf names them */
+const char *perfctr_name(enum perfctr_event e);
+
+void perfctr_begin(struct perfctr *pc);
+void perfctr_end(struct perfctr *pc);
+
+/* Take the last interval back out of the total, for a discarded round */
+void perfctr_discard(struct perfctr *pc);
+void perfctr_reset(struct perfctr *pc);
+
+/* Each event divided by ops, one line each after indent; per names an op */
+void perfctr_print(const struct perfctr_counts *c, FILE *f, double ops, const char *per,
+                   const char *indent);
+
+/* Rows prefix + event name in unit "/per", IPC, and the running fraction if below 100% */
+void perfctr_out(const struct perfctr_counts *c, struct bench_out *o, const char *prefix,
+                 double ops, const char *per);
+
+#endif /* PERFCTR_H */
@@ -0,0 +1,428 @@
+/*
+ * runctl.c
+ *
+ * Thermal- and frequency-aware run control, see runctl.h.
+ */
+
+#define _GNU_SOURCE
+
+#include "runctl.h"
+#include "topo.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define COOL_POLL_MS 100
+#define COOL_TIMEOUT_S 60
+
+/* Zone types that follow the CPUs: x86 packages, Qualcomm tsens/apc,
+ * Exynos and Tensor clusters, MediaTek "mtktscpu" */
+static const char *cpu_zone_types[] = {
+    "cpu", "soc", "tsens", "apc", "pkg", "cluster", "little", "mid", "big", "prime",
+};
+
+static const char *cpu_root(void) {
+    const char *env = getenv("TOPO_SYSFS");
+    return env && *env ? env : TOPO_SYSFS;
+}
+
+static const char *thermal_root(void) {
+    const char *env = getenv("RUNCTL_THERMAL");
+    return env && *env ? env : RUNCTL_THERMAL;
+}
+
+static int open_file(const char *root, const char *rel) {
+    char path[512];
+
+    snprintf(path, sizeof(path), "%s/%s", root, rel);
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+/* Reads the whole (small) file; returns the length, or -1 */
+static ssize_t read_file(const char *root, const char *rel, char *buf, size_t len) {
+    int fd = open_file(root, rel);
+    ssize_t n;
+
+    if (fd < 0)
+        return -1;
+    n = read(fd, buf, len - 1);
+    close(fd);
+    if (n < 0)
+        return -1;
+    buf[n] = '\0';
+    return n;
+}
+
+static long read_policy(const struct runctl_domain *d, const char *name) {
+    char rel[128], buf[32];
+
+    snprintf(rel, sizeof(rel), "cpu%d/cpufreq/%s", d->cpu, name);
+    if (read_file(cpu_root(), rel, buf, sizeof(buf)) <= 0)
+        return -1;
+    return strtol(buf, NULL, 10);
+}
+
+static void sleep_ms(int ms) {
+    struct timespec req = { ms / 1000, (long)(ms % 1000) * 1000000 };
+    nanosleep(&req, NULL);
+}
+
+static int freq_slot(struct runctl_domain *d, long khz) {
+    for (int i = 0; i < d->nr_freqs; i++)
+        if (d->khz[i] == khz)
+            return i;
+    if (d->nr_freqs == RUNCTL_MAX_FREQS)
+        return -1;
+    d->khz[d->nr_freqs] = khz;
+    return d->nr_freqs++;
+}
+
+/* time_in_state: "<khz> <10 ms units>" per line */
+static int read_time_in_state(struct runctl_domain *d, unsigned long long *out) {
+    char rel[128], buf[4096];
+    char *line, *save = NULL;
+
+    snprintf(rel, sizeof(rel), "cpu%d/cpufreq/stats/time_in_state", d->cpu);
+    if (read_file(cpu_root(), rel, buf, sizeof(buf)) <= 0)
+        return -1;
+    for (line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        char *end;
+        long khz = strtol(line, &end, 10);
+        int i = freq_slot(d, khz);
+
+        if (i >= 0)
+            out[i] = strtoull(end, NULL, 10);
+    }
+    return 0;
+}
+
+static void load_zones(struct runctl *rc) {
+    char rel[64], type[32];
+    bool any_cpu = false;
+    int fds[RUNCTL_MAX_ZONES];
+    char types[RUNCTL_MAX_ZONES][32];
+    bool is_cpu[RUNCTL_MAX_ZONES];
+    int n = 0;
+
+    for (int z = 0; z < 256 && n < RUNCTL_MAX_ZONES; z++) {
+        snprintf(rel, sizeof(rel), "thermal_zone%d/type", z);
+        if (read_file(thermal_root(), rel, type, sizeof(type)) <= 0)
+            continue;
+        type[strcspn(type, "\n")] = '\0';
+        snprintf(rel, sizeof(rel), "thermal_zone%d/temp", z);
+        fds[n] = open_file(thermal_root(), rel);
+        if (fds[n] < 0)
+            continue;
+        snprintf(types[n], sizeof(types[n]), "%s", type);
+        is_cpu[n] = false;
+        for (size_t i = 0; i < sizeof(cpu_zone_types) / sizeof(cpu_zone_types[0]); i++)
+            if (strcasestr(type, cpu_zone_types[i]))
+                is_cpu[n] = true;
+        any_cpu |= is_cpu[n];
+        n++;
+    }
+
+    /* Only the CPU zones when there are any, otherwise every zone */
+    for (int i = 0; i < n; i++) {
+        if (any_cpu && !is_cpu[i]) {
+            close(fds[i]);
+            continue;
+        }
+        rc->zone_fd[rc->nr_zones] = fds[i];
+        memcpy(rc->zone_type[rc->nr_zones], types[i], sizeof(types[i]));
+        rc->nr_zones++;
+    }
+}
+
+static void load_domains(struct runctl *rc) {
+    struct topo *t = topo_load();
+
+    if (!t)
+        return;
+    for (int i = 0; i < t->nr_domains && rc->nr_domains < RUNCTL_MAX_DOMAINS; i++) {
+        struct runctl_domain *d = &rc->domains[rc->nr_domains];
+        unsigned long long ignored[RUNCTL_MAX_FREQS];
+
+        memset(d, 0, sizeof(*d));
+        d->cpu = t->domains[i].first;
+        d->base_min_khz = read_policy(d, "scaling_min_freq");
+        d->base_max_khz = read_policy(d, "scaling_max_freq");
+        if (d->base_max_khz < 0)
+            continue;
+        d->stats = !read_time_in_state(d, ignored);
+        rc->nr_domains++;
+    }
+    topo_free(t);
+}
+
+int runctl_init(struct runctl *rc) {
+    const char *env;
+
+    memset(rc, 0, sizeof(*rc));
+    rc->max_mc = INT_MIN;
+
+    env = getenv("BENCH_COOL");
+    if (env && *env)
+        rc->cool_mc = (int)(atof(env) * 1000);
+    env = getenv("BENCH_COOL_TIMEOUT");
+    rc->cool_timeout_ms = (env && *env ? atoi(env) : COOL_TIMEOUT_S) * 1000;
+    env = getenv("BENCH_THROTTLED");
+    if (env && *env) {
+        if (!strcmp(env, "discard")) {
+            rc->discard = true;
+        } else if (strcmp(env, "tag")) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    load_zones(rc);
+    load_domains(rc);
+    if (rc->cool_mc && !rc->nr_zones)
+        fprintf(stderr, "BENCH_COOL: no thermal zones in %s, pausing instead\n", thermal_root());
+    return 0;
+}
+
+void runctl_close(struct runctl *rc) {
+    for (int i = 0; i < rc->nr_zones; i++)
+        close(rc->zone_fd[i]);
+    rc->nr_zones = 0;
+}
+
+int runctl_temp_mc(const struct runctl *rc) {
+    int hottest = INT_MIN;
+
+    for (int i = 0; i < rc->nr_zones; i++) {
+        char buf[32];
+        ssize_t n = pread(rc->zone_fd[i], buf, sizeof(buf) - 1, 0);
+        long mc;
+
+        if (n <= 0)
+            continue;       /* some zones fail while their sensor sleeps */
+        buf[n] = '\0';
+        mc = strtol(buf, NULL, 10);
+        /* Disabled sensors read 0 or nonsense */
+        if (mc > -40000 && mc < 200000 && mc != 0 && mc > hottest)
+            hottest = (int)mc;
+    }
+    return hottest;
+}
+
+static void note_temp(struct runctl *rc) {
+    int mc = runctl_temp_mc(rc);
+
+    if (mc > rc->max_mc)
+        rc->max_mc = mc;
+}
+
+void runctl_settle(struct runctl *rc, int pause_ms) {
+    long long start;
+
+    if (!rc->cool_mc || !rc->nr_zones) {
+        sleep_ms(pause_ms);
+        return;
+    }
+
+    start = bench_mono_ns();
+    for (;;) {
+        int mc = runctl_temp_mc(rc);
+        long long waited = bench_mono_ns() - start;
+
+        if (mc == INT_MIN || mc < rc->cool_mc)
+            break;
+        if (waited / 1000000 >= rc->cool_timeout_ms) {
+            fprintf(stderr, "BENCH_COOL: still at %.1f C after %d s, going on\n", mc / 1000.0,
+                    rc->cool_timeout_ms / 1000);
+            break;
+        }
+        sleep_ms(COOL_POLL_MS);
+    }
+    rc->cool_wait_ns += bench_mono_ns() - start;
+}
+
+void runctl_round_begin(struct runctl *rc) {
+    rc->round_throttled = false;
+    note_temp(rc);
+
+    for (int i = 0; i < rc->nr_domains; i++) {
+        struct runctl_domain *d = &rc->domains[i];
+
+        d->round_min_khz = read_policy(d, "scaling_min_freq");
+        d->round_max_khz = read_policy(d, "scaling_max_freq");
+        if (d->round_min_khz != d->base_min_khz || d->round_max_khz != d->base_max_khz)
+            rc->round_throttled = true;
+        if (d->stats)
+            read_time_in_state(d, d->start);
+        else
+            d->sample_khz = read_policy(d, "scaling_cur_freq");
+    }
+}
+
+static void add_sample(struct runctl_domain *d, long khz) {
+    int i;
+
+    if (khz > 0 && (i = freq_slot(d, khz)) >= 0)
+        d->residency[i]++;
+}
+
+enum runctl_verdict runctl_round_end(struct runctl *rc) {
+    enum runctl_verdict verdict;
+
+    /* The limits move when the thermal framework caps a policy */
+    for (int i = 0; i < rc->nr_domains; i++) {
+        struct runctl_domain *d = &rc->domains[i];
+
+        if (read_policy(d, "scaling_min_freq") != d->round_min_khz ||
+            read_policy(d, "scaling_max_freq") != d->round_max_khz)
+            rc->round_throttled = true;
+    }
+    note_temp(rc);
+
+    rc->rounds++;
+    if (!rc->round_throttled) {
+        verdict = RUNCTL_KEEP;
+    } else {
+        rc->throttled++;
+        verdict = rc->discard ? RUNCTL_DISCARD : RUNCTL_THROTTLED;
+    }
+    if (verdict == RUNCTL_DISCARD) {
+        rc->discarded++;
+        return verdict;
+    }
+
+    for (int i = 0; i < rc->nr_domains; i++) {
+        struct runctl_domain *d = &rc->domains[i];
+
+        if (d->stats) {
+            unsigned long long now[RUNCTL_MAX_FREQS];
+
+            memcpy(now, d->start, sizeof(now));
+            read_time_in_state(d, now);
+            for (int f = 0; f < d->nr_freqs; f++)
+                d->residency[f] += now[f] - d->start[f];
+        } else {
+            add_sample(d, d->sample_khz);
+            add_sample(d, read_policy(d, "scaling_cur_freq"));
+        }
+    }
+    return verdict;
+}
+
+int runctl_run(struct runctl *rc, int pause_ms, int (*round)(void *arg),
+               void (*discard)(void *arg), void *arg, enum runctl_verdict *verdict) {
+    *verdict = RUNCTL_KEEP;
+    for (int attempt = 0; attempt < RUNCTL_MAX_ATTEMPTS; attempt++) {
+        int ret;
+
+        runctl_settle(rc, pause_ms);
+        runctl_round_begin(rc);
+        ret = round(arg);
+        if (ret)
+            return ret;
+        *verdict = runctl_round_end(rc);
+        if (*verdict != RUNCTL_DISCARD)
+            break;
+        if (discard)
+            discard(arg);
+    }
+    return 0;
+}
+
+void runctl_reset(struct runctl *rc) {
+    rc->rounds = rc->throttled = rc->discarded = 0;
+    rc->max_mc = INT_MIN;
+    rc->cool_wait_ns = 0;
+    for (int i = 0; i < rc->nr_domains; i++)
+        memset(rc->domains[i].residency, 0, sizeof(rc->domains[i].residency));
+}
+
+static unsigned long long residency_total(const struct runctl_domain *d) {
+    unsigned long long total = 0;
+
+    for (int f = 0; f < d->nr_freqs; f++)
+        total += d->residency[f];
+    return total;
+}
+
+/* Frequency slots by descending frequency */
+static int sorted_freqs(const struct runctl_domain *d, int *order) {
+    for (int f = 0; f < d->nr_freqs; f++) {
+        int j = f;
+
+        while (j > 0 && d->khz[order[j - 1]] < d->khz[f]) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = f;
+    }
+    return d->nr_freqs;
+}
+
+void runctl_print(const struct runctl *rc, FILE *f) {
+    if (!runctl_active(rc))
+        return;
+
+    fprintf(f, "Run control: %d rounds, %d throttled", rc->rounds, rc->throttled);
+    if (rc->discarded)
+        fprintf(f, " (%d discarded)", rc->discarded);
+    if (rc->max_mc != INT_MIN)
+        fprintf(f, ", hottest %.1f C", rc->max_mc / 1000.0);
+    if (rc->cool_wait_ns)
+        fprintf(f, ", %.1f s cooling down", rc->cool_wait_ns / 1e9);
+    fputc('\n', f);
+
+    for (int i = 0; i < rc->nr_domains; i++) {
+        const struct runctl_domain *d = &rc->domains[i];
+        unsigned long long total = residency_total(d);
+        int order[RUNCTL_MAX_FREQS], n = sorted_freqs(d, order);
+
+        if (!total)
+            continue;
+        fprintf(f, "  cpu%d policy%s:", d->cpu, d->stats ? "" : " (sampled)");
+        for (int k = 0; k < n; k++) {
+            int s = order[k];
+
+            if (d->residency[s])
+                fprintf(f, " %ld MHz %.1f%%", d->khz[s] / 1000,
+                        100.0 * d->residency[s] / total);
+        }
+        fputc('\n', f);
+    }
+}
+
+void runctl_out(const struct runctl *rc, struct bench_out *o, const char *prefix) {
+    char name[96];
+
+    if (!runctl_active(rc))
+        return;
+
+    snprintf(name, sizeof(name), "%srunctl.rounds", prefix);
+    bench_out_value(o, name, "rounds", rc->rounds);
+    snprintf(name, sizeof(name), "%srunctl.throttled", prefix);
+    bench_out_value(o, name, "rounds", rc->throttled);
+    snprintf(name, sizeof(name), "%srunctl.discarded", prefix);
+    bench_out_value(o, name, "rounds", rc->discarded);
+    if (rc->max_mc != INT_MIN) {
+        snprintf(name, sizeof(name), "%srunctl.max_temp", prefix);
+        bench_out_value(o, name, "C", rc->max_mc / 1000.0);
+    }
+
+    for (int i = 0; i < rc->nr_domains; i++) {
+        const struct runctl_domain *d = &rc->domains[i];
+        unsigned long long total = residency_total(d);
+        int order[RUNCTL_MAX_FREQS], n = sorted_freqs(d, order);
+
+        for (int k = 0; k < n && total; k++) {
+            int s = order[k];
+
+            snprintf(name, sizeof(name), "%sresidency.cpu%d.%ld", prefix, d->cpu,
+                     d->khz[s] / 1000);
+            bench_out_value(o, name, "%", 100.0 * d->residency[s] / total);
+        }
+    }
+}
@@ -0,0 +1,127 @@
+/*
+ * runctl.h
+ *
+ * Thermal- and frequency-aware run control. Phones heat up over
+ * consecutive runs and the thermal framework caps CPU frequencies, so a
+ * benchmark that repeats rounds brackets each one with the controller:
+ *
+ *   runctl_settle(&rc, 125);       // cool down (or pause 125 ms)
+ *   runctl_round_begin(&rc);
+ *   ... measure ...
+ *   if (runctl_round_end(&rc) == RUNCTL_DISCARD) ... drop the round
+ *
+ * runctl_run() does all of that, and the reruns of discarded rounds,
+ * around a round callback.
+ *
+ * A round is throttled when a cpufreq policy's min or max limit differs
+ * from what it was when the controller started, or changed during the
+ * round. Frequency residency comes from cpufreq stats (time_in_state)
+ * where the kernel has them, otherwise from scaling_cur_freq sampled at
+ * round boundaries.
+ *
+ * Environment:
+ *   BENCH_COOL          wait before each round until every CPU thermal
+ *                       zone is below this many degrees C
+ *   BENCH_COOL_TIMEOUT  give up waiting after this many seconds (60)
+ *   BENCH_THROTTLED     "tag" (default) or "discard" throttled rounds
+ *   RUNCTL_THERMAL      thermal class directory (/sys/class/thermal);
+ *                       cpufreq is read from TOPO_SYSFS like topo.h
+ */
+
+#ifndef RUNCTL_H
+#define RUNCTL_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "bench.h"
+
+#define RUNCTL_THERMAL "/sys/class/thermal"
+#define RUNCTL_MAX_ZONES 32
+#define RUNCTL_MAX_DOMAINS 16
+#define RUNCTL_MAX_FREQS 64
+
+/* One cpufreq policy */
+struct runctl_domain {
+    int cpu;                        /* CPU whose policy files are read */
+    long base_min_khz, base_max_khz;    /* limits when the controller started */
+    long round_min_khz, round_max_khz;  /* limits at the start of this round */
+    bool stats;                     /* cpufreq stats/time_in_state available */
+    int nr_freqs;
+    long khz[RUNCTL_MAX_FREQS];
+    unsigned long long start[RUNCTL_MAX_FREQS];     /* time_in_state at round start */
+    unsigned long long residency[RUNCTL_MAX_FREQS]; /* kept rounds: 10 ms units or samples */
+    long sample_khz;                /* scaling_cur_freq at round start, without stats */
+};
+
+enum runctl_verdict {
+    RUNCTL_KEEP,
+    RUNCTL_THROTTLED,               /* keep, but tagged */
+    RUNCTL_DISCARD,
+};
+
+struct runctl {
+    /* Settings, from the environment */
+    int cool_mc;                    /* cool-down threshold, 0 for a plain pause */
+    int cool_timeout_ms;
+    bool discard;
+
+    int nr_zones;
+    int zone_fd[RUNCTL_MAX_ZONES];
+    char zone_type[RUNCTL_MAX_ZONES][32];
+
+    int nr_domains;
+    struct runctl_domain domains[RUNCTL_MAX_DOMAINS];
+
+    /* Totals */
+    int rounds;
+    int throttled;                  /* tagged or discarded */
+    int discarded;
+    int max_mc;                     /* hottest reading at a round boundary */
+    long long cool_wait_ns;         /* time spent waiting to cool down */
+    bool round_throttled;
+};
+
+/* Find thermal zones and cpufreq policies; 0, or -1 with errno set */
+int runctl_init(struct runctl *rc);
+void runctl_close(struct runctl *rc);
+
+/* Anything to measure: a thermal zone or a cpufreq policy */
+static inline bool runctl_active(const struct runctl *rc) {
+    return rc->nr_zones || rc->nr_domains;
+}
+
+/* Hottest CPU thermal zone in millidegrees C, or INT_MIN without zones */
+int runctl_temp_mc(const struct runctl *rc);
+
+/*
+ * Before a round: wait until the zones are below BENCH_COOL, or sleep
+ * pause_ms when no threshold is set or there is nothing to read.
+ */
+void runctl_settle(struct runctl *rc, int pause_ms);
+
+void runctl_round_begin(struct runctl *rc);
+enum runctl_verdict runctl_round_end(struct runctl *rc);
+
+/* Attempts runctl_run() makes at one round before giving up on it */
+#define RUNCTL_MAX_ATTEMPTS 3
+
+/*
+ * One round under the controller: settle, then round(arg) between
+ * runctl_round_begin() and runctl_round_end(). A discarded round calls
+ * discard(arg), if set, to drop its data and report it, and runs again,
+ * up to RUNCTL_MAX_ATTEMPTS times. *verdict is that of the last attempt,
+ * RUNCTL_DISCARD if every one was discarded. Returns 0, or round()'s
+ * non-zero return, which stops at once.
+ */
+int runctl_run(struct runctl *rc, int pause_ms, int (*round)(void *arg),
+               void (*discard)(void *arg), void *arg, enum runctl_verdict *verdict);
+
+/* Forget totals and residency, keeping the baseline limits */
+void runctl_reset(struct runctl *rc);
+
+/* Rounds, throttling, temperature and residency per policy */
+void runctl_print(const struct runctl *rc, FILE *f);
+void runctl_out(const struct runctl *rc, struct bench_out *o, const char *prefix);
+
+#endif /* RUNCTL_H */
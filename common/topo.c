@@ -0,0 +1,401 @@
+/*
+ * topo.c
+ *
+ * CPU topology from sysfs, see topo.h.
+ */
+
+#define _GNU_SOURCE
+
+#include "topo.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* bionic's LP32 cpu_set_t only holds 32 CPUs */
+#define TOPO_LIMIT (TOPO_MAX_CPUS < CPU_SETSIZE ? TOPO_MAX_CPUS : CPU_SETSIZE)
+
+static const char *sysfs_root(void) {
+    const char *env = getenv("TOPO_SYSFS");
+    return env && *env ? env : TOPO_SYSFS;
+}
+
+/* First line of root/fmt..., without the newline; returns 0 or -1 */
+static int read_line(char *buf, size_t len, const char *fmt, ...) {
+    char rel[128], path[512];
+    va_list ap;
+    FILE *f;
+
+    va_start(ap, fmt);
+    vsnprintf(rel, sizeof(rel), fmt, ap);
+    va_end(ap);
+    snprintf(path, sizeof(path), "%s/%s", sysfs_root(), rel);
+
+    f = fopen(path, "re");
+    if (!f)
+        return -1;
+    if (!fgets(buf, len, f)) {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+static long read_long(long def, const char *fmt, int cpu) {
+    char buf[64];
+
+    if (read_line(buf, sizeof(buf), fmt, cpu))
+        return def;
+    return strtol(buf, NULL, 10);
+}
+
+static int read_cpulist(cpu_set_t *set, const char *fmt, int cpu, int index) {
+    char buf[1024];
+
+    if (read_line(buf, sizeof(buf), fmt, cpu, index))
+        return -1;
+    return topo_parse_cpulist(buf, set);
+}
+
+int topo_parse_cpulist(const char *s, cpu_set_t *out) {
+    CPU_ZERO(out);
+    while (*s) {
+        char *end;
+        long lo = strtol(s, &end, 10), hi = lo;
+
+        if (end == s || lo < 0)
+            return -1;
+        if (*end == '-') {
+            s = end + 1;
+            hi = strtol(s, &end, 10);
+            if (end == s || hi < lo)
+                return -1;
+        }
+        for (long c = lo; c <= hi && c < TOPO_LIMIT; c++)
+            CPU_SET(c, out);
+        s = end;
+        if (*s == ',')
+            s++;
+        else if (*s)
+            return -1;
+    }
+    return 0;
+}
+
+char *topo_format_cpulist(const cpu_set_t *set, char *buf, size_t len) {
+    size_t pos = 0;
+
+    buf[0] = '\0';
+    for (int c = 0; c < TOPO_LIMIT && pos < len; c++) {
+        if (!CPU_ISSET(c, set))
+            continue;
+        int last = c;
+        while (last + 1 < TOPO_LIMIT && CPU_ISSET(last + 1, set))
+            last++;
+        if (last == c)
+            pos += snprintf(buf + pos, len - pos, "%s%d", pos ? "," : "", c);
+        else
+            pos += snprintf(buf + pos, len - pos, "%s%d-%d", pos ? "," : "", c, last);
+        c = last;
+    }
+    return buf;
+}
+
+int topo_nth_cpu(const cpu_set_t *set, int n) {
+    for (int c = 0; c < TOPO_LIMIT; c++)
+        if (CPU_ISSET(c, set) && n-- == 0)
+            return c;
+    return -1;
+}
+
+static void group_finish(struct topo_group *g) {
+    g->count = CPU_COUNT(&g->cpus);
+    g->first = topo_nth_cpu(&g->cpus, 0);
+}
+
+static int cmp_int(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+static void load_clusters(struct topo *t) {
+    int caps[TOPO_MAX_CPUS], n = 0;
+
+    for (int c = 0; c < t->nr_cpus; c++)
+        if (t->cpu[c].online)
+            caps[n++] = t->cpu[c].capacity;
+    qsort(caps, n, sizeof(int), cmp_int);
+
+    for (int i = 0; i < n; i++) {
+        if (i && caps[i] == caps[i - 1])
+            continue;
+        struct topo_group *g = &t->clusters[t->nr_clusters];
+        g->capacity = caps[i];
+        for (int c = 0; c < t->nr_cpus; c++) {
+            if (!t->cpu[c].online || t->cpu[c].capacity != caps[i])
+                continue;
+            CPU_SET(c, &g->cpus);
+            t->cpu[c].cluster = t->nr_clusters;
+            if (t->cpu[c].max_khz > g->max_khz)
+                g->max_khz = t->cpu[c].max_khz;
+        }
+        group_finish(g);
+        t->nr_clusters++;
+    }
+}
+
+static void load_domains(struct topo *t) {
+    for (int c = 0; c < t->nr_cpus; c++) {
+        cpu_set_t related;
+        int d;
+
+        t->cpu[c].domain = -1;
+        if (!t->cpu[c].online || read_cpulist(&related, "cpu%d/cpufreq/related_cpus", c, 0))
+            continue;
+        for (d = 0; d < t->nr_domains; d++)
+            if (CPU_EQUAL(&related, &t->domains[d].cpus))
+                break;
+        if (d == t->nr_domains) {
+            t->domains[d].cpus = related;
+            group_finish(&t->domains[d]);
+            t->nr_domains++;
+        }
+        t->cpu[c].domain = d;
+        if (t->cpu[c].max_khz > t->domains[d].max_khz)
+            t->domains[d].max_khz = t->cpu[c].max_khz;
+    }
+}
+
+static void load_caches(struct topo *t) {
+    for (int c = 0; c < t->nr_cpus; c++) {
+        int llc_level = 0;
+
+        t->cpu[c].llc = -1;
+        if (!t->cpu[c].online)
+            continue;
+
+        for (int idx = 0; ; idx++) {
+            struct topo_cache k = { 0 };
+            char buf[64];
+            int i;
+
+            if (read_line(buf, sizeof(buf), "cpu%d/cache/index%d/level", c, idx))
+                break;
+            k.level = atoi(buf);
+            if (!read_line(buf, sizeof(buf), "cpu%d/cache/index%d/type", c, idx))
+                k.type = buf[0];
+            if (!read_line(buf, sizeof(buf), "cpu%d/cache/index%d/size", c, idx)) {
+                char *unit;
+                k.size_kb = strtol(buf, &unit, 10);
+                if (*unit == 'M')
+                    k.size_kb *= 1024;
+            }
+            if (read_cpulist(&k.cpus, "cpu%d/cache/index%d/shared_cpu_list", c, idx))
+                CPU_SET(c, &k.cpus);
+
+            for (i = 0; i < t->nr_caches; i++)
+                if (t->caches[i].level == k.level && t->caches[i].type == k.type &&
+                    CPU_EQUAL(&t->caches[i].cpus, &k.cpus))
+                    break;
+            if (i == t->nr_caches) {
+                if (t->nr_caches == TOPO_MAX_CACHES)
+                    continue;
+                k.count = CPU_COUNT(&k.cpus);
+                k.first = topo_nth_cpu(&k.cpus, 0);
+                t->caches[t->nr_caches++] = k;
+            }
+            if (k.level > llc_level && k.type != 'I') {
+                llc_level = k.level;
+                t->cpu[c].llc = i;
+            }
+        }
+    }
+}
+
+struct topo *topo_load(void) {
+    struct topo *t = calloc(1, sizeof(*t));
+    bool have_capacity = false;
+    long top_khz = 0;
+    char buf[1024];
+
+    if (!t)
+        return NULL;
+
+    if (read_line(buf, sizeof(buf), "online") || topo_parse_cpulist(buf, &t->online)) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        CPU_ZERO(&t->online);
+        for (long c = 0; c < n && c < TOPO_LIMIT; c++)
+            CPU_SET(c, &t->online);
+    }
+    t->nr_online = CPU_COUNT(&t->online);
+    if (!t->nr_online) {
+        free(t);
+        errno = ENODEV;
+        return NULL;
+    }
+
+    for (int c = 0; c < TOPO_LIMIT; c++) {
+        struct topo_cpu *cpu = &t->cpu[c];
+        cpu_set_t siblings;
+
+        if (!CPU_ISSET(c, &t->online))
+            continue;
+        t->nr_cpus = c + 1;
+        cpu->online = true;
+        cpu->max_khz = read_long(0, "cpu%d/cpufreq/cpuinfo_max_freq", c);
+        cpu->capacity = read_long(-1, "cpu%d/cpu_capacity", c);
+        cpu->package = read_long(0, "cpu%d/topology/physical_package_id", c);
+        have_capacity |= cpu->capacity >= 0;
+        if (cpu->max_khz > top_khz)
+            top_khz = cpu->max_khz;
+
+        /* core_cpus_list is the 5.x name of thread_siblings_list */
+        if (read_cpulist(&siblings, "cpu%d/topology/core_cpus_list", c, 0) &&
+            read_cpulist(&siblings, "cpu%d/topology/thread_siblings_list", c, 0)) {
+            CPU_ZERO(&siblings);
+            CPU_SET(c, &siblings);
+        }
+        cpu->core = topo_nth_cpu(&siblings, 0);
+        t->smt |= CPU_COUNT(&siblings) > 1;
+    }
+
+    for (int c = 0; c < t->nr_cpus; c++) {
+        struct topo_cpu *cpu = &t->cpu[c];
+
+        if (!cpu->online)
+            continue;
+        if (have_capacity)
+            cpu->capacity = cpu->capacity >= 0 ? cpu->capacity : TOPO_CAPACITY_SCALE;
+        else if (top_khz)
+            cpu->capacity = (int)(cpu->max_khz * TOPO_CAPACITY_SCALE / top_khz);
+        else
+            cpu->capacity = TOPO_CAPACITY_SCALE;
+    }
+
+    load_clusters(t);
+    load_domains(t);
+    load_caches(t);
+    return t;
+}
+
+void topo_free(struct topo *t) {
+    free(t);
+}
+
+const char *topo_cluster_name(const struct topo *t, int cluster) {
+    if (t->nr_clusters == 1)
+        return "all";
+    if (cluster == 0)
+        return "little";
+    if (cluster == t->nr_clusters - 1)
+        return t->nr_clusters == 2 ? "big" : "prime";
+    if (cluster == t->nr_clusters - 2)
+        return "big";
+    return "mid";
+}
+
+/* caches[] index of the n-th distinct last-level cache by first CPU, or -1 */
+static int nth_llc(const struct topo *t, int n) {
+    int seen[TOPO_MAX_CACHES];
+    int nr = 0;
+
+    for (int c = 0; c < t->nr_cpus; c++) {
+        int llc = t->cpu[c].llc, i;
+
+        if (llc < 0)
+            continue;
+        for (i = 0; i < nr && seen[i] != llc; i++)
+            ;
+        if (i < nr)
+            continue;
+        if (nr == n)
+            return llc;
+        seen[nr++] = llc;
+    }
+    return -1;
+}
+
+int topo_parse_spec(const struct topo *t, const char *spec, cpu_set_t *out) {
+    int idx;
+    char extra;
+
+    CPU_ZERO(out);
+    /* On a machine with one class, phone class names select all of it */
+    if (!strcmp(spec, "all") ||
+        (t->nr_clusters == 1 && (!strcmp(spec, "little") || !strcmp(spec, "mid") ||
+                                 !strcmp(spec, "big") || !strcmp(spec, "prime")))) {
+        *out = t->online;
+        return 0;
+    }
+
+    /* "mid" may name several clusters on SoCs with more than four */
+    for (int i = 0; i < t->nr_clusters; i++)
+        if (!strcmp(spec, topo_cluster_name(t, i)))
+            CPU_OR(out, out, &t->clusters[i].cpus);
+    if (CPU_COUNT(out))
+        return 0;
+
+    if (sscanf(spec, "cluster%d%c", &idx, &extra) == 1) {
+        if (idx < 0 || idx >= t->nr_clusters)
+            return -1;
+        *out = t->clusters[idx].cpus;
+        return 0;
+    }
+    if (sscanf(spec, "domain%d%c", &idx, &extra) == 1) {
+        if (idx < 0 || idx >= t->nr_domains)
+            return -1;
+        CPU_AND(out, &t->domains[idx].cpus, &t->online);
+        return CPU_COUNT(out) ? 0 : -1;
+    }
+    if (sscanf(spec, "llc%d%c", &idx, &extra) == 1) {
+        if (idx < 0 || (idx = nth_llc(t, idx)) < 0)
+            return -1;
+        CPU_AND(out, &t->caches[idx].cpus, &t->online);
+        return CPU_COUNT(out) ? 0 : -1;
+    }
+
+    if (topo_parse_cpulist(spec, out))
+        return -1;
+    CPU_AND(out, out, &t->online);
+    return CPU_COUNT(out) ? 0 : -1;
+}
+
+bool topo_share_cache(const struct topo *t, int a, int b, int level) {
+    for (int i = 0; i < t->nr_caches; i++)
+        if (t->caches[i].level <= level && CPU_ISSET(a, &t->caches[i].cpus) &&
+            CPU_ISSET(b, &t->caches[i].cpus))
+            return true;
+    return false;
+}
+
+void topo_print(const struct topo *t, FILE *f) {
+    char list[256];
+
+    fprintf(f, "CPU topology: %d online (%s), %s\n", t->nr_online,
+            topo_format_cpulist(&t->online, list, sizeof(list)),
+            t->smt ? "SMT" : "no SMT");
+    for (int i = 0; i < t->nr_clusters; i++) {
+        const struct topo_group *g = &t->clusters[i];
+        fprintf(f, "  cluster %-7s cpus %-10s capacity %4d", topo_cluster_name(t, i),
+                topo_format_cpulist(&g->cpus, list, sizeof(list)), g->capacity);
+        if (g->max_khz)
+            fprintf(f, "  max %ld MHz", g->max_khz / 1000);
+        fputc('\n', f);
+    }
+    for (int i = 0; i < t->nr_domains; i++)
+        fprintf(f, "  domain%-9d cpus %s\n", i,
+                topo_format_cpulist(&t->domains[i].cpus, list, sizeof(list)));
+    /* Private caches say nothing about placement */
+    for (int i = 0; i < t->nr_caches; i++) {
+        const struct topo_cache *k = &t->caches[i];
+        if (k->count > 1)
+            fprintf(f, "  L%d%c %6ldK    cpus %s\n", k->level, k->type ? k->type : '?',
+                    k->size_kb, topo_format_cpulist(&k->cpus, list, sizeof(list)));
+    }
+    for (int i = 0, k; (k = nth_llc(t, i)) >= 0; i++)
+        fprintf(f, "  llc%-12d cpus %s\n", i,
+                topo_format_cpulist(&t->caches[k].cpus, list, sizeof(list)));
+}
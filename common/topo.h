@@ -0,0 +1,108 @@
+/*
+ * topo.h
+ *
+ * CPU topology from /sys/devices/system/cpu: capacity classes (the
+ * LITTLE, big and prime clusters of a phone SoC), cpufreq frequency
+ * domains, cache-sharing groups and SMT siblings, for tools that place
+ * work on particular CPUs or sweep across them.
+ *
+ * Capacity comes from cpu_capacity where the kernel has it (arm64 with
+ * a capacity-dmips-mhz or EAS energy model), otherwise from
+ * cpuinfo_max_freq, otherwise every CPU counts as 1024. TOPO_SYSFS in
+ * the environment points topo_load() at a copy of that directory, so
+ * a phone's layout can be inspected or tested on another machine.
+ */
+
+#ifndef TOPO_H
+#define TOPO_H
+
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define TOPO_SYSFS "/sys/devices/system/cpu"
+#define TOPO_MAX_CPUS 256
+#define TOPO_MAX_CACHES 64
+#define TOPO_CAPACITY_SCALE 1024
+
+/* A set of CPUs with what they have in common */
+struct topo_group {
+    cpu_set_t cpus;
+    int first;              /* lowest CPU in the group */
+    int count;
+    int capacity;           /* clusters: capacity of every member */
+    long max_khz;           /* highest cpuinfo_max_freq among members */
+};
+
+struct topo_cache {
+    int level;
+    char type;              /* 'D'ata, 'I'nstruction or 'U'nified */
+    long size_kb;
+    cpu_set_t cpus;         /* CPUs sharing this instance */
+    int first;
+    int count;
+};
+
+struct topo_cpu {
+    bool online;
+    int capacity;           /* 0..TOPO_CAPACITY_SCALE */
+    long max_khz;           /* 0 without cpufreq */
+    int cluster;            /* index into clusters[], ascending capacity */
+    int domain;             /* index into domains[], -1 without cpufreq */
+    int llc;                /* index into caches[] of the last level, or -1 */
+    int core;               /* lowest CPU among its SMT siblings */
+    int package;
+};
+
+struct topo {
+    int nr_cpus;            /* highest CPU id + 1 */
+    int nr_online;
+    cpu_set_t online;
+    struct topo_cpu cpu[TOPO_MAX_CPUS];
+
+    /* CPUs of equal capacity, slowest first */
+    struct topo_group clusters[TOPO_MAX_CPUS];
+    int nr_clusters;
+
+    /* cpufreq policies: CPUs that always run at the same frequency */
+    struct topo_group domains[TOPO_MAX_CPUS];
+    int nr_domains;
+
+    struct topo_cache caches[TOPO_MAX_CACHES];
+    int nr_caches;
+
+    bool smt;               /* some core runs more than one CPU */
+};
+
+/* Read the topology of online CPUs; NULL with errno set on failure */
+struct topo *topo_load(void);
+void topo_free(struct topo *t);
+
+/* "little", "mid", "big" or "prime" by rank; "all" with a single class */
+const char *topo_cluster_name(const struct topo *t, int cluster);
+
+/*
+ * Resolve a CPU spec to online CPUs: "all", a cluster name (any of them
+ * selects everything when all CPUs are alike), "clusterN",
+ * "domainN", "llcN" (CPUs sharing the N-th last-level cache) or a
+ * cpulist such as "0-3,6". Returns 0, or -1 if the spec is invalid or
+ * selects no online CPU.
+ */
+int topo_parse_spec(const struct topo *t, const char *spec, cpu_set_t *out);
+
+/* Parse a kernel cpulist ("0-3,6"); returns 0, or -1 on syntax errors */
+int topo_parse_cpulist(const char *s, cpu_set_t *out);
+
+/* Format a CPU set as a cpulist */
+char *topo_format_cpulist(const cpu_set_t *set, char *buf, size_t len);
+
+/* CPU n of a set in ascending order, or -1 */
+int topo_nth_cpu(const cpu_set_t *set, int n);
+
+/* Both CPUs share a cache of this level or a closer one (level 2: L1 or L2) */
+bool topo_share_cache(const struct topo *t, int a, int b, int level);
+
+/* Clusters, domains, shared caches, LLC groups and SMT, one line each */
+void topo_print(const struct topo *t, FILE *f);
+
+#endif /* TOPO_H */
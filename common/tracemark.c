@@ -0,0 +1,160 @@
+/*
+ * tracemark.c
+ *
+ * ftrace phase markers, see tracemark.h.
+ */
+
+#define _GNU_SOURCE
+
+#include "tracemark.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Older kernels only have tracefs under debugfs */
+static const char *tracefs_roots[] = {
+    TRACEMARK_TRACEFS,
+    "/sys/kernel/debug/tracing",
+};
+
+/* The armed instance, restored on exit() and by the signal handler */
+static struct tracemark *armed;
+static bool exit_registered;
+
+static const int restore_signals[] = { SIGINT, SIGTERM, SIGHUP };
+
+static int open_in(const char *root, const char *name, int flags) {
+    char path[512];
+
+    snprintf(path, sizeof(path), "%s/%s", root, name);
+    return open(path, flags | O_CLOEXEC);
+}
+
+/* Only the process that opened it; forked workers exit with a copy */
+static void restore_armed(void) {
+    if (armed && armed->on_fd >= 0 && getpid() == armed->pid &&
+        pwrite(armed->on_fd, &armed->was_on, 1, 0) < 0) {
+        /* Nothing more to do on the way out */
+    }
+}
+
+/* Puts tracing_on back and dies of the signal as it would have */
+static void restore_and_raise(int sig) {
+    restore_armed();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+int tracemark_open(struct tracemark *tm, const char *tool, bool arm) {
+    const char *env = getenv("BENCH_TRACEFS");
+    const char *root = NULL;
+    int err = ENOENT;
+
+    *tm = (struct tracemark)TRACEMARK_INIT;
+    tm->tool = tool;
+    tm->pid = getpid();
+
+    if (env && *env) {
+        root = env;
+        tm->marker_fd = open_in(root, "trace_marker", O_WRONLY);
+        err = errno;
+    } else {
+        for (size_t i = 0; i < sizeof(tracefs_roots) / sizeof(tracefs_roots[0]); i++) {
+            root = tracefs_roots[i];
+            tm->marker_fd = open_in(root, "trace_marker", O_WRONLY);
+            if (tm->marker_fd >= 0)
+                break;
+            /* A permission error says more than the fallback's ENOENT */
+            if (errno != ENOENT || err == ENOENT)
+                err = errno;
+        }
+    }
+    if (tm->marker_fd < 0) {
+        errno = err;
+        return -1;
+    }
+    if (!arm)
+        return 0;
+
+    tm->on_fd = open_in(root, "tracing_on", O_RDWR);
+    if (tm->on_fd < 0 || pread(tm->on_fd, &tm->was_on, 1, 0) != 1 ||
+        pwrite(tm->on_fd, "0", 1, 0) != 1) {
+        err = errno;
+        tracemark_close(tm);
+        errno = err;
+        return -1;
+    }
+    if (tm->was_on != '1')
+        tm->was_on = '0';
+
+    armed = tm;
+    if (!exit_registered)
+        exit_registered = !atexit(restore_armed);
+    for (size_t i = 0; i < sizeof(restore_signals) / sizeof(restore_signals[0]); i++) {
+        struct sigaction old;
+
+        if (!sigaction(restore_signals[i], NULL, &old) && old.sa_handler == SIG_DFL)
+            signal(restore_signals[i], restore_and_raise);
+    }
+    return 0;
+}
+
+void tracemark_close(struct tracemark *tm) {
+    if (tm->on_fd >= 0) {
+        if (pwrite(tm->on_fd, &tm->was_on, 1, 0) != 1)
+            fprintf(stderr, "tracing_on: %s\n", strerror(errno));
+        close(tm->on_fd);
+    }
+    if (armed == tm)
+        armed = NULL;
+    if (tm->marker_fd >= 0)
+        close(tm->marker_fd);
+    tm->marker_fd = tm->on_fd = -1;
+}
+
+/* One write() per marker, so the kernel records it whole */
+static void mark(struct tracemark *tm, const char *buf, int len) {
+    if (len > 0 && write(tm->marker_fd, buf, (size_t)len) < 0) {
+        /* A full or disabled buffer only loses the marker */
+    }
+}
+
+void tracemark_begin(struct tracemark *tm, const char *fmt, ...) {
+    char buf[256];
+    va_list ap;
+    int len;
+
+    if (tm->marker_fd < 0)
+        return;
+    len = snprintf(buf, sizeof(buf), "B|%d|%s ", tm->pid, tm->tool);
+    va_start(ap, fmt);
+    len += vsnprintf(buf + len, sizeof(buf) - (size_t)len, fmt, ap);
+    va_end(ap);
+    if (len >= (int)sizeof(buf))
+        len = sizeof(buf) - 1;
+    mark(tm, buf, len);
+}
+
+void tracemark_end(struct tracemark *tm) {
+    char buf[32];
+
+    if (tm->marker_fd < 0)
+        return;
+    mark(tm, buf, snprintf(buf, sizeof(buf), "E|%d", tm->pid));
+}
+
+void tracemark_arm(struct tracemark *tm) {
+    if (tm->on_fd >= 0 && pwrite(tm->on_fd, "1", 1, 0) != 1)
+        fprintf(stderr, "tracing_on: %s\n", strerror(errno));
+}
+
+void tracemark_disarm(struct tracemark *tm) {
+    if (tm->on_fd >= 0 && pwrite(tm->on_fd, "0", 1, 0) != 1)
+        fprintf(stderr, "tracing_on: %s\n", strerror(errno));
+}
@@ -0,0 +1,61 @@
+/*
+ * tracemark.h
+ *
+ * ftrace markers around benchmark phases, so a Perfetto or ftrace
+ * capture taken during a run lines up with what the tool was doing.
+ * Phases are written to trace_marker in the atrace format ("B|pid|name"
+ * and "E|pid"), which Perfetto and systrace show as nested slices on
+ * the tool's main thread:
+ *
+ *   tracemark_begin(&tm, "round %d", n);
+ *   tracemark_begin(&tm, "setup"); ... tracemark_end(&tm);
+ *   tracemark_arm(&tm);
+ *   tracemark_begin(&tm, "measure"); ... tracemark_end(&tm);
+ *   tracemark_disarm(&tm);
+ *   tracemark_end(&tm);
+ *
+ * When opened with arm, tracing_on is switched off at open and only on
+ * between tracemark_arm() and tracemark_disarm(), so the trace holds
+ * just the measured windows; the old value is restored at close, on
+ * exit(), and on SIGINT, SIGTERM or SIGHUP unless the tool handles those
+ * itself.
+ *
+ * tracefs is /sys/kernel/tracing, or /sys/kernel/debug/tracing on older
+ * kernels; BENCH_TRACEFS in the environment overrides it.
+ */
+
+#ifndef TRACEMARK_H
+#define TRACEMARK_H
+
+#include <stdbool.h>
+
+#define TRACEMARK_TRACEFS "/sys/kernel/tracing"
+
+struct tracemark {
+    int marker_fd;          /* trace_marker, -1 when not marking */
+    int on_fd;              /* tracing_on, -1 unless arming */
+    char was_on;            /* tracing_on before open, '0' or '1' */
+    int pid;
+    const char *tool;       /* prefix of every slice name */
+};
+
+#define TRACEMARK_INIT { .marker_fd = -1, .on_fd = -1 }
+
+/* Open trace_marker (and tracing_on with arm); 0, or -1 with errno set */
+int tracemark_open(struct tracemark *tm, const char *tool, bool arm);
+void tracemark_close(struct tracemark *tm);
+
+static inline bool tracemark_active(const struct tracemark *tm) {
+    return tm->marker_fd >= 0;
+}
+
+/* Start a slice named "tool name"; slices nest and end innermost first */
+void tracemark_begin(struct tracemark *tm, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+void tracemark_end(struct tracemark *tm);
+
+/* Turn tracing_on on and off around the measured window (arm only) */
+void tracemark_arm(struct tracemark *tm);
+void tracemark_disarm(struct tracemark *tm);
+
+#endif /* TRACEMARK_H */
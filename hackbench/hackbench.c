@@ -29,6 +29,12 @@
 #include <stdbool.h>
 #include <time.h>
 
+#include "../common/bench.h"
+#include "../common/perfctr.h"
+#include "../common/runctl.h"
+#include "../common/topo.h"
+#include "../common/tracemark.h"
+
 /* Defaults */
 static unsigned int datasize = 100;
 static unsigned int loops = 100;
@@ -37,6 +43,15 @@ static unsigned int num_fds = 20;
 static bool use_fifo = false;
 static bool use_pipes = false;
 static bool process_mode = true;
+static enum bench_format format = BENCH_FMT_TEXT;
+static const char *cpu_spec = NULL;
+static bool sweep = false;
+static struct runctl rc;
+static bool counters = false;
+static struct perfctr pc;
+static bool trace = false, trace_arm = false;
+static struct tracemark tm = TRACEMARK_INIT;
+static int round_nr = 0;
 
 struct sender_context {
     unsigned int num_fds;
@@ -60,7 +75,7 @@ typedef union {
 static childinfo_t *child_tab = NULL;
 static unsigned int total_children = 0;
 static volatile sig_atomic_t signal_caught = 0;
-static jmp_buf jmpbuf;
+static sigjmp_buf jmpbuf;
 
 /* Helper to handle fatal errors */
 static void panic(const char *msg) {
@@ -81,7 +96,20 @@ static void print_usage(void) {
            "  -T, --threads    Use threads (default: processes)\n"
            "  -P, --process    Use processes (default)\n"
            "  -F, --fifo       Use SCHED_FIFO (realtime)\n"
-           "  -h, --help       Show this help\n");
+           "  -o, --format     Output: text, csv or json (default: text)\n"
+           "  -c, --cpus       Run every task on these CPUs: a cpulist, little,\n"
+           "                   big, prime, clusterN, domainN or llcN\n"
+           "  -S, --sweep      Run once per CPU cluster, then on all CPUs\n"
+           "  -e, --counters   Count cycles, instructions, misses, context switches,\n"
+           "                   migrations and page faults per message, over every\n"
+           "                   task (each worker inherits the counters)\n"
+           "  -t, --trace      Mark setup, measure and round boundaries in\n"
+           "                   trace_marker for ftrace and Perfetto captures\n"
+           "  -A, --trace-arm  As -t, and keep tracing_on only while measuring\n"
+           "  -h, --help       Show this help\n"
+           "\n"
+           "BENCH_COOL=<degrees C> waits for the CPUs to cool down before each run,\n"
+           "BENCH_THROTTLED=discard reruns throttled runs.\n");
     exit(1);
 }
 
@@ -248,20 +276,203 @@ static void sigcatcher(int sig) {
     signal_caught = 1;
     fprintf(stderr, "Signal %d caught, exiting...\n", sig);
     signal(sig, SIG_IGN);
-    longjmp(jmpbuf, 1);
+    siglongjmp(jmpbuf, 1);
 }
 
-static void get_mono_time(struct timespec *ts) {
-    if (clock_gettime(CLOCK_MONOTONIC, ts) == -1) panic("clock_gettime");
+/*
+ * One run of every group; returns the time in seconds, or -1 if interrupted.
+ * sigcatcher jumps back into this frame, so it is only installed while the
+ * frame exists; SIGINT and SIGTERM keep their old disposition elsewhere.
+ */
+static double run_once(void) {
+    static const struct sigaction catcher = { .sa_handler = sigcatcher };
+    static struct sigaction old_int, old_term;    /* read after the jump */
+    static bool in_slice;                         /* setup or measure is open */
+    unsigned int i;
+    uint64_t start = 0, stop;
+    int readyfds[2], wakefds[2];
+    char dummy;
+
+    tracemark_begin(&tm, "setup");
+    in_slice = true;
+    child_tab = calloc(num_fds * 2 * num_groups, sizeof(childinfo_t));
+    if (!child_tab) panic("main:malloc()");
+
+    /* Worker processes exit through exit(), which would flush our buffers again */
+    fflush(NULL);
+
+    fdpair(readyfds);
+    fdpair(wakefds);
+
+    if (sigsetjmp(jmpbuf, 1) == 0) {
+        sigaction(SIGINT, &catcher, &old_int);
+        sigaction(SIGTERM, &catcher, &old_term);
+
+        total_children = 0;
+        for (i = 0; i < num_groups; i++) {
+            int c = group(child_tab, total_children, num_fds, readyfds[1], wakefds[0]);
+            total_children += c;
+        }
+
+        if (use_fifo && bench_set_fifo(1) < 0)
+            panic("can't change to fifo in main");
+
+        /* Wait for workers to allow setup to settle */
+        for (i = 0; i < total_children; i++) {
+            if (read(readyfds[0], &dummy, 1) != 1)
+                panic("Reading for readyfds");
+        }
+
+        tracemark_end(&tm);
+        in_slice = false;
+        tracemark_arm(&tm);
+        tracemark_begin(&tm, "measure");
+        in_slice = true;
+        if (counters) perfctr_begin(&pc);
+        start = bench_ticks();
+
+        /* Kick start */
+        if (write(wakefds[1], &dummy, 1) != 1)
+            panic("Writing to start senders");
+    } else {
+        if (in_slice)
+            tracemark_end(&tm);
+        tracemark_disarm(&tm);
+        reap_workers(child_tab, total_children, 1);
+        free(child_tab);
+        sigaction(SIGINT, &old_int, NULL);
+        sigaction(SIGTERM, &old_term, NULL);
+        return -1;
+    }
+
+    reap_workers(child_tab, total_children, 0);
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+
+    stop = bench_ticks();
+    if (counters) perfctr_end(&pc);
+    tracemark_end(&tm);
+    tracemark_disarm(&tm);
+
+    free(child_tab);
+    child_tab = NULL;
+    for (i = 0; i < 2; i++) {
+        close(readyfds[i]);
+        close(wakefds[i]);
+    }
+    return bench_ticks_to_ns(stop - start) / 1e9;
+}
+
+static int once_round(void *arg) {
+    double *diff_sec = arg;
+
+    tracemark_begin(&tm, "round %d", ++round_nr);
+    *diff_sec = run_once();
+    tracemark_end(&tm);
+    return *diff_sec < 0 ? -1 : 0;
+}
+
+static void once_discard(void *arg) {
+    (void)arg;
+    if (counters) perfctr_discard(&pc);
+    fprintf(stderr, "Throttled, running again\n");
+}
+
+/* run_once() as a round of the run controller; -1 if interrupted */
+static double run_controlled(bool *throttled) {
+    double diff_sec = -1;
+    enum runctl_verdict verdict = RUNCTL_KEEP;
+
+    if (counters) perfctr_reset(&pc);
+    runctl_run(&rc, 0, once_round, once_discard, &diff_sec, &verdict);
+    *throttled = verdict != RUNCTL_KEEP;
+    return diff_sec;
+}
+
+static void report(struct bench_out *out, const char *prefix, double diff_sec, bool throttled) {
+    char name[64];
+    double messages = (double)num_groups * num_fds * num_fds * loops;
+    const char *mode = process_mode ? "process" : "threads";
+
+    if (format == BENCH_FMT_TEXT) {
+        printf("Time: %.3f s%s\n", diff_sec, throttled ? " (throttled)" : "");
+        if (counters) perfctr_print(&pc.total, stdout, messages, "message", "");
+        return;
+    }
+    snprintf(name, sizeof(name), "%s%s.time", prefix, mode);
+    bench_out_value(out, name, "s", diff_sec);
+    snprintf(name, sizeof(name), "%s%s.messages", prefix, mode);
+    bench_out_value(out, name, "msg/s", messages / diff_sec);
+    if (throttled) {
+        snprintf(name, sizeof(name), "%s%s.throttled", prefix, mode);
+        bench_out_value(out, name, "runs", 1);
+    }
+    if (counters) {
+        snprintf(name, sizeof(name), "%s%s.", prefix, mode);
+        perfctr_out(&pc.total, out, name, messages, "msg");
+    }
+}
+
+/*
+ * Workers inherit the affinity of main, so restricting main before the
+ * groups are created places the whole run.
+ */
+static int restrict_cpus(const cpu_set_t *set) {
+    if (sched_setaffinity(0, sizeof(*set), set)) {
+        perror("sched_setaffinity");
+        return -1;
+    }
+    return 0;
+}
+
+static int run_sweep(struct bench_out *out) {
+    struct topo *t = topo_load();
+    cpu_set_t orig;
+    char cpus[256], prefix[32];
+    double diff_sec;
+    bool throttled;
+
+    if (!t) {
+        perror("topo_load");
+        return 1;
+    }
+    if (sched_getaffinity(0, sizeof(orig), &orig)) panic("sched_getaffinity");
+
+    /* Every cluster on its own, then the whole machine (index nr_clusters) */
+    for (int c = 0; c <= t->nr_clusters; c++) {
+        const cpu_set_t *set = c < t->nr_clusters ? &t->clusters[c].cpus : &t->online;
+        const char *name = c < t->nr_clusters ? topo_cluster_name(t, c) : "all";
+
+        if (c == t->nr_clusters && t->nr_clusters == 1)
+            break;      /* "all" was the only cluster */
+        if (format == BENCH_FMT_TEXT)
+            printf("Cluster %s (cpus %s): ", name, topo_format_cpulist(set, cpus, sizeof(cpus)));
+        fflush(NULL);
+        if (restrict_cpus(set)) {
+            if (format == BENCH_FMT_TEXT) printf("skipped\n");
+            continue;
+        }
+        tracemark_begin(&tm, "cluster %s", name);
+        diff_sec = run_controlled(&throttled);
+        tracemark_end(&tm);
+        sched_setaffinity(0, sizeof(orig), &orig);
+        if (diff_sec < 0) {
+            topo_free(t);
+            return 1;
+        }
+        snprintf(prefix, sizeof(prefix), "%s.", name);
+        report(out, prefix, diff_sec, throttled);
+    }
+
+    topo_free(t);
+    return 0;
 }
 
 int main(int argc, char *argv[]) {
-    unsigned int i;
-    struct timespec start, stop;
+    struct bench_out out;
     double diff_sec;
-    int readyfds[2], wakefds[2];
-    char dummy;
-    struct sched_param sp;
+    bool throttled;
+    int ret = 0;
 
     while (1) {
         int optind = 0;
@@ -274,11 +485,17 @@ int main(int argc, char *argv[]) {
             {"threads", no_argument, NULL, 'T'},
             {"processes", no_argument, NULL, 'P'},
             {"fifo", no_argument, NULL, 'F'},
+            {"format", required_argument, NULL, 'o'},
+            {"cpus", required_argument, NULL, 'c'},
+            {"sweep", no_argument, NULL, 'S'},
+            {"counters", no_argument, NULL, 'e'},
+            {"trace", no_argument, NULL, 't'},
+            {"trace-arm", no_argument, NULL, 'A'},
             {"help", no_argument, NULL, 'h'},
             {NULL, 0, NULL, 0}
         };
 
-        int c = getopt_long(argc, argv, "ps:l:g:f:TPFh", longopts, &optind);
+        int c = getopt_long(argc, argv, "ps:l:g:f:TPFo:c:SetAh", longopts, &optind);
         if (c == -1) break;
 
         switch (c) {
@@ -290,66 +507,78 @@ int main(int argc, char *argv[]) {
             case 'T': process_mode = false; break;
             case 'P': process_mode = true; break;
             case 'F': use_fifo = true; break;
+            case 'o':
+                if (bench_format_parse(optarg, &format)) print_usage();
+                break;
+            case 'c': cpu_spec = optarg; break;
+            case 'S': sweep = true; break;
+            case 'e': counters = true; break;
+            case 't': trace = true; break;
+            case 'A': trace = trace_arm = true; break;
             case 'h': print_usage(); break;
             default: exit(1);
         }
     }
 
-    printf("Running in %s mode with %d groups using %d file descriptors each (== %d tasks)\n",
+    if (cpu_spec) {
+        struct topo *t = topo_load();
+        cpu_set_t set;
+
+        if (!t || topo_parse_spec(t, cpu_spec, &set)) {
+            fprintf(stderr, "No online CPU in --cpus %s\n", cpu_spec);
+            return 1;
+        }
+        topo_free(t);
+        if (restrict_cpus(&set)) return 1;
+    }
+
+    /* Progress lines would break CSV and JSON, send them to stderr there */
+    FILE *info = format == BENCH_FMT_TEXT ? stdout : stderr;
+
+    fprintf(info, "Running in %s mode with %d groups using %d file descriptors each (== %d tasks)\n",
            process_mode ? "process" : "threaded",
            num_groups, 2 * num_fds, num_groups * (num_fds * 2));
-    printf("Each sender will pass %d messages of %d bytes\n", loops, datasize);
+    fprintf(info, "Each sender will pass %d messages of %d bytes\n", loops, datasize);
     fflush(NULL);
+    if (runctl_init(&rc)) {
+        fprintf(stderr, "BENCH_THROTTLED must be tag or discard\n");
+        return 1;
+    }
+    /* Before any worker exists, so that every one of them inherits the counters */
+    if (counters && perfctr_open(&pc, PERFCTR_INHERIT) < 0) {
+        fprintf(stderr, "No perf counters: %s\n", strerror(errno));
+        counters = false;
+    }
+    if (trace && tracemark_open(&tm, "hackbench", trace_arm) < 0) {
+        fprintf(stderr, "Can't write trace markers: %s\n", strerror(errno));
+        return 1;
+    }
+    bench_clock_init();
 
-    child_tab = calloc(num_fds * 2 * num_groups, sizeof(childinfo_t));
-    if (!child_tab) panic("main:malloc()");
-
-    fdpair(readyfds);
-    fdpair(wakefds);
-
-    signal(SIGINT, sigcatcher);
-    signal(SIGTERM, sigcatcher);
     signal(SIGHUP, SIG_IGN);
 
-    if (setjmp(jmpbuf) == 0) {
-        total_children = 0;
-        for (i = 0; i < num_groups; i++) {
-            int c = group(child_tab, total_children, num_fds, readyfds[1], wakefds[0]);
-            total_children += c;
-        }
+    if (format != BENCH_FMT_TEXT)
+        bench_out_begin(&out, stdout, format, "hackbench");
 
-        if (use_fifo) {
-            sp.sched_priority = 1;
-            if (sched_setscheduler(0, SCHED_FIFO, &sp) < 0)
-                panic("can't change to fifo in main");
-        }
-
-        /* Wait for workers to allow setup to settle */
-        for (i = 0; i < total_children; i++) {
-            if (read(readyfds[0], &dummy, 1) != 1)
-                panic("Reading for readyfds");
+    if (sweep) {
+        ret = run_sweep(&out);
+    } else {
+        diff_sec = run_controlled(&throttled);
+        if (diff_sec < 0) {
+            tracemark_close(&tm);
+            return 1;
         }
+        report(&out, "", diff_sec, throttled);
+    }
 
-        get_mono_time(&start);
-
-        /* Kick start */
-        if (write(wakefds[1], &dummy, 1) != 1)
-            panic("Writing to start senders");
+    if (format == BENCH_FMT_TEXT) {
+        runctl_print(&rc, stdout);
     } else {
-        reap_workers(child_tab, total_children, 1);
-        free(child_tab);
-        return 1;
+        runctl_out(&rc, &out, "");
+        bench_out_end(&out);
     }
-
-    reap_workers(child_tab, total_children, 0);
-
-    get_mono_time(&stop);
-
-    diff_sec = (stop.tv_sec - start.tv_sec) + 
-               (double)(stop.tv_nsec - start.tv_nsec) / 1e9;
-
-    printf("Time: %.3f s\n", diff_sec);
-
-    free(child_tab);
-    return 0;
+    if (counters) perfctr_close(&pc);
+    tracemark_close(&tm);
+    runctl_close(&rc);
+    return ret;
 }
@@ -0,0 +1,244 @@
+/*
+ * isolate.c
+ *
+ * bench-isolate: run one benchmark on CPUs reserved for it. The CPUs
+ * get a cpuset of their own, every other cpuset and thread that can be
+ * moved is moved off them, and optionally their deeper idle states are
+ * disabled (see common/isolate.h); all of it is put back when the
+ * benchmark exits.
+ *
+ *   bench-isolate -c big -- hackbench -g 4
+ *   bench-isolate -R        undo a run that was killed before restoring
+ *
+ * SIGINT, SIGTERM, SIGHUP and SIGQUIT are passed on to the benchmark
+ * and take effect on bench-isolate only once everything is restored.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../common/isolate.h"
+#include "../common/topo.h"
+
+#define EXIT_ERROR 125
+
+static const int forwarded[] = { SIGINT, SIGTERM, SIGHUP, SIGQUIT };
+
+static volatile pid_t child;
+static volatile sig_atomic_t caught;
+
+static void forward(int sig) {
+    caught = sig;
+    if (child > 0)
+        kill(child, sig);
+}
+
+static void set_forwarded(sigset_t *set) {
+    sigemptyset(set);
+    for (size_t i = 0; i < sizeof(forwarded) / sizeof(forwarded[0]); i++)
+        sigaddset(set, forwarded[i]);
+}
+
+/* The benchmark: next to this binary unless it has a path, else from PATH */
+static void exec_tool(char **argv) {
+    char path[PATH_MAX + 64], self[PATH_MAX];
+    ssize_t n;
+
+    if (!strchr(argv[0], '/') && (n = readlink("/proc/self/exe", self, sizeof(self) - 1)) > 0) {
+        self[n] = '\0';
+        *strrchr(self, '/') = '\0';
+        snprintf(path, sizeof(path), "%s/%s", self, argv[0]);
+        execv(path, argv);
+    }
+    execvp(argv[0], argv);
+    fprintf(stderr, "exec %s: %s\n", argv[0], strerror(errno));
+    _exit(127);
+}
+
+/*
+ * Fastest cluster, as long as something else is left to run the rest of
+ * the system; otherwise the last online CPU.
+ */
+static int default_cpus(const struct topo *t, cpu_set_t *set) {
+    const struct topo_group *fast = &t->clusters[t->nr_clusters - 1];
+
+    if (t->nr_online < 2)
+        return -1;
+    if (t->nr_clusters > 1) {
+        *set = fast->cpus;
+        return 0;
+    }
+    CPU_ZERO(set);
+    CPU_SET(topo_nth_cpu(&t->online, t->nr_online - 1), set);
+    return 0;
+}
+
+static char *short_options = "+hc:iRq";
+static struct option long_options[] = {
+        {"help", no_argument, 0, 'h'},
+        {"cpus", required_argument, 0, 'c'},
+        {"idle", no_argument, 0, 'i'},
+        {"restore", no_argument, 0, 'R'},
+        {"quiet", no_argument, 0, 'q'},
+        {0, 0, 0, 0}
+};
+
+static void print_help(char *prog_name) {
+    printf("Usage: %s [options] [--] command [args...]\n"
+           "       %s -R\n"
+           "\n"
+           "Run a benchmark on CPUs that nothing else may use meanwhile\n"
+           "\n"
+           "Options:\n"
+           "  -h, --help\t\tshow usage help\n"
+           "  -c, --cpus\t\tCPUs to reserve: a cpulist, little, big, prime,\n"
+           "            \t\tclusterN, domainN or llcN (default: the fastest\n"
+           "            \t\tcluster, or the last CPU when all are alike)\n"
+           "  -i, --idle\t\talso disable their cpuidle states past the first\n"
+           "  -R, --restore\t\tundo a run that was killed before it restored\n"
+           "  -q, --quiet\t\tdon't describe the isolation on stderr\n"
+           "\n"
+           "Needs root for anything but pinning the benchmark. The journal of\n"
+           "changes is BENCH_ISOLATE_STATE (default %s).\n"
+           "Exit status: the benchmark's, or 125 if isolation failed.\n",
+           prog_name, prog_name, isolate_journal_path());
+
+    exit(EXIT_ERROR);
+}
+
+int main(int argc, char **argv) {
+    const char *spec = NULL;
+    unsigned int flags = 0;
+    bool restore = false, quiet = false;
+    struct isolate iso;
+    struct topo *t;
+    cpu_set_t cpus;
+    sigset_t held, old;
+    int status = 0;
+
+    while (1) {
+        int c = getopt_long(argc, argv, short_options, long_options, NULL);
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case 'c':
+                spec = optarg;
+                break;
+            case 'i':
+                flags |= ISOLATE_IDLE;
+                break;
+            case 'R':
+                restore = true;
+                break;
+            case 'q':
+                quiet = true;
+                break;
+            case '?':
+            case 'h':
+            default:
+                print_help(argv[0]);
+                break;
+        }
+    }
+
+    if (restore) {
+        int failed = isolate_restore(isolate_journal_path());
+
+        if (failed < 0 && errno == ENOENT) {
+            fprintf(stderr, "%s: nothing to restore\n", argv[0]);
+            return 0;
+        }
+        if (failed < 0) {
+            fprintf(stderr, "%s: %s: %s\n", argv[0], isolate_journal_path(), strerror(errno));
+            return EXIT_ERROR;
+        }
+        if (failed)
+            fprintf(stderr, "%s: %d changes could not be undone\n", argv[0], failed);
+        return failed ? EXIT_ERROR : 0;
+    }
+    if (optind >= argc)
+        print_help(argv[0]);
+
+    t = topo_load();
+    if (!t) {
+        perror("topo_load");
+        return EXIT_ERROR;
+    }
+    if (spec && topo_parse_spec(t, spec, &cpus)) {
+        fprintf(stderr, "%s: no online CPU in '%s'\n", argv[0], spec);
+        return EXIT_ERROR;
+    }
+    if (!spec && default_cpus(t, &cpus)) {
+        fprintf(stderr, "%s: needs two online CPUs, one to reserve\n", argv[0]);
+        return EXIT_ERROR;
+    }
+    topo_free(t);
+
+    /* Held until the benchmark runs, and again while restoring */
+    set_forwarded(&held);
+    sigprocmask(SIG_BLOCK, &held, &old);
+
+    if (isolate_begin(&iso, &cpus, flags)) {
+        if (errno == EEXIST)
+            fprintf(stderr, "%s: %s exists: a run was not restored, undo it with %s -R\n",
+                    argv[0], isolate_journal_path(), argv[0]);
+        else if (errno == EINVAL)
+            fprintf(stderr, "%s: can't reserve offline CPUs, or all of them\n", argv[0]);
+        else
+            fprintf(stderr, "%s: %s: %s\n", argv[0], isolate_journal_path(), strerror(errno));
+        return EXIT_ERROR;
+    }
+    if (!quiet)
+        isolate_print(&iso, stderr);
+    fflush(NULL);
+
+    child = fork();
+    if (child < 0) {
+        perror("fork");
+        isolate_end(&iso);
+        return EXIT_ERROR;
+    }
+    if (!child) {
+        if (isolate_enter(&iso, 0))
+            fprintf(stderr, "%s: sched_setaffinity: %s\n", argv[0], strerror(errno));
+        sigprocmask(SIG_SETMASK, &old, NULL);
+        exec_tool(argv + optind);
+    }
+
+    for (size_t i = 0; i < sizeof(forwarded) / sizeof(forwarded[0]); i++)
+        signal(forwarded[i], forward);
+    sigprocmask(SIG_SETMASK, &old, NULL);
+
+    while (waitpid(child, &status, 0) < 0) {
+        if (errno != EINTR) {
+            perror("waitpid");
+            break;
+        }
+    }
+
+    sigprocmask(SIG_BLOCK, &held, NULL);
+    if (isolate_end(&iso))
+        fprintf(stderr, "%s: not everything was restored, retry with %s -R\n", argv[0], argv[0]);
+
+    /* Die of the benchmark's signal, or of the one that was passed on */
+    if (WIFSIGNALED(status) || caught) {
+        int sig = WIFSIGNALED(status) ? WTERMSIG(status) : caught;
+
+        signal(sig, SIG_DFL);
+        sigprocmask(SIG_SETMASK, &old, NULL);
+        raise(sig);
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_ERROR;
+}
@@ -0,0 +1,78 @@
+/*
+ * KernelSU driver interface shared by ksu_profile and its mock driver
+ *
+ * Authors: AzyrRuthless & j-hc
+ */
+
+#ifndef KSU_H
+#define KSU_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+/* KernelSU Constants */
+#define KSU_APP_PROFILE_VER 2
+#define KSU_MAX_PACKAGE_NAME 256
+#define KSU_MAX_GROUPS 32
+#define KSU_SELINUX_DOMAIN 64
+
+#define KSU_INSTALL_MAGIC1 0xDEADBEEF
+#define KSU_INSTALL_MAGIC2 0xCAFEBABE
+
+/* IOCTL Commands */
+#define KSU_IOCTL_MAGIC 'K'
+#define KSU_IOCTL_UID_SHOULD_UMOUNT _IOC(_IOC_READ | _IOC_WRITE, KSU_IOCTL_MAGIC, 9, 0)
+#define KSU_IOCTL_GET_MANAGER_APPID _IOC(_IOC_READ, KSU_IOCTL_MAGIC, 10, 0)
+#define KSU_IOCTL_GET_APP_PROFILE _IOC(_IOC_READ | _IOC_WRITE, KSU_IOCTL_MAGIC, 11, 0)
+#define KSU_IOCTL_SET_APP_PROFILE _IOC(_IOC_WRITE, KSU_IOCTL_MAGIC, 12, 0)
+
+/* Data Structures */
+struct root_profile {
+	int32_t uid;
+	int32_t gid;
+	int32_t groups_count;
+	int32_t groups[KSU_MAX_GROUPS];
+	struct {
+		uint64_t effective;
+		uint64_t permitted;
+		uint64_t inheritable;
+	} capabilities;
+	char selinux_domain[KSU_SELINUX_DOMAIN];
+	int32_t namespaces;
+	uint64_t flags; // Required for KernelSU v3+ driver structure compatibility
+};
+
+struct non_root_profile {
+	bool umount_modules;
+};
+
+struct app_profile {
+	uint32_t version;
+	char key[KSU_MAX_PACKAGE_NAME];
+	int32_t current_uid;
+	bool allow_su;
+	union {
+		struct {
+			bool use_default;
+			char template_name[KSU_MAX_PACKAGE_NAME];
+			struct root_profile profile;
+		} rp_config;
+		struct {
+			bool use_default;
+			struct non_root_profile profile;
+		} nrp_config;
+	};
+};
+
+/* IOCTL Command Structures */
+struct ksu_uid_should_umount_cmd {
+	uint32_t uid;
+	uint8_t should_umount;
+};
+
+struct ksu_get_manager_appid_cmd {
+	uint32_t appid;
+};
+
+#endif /* KSU_H */
@@ -0,0 +1,380 @@
+/*
+ * KernelSU mock driver
+ *
+ * An LD_PRELOAD shim that stands in for the KernelSU driver, so that
+ * ksu_profile can be tested and benchmarked on machines without it:
+ *
+ *   LD_PRELOAD=./libksu_mock.so ksu_profile --sync -P packages.list
+ *
+ * It intercepts the SYS_reboot magic used by ksu_get_driver_fd() and
+ * hands out a placeholder fd (/dev/null), answers the KSU_IOCTL_*
+ * commands on that fd from an in-memory profile table, and fakes the
+ * setuid()/setresuid() switch to the manager UID so no root is needed.
+ * Everything else is passed through to libc.
+ *
+ * Environment:
+ *   KSU_MOCK_MANAGER_APPID  manager app ID (default 10001)
+ *   KSU_MOCK_UMOUNT         umount modules for UIDs without a profile
+ *                           (default 1, as KernelSU does)
+ *   KSU_MOCK_SEED           UID or FIRST-LAST range to create default
+ *                           (use_default) profiles for at startup
+ *   KSU_MOCK_STATS          print per-command counts at exit if set
+ *   KSU_MOCK_PROFILE_VER    app profile version the driver speaks
+ *                           (default KSU_APP_PROFILE_VER)
+ *
+ * Authors: AzyrRuthless & j-hc
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "ksu.h"
+
+#define MOCK_MANAGER_APPID 10001
+#define MOCK_MAX_FDS 16
+#define MOCK_MIN_CAP 256
+#define PER_USER_RANGE 100000
+
+/* The ioctl prototype differs between libcs */
+#ifdef __BIONIC__
+typedef int ioctl_req_t;
+#else
+typedef unsigned long ioctl_req_t;
+#endif
+
+enum mock_cmd {
+	CMD_UID_SHOULD_UMOUNT,
+	CMD_GET_MANAGER_APPID,
+	CMD_GET_APP_PROFILE,
+	CMD_SET_APP_PROFILE,
+	CMD_COUNT,
+};
+
+static const char *mock_cmd_name[] = {
+	[CMD_UID_SHOULD_UMOUNT] = "UID_SHOULD_UMOUNT",
+	[CMD_GET_MANAGER_APPID] = "GET_MANAGER_APPID",
+	[CMD_GET_APP_PROFILE] = "GET_APP_PROFILE",
+	[CMD_SET_APP_PROFILE] = "SET_APP_PROFILE",
+};
+
+struct mock_slot {
+	bool used;
+	struct app_profile profile;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	bool ready;
+	int fds[MOCK_MAX_FDS];
+	uid_t uid;		/* what the driver sees as current_uid() */
+	uint32_t manager_appid;
+	uint32_t profile_ver;
+	bool default_umount;
+	bool stats;
+	unsigned long calls[CMD_COUNT];
+	unsigned long errors[CMD_COUNT];
+	struct mock_slot *slots;	/* open addressing, keyed by current_uid */
+	size_t cap, count;
+} mock = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static long (*real_syscall)(long, ...);
+static int (*real_ioctl)(int, ioctl_req_t, ...);
+static int (*real_close)(int);
+
+static void mock_print_stats(void)
+{
+	fprintf(stderr, "ksu_mock: %zu profiles\n", mock.count);
+	for (int i = 0; i < CMD_COUNT; i++)
+		fprintf(stderr, "ksu_mock: %-18s %8lu calls %8lu errors\n", mock_cmd_name[i],
+			mock.calls[i], mock.errors[i]);
+}
+
+static int mock_store(const struct app_profile *p);
+
+/* Default profiles for a UID range, as if the manager had created them */
+static void mock_seed(const char *spec)
+{
+	char *end;
+	long first = strtol(spec, &end, 10), last = first;
+
+	if (*end == '-')
+		last = strtol(end + 1, NULL, 10);
+	for (long uid = first; uid <= last && uid >= 0; uid++) {
+		struct app_profile p = { 0 };
+
+		p.version = mock.profile_ver;
+		p.current_uid = (int32_t)uid;
+		snprintf(p.key, sizeof(p.key), "mock.uid%ld", uid);
+		p.nrp_config.use_default = true;
+		if (mock_store(&p))
+			break;
+	}
+}
+
+static long env_long(const char *name, long def)
+{
+	const char *v = getenv(name);
+
+	return v && *v ? strtol(v, NULL, 0) : def;
+}
+
+/* Called with mock.lock held */
+static void mock_init(void)
+{
+	if (mock.ready)
+		return;
+
+	for (int i = 0; i < MOCK_MAX_FDS; i++)
+		mock.fds[i] = -1;
+	mock.uid = getuid();
+	mock.manager_appid = env_long("KSU_MOCK_MANAGER_APPID", MOCK_MANAGER_APPID);
+	mock.profile_ver = env_long("KSU_MOCK_PROFILE_VER", KSU_APP_PROFILE_VER);
+	mock.default_umount = env_long("KSU_MOCK_UMOUNT", 1);
+	mock.stats = getenv("KSU_MOCK_STATS") != NULL;
+	if (mock.stats)
+		atexit(mock_print_stats);
+	if (getenv("KSU_MOCK_SEED"))
+		mock_seed(getenv("KSU_MOCK_SEED"));
+	mock.ready = true;
+}
+
+static bool mock_is_fd(int fd)
+{
+	for (int i = 0; i < MOCK_MAX_FDS; i++)
+		if (mock.fds[i] == fd)
+			return fd >= 0;
+	return false;
+}
+
+static size_t mock_slot_of(int32_t uid)
+{
+	size_t i = ((uint32_t)uid * 0x9E3779B1u) & (mock.cap - 1);
+
+	while (mock.slots[i].used && mock.slots[i].profile.current_uid != uid)
+		i = (i + 1) & (mock.cap - 1);
+	return i;
+}
+
+static struct app_profile *mock_find(int32_t uid)
+{
+	if (!mock.cap)
+		return NULL;
+
+	size_t i = mock_slot_of(uid);
+	return mock.slots[i].used ? &mock.slots[i].profile : NULL;
+}
+
+static int mock_store(const struct app_profile *p)
+{
+	if ((mock.count + 1) * 2 > mock.cap) {
+		size_t old_cap = mock.cap;
+		struct mock_slot *old = mock.slots;
+		size_t cap = old_cap ? old_cap * 2 : MOCK_MIN_CAP;
+
+		mock.slots = calloc(cap, sizeof(*mock.slots));
+		if (!mock.slots) {
+			mock.slots = old;
+			return -ENOMEM;
+		}
+		mock.cap = cap;
+		for (size_t i = 0; i < old_cap; i++)
+			if (old[i].used)
+				mock.slots[mock_slot_of(old[i].profile.current_uid)] = old[i];
+		free(old);
+	}
+
+	size_t i = mock_slot_of(p->current_uid);
+	if (!mock.slots[i].used)
+		mock.count++;
+	mock.slots[i].used = true;
+	mock.slots[i].profile = *p;
+	return 0;
+}
+
+/* Same rule as the driver: only the manager may read or write profiles */
+static bool mock_caller_is_manager(void)
+{
+	return mock.uid % PER_USER_RANGE == mock.manager_appid;
+}
+
+static int mock_ioctl(enum mock_cmd cmd, void *arg)
+{
+	switch (cmd) {
+	case CMD_UID_SHOULD_UMOUNT: {
+		struct ksu_uid_should_umount_cmd *c = arg;
+		const struct app_profile *p = mock_find((int32_t)c->uid);
+
+		if (!p)
+			c->should_umount = mock.default_umount;
+		else if (p->allow_su)
+			c->should_umount = false;
+		else if (p->nrp_config.use_default)
+			c->should_umount = mock.default_umount;
+		else
+			c->should_umount = p->nrp_config.profile.umount_modules;
+		return 0;
+	}
+	case CMD_GET_MANAGER_APPID:
+		((struct ksu_get_manager_appid_cmd *)arg)->appid = mock.manager_appid;
+		return 0;
+	case CMD_GET_APP_PROFILE: {
+		struct app_profile *p = arg;
+		const struct app_profile *found;
+
+		if (!mock_caller_is_manager())
+			return -EPERM;
+		found = mock_find(p->current_uid);
+		if (!found)
+			return -ENOENT;
+		*p = *found;
+		return 0;
+	}
+	case CMD_SET_APP_PROFILE: {
+		const struct app_profile *p = arg;
+
+		if (!mock_caller_is_manager())
+			return -EPERM;
+		if (p->version != mock.profile_ver || !p->key[0])
+			return -EINVAL;
+		return mock_store(p);
+	}
+	default:
+		return -ENOTTY;
+	}
+}
+
+static int mock_cmd_of(ioctl_req_t req)
+{
+	switch ((unsigned int)req) {
+	case KSU_IOCTL_UID_SHOULD_UMOUNT:
+		return CMD_UID_SHOULD_UMOUNT;
+	case KSU_IOCTL_GET_MANAGER_APPID:
+		return CMD_GET_MANAGER_APPID;
+	case KSU_IOCTL_GET_APP_PROFILE:
+		return CMD_GET_APP_PROFILE;
+	case KSU_IOCTL_SET_APP_PROFILE:
+		return CMD_SET_APP_PROFILE;
+	default:
+		return -1;
+	}
+}
+
+/* Interposed libc functions */
+
+long syscall(long number, ...)
+{
+	va_list ap;
+	long a[6];
+
+	va_start(ap, number);
+	for (int i = 0; i < 6; i++)
+		a[i] = va_arg(ap, long);
+	va_end(ap);
+
+	if (number == SYS_reboot && (unsigned int)a[0] == KSU_INSTALL_MAGIC1 &&
+	    (unsigned int)a[1] == KSU_INSTALL_MAGIC2) {
+		int fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+		int ret = -1;
+
+		pthread_mutex_lock(&mock.lock);
+		mock_init();
+		for (int i = 0; fd >= 0 && i < MOCK_MAX_FDS; i++) {
+			if (mock.fds[i] < 0) {
+				mock.fds[i] = fd;
+				*(int *)a[3] = fd;
+				ret = 0;
+				break;
+			}
+		}
+		pthread_mutex_unlock(&mock.lock);
+		if (ret && fd >= 0) {
+			close(fd);
+			errno = EMFILE;
+		}
+		return ret;
+	}
+
+	if (!real_syscall)
+		real_syscall = (long (*)(long, ...))dlsym(RTLD_NEXT, "syscall");
+	return real_syscall(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+int ioctl(int fd, ioctl_req_t req, ...)
+{
+	va_list ap;
+	void *arg;
+	int cmd, ret;
+
+	va_start(ap, req);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	pthread_mutex_lock(&mock.lock);
+	if (mock.ready && mock_is_fd(fd)) {
+		cmd = mock_cmd_of(req);
+		ret = cmd < 0 ? -ENOTTY : mock_ioctl(cmd, arg);
+		if (cmd >= 0) {
+			mock.calls[cmd]++;
+			mock.errors[cmd] += ret < 0;
+		}
+		pthread_mutex_unlock(&mock.lock);
+		if (ret < 0) {
+			errno = -ret;
+			return -1;
+		}
+		return ret;
+	}
+	pthread_mutex_unlock(&mock.lock);
+
+	if (!real_ioctl)
+		real_ioctl = (int (*)(int, ioctl_req_t, ...))dlsym(RTLD_NEXT, "ioctl");
+	return real_ioctl(fd, req, arg);
+}
+
+int close(int fd)
+{
+	pthread_mutex_lock(&mock.lock);
+	for (int i = 0; i < MOCK_MAX_FDS; i++)
+		if (mock.fds[i] == fd)
+			mock.fds[i] = -1;
+	pthread_mutex_unlock(&mock.lock);
+
+	if (!real_close)
+		real_close = (int (*)(int))dlsym(RTLD_NEXT, "close");
+	return real_close(fd);
+}
+
+/* The manager switch only changes the UID the mock driver sees */
+
+int setuid(uid_t uid)
+{
+	pthread_mutex_lock(&mock.lock);
+	mock_init();
+	mock.uid = uid;
+	pthread_mutex_unlock(&mock.lock);
+	return 0;
+}
+
+int setresuid(uid_t ruid, uid_t euid, uid_t suid)
+{
+	(void)euid;
+	(void)suid;
+
+	pthread_mutex_lock(&mock.lock);
+	mock_init();
+	if (ruid != (uid_t)-1)
+		mock.uid = ruid;
+	pthread_mutex_unlock(&mock.lock);
+	return 0;
+}
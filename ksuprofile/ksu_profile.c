@@ -2,7 +2,8 @@
  * KernelSU Userspace Tool
  *
  * This tool interacts with the KernelSU driver via ioctl to manage
- * application profiles and mount namespaces.
+ * application profiles and mount namespaces. Without the driver it can
+ * run against the ksu_mock.c LD_PRELOAD shim.
  * 
  * Authors: AzyrRuthless & j-hc
  */
@@ -10,78 +11,25 @@
 #define _GNU_SOURCE
 #include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
+#include <time.h>
 #include <unistd.h>
 
-/* KernelSU Constants */
-#define KSU_APP_PROFILE_VER 2
-#define KSU_MAX_PACKAGE_NAME 256
-#define KSU_MAX_GROUPS 32
-#define KSU_SELINUX_DOMAIN 64
-
-#define KSU_INSTALL_MAGIC1 0xDEADBEEF
-#define KSU_INSTALL_MAGIC2 0xCAFEBABE
-
-/* IOCTL Commands */
-#define KSU_IOCTL_MAGIC 'K'
-#define KSU_IOCTL_UID_SHOULD_UMOUNT _IOC(_IOC_READ | _IOC_WRITE, KSU_IOCTL_MAGIC, 9, 0)
-#define KSU_IOCTL_GET_MANAGER_APPID _IOC(_IOC_READ, KSU_IOCTL_MAGIC, 10, 0)
-#define KSU_IOCTL_GET_APP_PROFILE _IOC(_IOC_READ | _IOC_WRITE, KSU_IOCTL_MAGIC, 11, 0)
-#define KSU_IOCTL_SET_APP_PROFILE _IOC(_IOC_WRITE, KSU_IOCTL_MAGIC, 12, 0)
-
-/* Data Structures */
-struct root_profile {
-	int32_t uid;
-	int32_t gid;
-	int32_t groups_count;
-	int32_t groups[KSU_MAX_GROUPS];
-	struct {
-		uint64_t effective;
-		uint64_t permitted;
-		uint64_t inheritable;
-	} capabilities;
-	char selinux_domain[KSU_SELINUX_DOMAIN];
-	int32_t namespaces;
-	uint64_t flags; // Required for KernelSU v3+ driver structure compatibility
-};
-
-struct non_root_profile {
-	bool umount_modules;
-};
-
-struct app_profile {
-	uint32_t version;
-	char key[KSU_MAX_PACKAGE_NAME];
-	int32_t current_uid;
-	bool allow_su;
-	union {
-		struct {
-			bool use_default;
-			char template_name[KSU_MAX_PACKAGE_NAME];
-			struct root_profile profile;
-		} rp_config;
-		struct {
-			bool use_default;
-			struct non_root_profile profile;
-		} nrp_config;
-	};
-};
-
-/* IOCTL Command Structures */
-struct ksu_uid_should_umount_cmd {
-	uint32_t uid;
-	uint8_t should_umount;
-};
-
-struct ksu_get_manager_appid_cmd {
-	uint32_t appid;
-};
+#include "ksu.h"
+#include "../common/bench.h"
 
 /* Helper Functions */
 
@@ -101,85 +49,1739 @@ static int ksu_get_driver_fd(void)
 #define REPORT_ERR(op, err) \
 	fprintf(stderr, "ERROR: %s failed: %s\n", op, strerror(err))
 
-int main(int argc, char *argv[])
-{
+/* One driver handle shared by every entry of a run */
+struct ksu_ctx {
 	int fd;
-	long uid;
-	int ret = 0;
-	struct ksu_uid_should_umount_cmd umount_cmd = { 0 };
+	bool is_manager;
+	bool reversible;	/* keep the original UID as saved UID */
+	uid_t orig_uid;
+	uint32_t manager_appid;	/* valid once is_manager was set */
+};
+
+enum apply_result {
+	APPLY_SKIPPED,	/* UID is not unmounted, nothing to do */
+	APPLY_UNCHANGED,	/* profile already disables unmounting */
+	APPLY_UPDATED,
+	APPLY_CREATED,
+	APPLY_FAILED,
+};
+
+static const char *apply_result_name[] = {
+	[APPLY_SKIPPED] = "skipped",
+	[APPLY_UNCHANGED] = "unchanged",
+	[APPLY_UPDATED] = "updated",
+	[APPLY_CREATED] = "created",
+	[APPLY_FAILED] = "failed",
+};
+
+/**
+ * ksu_become_manager - Switch to the manager UID
+ * @ctx: driver context
+ * @failed_op: set to the failing operation on error
+ *
+ * Editing profiles requires the caller to be the manager app. The
+ * current process must have CAP_SETUID (usually root). A plain setuid()
+ * is final; with @ctx->reversible the original UID stays the saved UID
+ * so that ksu_leave_manager() can switch back, e.g. to reread
+ * packages.list, which the manager cannot read.
+ */
+static int ksu_become_manager(struct ksu_ctx *ctx, const char **failed_op)
+{
 	struct ksu_get_manager_appid_cmd appid_cmd = { 0 };
-	struct app_profile profile = { 0 };
+	int ret;
 
-	if (argc <= 2) {
-		fprintf(stderr,
-				"ksu_profile (github.com/AzyrRuthless & github.com/j-hc)\n"
-				"Disables \"Unmount modules\" for given package\n"
-				"Usage: %s <uid> <pkg name>\n", argv[0]);
-		return 1;
-	}
+	if (ctx->is_manager)
+		return 0;
 
-	uid = atol(argv[1]);
+	if (ioctl(ctx->fd, KSU_IOCTL_GET_MANAGER_APPID, &appid_cmd) < 0) {
+		*failed_op = "KSU_IOCTL_GET_MANAGER_APPID";
+		return -1;
+	}
+	if (ctx->reversible)
+		ret = setresuid(appid_cmd.appid, appid_cmd.appid, ctx->orig_uid);
+	else
+		ret = setuid(appid_cmd.appid);
+	if (ret != 0) {
+		*failed_op = ctx->reversible ? "setresuid" : "setuid";
+		return -1;
+	}
+	ctx->manager_appid = appid_cmd.appid;
+	ctx->is_manager = true;
+	return 0;
+}
 
-	/* 1. Get Driver FD */
-	fd = ksu_get_driver_fd();
-	if (fd < 0) {
-		REPORT_ERR("ksu_get_driver_fd", errno);
-		return 1;
+/* Return to the original UID after a reversible ksu_become_manager() */
+static int ksu_leave_manager(struct ksu_ctx *ctx)
+{
+	if (!ctx->is_manager || !ctx->reversible)
+		return 0;
+	if (setresuid(ctx->orig_uid, ctx->orig_uid, ctx->orig_uid) != 0) {
+		REPORT_ERR("setresuid", errno);
+		return -1;
 	}
+	ctx->is_manager = false;
+	return 0;
+}
 
-	/* 2. Check if UID should unmount */
-	umount_cmd.uid = (uint32_t)uid;
-	if (ioctl(fd, KSU_IOCTL_UID_SHOULD_UMOUNT, &umount_cmd) < 0) {
-		REPORT_ERR("KSU_IOCTL_UID_SHOULD_UMOUNT", errno);
-		ret = 1;
-		goto out;
+/* Failures that no later entry can get past */
+static bool is_manager_failure(const char *failed_op)
+{
+	return !strcmp(failed_op, "KSU_IOCTL_GET_MANAGER_APPID") ||
+	       !strcmp(failed_op, "setuid") || !strcmp(failed_op, "setresuid");
+}
+
+/**
+ * apply_profile - Disable module unmounting for one UID
+ * @ctx: driver context
+ * @uid: application UID
+ * @pkg: package name, used as the key of a newly created profile
+ * @failed_op: set to the failing operation on APPLY_FAILED (errno is kept)
+ */
+static enum apply_result apply_profile(struct ksu_ctx *ctx, uint32_t uid, const char *pkg,
+				       const char **failed_op)
+{
+	struct ksu_uid_should_umount_cmd umount_cmd = { 0 };
+	struct app_profile profile = { 0 };
+	enum apply_result res = APPLY_UPDATED;
+
+	/* Check if UID should unmount */
+	umount_cmd.uid = uid;
+	if (ioctl(ctx->fd, KSU_IOCTL_UID_SHOULD_UMOUNT, &umount_cmd) < 0) {
+		*failed_op = "KSU_IOCTL_UID_SHOULD_UMOUNT";
+		return APPLY_FAILED;
 	}
 
 	if (!umount_cmd.should_umount) {
 		/* Not relevant for this UID */
-		goto out;
+		return APPLY_SKIPPED;
 	}
 
-	/* 3. Get Manager AppID */
-	if (ioctl(fd, KSU_IOCTL_GET_MANAGER_APPID, &appid_cmd) < 0) {
-		REPORT_ERR("KSU_IOCTL_GET_MANAGER_APPID", errno);
-		ret = 1;
-		goto out;
-	}
-
-	/* 4. Switch to Manager UID to gain permission to edit profiles */
-	/* Note: Current process must have CAP_SETUID (usually root) */
-	if (setuid(appid_cmd.appid) != 0) {
-		REPORT_ERR("setuid", errno);
-		ret = 1;
-		goto out;
-	}
+	if (ksu_become_manager(ctx, failed_op))
+		return APPLY_FAILED;
 
-	/* 5. Get or Initialize App Profile */
+	/* Get or Initialize App Profile */
 	profile.current_uid = (int32_t)uid;
-	if (ioctl(fd, KSU_IOCTL_GET_APP_PROFILE, &profile) < 0) {
+	if (ioctl(ctx->fd, KSU_IOCTL_GET_APP_PROFILE, &profile) < 0) {
 		/* Profile might not exist, initialize a new one */
-		printf("Creating new profile for %s\n", argv[2]);
 		memset(&profile, 0, sizeof(struct app_profile));
 		profile.version = KSU_APP_PROFILE_VER;
 		profile.current_uid = (int32_t)uid;
-		strncpy(profile.key, argv[2], KSU_MAX_PACKAGE_NAME - 1);
+		strncpy(profile.key, pkg, KSU_MAX_PACKAGE_NAME - 1);
+		res = APPLY_CREATED;
+	} else if (!profile.allow_su && !profile.nrp_config.use_default &&
+		   !profile.nrp_config.profile.umount_modules) {
+		/* Already what we would write: skip the SET */
+		return APPLY_UNCHANGED;
 	}
 
-	/* 6. Modify Profile (Disable module unmounting) */
+	/* Modify Profile (Disable module unmounting) */
 	profile.nrp_config.use_default = false;
 	profile.nrp_config.profile.umount_modules = false;
 
-	/* 7. Apply Profile */
-	if (ioctl(fd, KSU_IOCTL_SET_APP_PROFILE, &profile) < 0) {
-		REPORT_ERR("KSU_IOCTL_SET_APP_PROFILE", errno);
-		ret = 1;
+	/* Apply Profile */
+	if (ioctl(ctx->fd, KSU_IOCTL_SET_APP_PROFILE, &profile) < 0) {
+		*failed_op = "KSU_IOCTL_SET_APP_PROFILE";
+		return APPLY_FAILED;
+	}
+
+	return res;
+}
+
+static int ksu_open(struct ksu_ctx *ctx)
+{
+	ctx->is_manager = false;
+	ctx->reversible = false;
+	ctx->orig_uid = getuid();
+	ctx->fd = ksu_get_driver_fd();
+	if (ctx->fd < 0) {
+		REPORT_ERR("ksu_get_driver_fd", errno);
+		return -1;
+	}
+	return 0;
+}
+
+static int run_single(long uid, const char *pkg)
+{
+	struct ksu_ctx ctx;
+	const char *failed_op = NULL;
+	enum apply_result res;
+
+	if (ksu_open(&ctx))
+		return 1;
+
+	res = apply_profile(&ctx, (uint32_t)uid, pkg, &failed_op);
+	close(ctx.fd);
+
+	switch (res) {
+	case APPLY_FAILED:
+		REPORT_ERR(failed_op, errno);
+		return 1;
+	case APPLY_SKIPPED:
+		return 0;
+	case APPLY_CREATED:
+		printf("Creating new profile for %s\n", pkg);
+		/* fall through */
+	default:
+		printf("Success\n");
+		return 0;
+	}
+}
+
+/**
+ * run_batch - Apply profiles for every "<uid> <pkg name>" line of a file
+ * @path: input file, or "-" for stdin
+ *
+ * Blank lines and lines starting with '#' are ignored. The driver fd is
+ * obtained and the manager UID assumed once for the whole batch.
+ */
+static int run_batch(const char *path)
+{
+	int counts[APPLY_FAILED + 1] = { 0 };
+	struct ksu_ctx ctx;
+	char line[512];
+	int lineno = 0, bad = 0;
+	long long start;
+	FILE *in;
+
+	in = strcmp(path, "-") ? fopen(path, "re") : stdin;
+	if (!in) {
+		REPORT_ERR(path, errno);
+		return 1;
+	}
+
+	start = bench_mono_ns();
+	if (ksu_open(&ctx)) {
+		if (in != stdin)
+			fclose(in);
+		return 1;
+	}
+
+	while (fgets(line, sizeof(line), in)) {
+		char pkg[KSU_MAX_PACKAGE_NAME];
+		const char *failed_op = NULL;
+		enum apply_result res;
+		long long t0;
+		long uid;
+		char *p = line;
+
+		lineno++;
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (*p == '#' || *p == '\n' || !*p)
+			continue;
+		if (sscanf(p, "%ld %255s", &uid, pkg) != 2 || uid < 0) {
+			fprintf(stderr, "%s:%d: expected \"<uid> <pkg name>\"\n", path, lineno);
+			bad++;
+			continue;
+		}
+
+		t0 = bench_mono_ns();
+		res = apply_profile(&ctx, (uint32_t)uid, pkg, &failed_op);
+		counts[res]++;
+		if (res == APPLY_FAILED)
+			printf("%-6ld %-48s %s: %s (%s)\n", uid, pkg, apply_result_name[res],
+			       failed_op, strerror(errno));
+		else
+			printf("%-6ld %-48s %-8s %8.1f us\n", uid, pkg, apply_result_name[res],
+			       (bench_mono_ns() - t0) / 1e3);
+
+		/* Without the manager UID no later entry can succeed either */
+		if (res == APPLY_FAILED && is_manager_failure(failed_op))
+			break;
+	}
+
+	close(ctx.fd);
+	if (in != stdin)
+		fclose(in);
+
+	printf("%d entries: %d updated, %d created, %d unchanged, %d skipped, %d failed, "
+	       "%d malformed in %.3f ms\n",
+	       counts[APPLY_UPDATED] + counts[APPLY_CREATED] + counts[APPLY_UNCHANGED] +
+	       counts[APPLY_SKIPPED] + counts[APPLY_FAILED], counts[APPLY_UPDATED],
+	       counts[APPLY_CREATED], counts[APPLY_UNCHANGED], counts[APPLY_SKIPPED],
+	       counts[APPLY_FAILED], bad, (bench_mono_ns() - start) / 1e6);
+
+	return counts[APPLY_FAILED] || bad ? 1 : 0;
+}
+
+/* Package Database */
+
+#define PACKAGES_LIST "/data/system/packages.list"
+
+/* Android's first application UID; lower ones belong to the system */
+#define FIRST_APPLICATION_UID 10000
+#define PER_USER_RANGE 100000
+
+/* One packages.list line; name points into the mapped file */
+struct pkg_entry {
+	const char *name;
+	size_t name_len;
+	uint32_t uid;
+};
+
+typedef int (*pkg_fn)(const struct pkg_entry *e, void *arg);
+
+/**
+ * for_each_package - Call @fn for every well-formed packages.list line
+ * @path: packages.list path
+ * @fn: callback; a non-zero return stops the walk
+ * @arg: passed to @fn
+ *
+ * Lines look like "<name> <uid> <debuggable> <data dir> <seinfo> <gids>".
+ * The file is mapped and parsed in place, so a walk allocates nothing.
+ * Returns the number of entries visited, or -1 with errno set.
+ */
+static int for_each_package(const char *path, pkg_fn fn, void *arg)
+{
+	struct stat st;
+	const char *buf, *p, *end;
+	int fd, n = 0;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	if (st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (buf == MAP_FAILED)
+		return -1;
+
+	end = buf + st.st_size;
+	for (p = buf; p < end; ) {
+		const char *eol = memchr(p, '\n', end - p);
+		struct pkg_entry e;
+		const char *q;
+		uint64_t uid = 0;
+
+		if (!eol)
+			eol = end;
+
+		e.name = p;
+		for (q = p; q < eol && *q != ' '; q++)
+			;
+		e.name_len = q - p;
+		while (q < eol && *q == ' ')
+			q++;
+		if (q == eol || *q < '0' || *q > '9')
+			goto next;
+		for (; q < eol && *q >= '0' && *q <= '9'; q++)
+			uid = uid * 10 + (*q - '0');
+		if (!e.name_len || e.name_len >= KSU_MAX_PACKAGE_NAME || uid > UINT32_MAX ||
+		    (q < eol && *q != ' '))
+			goto next;
+		e.uid = (uint32_t)uid;
+
+		n++;
+		if (fn(&e, arg))
+			break;
+next:
+		p = eol + 1;
+	}
+
+	munmap((void *)buf, st.st_size);
+	return n;
+}
+
+struct sync_state {
+	struct ksu_ctx *ctx;
+	int counts[APPLY_FAILED + 1];
+	bool abort;
+};
+
+static int sync_one(const struct pkg_entry *e, void *arg)
+{
+	struct sync_state *s = arg;
+	char pkg[KSU_MAX_PACKAGE_NAME];
+	const char *failed_op = NULL;
+	enum apply_result res;
+
+	/* System UIDs (shared by the framework) are left alone */
+	if (e->uid % PER_USER_RANGE < FIRST_APPLICATION_UID)
+		return 0;
+
+	memcpy(pkg, e->name, e->name_len);
+	pkg[e->name_len] = '\0';
+
+	res = apply_profile(s->ctx, e->uid, pkg, &failed_op);
+	s->counts[res]++;
+	if (res == APPLY_FAILED) {
+		printf("%-6u %-48s %s: %s (%s)\n", e->uid, pkg, apply_result_name[res], failed_op,
+		       strerror(errno));
+		if (is_manager_failure(failed_op)) {
+			s->abort = true;
+			return 1;
+		}
+	} else if (res == APPLY_UPDATED || res == APPLY_CREATED) {
+		printf("%-6u %-48s %s\n", e->uid, pkg, apply_result_name[res]);
+	}
+	return 0;
+}
+
+/**
+ * run_sync - Disable module unmounting for every installed application
+ * @path: packages.list to read
+ *
+ * Only entries whose profile differs are written, so a rerun on an
+ * unchanged system issues no SET_APP_PROFILE at all.
+ */
+static int run_sync(const char *path)
+{
+	struct sync_state s = { 0 };
+	struct ksu_ctx ctx;
+	long long start = bench_mono_ns();
+	int n;
+
+	if (ksu_open(&ctx))
+		return 1;
+	s.ctx = &ctx;
+
+	n = for_each_package(path, sync_one, &s);
+	close(ctx.fd);
+	if (n < 0) {
+		REPORT_ERR(path, errno);
+		return 1;
+	}
+
+	printf("%d packages: %d updated, %d created, %d unchanged, %d skipped, %d failed in %.3f ms\n",
+	       n, s.counts[APPLY_UPDATED], s.counts[APPLY_CREATED], s.counts[APPLY_UNCHANGED],
+	       s.counts[APPLY_SKIPPED], s.counts[APPLY_FAILED], (bench_mono_ns() - start) / 1e6);
+
+	return s.abort || s.counts[APPLY_FAILED] ? 1 : 0;
+}
+
+/* Daemon Mode */
+
+/* Quiet time after the last packages.list event before rescanning */
+#define DAEMON_DEBOUNCE_MS 200
+#define UID_SET_MIN_CAP 256
+#define UID_SET_EMPTY UINT32_MAX
+
+/**
+ * struct uid_set - Open-addressing set of the application UIDs seen so far
+ *
+ * Each slot carries the generation of the scan that last saw it, so UIDs
+ * of uninstalled packages can be dropped after a scan.
+ */
+struct uid_set {
+	uint32_t *uids;
+	uint32_t *gens;
+	size_t cap;	/* power of two */
+	size_t count;
+};
+
+static size_t uid_slot(const struct uid_set *set, uint32_t uid)
+{
+	size_t i = (uid * 0x9E3779B1u) & (set->cap - 1);
+
+	while (set->uids[i] != UID_SET_EMPTY && set->uids[i] != uid)
+		i = (i + 1) & (set->cap - 1);
+	return i;
+}
+
+static int uid_set_init(struct uid_set *set, size_t cap)
+{
+	set->uids = malloc(cap * sizeof(*set->uids));
+	set->gens = calloc(cap, sizeof(*set->gens));
+	if (!set->uids || !set->gens) {
+		free(set->uids);
+		free(set->gens);
+		return -1;
+	}
+	memset(set->uids, 0xff, cap * sizeof(*set->uids));
+	set->cap = cap;
+	set->count = 0;
+	return 0;
+}
+
+static void uid_set_free(struct uid_set *set)
+{
+	free(set->uids);
+	free(set->gens);
+	memset(set, 0, sizeof(*set));
+}
+
+/* Rehash the UIDs seen in scan @gen (any scan if 0), except @drop */
+static int uid_set_rebuild(struct uid_set *set, size_t cap, uint32_t gen, uint32_t drop)
+{
+	struct uid_set n;
+
+	if (uid_set_init(&n, cap))
+		return -1;
+	for (size_t i = 0; i < set->cap; i++) {
+		if (set->uids[i] == UID_SET_EMPTY || set->uids[i] == drop ||
+		    (gen && set->gens[i] != gen))
+			continue;
+		size_t j = uid_slot(&n, set->uids[i]);
+		n.uids[j] = set->uids[i];
+		n.gens[j] = set->gens[i];
+		n.count++;
+	}
+	uid_set_free(set);
+	*set = n;
+	return 0;
+}
+
+/* Mark @uid as seen in scan @gen; returns true if it was not known */
+static bool uid_set_mark(struct uid_set *set, uint32_t uid, uint32_t gen)
+{
+	size_t i;
+
+	/* If growing fails, keep going until the table is actually full */
+	if ((set->count + 1) * 2 > set->cap &&
+	    uid_set_rebuild(set, set->cap * 2, 0, UID_SET_EMPTY) && set->count + 1 >= set->cap)
+		return false;
+
+	i = uid_slot(set, uid);
+	set->gens[i] = gen;
+	if (set->uids[i] == uid)
+		return false;
+	set->uids[i] = uid;
+	set->count++;
+	return true;
+}
+
+/* Rare (failed applies), so a rebuild rather than tombstones */
+static void uid_set_forget(struct uid_set *set, uint32_t uid)
+{
+	if (set->uids[uid_slot(set, uid)] == uid)
+		uid_set_rebuild(set, set->cap, 0, uid);
+}
+
+struct daemon_state {
+	struct ksu_ctx *ctx;
+	struct uid_set known;
+	uint32_t gen;
+	int counts[APPLY_FAILED + 1];
+	bool fatal;
+};
+
+static int daemon_scan_one(const struct pkg_entry *e, void *arg)
+{
+	struct daemon_state *d = arg;
+	char pkg[KSU_MAX_PACKAGE_NAME];
+	const char *failed_op = NULL;
+	enum apply_result res;
+
+	if (e->uid % PER_USER_RANGE < FIRST_APPLICATION_UID)
+		return 0;
+	if (!uid_set_mark(&d->known, e->uid, d->gen))
+		return 0;
+
+	memcpy(pkg, e->name, e->name_len);
+	pkg[e->name_len] = '\0';
+
+	res = apply_profile(d->ctx, e->uid, pkg, &failed_op);
+	d->counts[res]++;
+	if (res == APPLY_FAILED) {
+		printf("  %-6u %-48s %s: %s (%s)\n", e->uid, pkg, apply_result_name[res], failed_op,
+		       strerror(errno));
+		/* Not remembered, so the next change retries it */
+		uid_set_forget(&d->known, e->uid);
+		if (is_manager_failure(failed_op)) {
+			d->fatal = true;
+			return 1;
+		}
+	} else if (res == APPLY_UPDATED || res == APPLY_CREATED) {
+		printf("  %-6u %-48s %s\n", e->uid, pkg, apply_result_name[res]);
+	}
+	return 0;
+}
+
+static void log_stamp(void)
+{
+	char buf[32];
+	time_t now = time(NULL);
+
+	strftime(buf, sizeof(buf), "%H:%M:%S", localtime(&now));
+	printf("[%s] ", buf);
+}
+
+/* Apply profiles to UIDs not seen before, then forget uninstalled ones */
+static int daemon_scan(struct daemon_state *d, const char *path, long long event_ns)
+{
+	long long t0 = bench_mono_ns();
+	size_t before;
+	int n;
+
+	memset(d->counts, 0, sizeof(d->counts));
+	d->gen++;
+	n = for_each_package(path, daemon_scan_one, d);
+	if (ksu_leave_manager(d->ctx))
+		return -1;
+	if (n < 0) {
+		log_stamp();
+		printf("%s: %s\n", path, strerror(errno));
+		return 0;
+	}
+	if (d->fatal)
+		return -1;
+
+	before = d->known.count;
+	uid_set_rebuild(&d->known, d->known.cap, d->gen, UID_SET_EMPTY);
+
+	log_stamp();
+	printf("%d packages, %zu app UIDs: %d new applied, %d unchanged, %d skipped, %d failed, "
+	       "%zu removed in %.3f ms", n, d->known.count,
+	       d->counts[APPLY_UPDATED] + d->counts[APPLY_CREATED], d->counts[APPLY_UNCHANGED],
+	       d->counts[APPLY_SKIPPED], d->counts[APPLY_FAILED], before - d->known.count,
+	       (bench_mono_ns() - t0) / 1e6);
+	if (event_ns)
+		printf(" (%.1f ms after the first event)", (bench_mono_ns() - event_ns) / 1e6);
+	putchar('\n');
+	fflush(stdout);
+	return 0;
+}
+
+static volatile sig_atomic_t daemon_stop;
+
+static void daemon_signal(int sig)
+{
+	(void)sig;
+	daemon_stop = 1;
+}
+
+/* Drain pending inotify events; true if any concerns @name */
+static bool inotify_touches(int ifd, const char *name)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	bool hit = false;
+	ssize_t len;
+
+	while ((len = read(ifd, buf, sizeof(buf))) > 0) {
+		for (char *p = buf; p < buf + len; ) {
+			struct inotify_event *ev = (struct inotify_event *)p;
+			if (ev->len && !strcmp(ev->name, name))
+				hit = true;
+			p += sizeof(*ev) + ev->len;
+		}
+	}
+	return hit;
+}
+
+/**
+ * run_daemon - Apply profiles to newly installed apps as they appear
+ * @path: packages.list to watch
+ *
+ * PackageManager replaces packages.list by rename, so the directory is
+ * watched rather than the file. Bursts of events (an install rewrites
+ * the file more than once) are coalesced into one rescan once they have
+ * been quiet for DAEMON_DEBOUNCE_MS. The driver fd stays open and the
+ * manager UID is only assumed around the ioctls.
+ */
+static int run_daemon(const char *path)
+{
+	struct daemon_state d = { 0 };
+	struct sigaction sa = { 0 };
+	struct ksu_ctx ctx;
+	char dir[PATH_MAX];
+	const char *slash = strrchr(path, '/'), *name;
+	int ifd, ret = 1;
+
+	if (slash) {
+		snprintf(dir, sizeof(dir), "%.*s", slash == path ? 1 : (int)(slash - path), path);
+		name = slash + 1;
+	} else {
+		strcpy(dir, ".");
+		name = path;
+	}
+
+	if (ksu_open(&ctx))
+		return 1;
+	ctx.reversible = true;
+	d.ctx = &ctx;
+	if (uid_set_init(&d.known, UID_SET_MIN_CAP)) {
+		REPORT_ERR("malloc", errno);
+		goto out_fd;
+	}
+
+	ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (ifd < 0 || inotify_add_watch(ifd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		REPORT_ERR("inotify", errno);
+		goto out_set;
+	}
+
+	/* No SA_RESTART: a signal must interrupt poll() */
+	sa.sa_handler = daemon_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	log_stamp();
+	printf("watching %s, debounce %d ms\n", path, DAEMON_DEBOUNCE_MS);
+	if (daemon_scan(&d, path, 0))
+		goto out_ifd;
+
+	while (!daemon_stop) {
+		struct pollfd pfd = { .fd = ifd, .events = POLLIN };
+		long long first_ns;
+
+		if (poll(&pfd, 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			REPORT_ERR("poll", errno);
+			goto out_ifd;
+		}
+		first_ns = bench_mono_ns();
+		if (!inotify_touches(ifd, name))
+			continue;
+
+		/* Wait for the burst to settle */
+		while (!daemon_stop && poll(&pfd, 1, DAEMON_DEBOUNCE_MS) > 0)
+			inotify_touches(ifd, name);
+		if (daemon_stop)
+			break;
+
+		if (daemon_scan(&d, path, first_ns))
+			goto out_ifd;
+	}
+
+	log_stamp();
+	printf("stopping\n");
+	ret = 0;
+
+out_ifd:
+	close(ifd);
+out_set:
+	uid_set_free(&d.known);
+out_fd:
+	close(ctx.fd);
+	return ret;
+}
+
+/* Bench Mode */
+
+#define BENCH_ITERATIONS_DEFAULT 10000
+
+enum bench_op {
+	BENCH_UID_SHOULD_UMOUNT,
+	BENCH_GET_MANAGER_APPID,
+	BENCH_GET_APP_PROFILE,
+	BENCH_SET_APP_PROFILE,
+	BENCH_OP_COUNT,
+};
+
+static const char *bench_op_name[] = {
+	[BENCH_UID_SHOULD_UMOUNT] = "UID_SHOULD_UMOUNT",
+	[BENCH_GET_MANAGER_APPID] = "GET_MANAGER_APPID",
+	[BENCH_GET_APP_PROFILE] = "GET_APP_PROFILE",
+	[BENCH_SET_APP_PROFILE] = "SET_APP_PROFILE",
+};
+
+/* Issue one command; SET writes back @profile unchanged */
+static int bench_ioctl(int fd, enum bench_op op, uint32_t uid, struct app_profile *profile)
+{
+	struct ksu_uid_should_umount_cmd umount_cmd = { .uid = uid };
+	struct ksu_get_manager_appid_cmd appid_cmd = { 0 };
+
+	switch (op) {
+	case BENCH_UID_SHOULD_UMOUNT:
+		return ioctl(fd, KSU_IOCTL_UID_SHOULD_UMOUNT, &umount_cmd);
+	case BENCH_GET_MANAGER_APPID:
+		return ioctl(fd, KSU_IOCTL_GET_MANAGER_APPID, &appid_cmd);
+	case BENCH_GET_APP_PROFILE:
+		profile->current_uid = (int32_t)uid;
+		return ioctl(fd, KSU_IOCTL_GET_APP_PROFILE, profile);
+	case BENCH_SET_APP_PROFILE:
+		return ioctl(fd, KSU_IOCTL_SET_APP_PROFILE, profile);
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+}
+
+struct bench_scan {
+	struct ksu_ctx *ctx;
+	struct app_profile *found;	/* first profile seen, for bench_find_one */
+	const char *failed_op;
+	int err;		/* errno of failed_op */
+	int uids;
+	int failed;
+	bool abort;
+};
+
+/* What a sync costs per entry when nothing needs writing */
+static int bench_scan_one(const struct pkg_entry *e, void *arg)
+{
+	struct bench_scan *s = arg;
+	struct app_profile profile = { 0 };
+
+	if (e->uid % PER_USER_RANGE < FIRST_APPLICATION_UID)
+		return 0;
+	if (ksu_become_manager(s->ctx, &s->failed_op)) {
+		s->err = errno;
+		s->abort = true;
+		return 1;
+	}
+	s->uids++;
+	if (bench_ioctl(s->ctx->fd, BENCH_UID_SHOULD_UMOUNT, e->uid, &profile) < 0)
+		s->failed++;
+	if (bench_ioctl(s->ctx->fd, BENCH_GET_APP_PROFILE, e->uid, &profile) < 0 && errno != ENOENT)
+		s->failed++;
+	return 0;
+}
+
+/* Stops at the first installed app that has a profile */
+static int bench_find_one(const struct pkg_entry *e, void *arg)
+{
+	struct bench_scan *s = arg;
+
+	if (e->uid % PER_USER_RANGE < FIRST_APPLICATION_UID)
+		return 0;
+	if (ksu_become_manager(s->ctx, &s->failed_op)) {
+		s->err = errno;
+		s->abort = true;
+		return 1;
+	}
+	memset(s->found, 0, sizeof(*s->found));
+	return bench_ioctl(s->ctx->fd, BENCH_GET_APP_PROFILE, e->uid, s->found) == 0;
+}
+
+/**
+ * run_bench - Measure driver ioctl latency and batch throughput
+ * @uid: UID to query
+ * @packages_list: package database for the SET target and the scan
+ * @iterations: calls per command
+ *
+ * Nothing is modified: SET_APP_PROFILE writes back a profile GET
+ * returned, of @uid or, if it has none, of the first installed app in
+ * @packages_list that has one. Works against the real driver or the
+ * ksu_mock shim.
+ */
+static int run_bench(long uid, const char *packages_list, int iterations)
+{
+	struct app_profile profile = { 0 }, set_profile = { 0 };
+	struct bench_scan scan = { 0 };
+	struct bench_stats st;
+	const char *failed_op = NULL;
+	struct ksu_ctx ctx;
+	long long *buf, t0;
+	bool have_profile, have_set;
+	int n, ret = 1;
+
+	buf = calloc(iterations, sizeof(*buf));
+	if (!buf) {
+		REPORT_ERR("calloc", errno);
+		return 1;
+	}
+	if (ksu_open(&ctx)) {
+		free(buf);
+		return 1;
+	}
+	ctx.reversible = true;
+	if (ksu_become_manager(&ctx, &failed_op)) {
+		REPORT_ERR(failed_op, errno);
 		goto out;
 	}
+	if (uid < 0)
+		uid = ctx.manager_appid;
+
+	have_profile = bench_ioctl(ctx.fd, BENCH_GET_APP_PROFILE, uid, &profile) == 0;
+	printf("ksu_profile bench: uid %ld (%s), %d iterations, %s clock\n", uid,
+	       have_profile ? "has a profile" : "no profile", iterations, bench_clock_init()->name);
+
+	/* SET is timed as a write-back, so it needs a UID with a profile */
+	have_set = have_profile;
+	if (have_profile) {
+		set_profile = profile;
+	} else {
+		/* packages.list is not readable as the manager */
+		if (ksu_leave_manager(&ctx))
+			goto out;
+		scan.ctx = &ctx;
+		scan.found = &set_profile;
+		n = for_each_package(packages_list, bench_find_one, &scan);
+		if (scan.abort) {
+			REPORT_ERR(scan.failed_op, scan.err);
+			goto out;
+		}
+		if (ksu_become_manager(&ctx, &failed_op)) {
+			REPORT_ERR(failed_op, errno);
+			goto out;
+		}
+		have_set = n > 0 && set_profile.key[0];
+		if (have_set)
+			printf("SET_APP_PROFILE is timed on uid %d (%s)\n", set_profile.current_uid,
+			       set_profile.key);
+		memset(&scan, 0, sizeof(scan));
+	}
+	printf("%-22s %9s %9s %9s %9s  (ns)\n", "ioctl", "min", "p50", "p99", "max");
+
+	for (int op = 0; op < BENCH_OP_COUNT; op++) {
+		struct app_profile *p = op == BENCH_SET_APP_PROFILE ? &set_profile : &profile;
 
-	printf("Success\n");
+		printf("%-22s", bench_op_name[op]);
+		if (op == BENCH_SET_APP_PROFILE && !have_set) {
+			printf(" n/a: no installed app in %s has a profile to write back\n",
+			       packages_list);
+			continue;
+		}
+		for (n = 0; n < iterations; n++) {
+			uint64_t c0 = bench_ticks();
+
+			if (bench_ioctl(ctx.fd, op, uid, p) < 0 &&
+			    !(op == BENCH_GET_APP_PROFILE && errno == ENOENT))
+				break;
+			buf[n] = (long long)bench_ticks_to_ns(bench_ticks() - c0);
+		}
+		if (n < iterations) {
+			printf(" failed: %s\n", strerror(errno));
+			continue;
+		}
+		bench_stats_compute(buf, n, &st);
+		printf(" %9.0f %9.0f %9.0f %9.0f\n", st.min, st.p50, st.p99, st.max);
+	}
+
+	/* The per-entry work of apply_profile() when the profile is already right */
+	t0 = bench_now_ns();
+	for (n = 0; n < iterations; n++) {
+		bench_ioctl(ctx.fd, BENCH_UID_SHOULD_UMOUNT, uid, &profile);
+		bench_ioctl(ctx.fd, BENCH_GET_APP_PROFILE, uid, &profile);
+		if (have_set)
+			bench_ioctl(ctx.fd, BENCH_SET_APP_PROFILE, uid, &set_profile);
+	}
+	t0 = bench_now_ns() - t0;
+	printf("\nbatch cycle (umount check + GET%s): %.0f ns, %.0f entries/s\n",
+	       have_set ? " + SET" : "", (double)t0 / iterations, iterations * 1e9 / t0);
+
+	/* packages.list is not readable as the manager */
+	if (ksu_leave_manager(&ctx))
+		goto out;
+	scan.ctx = &ctx;
+	t0 = bench_now_ns();
+	n = for_each_package(packages_list, bench_scan_one, &scan);
+	t0 = bench_now_ns() - t0;
+	ksu_leave_manager(&ctx);
+	if (scan.abort) {
+		REPORT_ERR(scan.failed_op, scan.err);
+		goto out;
+	}
+	if (n < 0)
+		printf("%s: %s, scan skipped\n", packages_list, strerror(errno));
+	else
+		printf("%s: %d app UIDs checked in %.3f ms (%.1f us/entry, %d errors)\n",
+		       packages_list, scan.uids, t0 / 1e6, scan.uids ? t0 / 1e3 / scan.uids : 0.0,
+		       scan.failed);
+	ret = 0;
 
 out:
-	close(fd);
+	close(ctx.fd);
+	free(buf);
+	return ret;
+}
+
+/* Query Mode */
+
+enum query_format {
+	QUERY_TABLE,
+	QUERY_JSON,
+};
+
+struct query_state {
+	struct ksu_ctx *ctx;
+	struct uid_set seen;
+	enum query_format format;
+	int rows;
+	int profiles;
+	int failed;
+	bool abort;
+};
+
+static void print_json_str(const char *s)
+{
+	putchar('"');
+	for (; *s; s++) {
+		unsigned char c = *s;
+
+		if (c == '"' || c == '\\')
+			printf("\\%c", c);
+		else if (c < 0x20)
+			printf("\\u%04x", c);
+		else
+			putchar(c);
+	}
+	putchar('"');
+}
+
+/**
+ * query_print - Print one UID's profile as a table row or JSON object
+ * @s: query state, counts rows for separators
+ * @uid: application UID
+ * @pkg: package name from packages.list, or NULL
+ * @p: profile, or NULL if the UID has none
+ */
+static void query_print(struct query_state *s, uint32_t uid, const char *pkg,
+			const struct app_profile *p)
+{
+	const char *name = p ? p->key : pkg ? pkg : "";
+	const char *umount = "-", *tmpl = "-", *domain = "-";
+
+	if (p && p->allow_su) {
+		tmpl = p->rp_config.use_default ? "default" : p->rp_config.template_name;
+		domain = p->rp_config.profile.selinux_domain;
+	} else if (p) {
+		umount = p->nrp_config.use_default ? "default" :
+			 p->nrp_config.profile.umount_modules ? "yes" : "no";
+	}
+
+	if (s->format == QUERY_TABLE) {
+		if (!s->rows)
+			printf("%-7s %-8s %-8s %-16s %-24s %s\n", "UID", "ALLOW_SU", "UMOUNT",
+			       "TEMPLATE", "DOMAIN", "PACKAGE");
+		printf("%-7u %-8s %-8s %-16s %-24s %s\n", uid,
+		       p ? (p->allow_su ? "yes" : "no") : "none", umount, tmpl, domain, name);
+		s->rows++;
+		return;
+	}
+
+	printf("%s\n  {\"uid\": %u, \"package\": ", s->rows ? "," : "[", uid);
+	print_json_str(name);
+	printf(", \"profile\": %s", p ? "true" : "false");
+	if (p) {
+		printf(", \"allow_su\": %s", p->allow_su ? "true" : "false");
+		if (p->allow_su) {
+			printf(", \"template\": ");
+			print_json_str(tmpl);
+			printf(", \"selinux_domain\": ");
+			print_json_str(domain);
+		} else {
+			printf(", \"umount_modules\": ");
+			if (p->nrp_config.use_default)
+				printf("\"default\"");
+			else
+				printf("%s", p->nrp_config.profile.umount_modules ? "true" : "false");
+		}
+	}
+	putchar('}');
+	s->rows++;
+}
+
+static void query_finish(struct query_state *s)
+{
+	if (s->format == QUERY_JSON)
+		printf(s->rows ? "\n]\n" : "[]\n");
+}
+
+/* Returns 1 with a profile, 0 without, -1 on error */
+static int query_one(struct query_state *s, uint32_t uid, const char *pkg)
+{
+	struct app_profile profile = { 0 };
+	const char *failed_op = NULL;
+
+	if (ksu_become_manager(s->ctx, &failed_op)) {
+		REPORT_ERR(failed_op, errno);
+		s->abort = true;
+		return -1;
+	}
+
+	profile.current_uid = (int32_t)uid;
+	if (ioctl(s->ctx->fd, KSU_IOCTL_GET_APP_PROFILE, &profile) < 0) {
+		if (errno != ENOENT) {
+			fprintf(stderr, "ERROR: KSU_IOCTL_GET_APP_PROFILE for %u failed: %s\n", uid,
+				strerror(errno));
+			s->failed++;
+			return -1;
+		}
+		query_print(s, uid, pkg, NULL);
+		return 0;
+	}
+	query_print(s, uid, pkg, &profile);
+	s->profiles++;
+	return 1;
+}
+
+static int query_scan_one(const struct pkg_entry *e, void *arg)
+{
+	struct query_state *s = arg;
+	char pkg[KSU_MAX_PACKAGE_NAME];
+
+	/* Shared UIDs have one profile, listed under the first package */
+	if (!uid_set_mark(&s->seen, e->uid, 1))
+		return 0;
+	snprintf(pkg, sizeof(pkg), "%.*s", (int)e->name_len, e->name);
+	query_one(s, e->uid, pkg);
+	return s->abort;
+}
+
+/**
+ * run_query - Show profiles without modifying them
+ * @uid: UID to show, or -1 for every package in @packages_list
+ * @packages_list: package database for the full dump
+ * @format: table or JSON on stdout; the summary goes to stderr
+ *
+ * One driver fd serves the whole scan. The manager switch is reversible
+ * and undone at the end, since nothing here needs to stay the manager.
+ */
+static int run_query(long uid, const char *packages_list, enum query_format format)
+{
+	struct query_state s = { .format = format };
+	struct ksu_ctx ctx;
+	long long start = bench_mono_ns();
+	int n = 1;
+
+	if (ksu_open(&ctx))
+		return 1;
+	ctx.reversible = true;
+	s.ctx = &ctx;
+
+	if (uid >= 0) {
+		query_one(&s, (uint32_t)uid, NULL);
+	} else {
+		if (uid_set_init(&s.seen, UID_SET_MIN_CAP)) {
+			REPORT_ERR("malloc", errno);
+			close(ctx.fd);
+			return 1;
+		}
+		n = for_each_package(packages_list, query_scan_one, &s);
+		if (n < 0)
+			REPORT_ERR(packages_list, errno);
+		uid_set_free(&s.seen);
+	}
+	ksu_leave_manager(&ctx);
+	close(ctx.fd);
+	query_finish(&s);
+
+	if (uid < 0 && n >= 0)
+		fprintf(stderr, "%d packages, %d UIDs, %d profiles, %d failed in %.3f ms\n", n, s.rows,
+			s.profiles, s.failed, (bench_mono_ns() - start) / 1e6);
+	return n < 0 || s.abort || s.failed ? 1 : 0;
+}
+
+/* Snapshot Export/Import */
+
+/*
+ * Snapshot file layout, host byte order (little-endian on every Android
+ * ABI):
+ *
+ *   struct snap_header
+ *   count x { u16 body_len, u8 profile version, body[body_len] }
+ *
+ * A body is the profile field by field rather than struct app_profile,
+ * so it neither depends on the struct layout of the exporting build nor
+ * wastes the unused halves of the union and name buffers:
+ *
+ *   u32 uid, u8 allow_su, u8 use_default, u8 key_len, key
+ *   allow_su: u8 template_len, template, i32 uid, i32 gid,
+ *             i32 groups_count, i32 groups[groups_count],
+ *             u64 effective, u64 permitted, u64 inheritable,
+ *             u8 domain_len, domain, i32 namespaces,
+ *             u64 flags (only with SNAP_LAYOUT_ROOT_FLAGS)
+ *   else:     u8 umount_modules
+ */
+#define SNAP_MAGIC "KSUSNAP"
+#define SNAP_FORMAT 1
+#define SNAP_LAYOUT_ROOT_FLAGS 0x1	/* root_profile has the v3 flags word */
+#define SNAP_BODY_MAX 1024
+
+struct snap_header {
+	char magic[8];
+	uint16_t format;
+	uint16_t profile_ver;	/* KSU_APP_PROFILE_VER of the exporting build */
+	uint32_t layout;
+	uint32_t count;
+	uint32_t reserved;
+};
+
+/* Bounds-checked cursor; any overrun sets ok to false */
+struct snap_buf {
+	uint8_t *p;
+	uint8_t *end;
+	bool ok;
+};
+
+static void snap_put(struct snap_buf *b, const void *src, size_t len)
+{
+	if (!b->ok || (size_t)(b->end - b->p) < len) {
+		b->ok = false;
+		return;
+	}
+	memcpy(b->p, src, len);
+	b->p += len;
+}
+
+static void snap_get(struct snap_buf *b, void *dst, size_t len)
+{
+	if (!b->ok || (size_t)(b->end - b->p) < len) {
+		b->ok = false;
+		memset(dst, 0, len);
+		return;
+	}
+	memcpy(dst, b->p, len);
+	b->p += len;
+}
+
+static void snap_put_str(struct snap_buf *b, const char *s, size_t max)
+{
+	uint8_t len = (uint8_t)strnlen(s, max - 1 < 255 ? max - 1 : 255);
+
+	snap_put(b, &len, 1);
+	snap_put(b, s, len);
+}
+
+/* Reads into a zeroed buffer of @max bytes, always NUL-terminated */
+static void snap_get_str(struct snap_buf *b, char *s, size_t max)
+{
+	uint8_t len;
+
+	snap_get(b, &len, 1);
+	if (len >= max) {
+		b->ok = false;
+		return;
+	}
+	snap_get(b, s, len);
+	s[len] = '\0';
+}
+
+static size_t snap_encode(const struct app_profile *p, uint32_t layout, uint8_t *out, size_t len)
+{
+	struct snap_buf b = { out, out + len, true };
+	uint32_t uid = (uint32_t)p->current_uid;
+	uint8_t allow_su = p->allow_su;
+	uint8_t use_default = allow_su ? p->rp_config.use_default : p->nrp_config.use_default;
+
+	snap_put(&b, &uid, 4);
+	snap_put(&b, &allow_su, 1);
+	snap_put(&b, &use_default, 1);
+	snap_put_str(&b, p->key, sizeof(p->key));
+
+	if (allow_su) {
+		const struct root_profile *rp = &p->rp_config.profile;
+		int32_t groups = rp->groups_count;
+
+		if (groups < 0 || groups > KSU_MAX_GROUPS)
+			groups = 0;
+		snap_put_str(&b, p->rp_config.template_name, sizeof(p->rp_config.template_name));
+		snap_put(&b, &rp->uid, 4);
+		snap_put(&b, &rp->gid, 4);
+		snap_put(&b, &groups, 4);
+		snap_put(&b, rp->groups, groups * sizeof(rp->groups[0]));
+		snap_put(&b, &rp->capabilities.effective, 8);
+		snap_put(&b, &rp->capabilities.permitted, 8);
+		snap_put(&b, &rp->capabilities.inheritable, 8);
+		snap_put_str(&b, rp->selinux_domain, sizeof(rp->selinux_domain));
+		snap_put(&b, &rp->namespaces, 4);
+		if (layout & SNAP_LAYOUT_ROOT_FLAGS)
+			snap_put(&b, &rp->flags, 8);
+	} else {
+		uint8_t umount = p->nrp_config.profile.umount_modules;
+		snap_put(&b, &umount, 1);
+	}
+	return b.ok ? (size_t)(b.p - out) : 0;
+}
+
+/* Rebuild a profile for this build's KSU_APP_PROFILE_VER */
+static bool snap_decode(const uint8_t *body, size_t len, uint32_t layout, struct app_profile *p)
+{
+	struct snap_buf b = { (uint8_t *)body, (uint8_t *)body + len, true };
+	uint32_t uid;
+	uint8_t allow_su, use_default;
+
+	memset(p, 0, sizeof(*p));
+	p->version = KSU_APP_PROFILE_VER;
+	snap_get(&b, &uid, 4);
+	snap_get(&b, &allow_su, 1);
+	snap_get(&b, &use_default, 1);
+	snap_get_str(&b, p->key, sizeof(p->key));
+	p->current_uid = (int32_t)uid;
+	p->allow_su = allow_su;
+
+	if (allow_su) {
+		struct root_profile *rp = &p->rp_config.profile;
+
+		p->rp_config.use_default = use_default;
+		snap_get_str(&b, p->rp_config.template_name, sizeof(p->rp_config.template_name));
+		snap_get(&b, &rp->uid, 4);
+		snap_get(&b, &rp->gid, 4);
+		snap_get(&b, &rp->groups_count, 4);
+		if (rp->groups_count < 0 || rp->groups_count > KSU_MAX_GROUPS)
+			return false;
+		snap_get(&b, rp->groups, rp->groups_count * sizeof(rp->groups[0]));
+		snap_get(&b, &rp->capabilities.effective, 8);
+		snap_get(&b, &rp->capabilities.permitted, 8);
+		snap_get(&b, &rp->capabilities.inheritable, 8);
+		snap_get_str(&b, rp->selinux_domain, sizeof(rp->selinux_domain));
+		snap_get(&b, &rp->namespaces, 4);
+		/* Snapshots from pre-v3 layouts have no flags word: leave it 0 */
+		if (layout & SNAP_LAYOUT_ROOT_FLAGS)
+			snap_get(&b, &rp->flags, 8);
+	} else {
+		uint8_t umount;
+
+		p->nrp_config.use_default = use_default;
+		snap_get(&b, &umount, 1);
+		p->nrp_config.profile.umount_modules = umount;
+	}
+	return b.ok && p->key[0];
+}
+
+/* Two profiles are the same if they encode to the same body */
+static bool snap_same(const struct app_profile *a, const struct app_profile *b)
+{
+	uint8_t ea[SNAP_BODY_MAX], eb[SNAP_BODY_MAX];
+	size_t la = snap_encode(a, SNAP_LAYOUT_ROOT_FLAGS, ea, sizeof(ea));
+	size_t lb = snap_encode(b, SNAP_LAYOUT_ROOT_FLAGS, eb, sizeof(eb));
+
+	return la && la == lb && !memcmp(ea, eb, la);
+}
+
+/* Installed packages by name, to find the UID a package has now */
+struct pkg_index {
+	struct pkg_uid {
+		char *name;
+		uint32_t uid;
+	} *v;
+	size_t count, cap;
+	bool oom;
+};
+
+static int pkg_index_add(const struct pkg_entry *e, void *arg)
+{
+	struct pkg_index *idx = arg;
+
+	if (idx->count == idx->cap) {
+		size_t cap = idx->cap ? idx->cap * 2 : 256;
+		struct pkg_uid *v = realloc(idx->v, cap * sizeof(*v));
+
+		if (!v) {
+			idx->oom = true;
+			return 1;
+		}
+		idx->v = v;
+		idx->cap = cap;
+	}
+	idx->v[idx->count].name = strndup(e->name, e->name_len);
+	if (!idx->v[idx->count].name) {
+		idx->oom = true;
+		return 1;
+	}
+	idx->v[idx->count++].uid = e->uid;
+	return 0;
+}
+
+static int pkg_uid_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct pkg_uid *)a)->name, ((const struct pkg_uid *)b)->name);
+}
+
+static void pkg_index_free(struct pkg_index *idx)
+{
+	for (size_t i = 0; i < idx->count; i++)
+		free(idx->v[i].name);
+	free(idx->v);
+}
+
+/* Sorted index of @path; returns 0, or -1 with errno set */
+static int pkg_index_load(struct pkg_index *idx, const char *path)
+{
+	memset(idx, 0, sizeof(*idx));
+	if (for_each_package(path, pkg_index_add, idx) < 0)
+		return -1;
+	if (idx->oom) {
+		pkg_index_free(idx);
+		errno = ENOMEM;
+		return -1;
+	}
+	qsort(idx->v, idx->count, sizeof(*idx->v), pkg_uid_cmp);
+	return 0;
+}
+
+static const struct pkg_uid *pkg_index_find(const struct pkg_index *idx, const char *name)
+{
+	struct pkg_uid key = { .name = (char *)name };
+
+	return idx->count ? bsearch(&key, idx->v, idx->count, sizeof(*idx->v), pkg_uid_cmp) : NULL;
+}
+
+struct export_state {
+	struct ksu_ctx *ctx;
+	struct uid_set seen;
+	FILE *out;
+	uint32_t count;
+	size_t bytes;
+	int failed;
+	bool abort;
+};
+
+static int export_one(const struct pkg_entry *e, void *arg)
+{
+	struct export_state *s = arg;
+	struct app_profile profile = { 0 };
+	uint8_t body[SNAP_BODY_MAX];
+	const char *failed_op = NULL;
+	uint16_t len;
+	uint8_t ver;
+
+	/* Shared UIDs have one profile */
+	if (!uid_set_mark(&s->seen, e->uid, 1))
+		return 0;
+	if (ksu_become_manager(s->ctx, &failed_op)) {
+		REPORT_ERR(failed_op, errno);
+		s->abort = true;
+		return 1;
+	}
+
+	profile.current_uid = (int32_t)e->uid;
+	if (ioctl(s->ctx->fd, KSU_IOCTL_GET_APP_PROFILE, &profile) < 0) {
+		if (errno != ENOENT) {
+			printf("%-6u %.*s: KSU_IOCTL_GET_APP_PROFILE: %s\n", e->uid, (int)e->name_len,
+			       e->name, strerror(errno));
+			s->failed++;
+		}
+		return 0;
+	}
+
+	len = (uint16_t)snap_encode(&profile, SNAP_LAYOUT_ROOT_FLAGS, body, sizeof(body));
+	ver = (uint8_t)profile.version;
+	if (!len || fwrite(&len, 2, 1, s->out) != 1 || fwrite(&ver, 1, 1, s->out) != 1 ||
+	    fwrite(body, len, 1, s->out) != 1) {
+		s->failed++;
+		return 0;
+	}
+	s->count++;
+	s->bytes += 3 + len;
+	return 0;
+}
+
+/**
+ * run_export - Save every profile of an installed package to a snapshot
+ * @path: snapshot file, replaced atomically
+ * @packages_list: source of the UIDs to query
+ */
+static int run_export(const char *path, const char *packages_list)
+{
+	struct snap_header hdr = { .magic = SNAP_MAGIC, .format = SNAP_FORMAT,
+				   .profile_ver = KSU_APP_PROFILE_VER,
+				   .layout = SNAP_LAYOUT_ROOT_FLAGS };
+	struct export_state s = { 0 };
+	struct ksu_ctx ctx;
+	char tmp[PATH_MAX];
+	long long start = bench_mono_ns();
+	int n, ret = 1;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	s.out = fopen(tmp, "we");
+	if (!s.out) {
+		REPORT_ERR(tmp, errno);
+		return 1;
+	}
+	if (uid_set_init(&s.seen, UID_SET_MIN_CAP)) {
+		REPORT_ERR("malloc", errno);
+		goto out_file;
+	}
+	if (ksu_open(&ctx))
+		goto out_set;
+	/* packages.list is mapped as root, profiles are read as the manager */
+	ctx.reversible = true;
+	s.ctx = &ctx;
+
+	fwrite(&hdr, sizeof(hdr), 1, s.out);
+	n = for_each_package(packages_list, export_one, &s);
+	ksu_leave_manager(&ctx);
+	close(ctx.fd);
+	if (n < 0) {
+		REPORT_ERR(packages_list, errno);
+		goto out_set;
+	}
+	if (s.abort)
+		goto out_set;
+
+	hdr.count = s.count;
+	if (fseek(s.out, 0, SEEK_SET) || fwrite(&hdr, sizeof(hdr), 1, s.out) != 1 ||
+	    fclose(s.out)) {
+		s.out = NULL;
+		REPORT_ERR(tmp, errno);
+		goto out_set;
+	}
+	s.out = NULL;
+	if (rename(tmp, path)) {
+		REPORT_ERR("rename", errno);
+		goto out_set;
+	}
+
+	printf("Exported %u profiles from %d packages to %s: %zu bytes, %.0f bytes/profile "
+	       "(struct app_profile is %zu), %d failed in %.3f ms\n",
+	       s.count, n, path, sizeof(hdr) + s.bytes,
+	       s.count ? (double)s.bytes / s.count : 0.0, sizeof(struct app_profile), s.failed,
+	       (bench_mono_ns() - start) / 1e6);
+	ret = s.failed ? 1 : 0;
+
+out_set:
+	uid_set_free(&s.seen);
+out_file:
+	if (s.out)
+		fclose(s.out);
+	if (ret)
+		unlink(tmp);
 	return ret;
 }
+
+/**
+ * run_import - Restore profiles from a snapshot, skipping unchanged ones
+ * @path: snapshot written by run_export()
+ * @packages_list: package database giving each package its current UID
+ *
+ * Records are rebuilt field by field for this build's struct layout.
+ * Older profile versions are upgraded; newer ones may carry fields this
+ * build does not know, so they are skipped rather than truncated.
+ * A reflash or an update can reassign app UIDs, so each profile goes to
+ * the UID its package has now, in the user it was exported from, and
+ * packages that are not installed are skipped.
+ */
+static int run_import(const char *path, const char *packages_list)
+{
+	int counts[APPLY_FAILED + 1] = { 0 };
+	struct snap_header hdr;
+	struct ksu_ctx ctx;
+	struct pkg_index idx;
+	const char *failed_op = NULL;
+	long long start = bench_mono_ns();
+	int newer = 0, upgraded = 0, bad = 0, missing = 0, moved = 0;
+	uint32_t i;
+	FILE *in;
+
+	in = fopen(path, "re");
+	if (!in) {
+		REPORT_ERR(path, errno);
+		return 1;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, in) != 1 || memcmp(hdr.magic, SNAP_MAGIC, sizeof(hdr.magic))) {
+		fprintf(stderr, "ERROR: %s is not a ksu_profile snapshot\n", path);
+		fclose(in);
+		return 1;
+	}
+	if (hdr.format > SNAP_FORMAT) {
+		fprintf(stderr, "ERROR: %s uses snapshot format %u, this build reads up to %u\n",
+			path, hdr.format, SNAP_FORMAT);
+		fclose(in);
+		return 1;
+	}
+	if (hdr.profile_ver != KSU_APP_PROFILE_VER)
+		printf("Note: exported with profile version %u, this build uses %u\n",
+		       hdr.profile_ver, KSU_APP_PROFILE_VER);
+	if (!(hdr.layout & SNAP_LAYOUT_ROOT_FLAGS))
+		printf("Note: snapshot predates the root_profile flags word, root profiles get flags 0\n");
+
+	/* The manager cannot read packages.list, so index it first */
+	if (pkg_index_load(&idx, packages_list)) {
+		REPORT_ERR(packages_list, errno);
+		fclose(in);
+		return 1;
+	}
+	if (ksu_open(&ctx)) {
+		pkg_index_free(&idx);
+		fclose(in);
+		return 1;
+	}
+	if (ksu_become_manager(&ctx, &failed_op)) {
+		REPORT_ERR(failed_op, errno);
+		close(ctx.fd);
+		pkg_index_free(&idx);
+		fclose(in);
+		return 1;
+	}
+
+	for (i = 0; i < hdr.count; i++) {
+		struct app_profile want, cur = { 0 };
+		uint8_t body[SNAP_BODY_MAX];
+		const struct pkg_uid *pkg;
+		enum apply_result res;
+		uint16_t len;
+		uint8_t ver;
+		int32_t uid;
+
+		if (fread(&len, 2, 1, in) != 1 || fread(&ver, 1, 1, in) != 1 || len > sizeof(body) ||
+		    fread(body, len, 1, in) != 1) {
+			fprintf(stderr, "ERROR: %s: truncated at record %u of %u\n", path, i, hdr.count);
+			bad++;
+			break;
+		}
+		if (!snap_decode(body, len, hdr.layout, &want)) {
+			fprintf(stderr, "ERROR: %s: record %u is malformed\n", path, i);
+			bad++;
+			continue;
+		}
+		if (ver > KSU_APP_PROFILE_VER) {
+			printf("%-6d %-48s skipped: profile version %u is newer than %u\n",
+			       want.current_uid, want.key, ver, KSU_APP_PROFILE_VER);
+			newer++;
+			continue;
+		}
+		upgraded += ver < KSU_APP_PROFILE_VER;
+
+		pkg = pkg_index_find(&idx, want.key);
+		if (!pkg) {
+			printf("%-6d %-48s skipped: not installed\n", want.current_uid, want.key);
+			missing++;
+			continue;
+		}
+		uid = (int32_t)(want.current_uid / PER_USER_RANGE * PER_USER_RANGE +
+				pkg->uid % PER_USER_RANGE);
+		if (uid != want.current_uid) {
+			printf("%-6d %-48s now UID %d\n", want.current_uid, want.key, uid);
+			want.current_uid = uid;
+			moved++;
+		}
+
+		cur.current_uid = want.current_uid;
+		if (ioctl(ctx.fd, KSU_IOCTL_GET_APP_PROFILE, &cur) == 0 && snap_same(&cur, &want)) {
+			counts[APPLY_UNCHANGED]++;
+			continue;
+		}
+		res = cur.key[0] ? APPLY_UPDATED : APPLY_CREATED;
+		if (ioctl(ctx.fd, KSU_IOCTL_SET_APP_PROFILE, &want) < 0) {
+			printf("%-6d %-48s failed: KSU_IOCTL_SET_APP_PROFILE (%s)%s\n", want.current_uid,
+			       want.key, strerror(errno),
+			       errno == EINVAL ? ", driver may expect another profile version" : "");
+			res = APPLY_FAILED;
+		} else {
+			printf("%-6d %-48s %s\n", want.current_uid, want.key, apply_result_name[res]);
+		}
+		counts[res]++;
+	}
+
+	close(ctx.fd);
+	pkg_index_free(&idx);
+	fclose(in);
+
+	printf("%u records: %d updated, %d created, %d unchanged, %d failed, %d newer, "
+	       "%d upgraded, %d malformed, %d not installed, %d moved to a new UID in %.3f ms\n",
+	       hdr.count, counts[APPLY_UPDATED], counts[APPLY_CREATED], counts[APPLY_UNCHANGED],
+	       counts[APPLY_FAILED], newer, upgraded, bad, missing, moved,
+	       (bench_mono_ns() - start) / 1e6);
+	return counts[APPLY_FAILED] || bad ? 1 : 0;
+}
+
+static char *short_options = "hb:sdBn:e:i:g:DjP:";
+static struct option long_options[] = {
+	{"help", no_argument, 0, 'h'},
+	{"batch", required_argument, 0, 'b'},
+	{"sync", no_argument, 0, 's'},
+	{"daemon", no_argument, 0, 'd'},
+	{"bench", no_argument, 0, 'B'},
+	{"iterations", required_argument, 0, 'n'},
+	{"export", required_argument, 0, 'e'},
+	{"import", required_argument, 0, 'i'},
+	{"get", required_argument, 0, 'g'},
+	{"dump", no_argument, 0, 'D'},
+	{"json", no_argument, 0, 'j'},
+	{"packages-list", required_argument, 0, 'P'},
+	{0, 0, 0, 0}
+};
+
+static void print_help(char *prog_name)
+{
+	fprintf(stderr,
+		"ksu_profile (github.com/AzyrRuthless & github.com/j-hc)\n"
+		"Disables \"Unmount modules\" for given package\n"
+		"Usage: %s <uid> <pkg name>\n"
+		"       %s [options]\n"
+		"\n"
+		"Options:\n"
+		"  -h, --help\tshow usage help\n"
+		"  -b, --batch\tapply \"<uid> <pkg name>\" lines from FILE (- for stdin)\n"
+		"  -s, --sync\tapply to every installed app, writing only changed profiles\n"
+		"  -d, --daemon\tsync, then watch the package database and apply to new apps\n"
+		"  -B, --bench\t[uid]: time each driver ioctl and a package scan, read-only\n"
+		"  -n, --iterations\tcalls per ioctl in bench mode (default: %d)\n"
+		"  -e, --export\tsave the profiles of all installed packages to FILE\n"
+		"  -i, --import\trestore profiles from FILE to the packages' current UIDs\n"
+		"  -g, --get\tshow the profile of UID, read-only\n"
+		"  -D, --dump\tshow the profiles of all installed packages, read-only\n"
+		"  -j, --json\tprint --get/--dump output as JSON\n"
+		"  -P, --packages-list\tpackage database (default: %s)\n",
+		prog_name, prog_name, BENCH_ITERATIONS_DEFAULT, PACKAGES_LIST);
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *batch = NULL;
+	const char *packages_list = PACKAGES_LIST;
+	bool sync = false;
+	bool daemon = false;
+	bool bench = false;
+	int iterations = BENCH_ITERATIONS_DEFAULT;
+	const char *export_path = NULL;
+	const char *import_path = NULL;
+	long get_uid = -1;
+	bool dump = false;
+	enum query_format format = QUERY_TABLE;
+
+	while (1) {
+		int c = getopt_long(argc, argv, short_options, long_options, NULL);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'b':
+			batch = optarg;
+			break;
+		case 's':
+			sync = true;
+			break;
+		case 'd':
+			daemon = true;
+			break;
+		case 'B':
+			bench = true;
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations <= 0)
+				print_help(argv[0]);
+			break;
+		case 'e':
+			export_path = optarg;
+			break;
+		case 'i':
+			import_path = optarg;
+			break;
+		case 'g':
+			get_uid = atol(optarg);
+			if (get_uid < 0)
+				print_help(argv[0]);
+			break;
+		case 'D':
+			dump = true;
+			break;
+		case 'j':
+			format = QUERY_JSON;
+			break;
+		case 'P':
+			packages_list = optarg;
+			break;
+		case '?':
+		case 'h':
+		default:
+			print_help(argv[0]);
+			break;
+		}
+	}
+
+	if (batch)
+		return run_batch(batch);
+	if (sync)
+		return run_sync(packages_list);
+	if (daemon)
+		return run_daemon(packages_list);
+	if (export_path)
+		return run_export(export_path, packages_list);
+	if (import_path)
+		return run_import(import_path, packages_list);
+	if (get_uid >= 0 || dump)
+		return run_query(get_uid, packages_list, format);
+	if (bench)
+		return run_bench(optind < argc ? atol(argv[optind]) : -1, packages_list, iterations);
+
+	if (argc - optind < 2)
+		print_help(argv[0]);
+
+	return run_single(atol(argv[optind]), argv[optind + 1]);
+}
@@ -9,7 +9,7 @@
  * Refactored for modern Linux/Android environments.
  */
 
-#define _POSIX_C_SOURCE 199309L /* Required for clock_gettime */
+#define _GNU_SOURCE /* clock_gettime and the CPU_* affinity macros */
 
 #include <unistd.h>
 #include <stdio.h>
@@ -26,6 +26,12 @@
 #include <stdint.h>
 #include <inttypes.h>
 
+#include "../common/bench.h"
+#include "../common/perfctr.h"
+#include "../common/runctl.h"
+#include "../common/topo.h"
+#include "../common/tracemark.h"
+
 #define BUG_ON(condition) do { \
 	if (condition) { \
 		fprintf(stderr, "Bug on: %s\n", #condition); \
@@ -36,22 +42,58 @@
 #define USEC_PER_SEC 1000000
 #define USEC_PER_MSEC 1000
 
+/* Longest round trip the histogram resolves; slower ones count as overflow */
+#define RTT_MAX_NS (1000 * 1000 * 1000)
+
 struct thread_data {
 	int nr;
 	int pipe_read;
 	int pipe_write;
 	pthread_t pthread;
+	int cpu;		/* pinned here unless -1 */
+	struct bench_hist *rtt;	/* round trips, timed by thread 1 */
+};
+
+/* One measurement: both ends, the whole run and its round trips */
+struct pair_result {
+	double diff_sec;
+	struct bench_stats rtt;
+	bool throttled;
 };
 
 #define LOOPS_DEFAULT 1000000
 static int loops = LOOPS_DEFAULT;
 static bool threaded = false;
+static enum bench_format format = BENCH_FMT_TEXT;
+static const char *cpu_spec = NULL;
+static bool sweep = false;
+static struct runctl rc;
+static bool counters = false;
+static struct perfctr pc;
+static bool trace = false, trace_arm = false;
+static struct tracemark tm = TRACEMARK_INIT;
+static int round_nr = 0;
 
 static void print_usage(const char *prog_name) {
 	printf("Usage: %s [options]\n", prog_name);
 	printf("Options:\n");
 	printf("  -l, --loop <number>     Specify number of loops (default: %d)\n", LOOPS_DEFAULT);
 	printf("  -T, --threaded          Use threads instead of processes\n");
+	printf("  -o, --format <format>   Output: text, csv or json (default: text)\n");
+	printf("  -c, --cpus <spec>       Pin the two ends to the first two CPUs of spec\n");
+	printf("                          (a cpulist, little, big, prime, clusterN, domainN,\n");
+	printf("                          llcN)\n");
+	printf("  -S, --sweep             Measure same-CPU, SMT, same-cluster, cross-cluster\n");
+	printf("                          and shared/split last-level cache pairs from the\n");
+	printf("                          CPU topology\n");
+	printf("  -e, --counters          Count cycles, instructions, misses, context\n");
+	printf("                          switches, migrations and page faults per\n");
+	printf("                          round trip, over both ends\n");
+	printf("  -t, --trace             Mark setup, measure and round boundaries in\n");
+	printf("                          trace_marker for ftrace and Perfetto captures\n");
+	printf("  -A, --trace-arm         As -t, and keep tracing_on only while measuring\n");
+	printf("\nBENCH_COOL=<degrees C> waits for the CPUs to cool down before each run,\n");
+	printf("BENCH_THROTTLED=discard reruns throttled runs.\n");
 }
 
 static void parse_options(int argc, char **argv) {
@@ -66,6 +108,27 @@ static void parse_options(int argc, char **argv) {
 			}
 		} else if (strcmp(argv[i], "-T") == 0 || strcmp(argv[i], "--threaded") == 0) {
 			threaded = true;
+		} else if (strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "--format") == 0) {
+			if (i + 1 >= argc || bench_format_parse(argv[++i], &format)) {
+				fprintf(stderr, "Error: --format takes text, csv or json\n");
+				print_usage(argv[0]);
+				exit(1);
+			}
+		} else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--cpus") == 0) {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "Error: --cpus requires a value\n");
+				print_usage(argv[0]);
+				exit(1);
+			}
+			cpu_spec = argv[++i];
+		} else if (strcmp(argv[i], "-S") == 0 || strcmp(argv[i], "--sweep") == 0) {
+			sweep = true;
+		} else if (strcmp(argv[i], "-e") == 0 || strcmp(argv[i], "--counters") == 0) {
+			counters = true;
+		} else if (strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--trace") == 0) {
+			trace = true;
+		} else if (strcmp(argv[i], "-A") == 0 || strcmp(argv[i], "--trace-arm") == 0) {
+			trace = trace_arm = true;
 		} else {
 			print_usage(argv[0]);
 			exit(1);
@@ -73,18 +136,14 @@ static void parse_options(int argc, char **argv) {
 	}
 }
 
-static void get_mono_time(struct timespec *ts) {
-	if (clock_gettime(CLOCK_MONOTONIC, ts) == -1) {
-		perror("clock_gettime");
-		exit(1);
-	}
-}
-
 static void *worker_thread(void *__tdata) {
 	struct thread_data *td = (struct thread_data *)__tdata;
 	int m = 0;
 	ssize_t ret;
 
+	if (td->cpu >= 0)
+		BUG_ON(bench_pin_cpu(td->cpu));
+
 	for (int i = 0; i < loops; i++) {
 		if (!td->nr) {
 			/* Thread 0: Read -> Write */
@@ -93,32 +152,53 @@ static void *worker_thread(void *__tdata) {
 			ret = write(td->pipe_write, &m, sizeof(int));
 			BUG_ON(ret != sizeof(int));
 		} else {
-			/* Thread 1: Write -> Read */
+			/* Thread 1: Write -> Read, one round trip */
+			uint64_t t0 = bench_ticks();
 			ret = write(td->pipe_write, &m, sizeof(int));
 			BUG_ON(ret != sizeof(int));
 			ret = read(td->pipe_read, &m, sizeof(int));
 			BUG_ON(ret != sizeof(int));
+			bench_hist_add(td->rtt, (uint64_t)bench_ticks_to_ns(bench_ticks() - t0));
 		}
 	}
 
 	return NULL;
 }
 
-int main(int argc, char **argv) {
+/*
+ * Run the benchmark once with the ends on cpu0 and cpu1 (-1: unpinned).
+ * The calling thread is one of the ends in process mode, so its
+ * affinity is restored afterwards.
+ */
+static int run_pair(int cpu0, int cpu1, struct pair_result *res) {
 	struct thread_data threads[2];
 	int pipe_1[2], pipe_2[2];
-	struct timespec start, stop;
-	double result_usec = 0;
-	double diff_sec = 0;
+	struct bench_hist rtt;
+	cpu_set_t orig;
+	uint64_t start, stop;
 	int nr_threads = 2;
 
-	parse_options(argc, argv);
+	tracemark_begin(&tm, "setup");
+
+	/* Fail here, not in a worker, if a CPU cannot be used */
+	BUG_ON(sched_getaffinity(0, sizeof(orig), &orig));
+	if ((cpu0 >= 0 && bench_pin_cpu(cpu0)) || (cpu1 >= 0 && bench_pin_cpu(cpu1))) {
+		int err = errno;
+
+		sched_setaffinity(0, sizeof(orig), &orig);
+		tracemark_end(&tm);
+		errno = err;
+		return -1;
+	}
 
 	BUG_ON(pipe(pipe_1));
 	BUG_ON(pipe(pipe_2));
+	BUG_ON(bench_hist_init(&rtt, RTT_MAX_NS));
 
 	for (int t = 0; t < nr_threads; t++) {
 		threads[t].nr = t;
+		threads[t].cpu = t == 0 ? cpu0 : cpu1;
+		threads[t].rtt = &rtt;
 		if (t == 0) {
 			threads[t].pipe_read = pipe_1[0];
 			threads[t].pipe_write = pipe_2[1];
@@ -128,7 +208,12 @@ int main(int argc, char **argv) {
 		}
 	}
 
-	get_mono_time(&start);
+	tracemark_end(&tm);
+	tracemark_arm(&tm);
+	tracemark_begin(&tm, "measure");
+	if (counters)
+		perfctr_begin(&pc);
+	start = bench_ticks();
 
 	if (threaded) {
 		for (int t = 0; t < nr_threads; t++) {
@@ -141,6 +226,7 @@ int main(int argc, char **argv) {
 			BUG_ON(ret);
 		}
 	} else {
+		fflush(stdout);	/* the child exits through exit() */
 		pid_t pid = fork();
 		assert(pid >= 0);
 
@@ -156,19 +242,287 @@ int main(int argc, char **argv) {
 		assert((retpid == pid) && WIFEXITED(wait_stat));
 	}
 
-	get_mono_time(&stop);
+	stop = bench_ticks();
+	if (counters)
+		perfctr_end(&pc);
+	tracemark_end(&tm);
+	tracemark_disarm(&tm);
+
+	res->diff_sec = bench_ticks_to_ns(stop - start) / 1e9;
+	bench_hist_stats(&rtt, &res->rtt);
+	bench_hist_free(&rtt);
+	for (int i = 0; i < 2; i++) {
+		close(pipe_1[i]);
+		close(pipe_2[i]);
+	}
+	sched_setaffinity(0, sizeof(orig), &orig);
+	return 0;
+}
+
+struct pair_round {
+	int cpu0, cpu1;
+	struct pair_result *res;
+};
+
+static int pair_round(void *arg) {
+	struct pair_round *r = arg;
+	int ret;
+
+	tracemark_begin(&tm, "round %d", ++round_nr);
+	ret = run_pair(r->cpu0, r->cpu1, r->res);
+	tracemark_end(&tm);
+	return ret;
+}
+
+static void pair_discard(void *arg) {
+	(void)arg;
+	if (counters)
+		perfctr_discard(&pc);
+	fprintf(stderr, "Throttled, running again\n");
+}
+
+/* run_pair() as a round of the run controller; a throttled run is tagged */
+static int run_controlled(int cpu0, int cpu1, struct pair_result *res) {
+	struct pair_round r = { cpu0, cpu1, res };
+	enum runctl_verdict verdict;
+
+	if (counters)
+		perfctr_reset(&pc);
+	if (runctl_run(&rc, 0, pair_round, pair_discard, &r, &verdict))
+		return -1;
+	res->throttled = verdict != RUNCTL_KEEP;
+	return 0;
+}
+
+struct sweep_pair {
+	const char *kind;
+	int cpu0, cpu1;
+};
+
+/*
+ * With more than one last-level cache, two cores that share one against
+ * two that don't; a single LLC is shared by every pair above.
+ */
+static void llc_pairs(const struct topo *t, struct sweep_pair *pairs, int *n, int max) {
+	int first = topo_nth_cpu(&t->online, 0);
+	int shared = -1, split = -1;
+	int level;
+
+	if (first < 0 || t->cpu[first].llc < 0)
+		return;
+	level = t->caches[t->cpu[first].llc].level;
+	for (int c = first + 1; c < t->nr_cpus; c++) {
+		if (!t->cpu[c].online || t->cpu[c].llc < 0 ||
+		    t->cpu[c].core == t->cpu[first].core)
+			continue;
+		if (topo_share_cache(t, first, c, level)) {
+			if (shared < 0)
+				shared = c;
+		} else if (split < 0) {
+			split = c;
+		}
+	}
+	if (split < 0)
+		return;
+	if (shared >= 0 && *n < max)
+		pairs[(*n)++] = (struct sweep_pair){ "llc-shared", first, shared };
+	if (*n < max)
+		pairs[(*n)++] = (struct sweep_pair){ "llc-split", first, split };
+}
+
+/* Representative pairs: one of each relation the topology has */
+static int sweep_pairs(const struct topo *t, struct sweep_pair *pairs, int max) {
+	int n = 0;
+
+	for (int c = 0; c < t->nr_clusters && n < max; c++) {
+		const struct topo_group *g = &t->clusters[c];
+		int first = g->first;
+
+		pairs[n++] = (struct sweep_pair){ "same-cpu", first, first };
+		for (int i = 1; i < g->count && n < max; i++) {
+			int other = topo_nth_cpu(&g->cpus, i);
+			if (t->cpu[other].core == t->cpu[first].core) {
+				pairs[n++] = (struct sweep_pair){ "smt", first, other };
+				break;
+			}
+		}
+		for (int i = 1; i < g->count && n < max; i++) {
+			int other = topo_nth_cpu(&g->cpus, i);
+			if (t->cpu[other].core != t->cpu[first].core) {
+				pairs[n++] = (struct sweep_pair){ "same-cluster", first, other };
+				break;
+			}
+		}
+	}
+	for (int a = 0; a < t->nr_clusters; a++)
+		for (int b = a + 1; b < t->nr_clusters && n < max; b++)
+			pairs[n++] = (struct sweep_pair){ "cross-cluster", t->clusters[a].first,
+							  t->clusters[b].first };
+	llc_pairs(t, pairs, &n, max);
+	return n;
+}
+
+static int run_sweep(void) {
+	struct topo *t = topo_load();
+	struct sweep_pair pairs[64];
+	struct bench_out out;
+	int n;
+
+	if (!t) {
+		perror("topo_load");
+		return 1;
+	}
+	n = sweep_pairs(t, pairs, sizeof(pairs) / sizeof(pairs[0]));
+
+	if (format == BENCH_FMT_TEXT) {
+		topo_print(t, stdout);
+		printf("\n# %d pipe operations per pair between two %s\n\n", loops,
+		       threaded ? "threads" : "processes");
+		printf(" %-14s %-7s %-7s %10s %10s %10s %10s\n", "pair", "cpus", "cluster",
+		       "usecs/op", "rtt p50", "rtt p99", "rtt max");
+	} else {
+		bench_out_begin(&out, stdout, format, "pipe-latency");
+	}
+
+	for (int i = 0; i < n; i++) {
+		struct pair_result res;
+		char cpus[16], name[64];
 
-	diff_sec = (stop.tv_sec - start.tv_sec) + 
-		   (double)(stop.tv_nsec - start.tv_nsec) / 1e9;
-	
+		snprintf(cpus, sizeof(cpus), "%d,%d", pairs[i].cpu0, pairs[i].cpu1);
+		tracemark_begin(&tm, "pair %s %s", pairs[i].kind, cpus);
+		if (run_controlled(pairs[i].cpu0, pairs[i].cpu1, &res)) {
+			tracemark_end(&tm);
+			fprintf(stderr, "%s %s: %s\n", pairs[i].kind, cpus, strerror(errno));
+			continue;
+		}
+		tracemark_end(&tm);
+		if (format == BENCH_FMT_TEXT) {
+			printf(" %-14s %-7s %-7s %10.3f %10.3f %10.3f %10.3f%s\n", pairs[i].kind, cpus,
+			       topo_cluster_name(t, t->cpu[pairs[i].cpu0].cluster),
+			       res.diff_sec * USEC_PER_SEC / loops, res.rtt.p50 / 1e3,
+			       res.rtt.p99 / 1e3, res.rtt.max / 1e3, res.throttled ? "  throttled" : "");
+			if (counters)
+				perfctr_print(&pc.total, stdout, loops, "round trip", "   ");
+			fflush(stdout);
+		} else {
+			snprintf(name, sizeof(name), "%s.%d-%d.round_trip", pairs[i].kind,
+				 pairs[i].cpu0, pairs[i].cpu1);
+			bench_out_stats(&out, name, "ns", &res.rtt);
+			if (res.throttled) {
+				snprintf(name, sizeof(name), "%s.%d-%d.throttled", pairs[i].kind,
+					 pairs[i].cpu0, pairs[i].cpu1);
+				bench_out_value(&out, name, "runs", 1);
+			}
+			if (counters) {
+				snprintf(name, sizeof(name), "%s.%d-%d.", pairs[i].kind, pairs[i].cpu0,
+					 pairs[i].cpu1);
+				perfctr_out(&pc.total, &out, name, loops, "rtt");
+			}
+		}
+	}
+
+	if (format == BENCH_FMT_TEXT) {
+		putchar('\n');
+		runctl_print(&rc, stdout);
+	} else {
+		runctl_out(&rc, &out, "");
+		bench_out_end(&out);
+	}
+	topo_free(t);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	struct pair_result res;
+	double result_usec = 0;
+	double diff_sec = 0;
+	int cpu0 = -1, cpu1 = -1;
+
+	parse_options(argc, argv);
+	if (runctl_init(&rc)) {
+		fprintf(stderr, "Error: BENCH_THROTTLED must be tag or discard\n");
+		exit(1);
+	}
+	/* Before the second end exists, so that it inherits the counters */
+	if (counters && perfctr_open(&pc, PERFCTR_INHERIT) < 0) {
+		fprintf(stderr, "Warning: no perf counters: %s\n", strerror(errno));
+		counters = false;
+	}
+	if (trace && tracemark_open(&tm, "pipe-latency", trace_arm) < 0) {
+		fprintf(stderr, "Error: can't write trace markers: %s\n", strerror(errno));
+		exit(1);
+	}
+	bench_clock_init();
+
+	if (sweep) {
+		int ret = run_sweep();
+
+		tracemark_close(&tm);
+		return ret;
+	}
+
+	if (cpu_spec) {
+		struct topo *t = topo_load();
+		cpu_set_t set;
+
+		if (!t || topo_parse_spec(t, cpu_spec, &set)) {
+			fprintf(stderr, "Error: no online CPU in --cpus %s\n", cpu_spec);
+			exit(1);
+		}
+		cpu0 = topo_nth_cpu(&set, 0);
+		cpu1 = CPU_COUNT(&set) > 1 ? topo_nth_cpu(&set, 1) : cpu0;
+		topo_free(t);
+	}
+
+	if (run_controlled(cpu0, cpu1, &res)) {
+		perror("sched_setaffinity");
+		exit(1);
+	}
+	tracemark_close(&tm);
+	diff_sec = res.diff_sec;
 	result_usec = diff_sec * USEC_PER_SEC;
 
-	printf("# Executed %d pipe operations between two %s\n\n", 
-		loops, threaded ? "threads" : "processes");
+	if (format != BENCH_FMT_TEXT) {
+		struct bench_out out;
+
+		bench_out_begin(&out, stdout, format, "pipe-latency");
+		bench_out_value(&out, threaded ? "threads.total" : "processes.total", "s", diff_sec);
+		bench_out_value(&out, threaded ? "threads.op" : "processes.op", "us",
+				result_usec / (double)loops);
+		bench_out_stats(&out, threaded ? "threads.round_trip" : "processes.round_trip", "ns",
+				&res.rtt);
+		if (res.throttled)
+			bench_out_value(&out, threaded ? "threads.throttled" : "processes.throttled",
+					"runs", 1);
+		if (counters)
+			perfctr_out(&pc.total, &out, threaded ? "threads." : "processes.", loops,
+				    "rtt");
+		runctl_out(&rc, &out, "");
+		bench_out_end(&out);
+		return 0;
+	}
+
+	printf("# Executed %d pipe operations between two %s", loops,
+	       threaded ? "threads" : "processes");
+	if (cpu0 >= 0)
+		printf(" on CPUs %d and %d", cpu0, cpu1);
+	printf("\n\n");
 
-	printf(" %14s: %.3f [sec]\n\n", "Total time", diff_sec);
+	printf(" %14s: %.3f [sec]%s\n\n", "Total time", diff_sec,
+	       res.throttled ? " (throttled)" : "");
 	printf(" %14.3f usecs/op\n", result_usec / (double)loops);
 	printf(" %14.0f ops/sec\n", (double)loops / diff_sec);
+	printf("\n Round trip (usecs): p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n",
+	       res.rtt.p50 / 1e3, res.rtt.p90 / 1e3, res.rtt.p99 / 1e3, res.rtt.p999 / 1e3,
+	       res.rtt.max / 1e3);
+	if (counters) {
+		putchar('\n');
+		perfctr_print(&pc.total, stdout, loops, "round trip", " ");
+	}
+	if (runctl_active(&rc)) {
+		putchar('\n');
+		runctl_print(&rc, stdout);
+	}
 
 	return 0;
 }
@@ -36,6 +36,8 @@
 #include <sys/types.h>
 #include <errno.h>
 
+#include "../common/bench.h"
+
 #ifdef sun
 #define u_int8_t uint8_t
 #define u_int16_t uint16_t
@@ -144,7 +146,7 @@ static void usage(void)
 	printf("Pipebench %1.2f, by Thomas Habets <thomas@habets.se>\n",
 	       version);
 	printf("usage: ... | pipebench [ -ehqQIoru ] [ -b <bufsize ] "
-	       "[ -s <file> | -S <file> ]\\\n           | ...\n");
+	       "[ -s <file> | -S <file> ]\\\n           [ -f text|csv|json ] | ...\n");
 }
 
 /*
@@ -169,10 +171,12 @@ int main(int argc, char **argv)
 	const char *statusfn = 0;
 	int unit = 1024;
 	char *buffer;
+	enum bench_format format = BENCH_FMT_TEXT;
+	uint64_t start_ticks, last_ticks;
 
 	statusf = stderr;
 
-	while (EOF != (c = getopt(argc, argv, "ehqQb:ros:S:Iu"))) {
+	while (EOF != (c = getopt(argc, argv, "ehqQb:ros:S:Iuf:"))) {
 		switch(c) {
 		case 'e':
 			errout = 1;
@@ -211,6 +215,12 @@ int main(int argc, char **argv)
 		case 'u':
 			dounit = 0;
 			break;
+		case 'f':
+			if (bench_format_parse(optarg, &format)) {
+				usage();
+				return 1;
+			}
+			break;
 		default:
 			usage();
 			return 1;
@@ -233,6 +243,8 @@ int main(int argc, char **argv)
 			return 1;
 		}
 	}
+	/* gettimeofday() drives the display, the summary uses the bench clock */
+	start_ticks = last_ticks = bench_ticks();
 
 	if ((SIG_ERR == signal(SIGINT, sigint))) {
 		perror("pipebench: signal()");
@@ -268,6 +280,7 @@ int main(int argc, char **argv)
 			fflush(stdout);
 		}
 
+		last_ticks = bench_ticks();
 		if (-1 == gettimeofday(&tv2,NULL)) {
 			perror("pipebench(): gettimeofday()");
 			if (errout) {
@@ -303,7 +316,16 @@ int main(int argc, char **argv)
 		}
 	}
 	free(buffer);
-	if (summary) {
+	if (summary && format != BENCH_FMT_TEXT) {
+		struct bench_out out;
+		double secs = bench_ticks_to_ns(last_ticks - start_ticks) / 1e9;
+
+		bench_out_begin(&out, statusf, format, "pipebench");
+		bench_out_value(&out, "bytes", "B", (double)datalen);
+		bench_out_value(&out, "time", "s", secs);
+		bench_out_value(&out, "throughput", "B/s", secs > 0 ? datalen / secs : 0);
+		bench_out_end(&out);
+	} else if (summary) {
 		float n;
 
 		if (-1 == gettimeofday(&tv,NULL)) {
@@ -313,8 +335,7 @@ int main(int argc, char **argv)
 			}
 		}
 
-		n = (tv2.tv_sec - start.tv_sec)
-			+ (tv2.tv_usec - start.tv_usec) / 1000000.0;
+		n = bench_ticks_to_ns(last_ticks - start_ticks) / 1e9;
 		fprintf(statusf,"                                     "
 			"            "
 			"                              "
@@ -0,0 +1,978 @@
+/*
+ * suite.c
+ *
+ * bench-suite: run a profile of the benchmarks in this repository, gather
+ * their structured output into one results file, and gate on a baseline.
+ *
+ * A profile is a text file: settings, then one benchmark per line as a
+ * label, the tool and its arguments. The suite adds the output options
+ * itself (-o json for the bench tools, --json - for syscall-check) and
+ * feeds pipebench from memory into /dev/null.
+ *
+ *   repeat 5            runs of every benchmark
+ *   alpha 0.01          significance level, after Holm's correction
+ *   threshold 3         smallest change in percent that counts
+ *   pipe_bytes 256M     data pushed through pipebench per run
+ *   callbench   callbench -m time -r 3
+ *   hackbench   hackbench -g 4 -l 200
+ *
+ * The results file holds the environment fingerprint, every tool's raw
+ * output and, per metric, the value of each run (the mean for rows with
+ * statistics). --compare lists fingerprint differences first, then
+ * tests each metric against the same one in a baseline results file
+ * with Welch's t-test over the runs; with repeat 1 it falls back to the
+ * within-run spread of rows that have one. Only times (s, ms, us, ns)
+ * and rates (per second) are gated. Exit status: 0, 1 on a significant
+ * regression, 2 if a benchmark or a file failed.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../common/bench.h"
+#include "../syscall/json.h"
+
+#define RESULTS_FORMAT "bench-suite/1"
+#define MAX_ARGS 32
+#define MAX_ENTRIES 32
+#define MAX_REPEAT 100
+#define FEED_CHUNK 65536
+
+#define EXIT_REGRESSION 1
+#define EXIT_ERROR 2
+
+enum adapter {
+    AD_BENCH,               /* bench_out JSON on stdout */
+    AD_PIPEBENCH,           /* bench_out JSON on stderr, data on stdin */
+    AD_SYSCALL,             /* syscall-check --json report on stdout */
+};
+
+struct entry {
+    char *label;
+    char *argv[MAX_ARGS + 4];   /* tool, arguments, output options, NULL */
+    int argc;
+    enum adapter adapter;
+};
+
+struct profile {
+    int repeat;
+    double alpha;
+    double threshold;       /* percent */
+    long long pipe_bytes;
+    struct entry entries[MAX_ENTRIES];
+    int nr_entries;
+};
+
+struct metric {
+    char *bench;
+    char *name;
+    char *unit;
+    double values[MAX_REPEAT];
+    int n;
+    /* Spread inside a single run, for rows with statistics */
+    double within_sd;
+    long long within_n;
+};
+
+struct results {
+    struct metric *m;
+    size_t count, cap;
+    struct bench_env env;   /* of the machine that produced them */
+};
+
+static const char default_profile[] =
+    "# Every tool once per run, a few minutes on a phone\n"
+    "repeat 5\n"
+    "alpha 0.01\n"
+    "threshold 3\n"
+    "pipe_bytes 256M\n"
+    "callbench         callbench -r 3\n"
+    "pipe-latency      pipe-latency -l 200000\n"
+    "hackbench         hackbench -g 4 -l 200\n"
+    "hackbench-threads hackbench -g 4 -l 200 -T\n"
+    "pipebench         pipebench\n"
+    "syscall           syscall-check\n";
+
+static bool verbose = false;
+
+/* ------------------------------------------------------------------ */
+/* Profiles                                                            */
+/* ------------------------------------------------------------------ */
+
+static long long parse_size(const char *s) {
+    char *end;
+    long long v = strtoll(s, &end, 10);
+
+    switch (*end) {
+    case 'G': v <<= 10; /* fall through */
+    case 'M': v <<= 10; /* fall through */
+    case 'K': v <<= 10; break;
+    }
+    return v;
+}
+
+static enum adapter adapter_of(const char *tool) {
+    const char *base = strrchr(tool, '/');
+
+    base = base ? base + 1 : tool;
+    if (!strcmp(base, "pipebench"))
+        return AD_PIPEBENCH;
+    if (!strcmp(base, "syscall-check"))
+        return AD_SYSCALL;
+    return AD_BENCH;
+}
+
+static int parse_profile(const char *text, const char *origin, struct profile *p) {
+    char *copy = strdup(text), *line, *save = NULL;
+    int lineno = 0;
+
+    if (!copy)
+        return -1;
+    p->repeat = 5;
+    p->alpha = 0.01;
+    p->threshold = 3;
+    p->pipe_bytes = 256LL << 20;
+    p->nr_entries = 0;
+
+    /* strtok_r would merge empty lines and break the line numbers */
+    for (line = copy; line; line = save) {
+        char *words[MAX_ARGS + 1], *tok, *wsave = NULL;
+        int n = 0;
+
+        save = strchr(line, '\n');
+        if (save)
+            *save++ = '\0';
+        lineno++;
+        *strchrnul(line, '#') = '\0';
+        for (tok = strtok_r(line, " \t\r", &wsave); tok && n <= MAX_ARGS;
+             tok = strtok_r(NULL, " \t\r", &wsave))
+            words[n++] = tok;
+        if (!n)
+            continue;
+
+        if (n == 2 && !strcmp(words[0], "repeat")) {
+            p->repeat = atoi(words[1]);
+        } else if (n == 2 && !strcmp(words[0], "alpha")) {
+            p->alpha = atof(words[1]);
+        } else if (n == 2 && !strcmp(words[0], "threshold")) {
+            p->threshold = atof(words[1]);
+        } else if (n == 2 && !strcmp(words[0], "pipe_bytes")) {
+            p->pipe_bytes = parse_size(words[1]);
+        } else if (n >= 2 && n <= MAX_ARGS && p->nr_entries < MAX_ENTRIES) {
+            struct entry *e = &p->entries[p->nr_entries++];
+
+            e->label = strdup(words[0]);
+            e->argc = n - 1;
+            for (int i = 1; i < n; i++)
+                e->argv[i - 1] = strdup(words[i]);
+            e->adapter = adapter_of(words[1]);
+        } else {
+            fprintf(stderr, "%s:%d: bad line\n", origin, lineno);
+            free(copy);
+            return -1;
+        }
+    }
+    free(copy);
+
+    if (p->repeat < 1 || p->repeat > MAX_REPEAT || p->alpha <= 0 || p->alpha >= 1 ||
+        p->threshold < 0 || p->pipe_bytes <= 0) {
+        fprintf(stderr, "%s: repeat must be 1-%d, alpha in (0, 1), threshold and "
+                "pipe_bytes positive\n", origin, MAX_REPEAT);
+        return -1;
+    }
+    return 0;
+}
+
+static char *read_file(const char *path) {
+    FILE *f = fopen(path, "re");
+    char *buf = NULL;
+    size_t len = 0, cap = 0, n;
+
+    if (!f)
+        return NULL;
+    do {
+        if (cap - len < 4096) {
+            char *nbuf = realloc(buf, cap = cap * 2 + 4096);
+            if (!nbuf) {
+                free(buf);
+                fclose(f);
+                return NULL;
+            }
+            buf = nbuf;
+        }
+        n = fread(buf + len, 1, cap - len - 1, f);
+        len += n;
+    } while (n);
+    fclose(f);
+    buf[len] = '\0';
+    return buf;
+}
+
+/* ------------------------------------------------------------------ */
+/* Running the tools                                                   */
+/* ------------------------------------------------------------------ */
+
+/* Where the tools live: -b, else next to this binary */
+static char bindir[PATH_MAX];
+
+static void find_bindir(const char *opt) {
+    ssize_t n;
+
+    if (opt) {
+        snprintf(bindir, sizeof(bindir), "%s", opt);
+        return;
+    }
+    n = readlink("/proc/self/exe", bindir, sizeof(bindir) - 1);
+    if (n <= 0) {
+        bindir[0] = '\0';
+        return;
+    }
+    bindir[n] = '\0';
+    *strrchr(bindir, '/') = '\0';
+}
+
+static void exec_tool(char **argv) {
+    char path[PATH_MAX + 64];
+
+    if (!strchr(argv[0], '/') && bindir[0]) {
+        snprintf(path, sizeof(path), "%s/%s", bindir, argv[0]);
+        execv(path, argv);
+    }
+    execvp(argv[0], argv);
+    fprintf(stderr, "exec %s: %s\n", argv[0], strerror(errno));
+    _exit(127);
+}
+
+static char *read_all(int fd) {
+    char *buf = NULL;
+    size_t len = 0, cap = 0;
+    ssize_t n;
+
+    for (;;) {
+        if (cap - len < 4096) {
+            char *nbuf = realloc(buf, cap = cap * 2 + 4096);
+            if (!nbuf)
+                break;
+            buf = nbuf;
+        }
+        n = read(fd, buf + len, cap - len - 1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        len += n;
+    }
+    if (buf)
+        buf[len] = '\0';
+    return buf;
+}
+
+/*
+ * Run one benchmark and return what it printed on its result stream, or
+ * NULL if it failed. pipebench reads feed bytes on stdin and reports on
+ * stderr; everything else reports on stdout.
+ */
+static char *run_entry(const struct entry *e, long long feed) {
+    int out[2], in[2] = { -1, -1 };
+    int result_fd = e->adapter == AD_PIPEBENCH ? STDERR_FILENO : STDOUT_FILENO;
+    int devnull = open("/dev/null", O_RDWR | O_CLOEXEC);
+    char *argv[MAX_ARGS + 8];
+    int argc = 0, status;
+    char *text;
+    pid_t pid;
+
+    for (int i = 0; i < e->argc; i++)
+        argv[argc++] = e->argv[i];
+    switch (e->adapter) {
+    case AD_BENCH:
+        argv[argc++] = "-o";
+        argv[argc++] = "json";
+        break;
+    case AD_PIPEBENCH:
+        argv[argc++] = "-q";
+        argv[argc++] = "-f";
+        argv[argc++] = "json";
+        break;
+    case AD_SYSCALL:
+        argv[argc++] = "--json";
+        argv[argc++] = "-";
+        break;
+    }
+    argv[argc] = NULL;
+
+    if (devnull < 0 || pipe2(out, O_CLOEXEC) ||
+        (e->adapter == AD_PIPEBENCH && pipe2(in, O_CLOEXEC))) {
+        perror("pipe");
+        return NULL;
+    }
+    fflush(NULL);
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return NULL;
+    }
+    if (!pid) {
+        dup2(in[0] >= 0 ? in[0] : devnull, STDIN_FILENO);
+        dup2(result_fd == STDOUT_FILENO ? out[1] : devnull, STDOUT_FILENO);
+        if (result_fd == STDERR_FILENO)
+            dup2(out[1], STDERR_FILENO);
+        else if (!verbose)
+            dup2(devnull, STDERR_FILENO);
+        /* The suite ignores SIGPIPE for itself; the tools get the default */
+        signal(SIGPIPE, SIG_DFL);
+        exec_tool(argv);
+    }
+    close(out[1]);
+    close(devnull);
+
+    if (in[1] >= 0) {
+        static char chunk[FEED_CHUNK];
+
+        close(in[0]);
+        for (long long left = feed; left > 0;) {
+            ssize_t n = write(in[1], chunk, left < FEED_CHUNK ? left : FEED_CHUNK);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            left -= n;
+        }
+        close(in[1]);
+    }
+
+    text = read_all(out[0]);
+    close(out[0]);
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+        ;
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+        fprintf(stderr, "%s: %s %d\n", e->label, WIFEXITED(status) ? "exit status" : "signal",
+                WIFEXITED(status) ? WEXITSTATUS(status) : WTERMSIG(status));
+        free(text);
+        return NULL;
+    }
+    return text;
+}
+
+/* ------------------------------------------------------------------ */
+/* Metrics                                                             */
+/* ------------------------------------------------------------------ */
+
+static struct metric *find_metric(struct results *r, const char *bench, const char *name) {
+    for (size_t i = 0; i < r->count; i++)
+        if (!strcmp(r->m[i].bench, bench) && !strcmp(r->m[i].name, name))
+            return &r->m[i];
+    return NULL;
+}
+
+static struct metric *get_metric(struct results *r, const char *bench, const char *name,
+                                 const char *unit) {
+    struct metric *m = find_metric(r, bench, name);
+
+    if (m)
+        return m;
+    if (r->count == r->cap) {
+        size_t cap = r->cap ? r->cap * 2 : 64;
+        struct metric *nm = realloc(r->m, cap * sizeof(*nm));
+        if (!nm)
+            return NULL;
+        r->m = nm;
+        r->cap = cap;
+    }
+    m = &r->m[r->count++];
+    memset(m, 0, sizeof(*m));
+    m->bench = strdup(bench);
+    m->name = strdup(name);
+    m->unit = strdup(unit);
+    return m;
+}
+
+static void add_value(struct results *r, const char *bench, const char *name, const char *unit,
+                      double v) {
+    struct metric *m = get_metric(r, bench, name, unit);
+
+    if (m && m->n < MAX_REPEAT)
+        m->values[m->n++] = v;
+}
+
+/* bench_out rows: "value", or "mean" with n and stddev */
+static int collect_bench(struct results *r, const char *bench, const struct json *doc) {
+    const struct json *rows = json_get(doc, "results");
+
+    if (!rows || rows->type != JSON_ARRAY)
+        return -1;
+    for (const struct json *row = rows->child; row; row = row->next) {
+        const char *name = json_get_str(row, "name", NULL);
+        const char *unit = json_get_str(row, "unit", "");
+
+        if (!name)
+            continue;
+        if (json_get(row, "value")) {
+            add_value(r, bench, name, unit, json_get_num(row, "value", 0));
+        } else if (json_get(row, "mean")) {
+            struct metric *m;
+
+            add_value(r, bench, name, unit, json_get_num(row, "mean", 0));
+            m = find_metric(r, bench, name);
+            if (m) {
+                m->within_sd = json_get_num(row, "stddev", 0);
+                m->within_n = (long long)json_get_num(row, "n", 0);
+            }
+        }
+    }
+    return 0;
+}
+
+/* syscall-check reports: probe costs and vDSO timings */
+static int collect_syscall(struct results *r, const char *bench, const struct json *doc) {
+    const struct json *calls = json_get(doc, "syscalls");
+    const struct json *timing = json_get(json_get(doc, "vdso"), "timing");
+    char name[128];
+
+    if (!calls || calls->type != JSON_ARRAY)
+        return -1;
+    for (const struct json *e = calls->child; e; e = e->next) {
+        const struct json *cost = json_get(e, "cost_ns");
+
+        if (!cost || cost->type != JSON_NUMBER)
+            continue;
+        snprintf(name, sizeof(name), "syscall.%s", json_get_str(e, "name", "?"));
+        add_value(r, bench, name, "ns", cost->num);
+    }
+    for (const struct json *e = timing ? timing->child : NULL; e; e = e->next) {
+        double ns = json_get_num(e, "vdso_ns", -1);
+
+        /* Negative: the call was not measured */
+        if (ns < 0)
+            continue;
+        snprintf(name, sizeof(name), "vdso.%s.%s", json_get_str(e, "function", "?"),
+                 json_get_str(e, "clock", "?"));
+        add_value(r, bench, name, "ns", ns);
+    }
+    return 0;
+}
+
+static void mean_sd(const double *v, int n, double *mean, double *sd) {
+    double sum = 0, sq = 0;
+
+    for (int i = 0; i < n; i++)
+        sum += v[i];
+    *mean = n ? sum / n : 0;
+    for (int i = 0; i < n; i++)
+        sq += (v[i] - *mean) * (v[i] - *mean);
+    *sd = n > 1 ? sqrt(sq / (n - 1)) : 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Results file                                                        */
+/* ------------------------------------------------------------------ */
+
+static void write_header(FILE *f, const struct profile *p) {
+    struct utsname uts;
+    time_t now = time(NULL);
+    char stamp[32];
+
+    uname(&uts);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    fprintf(f, "{\n  \"format\": \"%s\",\n  \"timestamp\": \"%s\",\n", RESULTS_FORMAT, stamp);
+    fprintf(f, "  \"kernel\": ");
+    json_put_str(f, uts.release);
+    fprintf(f, ",\n  \"env\": ");
+    bench_env_write_json(bench_env_self(), f, "  ");
+    fprintf(f, ",\n  \"profile\": {\"repeat\": %d, \"alpha\": %g, \"threshold\": %g, "
+            "\"pipe_bytes\": %lld, \"benchmarks\": [", p->repeat, p->alpha, p->threshold,
+            p->pipe_bytes);
+    for (int i = 0; i < p->nr_entries; i++) {
+        fprintf(f, "%s\n    {\"label\": ", i ? "," : "");
+        json_put_str(f, p->entries[i].label);
+        fprintf(f, ", \"argv\": [");
+        for (int a = 0; a < p->entries[i].argc; a++) {
+            fprintf(f, "%s", a ? ", " : "");
+            json_put_str(f, p->entries[i].argv[a]);
+        }
+        fprintf(f, "]}");
+    }
+    fprintf(f, "\n  ]},\n  \"runs\": [");
+}
+
+static void write_run(FILE *f, bool first, const char *bench, int rep, const char *output) {
+    size_t len = strlen(output);
+
+    while (len && (output[len - 1] == '\n' || output[len - 1] == ' '))
+        len--;
+    fprintf(f, "%s\n    {\"bench\": ", first ? "" : ",");
+    json_put_str(f, bench);
+    fprintf(f, ", \"run\": %d, \"output\": %.*s}", rep, (int)len, output);
+}
+
+static void write_metrics(FILE *f, const struct results *r) {
+    fprintf(f, "\n  ],\n  \"metrics\": [");
+    for (size_t i = 0; i < r->count; i++) {
+        const struct metric *m = &r->m[i];
+
+        fprintf(f, "%s\n    {\"bench\": ", i ? "," : "");
+        json_put_str(f, m->bench);
+        fprintf(f, ", \"name\": ");
+        json_put_str(f, m->name);
+        fprintf(f, ", \"unit\": ");
+        json_put_str(f, m->unit);
+        fprintf(f, ", \"values\": [");
+        for (int v = 0; v < m->n; v++)
+            fprintf(f, "%s%.12g", v ? ", " : "", m->values[v]);
+        fprintf(f, "]");
+        if (m->within_n)
+            fprintf(f, ", \"within_n\": %lld, \"within_sd\": %.12g", m->within_n, m->within_sd);
+        fprintf(f, "}");
+    }
+    fprintf(f, "\n  ]\n}\n");
+}
+
+static int load_results(const char *path, struct results *r) {
+    struct json *doc = json_parse_file(path);
+    const struct json *metrics = json_get(doc, "metrics");
+    const struct json *env = json_get(doc, "env");
+
+    if (!doc || !metrics || metrics->type != JSON_ARRAY ||
+        strcmp(json_get_str(doc, "format", ""), RESULTS_FORMAT)) {
+        fprintf(stderr, "%s: not a %s results file\n", path, RESULTS_FORMAT);
+        json_free(doc);
+        return -1;
+    }
+    for (const struct json *e = metrics->child; e; e = e->next) {
+        const struct json *values = json_get(e, "values");
+        struct metric *m = get_metric(r, json_get_str(e, "bench", "?"),
+                                      json_get_str(e, "name", "?"), json_get_str(e, "unit", ""));
+
+        if (!m)
+            break;
+        for (const struct json *v = values ? values->child : NULL; v && m->n < MAX_REPEAT;
+             v = v->next)
+            m->values[m->n++] = v->num;
+        m->within_n = (long long)json_get_num(e, "within_n", 0);
+        m->within_sd = json_get_num(e, "within_sd", 0);
+    }
+    for (const struct json *e = env ? env->child : NULL; e; e = e->next)
+        if (e->type == JSON_STRING)
+            bench_env_set(&r->env, e->key, e->str);
+    json_free(doc);
+    return 0;
+}
+
+/* Runs every benchmark repeat times, round-robin so drift spreads evenly */
+static int run_profile(const struct profile *p, const char *path, struct results *r) {
+    char tmp[PATH_MAX];
+    FILE *f;
+    bool first = true;
+    int failed = 0;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    f = fopen(tmp, "we");
+    if (!f) {
+        fprintf(stderr, "fopen(%s): %s\n", tmp, strerror(errno));
+        return -1;
+    }
+    write_header(f, p);
+    /* compare() diffs this against the baseline's, as if loaded from the file */
+    for (size_t i = 0; i < bench_env_self()->count; i++)
+        bench_env_set(&r->env, bench_env_self()->items[i].key,
+                      bench_env_self()->items[i].value);
+
+    for (int rep = 0; rep < p->repeat; rep++) {
+        for (int i = 0; i < p->nr_entries; i++) {
+            const struct entry *e = &p->entries[i];
+            long long start = bench_mono_ns();
+            char *text = run_entry(e, p->pipe_bytes);
+            struct json *doc = text ? json_parse(text) : NULL;
+            int ret = -1;
+
+            if (doc)
+                ret = e->adapter == AD_SYSCALL ? collect_syscall(r, e->label, doc)
+                                               : collect_bench(r, e->label, doc);
+            fprintf(stderr, "[%d/%d] %-20s %s (%.1f s)\n", rep + 1, p->repeat, e->label,
+                    ret ? "FAILED" : "ok", (bench_mono_ns() - start) / 1e9);
+            if (ret) {
+                failed++;
+            } else {
+                write_run(f, first, e->label, rep, text);
+                first = false;
+            }
+            json_free(doc);
+            free(text);
+        }
+    }
+
+    write_metrics(f, r);
+    if (fclose(f) || rename(tmp, path)) {
+        fprintf(stderr, "write(%s): %s\n", path, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    fprintf(stderr, "Wrote %s\n", path);
+    return failed;
+}
+
+/* ------------------------------------------------------------------ */
+/* Comparison                                                          */
+/* ------------------------------------------------------------------ */
+
+/* Continued fraction for the incomplete beta function (modified Lentz) */
+static double beta_cf(double a, double b, double x) {
+    const double tiny = 1e-300;
+    double c = 1, d = 1 - (a + b) * x / (a + 1), h;
+
+    d = 1 / (fabs(d) < tiny ? tiny : d);
+    h = d;
+    for (int m = 1; m <= 300; m++) {
+        double m2 = 2.0 * m, aa, del;
+
+        aa = m * (b - m) * x / ((a + m2 - 1) * (a + m2));
+        d = 1 + aa * d;
+        d = 1 / (fabs(d) < tiny ? tiny : d);
+        c = 1 + aa / c;
+        c = fabs(c) < tiny ? tiny : c;
+        h *= d * c;
+        aa = -(a + m) * (a + b + m) * x / ((a + m2) * (a + m2 + 1));
+        d = 1 + aa * d;
+        d = 1 / (fabs(d) < tiny ? tiny : d);
+        c = 1 + aa / c;
+        c = fabs(c) < tiny ? tiny : c;
+        del = d * c;
+        h *= del;
+        if (fabs(del - 1) < 1e-12)
+            break;
+    }
+    return h;
+}
+
+/* Regularized incomplete beta I_x(a, b) */
+static double inc_beta(double a, double b, double x) {
+    double front;
+
+    if (x <= 0)
+        return 0;
+    if (x >= 1)
+        return 1;
+    front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) + b * log(1 - x));
+    if (x < (a + 1) / (a + b + 2))
+        return front * beta_cf(a, b, x) / a;
+    return 1 - front * beta_cf(b, a, 1 - x) / b;
+}
+
+struct sample {
+    double mean, sd;
+    double n;
+};
+
+/* Runs when there are several, otherwise the spread inside the one run */
+static bool sample_of(const struct metric *m, struct sample *s) {
+    if (m->n >= 2) {
+        mean_sd(m->values, m->n, &s->mean, &s->sd);
+        s->n = m->n;
+        return true;
+    }
+    if (m->n == 1 && m->within_n >= 2) {
+        s->mean = m->values[0];
+        s->sd = m->within_sd;
+        s->n = (double)m->within_n;
+        return true;
+    }
+    if (m->n == 1)
+        s->mean = m->values[0];
+    return false;
+}
+
+/* Two-sided p-value of Welch's t-test */
+static double welch_p(const struct sample *a, const struct sample *b) {
+    double va = a->sd * a->sd / a->n, vb = b->sd * b->sd / b->n;
+    double t, df;
+
+    if (va + vb == 0)
+        return a->mean == b->mean ? 1 : 0;
+    t = (a->mean - b->mean) / sqrt(va + vb);
+    df = (va + vb) * (va + vb) /
+         (va * va / (a->n - 1) + vb * vb / (b->n - 1));
+    return inc_beta(df / 2, 0.5, df / (df + t * t));
+}
+
+/* +1 if higher is better, -1 if lower is, 0 if not gated */
+static int direction(const char *unit) {
+    size_t len = strlen(unit);
+
+    if (len > 2 && !strcmp(unit + len - 2, "/s"))
+        return 1;
+    if (!strcmp(unit, "s") || !strcmp(unit, "ms") || !strcmp(unit, "us") || !strcmp(unit, "ns"))
+        return -1;
+    return 0;
+}
+
+struct verdict {
+    const struct metric *cur, *base;
+    double change;          /* percent, positive is worse */
+    double p;               /* Holm-adjusted */
+    bool tested;
+};
+
+static int cmp_p(const void *a, const void *b) {
+    const struct verdict *x = *(struct verdict *const *)a, *y = *(struct verdict *const *)b;
+    return x->p < y->p ? -1 : x->p > y->p;
+}
+
+static int compare(const struct results *cur, struct results *base, double alpha,
+                   double threshold) {
+    struct verdict *v = calloc(cur->count + 1, sizeof(*v));
+    struct verdict **tested = calloc(cur->count + 1, sizeof(*tested));
+    size_t nv = 0, nt = 0;
+    int regressions = 0, improvements = 0, env_changes;
+
+    if (!v || !tested) {
+        perror("calloc");
+        free(v);
+        free(tested);
+        return EXIT_ERROR;
+    }
+
+    for (size_t i = 0; i < cur->count; i++) {
+        const struct metric *m = &cur->m[i];
+        struct verdict *x = &v[nv++];
+        struct sample a = { 0 }, b = { 0 };
+        int dir = direction(m->unit);
+
+        x->cur = m;
+        x->base = find_metric(base, m->bench, m->name);
+        x->p = 1;
+        if (!x->base)
+            continue;
+        bool testable = sample_of(m, &a) & sample_of(x->base, &b);
+        if (b.mean != 0)
+            x->change = (a.mean - b.mean) / fabs(b.mean) * 100 * (dir ? -dir : 1);
+        if (!dir || !testable)
+            continue;
+        x->p = welch_p(&a, &b);
+        x->tested = true;
+        tested[nt++] = x;
+    }
+
+    /* Holm: the k-th smallest of m p-values is scaled by m - k, monotonically */
+    qsort(tested, nt, sizeof(*tested), cmp_p);
+    for (size_t k = 0; k < nt; k++) {
+        double adj = tested[k]->p * (double)(nt - k);
+
+        if (adj > 1)
+            adj = 1;
+        if (k && adj < tested[k - 1]->p)
+            adj = tested[k - 1]->p;
+        tested[k]->p = adj;
+    }
+
+    /* A different governor or mitigation explains many a "regression" */
+    printf("Environment, baseline -> current:\n");
+    env_changes = bench_env_diff(&base->env, &cur->env, stdout, "  ");
+    if (!env_changes)
+        printf("  identical\n");
+    putchar('\n');
+
+    printf("%-18s %-34s %-6s %12s %12s %8s %7s  %s\n", "bench", "metric", "unit", "baseline",
+           "current", "change", "p", "verdict");
+    for (size_t i = 0; i < nv; i++) {
+        struct verdict *x = &v[i];
+        const char *verdict;
+        double cm, csd, bm = 0, bsd;
+        char p[16] = "-";
+
+        mean_sd(x->cur->values, x->cur->n, &cm, &csd);
+        if (x->base)
+            mean_sd(x->base->values, x->base->n, &bm, &bsd);
+
+        if (!x->base) {
+            verdict = "new";
+        } else if (!direction(x->cur->unit)) {
+            verdict = "info";
+        } else if (!x->tested) {
+            verdict = "untested";
+        } else if (x->p < alpha && x->change > threshold) {
+            verdict = "REGRESSION";
+            regressions++;
+        } else if (x->p < alpha && -x->change > threshold) {
+            verdict = "improved";
+            improvements++;
+        } else {
+            verdict = "same";
+        }
+        if (x->tested)
+            snprintf(p, sizeof(p), "%.4f", x->p);
+
+        printf("%-18s %-34s %-6s %12.3f %12.3f %+7.1f%% %7s  %s\n", x->cur->bench,
+               x->cur->name, x->cur->unit, bm, cm, x->change, p, verdict);
+    }
+    for (size_t i = 0; i < base->count; i++)
+        if (!find_metric((struct results *)cur, base->m[i].bench, base->m[i].name))
+            printf("%-18s %-34s %-6s %12s %12s %8s %7s  missing\n", base->m[i].bench,
+                   base->m[i].name, base->m[i].unit, "", "", "", "-");
+
+    printf("\n%d regressions, %d improvements among %zu tested metrics "
+           "(alpha %g after Holm, threshold %g%%; change is positive when worse)\n",
+           regressions, improvements, nt, alpha, threshold);
+    if (env_changes)
+        printf("%d environment differences, see above\n", env_changes);
+    free(v);
+    free(tested);
+    return regressions ? EXIT_REGRESSION : 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Main                                                                */
+/* ------------------------------------------------------------------ */
+
+static char *short_options = "hp:b:o:c:i:n:a:t:Lv";
+static struct option long_options[] = {
+        {"help", no_argument, 0, 'h'},
+        {"profile", required_argument, 0, 'p'},
+        {"bindir", required_argument, 0, 'b'},
+        {"output", required_argument, 0, 'o'},
+        {"compare", required_argument, 0, 'c'},
+        {"input", required_argument, 0, 'i'},
+        {"repeat", required_argument, 0, 'n'},
+        {"alpha", required_argument, 0, 'a'},
+        {"threshold", required_argument, 0, 't'},
+        {"list", no_argument, 0, 'L'},
+        {"verbose", no_argument, 0, 'v'},
+        {0, 0, 0, 0}
+};
+
+static void print_help(char *prog_name) {
+    printf("Usage: %s [options]\n"
+           "\n"
+           "Run the benchmark suite and compare it with a baseline\n"
+           "\n"
+           "Options:\n"
+           "  -h, --help\t\tshow usage help\n"
+           "  -p, --profile\t\tprofile file (default: built in, see --list)\n"
+           "  -b, --bindir\t\twhere the tools are (default: next to this binary)\n"
+           "  -o, --output\t\tresults file (default: suite-results.json)\n"
+           "  -c, --compare\t\tbaseline results file to gate on\n"
+           "  -i, --input\t\tcompare these results instead of running\n"
+           "  -n, --repeat\t\truns per benchmark, overrides the profile\n"
+           "  -a, --alpha\t\tsignificance level, overrides the profile\n"
+           "  -t, --threshold\tsmallest change in percent, overrides the profile\n"
+           "  -L, --list\t\tprint the built-in profile\n"
+           "  -v, --verbose\t\tshow the tools' stderr\n"
+           "\n"
+           "Exit status: 0, 1 on a significant regression, 2 if a benchmark or a\n"
+           "file failed.\n",
+           prog_name);
+
+    exit(EXIT_ERROR);
+}
+
+int main(int argc, char **argv) {
+    const char *profile_path = NULL, *bin_opt = NULL, *input = NULL, *baseline = NULL;
+    const char *output = "suite-results.json";
+    int repeat = 0, ret = 0;
+    double alpha = 0, threshold = -1;
+    struct profile p;
+    struct results cur = { 0 }, base = { 0 };
+    char *text;
+
+    while (1) {
+        int c = getopt_long(argc, argv, short_options, long_options, NULL);
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case 'p':
+                profile_path = optarg;
+                break;
+            case 'b':
+                bin_opt = optarg;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'c':
+                baseline = optarg;
+                break;
+            case 'i':
+                input = optarg;
+                break;
+            case 'n':
+                repeat = atoi(optarg);
+                break;
+            case 'a':
+                alpha = atof(optarg);
+                break;
+            case 't':
+                threshold = atof(optarg);
+                break;
+            case 'L':
+                fputs(default_profile, stdout);
+                return 0;
+            case 'v':
+                verbose = true;
+                break;
+            case '?':
+            case 'h':
+            default:
+                print_help(argv[0]);
+                break;
+        }
+    }
+
+    text = profile_path ? read_file(profile_path) : strdup(default_profile);
+    if (!text) {
+        fprintf(stderr, "%s: %s\n", profile_path, strerror(errno));
+        return EXIT_ERROR;
+    }
+    if (parse_profile(text, profile_path ? profile_path : "built-in profile", &p)) {
+        free(text);
+        return EXIT_ERROR;
+    }
+    free(text);
+    if (repeat)
+        p.repeat = repeat;
+    if (alpha)
+        p.alpha = alpha;
+    if (threshold >= 0)
+        p.threshold = threshold;
+    if (p.repeat < 1 || p.repeat > MAX_REPEAT) {
+        fprintf(stderr, "%s: --repeat must be 1-%d\n", argv[0], MAX_REPEAT);
+        return EXIT_ERROR;
+    }
+
+    if (input) {
+        if (load_results(input, &cur))
+            return EXIT_ERROR;
+    } else {
+        find_bindir(bin_opt);
+        signal(SIGPIPE, SIG_IGN);
+        bench_clock_init();
+        ret = run_profile(&p, output, &cur);
+        if (ret < 0)
+            return EXIT_ERROR;
+        ret = ret ? EXIT_ERROR : 0;
+    }
+
+    if (baseline) {
+        int cmp;
+
+        if (load_results(baseline, &base))
+            return EXIT_ERROR;
+        cmp = compare(&cur, &base, p.alpha, p.threshold);
+        if (!ret)
+            ret = cmp;
+    }
+    return ret;
+}
@@ -0,0 +1,66 @@
+#!/bin/sh
+#
+# test-compare.sh BINDIR
+#
+# bench-suite --input/--compare on hand-written results files: a clear
+# slowdown of a time fails with status 1, a speedup passes, and a change
+# that is significant on its own but not after Holm's correction over
+# ten metrics passes too.
+
+set -eu
+
+bindir=$1
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+failed=0
+
+# results FILE VALUES... - one "ns" metric per argument, comma-separated runs
+results() {
+    file=$1
+    shift
+    {
+        printf '{"format": "bench-suite/1", "env": {}, "metrics": ['
+        i=0
+        for values; do
+            [ $i -gt 0 ] && printf ','
+            printf '\n  {"bench": "t", "name": "m%d", "unit": "ns", "values": [%s]}' \
+                "$i" "$values"
+            i=$((i + 1))
+        done
+        printf '\n]}\n'
+    } > "$file"
+}
+
+# expect NAME STATUS VERDICT - compare cur.json with base.json, VERDICT for m0
+expect() {
+    status=0
+    "$bindir/bench-suite" -i "$dir/cur.json" -c "$dir/base.json" > "$dir/out.txt" 2>&1 ||
+        status=$?
+    if [ "$status" -ne "$2" ] || ! grep -q "^t  *m0 .* $3\$" "$dir/out.txt"; then
+        echo "FAIL: $1: exit status $status, expected $2 and a '$3' verdict" >&2
+        cat "$dir/out.txt" >&2
+        failed=1
+    else
+        echo "PASS: $1"
+    fi
+}
+
+same=100,101,99,100,102
+
+results "$dir/base.json" $same
+results "$dir/cur.json" 120,121,119,120,122
+expect "regression" 1 REGRESSION
+
+results "$dir/cur.json" 80,81,79,80,82
+expect "improvement" 0 improved
+
+# p is about 0.001 alone, about 0.01 after Holm over ten metrics
+results "$dir/base.json" $same
+results "$dir/cur.json" 104,106,103,105,107
+expect "significant alone" 1 REGRESSION
+
+results "$dir/base.json" $same $same $same $same $same $same $same $same $same $same
+results "$dir/cur.json" 104,106,103,105,107 $same $same $same $same $same $same $same $same $same
+expect "not significant after Holm" 0 same
+
+exit $failed
@@ -0,0 +1,26 @@
+#!/bin/sh
+#
+# test-env.sh BINDIR
+#
+# A live bench-suite run compared with its own results must report an
+# identical environment: the fingerprint of the run and the one read
+# back from the file are the same machine's.
+
+set -eu
+
+bindir=$1
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+printf 'repeat 2\nhackbench hackbench -g 1 -l 10\n' > "$dir/profile"
+"$bindir/bench-suite" -b "$bindir" -p "$dir/profile" -o "$dir/base.json" 2>/dev/null
+"$bindir/bench-suite" -b "$bindir" -p "$dir/profile" -o "$dir/cur.json" \
+    -c "$dir/base.json" -t 100 > "$dir/compare.txt" 2>/dev/null || true
+
+if ! grep -qx '  identical' "$dir/compare.txt" ||
+   grep -q 'environment differences' "$dir/compare.txt"; then
+    echo "FAIL: environment differs from its own baseline" >&2
+    cat "$dir/compare.txt" >&2
+    exit 1
+fi
+echo "PASS: environment identical to its own baseline"
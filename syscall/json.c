@@ -0,0 +1,292 @@
+/*
+ * json.c
+ *
+ * Recursive-descent parser into a linked DOM. Reports are a few hundred
+ * KiB at most, so nothing here tries to be fast.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "json.h"
+
+#define JSON_MAX_DEPTH 32
+
+void json_put_str(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+            fprintf(f, "\\%c", c);
+        else if (c == '\n')
+            fputs("\\n", f);
+        else if (c == '\t')
+            fputs("\\t", f);
+        else if (c < 0x20)
+            fprintf(f, "\\u%04x", c);
+        else
+            fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+struct parser {
+    const char *p;
+    int depth;
+};
+
+static struct json *parse_value(struct parser *ps);
+
+static void skip_ws(struct parser *ps) {
+    while (isspace((unsigned char)*ps->p))
+        ps->p++;
+}
+
+static void put_utf8(char **out, unsigned int cp) {
+    char *o = *out;
+
+    if (cp < 0x80) {
+        *o++ = cp;
+    } else if (cp < 0x800) {
+        *o++ = 0xc0 | (cp >> 6);
+        *o++ = 0x80 | (cp & 0x3f);
+    } else {
+        *o++ = 0xe0 | (cp >> 12);
+        *o++ = 0x80 | ((cp >> 6) & 0x3f);
+        *o++ = 0x80 | (cp & 0x3f);
+    }
+    *out = o;
+}
+
+/* Decoded strings are never longer than their escaped form */
+static char *parse_string(struct parser *ps) {
+    const char *start = ++ps->p;
+    char *out, *o;
+
+    while (*ps->p && *ps->p != '"')
+        ps->p += *ps->p == '\\' && ps->p[1] ? 2 : 1;
+    if (*ps->p != '"')
+        return NULL;
+
+    out = o = malloc(ps->p - start + 1);
+    if (!out)
+        return NULL;
+    for (const char *s = start; s < ps->p; s++) {
+        if (*s != '\\') {
+            *o++ = *s;
+            continue;
+        }
+        switch (*++s) {
+        case 'n': *o++ = '\n'; break;
+        case 't': *o++ = '\t'; break;
+        case 'r': *o++ = '\r'; break;
+        case 'b': *o++ = '\b'; break;
+        case 'f': *o++ = '\f'; break;
+        case 'u': {
+            unsigned int cp = 0;
+            int i;
+            for (i = 1; i <= 4 && isxdigit((unsigned char)s[i]); i++)
+                cp = cp * 16 + (isdigit((unsigned char)s[i]) ? s[i] - '0'
+                                                               : (tolower(s[i]) - 'a' + 10));
+            if (i != 5) {
+                free(out);
+                return NULL;
+            }
+            /* Surrogate pairs are not needed for anything we write */
+            put_utf8(&o, cp);
+            s += 4;
+            break;
+        }
+        default: *o++ = *s; break;
+        }
+    }
+    *o = '\0';
+    ps->p++;
+    return out;
+}
+
+static struct json *new_node(enum json_type type) {
+    struct json *j = calloc(1, sizeof(*j));
+
+    if (j)
+        j->type = type;
+    return j;
+}
+
+/* Arrays and objects: members separated by ',' up to the closing bracket */
+static struct json *parse_container(struct parser *ps, bool object) {
+    struct json *j = new_node(object ? JSON_OBJECT : JSON_ARRAY);
+    struct json **tail;
+    char close = object ? '}' : ']';
+
+    if (!j || ++ps->depth > JSON_MAX_DEPTH)
+        goto fail;
+    tail = &j->child;
+    ps->p++;
+    skip_ws(ps);
+    if (*ps->p == close) {
+        ps->p++;
+        ps->depth--;
+        return j;
+    }
+
+    while (1) {
+        char *key = NULL;
+        struct json *v;
+
+        skip_ws(ps);
+        if (object) {
+            if (*ps->p != '"' || !(key = parse_string(ps)))
+                goto fail;
+            skip_ws(ps);
+            if (*ps->p != ':') {
+                free(key);
+                goto fail;
+            }
+            ps->p++;
+        }
+        v = parse_value(ps);
+        if (!v) {
+            free(key);
+            goto fail;
+        }
+        v->key = key;
+        *tail = v;
+        tail = &v->next;
+
+        skip_ws(ps);
+        if (*ps->p == ',') {
+            ps->p++;
+        } else if (*ps->p == close) {
+            ps->p++;
+            ps->depth--;
+            return j;
+        } else {
+            goto fail;
+        }
+    }
+
+fail:
+    json_free(j);
+    return NULL;
+}
+
+static struct json *parse_value(struct parser *ps) {
+    struct json *j;
+
+    skip_ws(ps);
+    switch (*ps->p) {
+    case '{':
+        return parse_container(ps, true);
+    case '[':
+        return parse_container(ps, false);
+    case '"':
+        if (!(j = new_node(JSON_STRING)))
+            return NULL;
+        if (!(j->str = parse_string(ps))) {
+            free(j);
+            return NULL;
+        }
+        return j;
+    case 't':
+    case 'f':
+    case 'n': {
+        static const struct { const char *word; enum json_type type; bool val; } words[] = {
+            { "true", JSON_BOOL, true }, { "false", JSON_BOOL, false }, { "null", JSON_NULL, false },
+        };
+        for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+            size_t len = strlen(words[i].word);
+            if (!strncmp(ps->p, words[i].word, len)) {
+                ps->p += len;
+                if ((j = new_node(words[i].type)))
+                    j->boolean = words[i].val;
+                return j;
+            }
+        }
+        return NULL;
+    }
+    default: {
+        char *end;
+        double num = strtod(ps->p, &end);
+        if (end == ps->p || !(j = new_node(JSON_NUMBER)))
+            return NULL;
+        j->num = num;
+        ps->p = end;
+        return j;
+    }
+    }
+}
+
+struct json *json_parse(const char *text) {
+    struct parser ps = { text, 0 };
+    struct json *j = parse_value(&ps);
+
+    if (!j)
+        return NULL;
+    skip_ws(&ps);
+    if (*ps.p) {
+        json_free(j);
+        return NULL;
+    }
+    return j;
+}
+
+struct json *json_parse_file(const char *path) {
+    FILE *f = fopen(path, "re");
+    struct json *j = NULL;
+    char *buf = NULL;
+    long len;
+
+    if (!f)
+        return NULL;
+    if (fseek(f, 0, SEEK_END) || (len = ftell(f)) < 0 || fseek(f, 0, SEEK_SET))
+        goto out;
+    if (!(buf = malloc(len + 1)) || fread(buf, 1, len, f) != (size_t)len)
+        goto out;
+    buf[len] = '\0';
+    j = json_parse(buf);
+
+out:
+    free(buf);
+    fclose(f);
+    return j;
+}
+
+void json_free(struct json *j) {
+    while (j) {
+        struct json *next = j->next;
+        json_free(j->child);
+        free(j->key);
+        free(j->str);
+        free(j);
+        j = next;
+    }
+}
+
+const struct json *json_get(const struct json *obj, const char *key) {
+    if (!obj || obj->type != JSON_OBJECT)
+        return NULL;
+    for (const struct json *c = obj->child; c; c = c->next)
+        if (!strcmp(c->key, key))
+            return c;
+    return NULL;
+}
+
+const char *json_get_str(const struct json *obj, const char *key, const char *def) {
+    const struct json *j = json_get(obj, key);
+
+    return j && j->type == JSON_STRING ? j->str : def;
+}
+
+double json_get_num(const struct json *obj, const char *key, double def) {
+    const struct json *j = json_get(obj, key);
+
+    return j && j->type == JSON_NUMBER ? j->num : def;
+}
+
+bool json_get_bool(const struct json *obj, const char *key, bool def) {
+    const struct json *j = json_get(obj, key);
+
+    return j && j->type == JSON_BOOL ? j->boolean : def;
+}
@@ -0,0 +1,41 @@
+/*
+ * json.h
+ *
+ * Just enough JSON for syscall-check reports: an escaping string writer
+ * for the emitter, and a small DOM parser for --compare.
+ */
+
+#ifndef SC_JSON_H
+#define SC_JSON_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+enum json_type { JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT };
+
+/* Arrays and objects keep their members as a child list */
+struct json {
+    enum json_type type;
+    char *key;              /* member name, when inside an object */
+    char *str;
+    double num;
+    bool boolean;
+    struct json *child;
+    struct json *next;
+};
+
+/* Write s as a quoted JSON string */
+void json_put_str(FILE *f, const char *s);
+
+/* Parse a whole document; NULL on syntax errors */
+struct json *json_parse(const char *text);
+struct json *json_parse_file(const char *path);
+void json_free(struct json *j);
+
+/* Lookups return NULL/the default when the member is missing or mistyped */
+const struct json *json_get(const struct json *obj, const char *key);
+const char *json_get_str(const struct json *obj, const char *key, const char *def);
+double json_get_num(const struct json *obj, const char *key, double def);
+bool json_get_bool(const struct json *obj, const char *key, bool def);
+
+#endif /* SC_JSON_H */
@@ -1,98 +1,2026 @@
+/*
+ * syscall.c
+ *
+ * syscall-check: probe which post-5.x syscalls the running kernel
+ * provides (mainline or backported) and what each one costs.
+ *
+ * Every probe calls its syscall with arguments that are harmless
+ * whether or not the kernel implements it, then classifies the result:
+ *   [PASS] present - the call succeeded or failed the way a working
+ *                    implementation must for those arguments
+ *   [FAIL] absent  - ENOSYS
+ *   [WARN] error   - any other outcome (EPERM, seccomp SIGSYS, ...)
+ *
+ * Other modes:
+ *   timeout - how precisely epoll_pwait2, epoll_wait, ppoll and timerfd
+ *             honour 1 us - 10 ms timeouts, with and without timer slack
+ *   close   - close() loop vs close_range vs CLOSE_RANGE_CLOEXEC + exec
+ *             for 10 - 100k dense or sparse fds
+ *   uring   - io_uring setup flags, features, opcodes (REGISTER_PROBE),
+ *             registered rings, buffer rings, multishot, and NOP latency
+ *             per setup mode
+ *   vdso    - vDSO exports with versions, and which time calls are
+ *             really served in user space
+ *
+ * --json writes the probe table, vDSO inventory and relevant sysctls as
+ * one report per kernel build; --compare diffs two of them for a fleet.
+ *
+ * The probes and the fallback wrappers live in syscompat.c; the compat
+ * rows in timeout and close mode measure those fallbacks.
+ */
+
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <unistd.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/utsname.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/auxv.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <linux/io_uring.h>
+#include <elf.h>
+#include <link.h>
+#include <poll.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <time.h>
 #include <string.h>
 
-/* Arch-specific definitions for older NDK/libc headers */
-#ifndef __NR_close_range
-  #if defined(__aarch64__) || defined(__arm__) || defined(__x86_64__) || defined(__i386__)
-    #define __NR_close_range 436
-  #endif
-#endif
+#include "syscompat.h"
+#include "json.h"
+#include "../common/bench.h"
 
-#ifndef __NR_epoll_pwait2
-  #if defined(__aarch64__) || defined(__arm__) || defined(__x86_64__) || defined(__i386__)
-    #define __NR_epoll_pwait2 441
-  #endif
-#endif
+#define NS_PER_SEC 1000000000LL
 
-/* ARM64 requires epoll_create1 (syscall 20) */
-#ifndef __NR_epoll_create1
-  #if defined(__aarch64__)
-    #define __NR_epoll_create1 20
-  #endif
-#endif
+#define COST_CALLS_DEFAULT 1000
+#define COST_LOOPS_DEFAULT 10
+
+#define TIMEOUT_SAMPLES_DEFAULT 100
+
+#define CLOSE_REPS_DEFAULT 5
+#define CLOSE_FD_BASE 64
+#define CLOSE_SPARSE_STRIDE 8
+
+/* argv[1] of the re-exec'd child in close mode: exit immediately */
+#define EXEC_NOOP_ARG "--exec-noop"
+
+static const char *status_tag[] = {
+    [SC_PRESENT] = "[PASS]",
+    [SC_ABSENT] = "[FAIL]",
+    [SC_ERROR] = "[WARN]",
+    [SC_UNDEFINED] = "[ -- ]",
+};
+
+static const char *status_name[] = {
+    [SC_PRESENT] = "present",
+    [SC_ABSENT] = "absent",
+    [SC_ERROR] = "error",
+    [SC_UNDEFINED] = "no nr",
+};
+
+static void describe_result(const struct sc_probe *p, const struct sc_probe_result *res,
+                            char *buf, size_t len) {
+    if (res->status == SC_UNDEFINED)
+        snprintf(buf, len, "no syscall number for this arch");
+    else if (res->sigsys)
+        snprintf(buf, len, "blocked by seccomp (SIGSYS)");
+    else if (res->ret >= 0 && p->returns_fd)
+        snprintf(buf, len, "returned fd");
+    else if (res->ret >= 0)
+        snprintf(buf, len, "returned %ld", res->ret);
+    else if (res->status == SC_PRESENT)
+        snprintf(buf, len, "%s (expected)", strerror(res->err));
+    else
+        snprintf(buf, len, "%s", strerror(res->err));
+}
+
+static void run_probe_table(int calls, int loops) {
+    struct utsname uts;
+    struct sc_probe_result res;
+    char desc[64];
+    int counts[SC_UNDEFINED + 1] = { 0 };
 
-int main() {
-    printf("[*] Verifying Backported Syscalls...\n");
+    uname(&uts);
+    printf("[*] Probing syscalls on %s %s (%s)\n\n", uts.sysname, uts.release, uts.machine);
+    printf("    %-6s %-24s %4s  %-7s  %-36s %9s\n",
+           "", "syscall", "nr", "status", "result", "cost");
 
-    /* --- TEST 1: close_range (436) --- */
-    #ifdef __NR_close_range
-    printf("[+] Testing close_range (__NR_close_range = %d)...\n", __NR_close_range);
+    sc_probe_begin();
+    for (int i = 0; i < SC_NR_CAPS; i++) {
+        const struct sc_probe *p = &sc_probes[i];
+        long cost_ns = 0;
 
-    int test_fd = open("/dev/null", O_RDONLY);
-    if (test_fd < 0) return 1;
+        sc_probe_run(p, &res);
+        if (res.status == SC_PRESENT)
+            cost_ns = sc_probe_cost(p, calls, loops);
+        counts[res.status]++;
 
-    long ret = syscall(__NR_close_range, test_fd, test_fd, 0);
+        describe_result(p, &res, desc, sizeof(desc));
+        printf("    %-6s %-24s %4ld  %-7s  %-36s",
+               status_tag[res.status], p->name, p->nr, status_name[res.status], desc);
+        if (res.status == SC_PRESENT)
+            printf(" %6ld ns%s", cost_ns, p->returns_fd ? " (+close)" : "");
+        putchar('\n');
+    }
+    sc_probe_end();
+
+    printf("\n[*] %d present, %d absent, %d error (getppid is the baseline)\n",
+           counts[SC_PRESENT], counts[SC_ABSENT], counts[SC_ERROR]);
+    printf("[*] Capability bitmap: 0x%016llx\n", (unsigned long long)sc_init());
+}
+
+/* ------------------------------------------------------------------ */
+/* Mode: timeout                                                       */
+/* ------------------------------------------------------------------ */
+
+enum sleep_mech { MECH_EPOLL_PWAIT2, MECH_EPOLL_WAIT, MECH_PPOLL, MECH_TIMERFD,
+                  MECH_COMPAT, MECH_COUNT };
+
+static const char *mech_name[] = {
+    [MECH_EPOLL_PWAIT2] = "epoll_pwait2",
+    [MECH_EPOLL_WAIT] = "epoll_wait",
+    [MECH_PPOLL] = "ppoll",
+    [MECH_TIMERFD] = "timerfd",
+    [MECH_COMPAT] = "pwait+timerfd",
+};
+
+struct sleep_ctx {
+    int epfd;
+    int tfd;
+};
+
+/* Sleep for req_ns with one mechanism; returns the time actually slept or -1 */
+static long long timed_sleep(enum sleep_mech mech, const struct sleep_ctx *ctx,
+                             long long req_ns) {
+    struct timespec ts = { req_ns / NS_PER_SEC, req_ns % NS_PER_SEC };
+    struct epoll_event ev;
+    uint64_t expirations;
+    long ret = 0;
+
+    long long t0 = bench_now_ns();
+    switch (mech) {
+    case MECH_EPOLL_PWAIT2:
+        ret = syscall(__NR_epoll_pwait2, ctx->epfd, &ev, 1, &ts, NULL, 0);
+        break;
+    case MECH_EPOLL_WAIT:
+        /* Millisecond granularity: the best it can do is round up */
+        ret = epoll_wait(ctx->epfd, &ev, 1, (int)((req_ns + 999999) / 1000000));
+        break;
+    case MECH_PPOLL:
+        ret = ppoll(NULL, 0, &ts, NULL);
+        break;
+    case MECH_TIMERFD: {
+        struct itimerspec its = { .it_value = ts };
+        if (timerfd_settime(ctx->tfd, 0, &its, NULL))
+            return -1;
+        ret = read(ctx->tfd, &expirations, sizeof(expirations)) == sizeof(expirations) ? 0 : -1;
+        break;
+    }
+    case MECH_COMPAT:
+        /* What sc_epoll_pwait2() falls back to on kernels without it */
+        ret = sc_epoll_pwait_timerfd(ctx->epfd, &ev, 1, &ts, NULL);
+        break;
+    default:
+        return -1;
+    }
+    long long t1 = bench_now_ns();
+
+    return ret < 0 ? -1 : t1 - t0;
+}
 
-    if (ret == 0) {
-        printf("    [PASS] close_range works! (Return: 0)\n");
-        /* Verify FD is actually closed */
-        if (close(test_fd) == -1 && errno == EBADF) {
-             printf("           (Verified: FD actually closed)\n");
+static void sweep_timeouts(const struct sleep_ctx *ctx, int samples, long long *buf) {
+    static const long long req_us[] = {
+        1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000
+    };
+
+    printf("  %-13s %8s %9s %9s %9s %9s %9s %9s\n",
+           "mechanism", "req_us", "min_us", "p50_us", "p90_us", "p99_us", "max_us", "over_p50");
+
+    for (int m = 0; m < MECH_COUNT; m++) {
+        for (size_t r = 0; r < sizeof(req_us) / sizeof(req_us[0]); r++) {
+            long long req_ns = req_us[r] * 1000;
+            int n = 0;
+
+            for (int i = 0; i < samples; i++) {
+                long long got = timed_sleep(m, ctx, req_ns);
+                if (got >= 0)
+                    buf[n++] = got;
+            }
+
+            printf("  %-13s %8lld", mech_name[m], req_us[r]);
+            if (!n) {
+                printf(" %9s (%s)\n", "failed", strerror(errno));
+                break;
+            }
+
+            struct bench_stats st;
+            bench_stats_compute(buf, n, &st);
+            printf(" %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+                   st.min / 1e3, st.p50 / 1e3, st.p90 / 1e3, st.p99 / 1e3, st.max / 1e3,
+                   st.p50 / 1e3 - (double)req_us[r]);
+            fflush(stdout);
         }
-    } else if (errno == ENOSYS) {
-        printf("    [FAIL] close_range NOT FOUND (ENOSYS).\n");
+    }
+}
+
+static int run_timeout(int samples) {
+    struct sleep_ctx ctx;
+    long long *buf = calloc(samples, sizeof(long long));
+    int default_slack = prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0);
+
+    if (!buf) {
+        perror("calloc");
+        return 1;
+    }
+
+    /* An empty epoll set: every wait ends by timeout */
+    ctx.epfd = sc_epoll_create1(EPOLL_CLOEXEC);
+    ctx.tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (ctx.epfd < 0 || ctx.tfd < 0) {
+        perror("epoll_create1/timerfd_create");
+        return 1;
+    }
+
+    printf("[*] Timeout precision, %d samples per point\n", samples);
+    printf("    over_p50 = median oversleep; epoll_wait rounds requests up to whole ms\n");
+    printf("    pwait+timerfd is the syscompat fallback for kernels without epoll_pwait2\n");
+
+    printf("\n[+] Default timer slack (%d ns)\n", default_slack);
+    sweep_timeouts(&ctx, samples, buf);
+
+    if (prctl(PR_SET_TIMERSLACK, 1, 0, 0, 0)) {
+        perror("prctl(PR_SET_TIMERSLACK)");
     } else {
-        printf("    [WARN] close_range present, error: %s\n", strerror(errno));
+        printf("\n[+] Timer slack %d ns\n", prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0));
+        sweep_timeouts(&ctx, samples, buf);
+        prctl(PR_SET_TIMERSLACK, default_slack, 0, 0, 0);
+    }
+
+    close(ctx.epfd);
+    close(ctx.tfd);
+    free(buf);
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Mode: close                                                         */
+/* ------------------------------------------------------------------ */
+
+enum close_method { CM_LOOP, CM_PROCFD, CM_RANGE, CM_RANGE_CLOEXEC, CM_COUNT };
+
+static const char *close_method_name[] = {
+    [CM_LOOP] = "close loop",
+    [CM_PROCFD] = "/proc/fd scan",
+    [CM_RANGE] = "close_range",
+    [CM_RANGE_CLOEXEC] = "CLOEXEC+exec",
+};
+
+/* Populate n fds at CLOSE_FD_BASE, contiguous or every stride-th slot */
+static bool open_fd_set(int src, int n, int stride) {
+    for (int i = 0; i < n; i++) {
+        if (dup2(src, CLOSE_FD_BASE + i * stride) < 0)
+            return false;
+    }
+    return true;
+}
+
+static void close_fds(enum close_method cm, int lo, int hi) {
+    switch (cm) {
+    case CM_LOOP:
+        /* A spawner does not know which fds are open, so it tries them all */
+        for (int fd = lo; fd <= hi; fd++)
+            close(fd);
+        break;
+    case CM_PROCFD:
+        /* What sc_close_range() falls back to on kernels without it */
+        sc_close_range_fallback(lo, hi, 0);
+        break;
+    case CM_RANGE:
+        syscall(__NR_close_range, lo, hi, 0);
+        break;
+    case CM_RANGE_CLOEXEC:
+        syscall(__NR_close_range, lo, hi, CLOSE_RANGE_CLOEXEC);
+        break;
+    default:
+        break;
+    }
+}
+
+/* In-process cost of closing the set; CLOEXEC only marks, so it is not timed here */
+static long long time_close(enum close_method cm, int src, int n, int stride) {
+    int lo = CLOSE_FD_BASE, hi = CLOSE_FD_BASE + (n - 1) * stride;
+
+    if (!open_fd_set(src, n, stride))
+        return -1;
+
+    long long t0 = bench_now_ns();
+    close_fds(cm, lo, hi);
+    long long t1 = bench_now_ns();
+
+    /* Leave nothing behind for the next measurement */
+    if (cm == CM_RANGE_CLOEXEC)
+        close_fds(CM_LOOP, lo, hi);
+    return t1 - t0;
+}
+
+/* fork + close + exec of a no-op + wait, as a process spawner does it */
+static long long time_spawn(enum close_method cm, int src, int n, int stride,
+                            const char *self) {
+    int lo = CLOSE_FD_BASE, hi = CLOSE_FD_BASE + (n - 1) * stride;
+    char *const child_argv[] = { (char *)self, EXEC_NOOP_ARG, NULL };
+    int status;
+
+    if (!open_fd_set(src, n, stride))
+        return -1;
+
+    long long t0 = bench_now_ns();
+    pid_t pid = fork();
+    if (pid < 0)
+        return -1;
+    if (!pid) {
+        close_fds(cm, lo, hi);
+        execv(self, child_argv);
+        _exit(127);
+    }
+    waitpid(pid, &status, 0);
+    long long t1 = bench_now_ns();
+
+    close_fds(CM_LOOP, lo, hi);
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+        return -1;
+    return t1 - t0;
+}
+
+/* Make room for fds up to max_fd; returns false if the limit cannot be raised */
+static bool ensure_nofile(int max_fd) {
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl))
+        return false;
+    if (rl.rlim_cur > (rlim_t)max_fd)
+        return true;
+    rl.rlim_cur = max_fd + 1;
+    if (rl.rlim_max < rl.rlim_cur)
+        rl.rlim_max = rl.rlim_cur;
+    return setrlimit(RLIMIT_NOFILE, &rl) == 0;
+}
+
+static void print_close_cell(long long best) {
+    if (best < 0)
+        printf(" %13s", "fail");
+    else
+        printf(" %13.1f", (double)best / 1e3);
+}
+
+static int run_close(int reps) {
+    static const int counts[] = { 10, 100, 1000, 10000, 100000 };
+    static const int strides[] = { 1, CLOSE_SPARSE_STRIDE };
+    char self[PATH_MAX];
+    ssize_t len;
+
+    if (!sc_has(SC_CLOSE_RANGE)) {
+        printf("[FAIL] close_range NOT FOUND (ENOSYS), nothing to compare\n");
+        return 1;
+    }
+
+    /* Re-exec ourselves as the cheapest possible exec target */
+    len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (len < 0) {
+        perror("readlink(/proc/self/exe)");
+        return 1;
     }
-    #else
-    printf("[!] __NR_close_range undefined for this arch.\n");
-    #endif
+    self[len] = '\0';
+
+    int src = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (src < 0) {
+        perror("open(/dev/null)");
+        return 1;
+    }
+
+    printf("[*] Closing N fds from %d up, best of %d; sparse = every %dth fd\n",
+           CLOSE_FD_BASE, reps, CLOSE_SPARSE_STRIDE);
+    printf("    close loop walks the whole range, as a spawner must without close_range\n");
+
+    for (int mode = 0; mode < 2; mode++) {
+        if (!mode)
+            printf("\n[+] In-process close (us)\n");
+        else
+            printf("\n[+] Spawn: fork + close + exec + wait (us)\n");
+        printf("  %-7s %8s", "layout", "N");
+        for (int cm = 0; cm < CM_COUNT; cm++) {
+            if (!mode && cm == CM_RANGE_CLOEXEC)
+                continue;
+            printf(" %13s", close_method_name[cm]);
+        }
+        printf(" %9s\n", "speedup");
+
+        for (size_t s = 0; s < sizeof(strides) / sizeof(strides[0]); s++) {
+            for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+                int n = counts[c], stride = strides[s];
+                long long best[CM_COUNT];
+
+                printf("  %-7s %8d", stride == 1 ? "dense" : "sparse", n);
+                if (!ensure_nofile(CLOSE_FD_BASE + (n - 1) * stride)) {
+                    printf("  skipped: RLIMIT_NOFILE too low\n");
+                    continue;
+                }
+
+                for (int cm = 0; cm < CM_COUNT; cm++) {
+                    best[cm] = -1;
+                    if (!mode && cm == CM_RANGE_CLOEXEC)
+                        continue;
+                    for (int r = 0; r < reps; r++) {
+                        long long t = mode ? time_spawn(cm, src, n, stride, self)
+                                           : time_close(cm, src, n, stride);
+                        if (t >= 0 && (best[cm] < 0 || t < best[cm]))
+                            best[cm] = t;
+                    }
+                    print_close_cell(best[cm]);
+                }
+
+                /* Speedup of close_range over the close() loop */
+                if (best[CM_LOOP] > 0 && best[CM_RANGE] > 0)
+                    printf(" %8.1fx\n", (double)best[CM_LOOP] / best[CM_RANGE]);
+                else
+                    printf(" %9s\n", "-");
+                fflush(stdout);
+            }
+        }
+    }
+
+    close(src);
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Mode: uring                                                         */
+/* ------------------------------------------------------------------ */
+
+/* Newer than some NDK/libc uapi headers */
+#ifndef IORING_SETUP_NO_SQARRAY
+  #define IORING_SETUP_NO_SQARRAY (1U << 16)
+#endif
+#ifndef IORING_FEAT_REG_REG_RING
+  #define IORING_FEAT_REG_REG_RING (1U << 13)
+#endif
+#ifndef IORING_FEAT_RECVSEND_BUNDLE
+  #define IORING_FEAT_RECVSEND_BUNDLE (1U << 14)
+#endif
+#ifndef IORING_FEAT_MIN_TIMEOUT
+  #define IORING_FEAT_MIN_TIMEOUT (1U << 15)
+#endif
+
+#define URING_ENTRIES 64
+#define URING_BATCH 32
+#define URING_PROBE_OPS 256
+#define URING_SQPOLL_IDLE_MS 1000
+#define URING_SQPOLL_SPINS 10000
+#define URING_BGID 7
+
+/* Indexed by IORING_OP_*; the kernel only reports numbers */
+static const char *uring_op_name[] = {
+    "NOP", "READV", "WRITEV", "FSYNC", "READ_FIXED", "WRITE_FIXED", "POLL_ADD",
+    "POLL_REMOVE", "SYNC_FILE_RANGE", "SENDMSG", "RECVMSG", "TIMEOUT",
+    "TIMEOUT_REMOVE", "ACCEPT", "ASYNC_CANCEL", "LINK_TIMEOUT", "CONNECT",
+    "FALLOCATE", "OPENAT", "CLOSE", "FILES_UPDATE", "STATX", "READ", "WRITE",
+    "FADVISE", "MADVISE", "SEND", "RECV", "OPENAT2", "EPOLL_CTL", "SPLICE",
+    "PROVIDE_BUFFERS", "REMOVE_BUFFERS", "TEE", "SHUTDOWN", "RENAMEAT",
+    "UNLINKAT", "MKDIRAT", "SYMLINKAT", "LINKAT", "MSG_RING", "FSETXATTR",
+    "SETXATTR", "FGETXATTR", "GETXATTR", "SOCKET", "URING_CMD", "SEND_ZC",
+    "SENDMSG_ZC", "READ_MULTISHOT", "WAITID", "FUTEX_WAIT", "FUTEX_WAKE",
+    "FUTEX_WAITV", "FIXED_FD_INSTALL", "FTRUNCATE", "BIND", "LISTEN",
+    "RECV_ZC", "EPOLL_WAIT", "READV_FIXED", "WRITEV_FIXED",
+};
+
+struct uring_flag {
+    const char *name;
+    unsigned int bits;
+};
+
+/* Setup flags worth knowing about, with whatever each one requires */
+static const struct uring_flag uring_setup_flags[] = {
+    { "IOPOLL", IORING_SETUP_IOPOLL },
+    { "SQPOLL", IORING_SETUP_SQPOLL },
+    { "CQSIZE", IORING_SETUP_CQSIZE },
+    { "CLAMP", IORING_SETUP_CLAMP },
+    { "R_DISABLED", IORING_SETUP_R_DISABLED },
+    { "SUBMIT_ALL", IORING_SETUP_SUBMIT_ALL },
+    { "COOP_TASKRUN", IORING_SETUP_COOP_TASKRUN },
+    { "TASKRUN_FLAG", IORING_SETUP_COOP_TASKRUN | IORING_SETUP_TASKRUN_FLAG },
+    { "SQE128", IORING_SETUP_SQE128 },
+    { "CQE32", IORING_SETUP_CQE32 },
+    { "SINGLE_ISSUER", IORING_SETUP_SINGLE_ISSUER },
+    { "DEFER_TASKRUN", IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN },
+    { "NO_SQARRAY", IORING_SETUP_NO_SQARRAY },
+};
+
+static const struct uring_flag uring_feat_flags[] = {
+    { "SINGLE_MMAP", IORING_FEAT_SINGLE_MMAP },
+    { "NODROP", IORING_FEAT_NODROP },
+    { "SUBMIT_STABLE", IORING_FEAT_SUBMIT_STABLE },
+    { "RW_CUR_POS", IORING_FEAT_RW_CUR_POS },
+    { "CUR_PERSONALITY", IORING_FEAT_CUR_PERSONALITY },
+    { "FAST_POLL", IORING_FEAT_FAST_POLL },
+    { "POLL_32BITS", IORING_FEAT_POLL_32BITS },
+    { "SQPOLL_NONFIXED", IORING_FEAT_SQPOLL_NONFIXED },
+    { "EXT_ARG", IORING_FEAT_EXT_ARG },
+    { "NATIVE_WORKERS", IORING_FEAT_NATIVE_WORKERS },
+    { "RSRC_TAGS", IORING_FEAT_RSRC_TAGS },
+    { "CQE_SKIP", IORING_FEAT_CQE_SKIP },
+    { "LINKED_FILE", IORING_FEAT_LINKED_FILE },
+    { "REG_REG_RING", IORING_FEAT_REG_REG_RING },
+    { "RECVSEND_BUNDLE", IORING_FEAT_RECVSEND_BUNDLE },
+    { "MIN_TIMEOUT", IORING_FEAT_MIN_TIMEOUT },
+};
+
+/* Just enough of liburing to submit and reap from a mapped ring */
+struct uring {
+    int fd;
+    int enter_fd;           /* fd, or its index once registered */
+    unsigned int enter_flags;
+    unsigned int setup_flags;
+    unsigned int features;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned int *sq_head, *sq_tail, *sq_flags, *sq_array;
+    unsigned int sq_mask, sq_entries;
+    unsigned int *cq_head, *cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned int sqe_tail;  /* prepared, not yet published */
+};
+
+static int uring_setup(unsigned int entries, struct io_uring_params *p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
 
-    /* --- TEST 2: epoll_pwait2 (441) --- */
-    #ifdef __NR_epoll_pwait2
-    printf("\n[+] Testing epoll_pwait2 (__NR_epoll_pwait2 = %d)...\n", __NR_epoll_pwait2);
+static int uring_register(int fd, unsigned int op, void *arg, unsigned int nr) {
+    return syscall(__NR_io_uring_register, fd, op, arg, nr);
+}
+
+static void uring_exit(struct uring *r) {
+    if (r->sqes)
+        munmap(r->sqes, r->sqes_len);
+    if (r->cq_ptr && r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_len);
+    if (r->sq_ptr)
+        munmap(r->sq_ptr, r->sq_len);
+    if (r->fd >= 0)
+        close(r->fd);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+/* Returns 0, or -errno from setup or mmap */
+static int uring_init(struct uring *r, unsigned int flags) {
+    struct io_uring_params p;
 
-    int epfd = -1;
-    
-    /* Try epoll_create1 first (modern standard) */
-    #ifdef __NR_epoll_create1
-        epfd = syscall(__NR_epoll_create1, 0);
-    #endif
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+    p.flags = flags;
+    p.sq_thread_idle = URING_SQPOLL_IDLE_MS;
 
-    /* Fallback to legacy epoll_create ONLY if defined (missing on arm64) */
-    if (epfd < 0) {
-        #ifdef __NR_epoll_create
-            epfd = syscall(__NR_epoll_create, 1);
-        #endif
+    r->fd = uring_setup(URING_ENTRIES, &p);
+    if (r->fd < 0)
+        return -errno;
+    r->enter_fd = r->fd;
+    r->setup_flags = flags;
+    r->features = p.features;
+
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_len > r->sq_len)
+            r->sq_len = r->cq_len;
+        r->cq_len = r->sq_len;
     }
 
-    if (epfd < 0) {
-        perror("    [-] Failed to create epoll instance");
+    r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED)
+        goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ptr = r->sq_ptr;
     } else {
-        struct timespec ts = { .tv_sec = 0, .tv_nsec = 100 };
+        r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED)
+            goto fail;
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        goto fail;
+
+    char *sq = r->sq_ptr, *cq = r->cq_ptr;
+    r->sq_head = (unsigned int *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+    r->sq_flags = (unsigned int *)(sq + p.sq_off.flags);
+    r->sq_array = (unsigned int *)(sq + p.sq_off.array);
+    r->sq_mask = *(unsigned int *)(sq + p.sq_off.ring_mask);
+    r->sq_entries = p.sq_entries;
+    r->cq_head = (unsigned int *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+    r->cq_mask = *(unsigned int *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->sqe_tail = *r->sq_tail;
+    return 0;
+
+fail: {
+        int err = errno;
+        if (r->sq_ptr == MAP_FAILED)
+            r->sq_ptr = NULL;
+        if (r->cq_ptr == MAP_FAILED)
+            r->cq_ptr = NULL;
+        if (r->sqes == MAP_FAILED)
+            r->sqes = NULL;
+        uring_exit(r);
+        return -err;
+    }
+}
+
+static struct io_uring_sqe *uring_get_sqe(struct uring *r) {
+    unsigned int head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+
+    if (r->sqe_tail - head >= r->sq_entries)
+        return NULL;
+    unsigned int idx = r->sqe_tail++ & r->sq_mask;
+    r->sq_array[idx] = idx;
+    memset(&r->sqes[idx], 0, sizeof(r->sqes[idx]));
+    return &r->sqes[idx];
+}
+
+/* Publish prepared SQEs and, unless the SQ thread does it, submit and wait */
+static int uring_submit(struct uring *r, unsigned int wait_nr) {
+    unsigned int to_submit = r->sqe_tail - *r->sq_tail;
+
+    __atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+    if (r->setup_flags & IORING_SETUP_SQPOLL) {
+        /* Orders the tail store before the flags load, as liburing does */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(r->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP)
+            return syscall(__NR_io_uring_enter, r->enter_fd, 0, 0,
+                           r->enter_flags | IORING_ENTER_SQ_WAKEUP, NULL, 0);
+        return 0;
+    }
+    return syscall(__NR_io_uring_enter, r->enter_fd, to_submit, wait_nr,
+                   r->enter_flags | (wait_nr ? IORING_ENTER_GETEVENTS : 0), NULL, 0);
+}
+
+static struct io_uring_cqe *uring_peek_cqe(struct uring *r) {
+    unsigned int head = *r->cq_head;
+
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &r->cqes[head & r->cq_mask];
+}
+
+static void uring_cqe_seen(struct uring *r) {
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * SQPOLL rings are polled for a while first, then block like the others:
+ * spinning forever would starve the SQ thread when it shares our CPU.
+ */
+static struct io_uring_cqe *uring_wait_cqe(struct uring *r) {
+    struct io_uring_cqe *cqe;
+    int spins = 0;
+
+    while (!(cqe = uring_peek_cqe(r))) {
+        if ((r->setup_flags & IORING_SETUP_SQPOLL) && ++spins < URING_SQPOLL_SPINS)
+            continue;
+        if (syscall(__NR_io_uring_enter, r->enter_fd, 0, 1,
+                    r->enter_flags | IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+            return NULL;
+    }
+    return cqe;
+}
+
+static int uring_register_ring_fd(struct uring *r) {
+    struct io_uring_rsrc_update up = { .offset = -1U, .data = r->fd };
+
+    if (uring_register(r->fd, IORING_REGISTER_RING_FDS, &up, 1) != 1)
+        return -errno;
+    r->enter_fd = up.offset;
+    r->enter_flags |= IORING_ENTER_REGISTERED_RING;
+    return 0;
+}
+
+static void print_uring_status(enum sc_status st, const char *name, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static void print_uring_status(enum sc_status st, const char *name, const char *fmt, ...) {
+    va_list ap;
+
+    printf("    %-6s %-22s ", status_tag[st], name);
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    putchar('\n');
+}
+
+static enum sc_status errno_status(int err) {
+    return err == EINVAL || err == EOPNOTSUPP ? SC_ABSENT : SC_ERROR;
+}
+
+static void probe_setup_flags(void) {
+    printf("\n[+] Setup flags (io_uring_setup with the flag set)\n");
+    for (size_t i = 0; i < sizeof(uring_setup_flags) / sizeof(uring_setup_flags[0]); i++) {
+        struct io_uring_params p;
+
+        memset(&p, 0, sizeof(p));
+        p.flags = uring_setup_flags[i].bits;
+        p.cq_entries = URING_ENTRIES * 2;
+        p.sq_thread_idle = URING_SQPOLL_IDLE_MS;
+        int fd = uring_setup(URING_ENTRIES, &p);
+        if (fd >= 0) {
+            close(fd);
+            print_uring_status(SC_PRESENT, uring_setup_flags[i].name, "accepted");
+        } else {
+            print_uring_status(errno_status(errno), uring_setup_flags[i].name,
+                               "rejected: %s", strerror(errno));
+        }
+    }
+}
+
+static void probe_features(unsigned int features) {
+    printf("\n[+] Kernel features (IORING_FEAT_*, 0x%x)\n", features);
+    for (size_t i = 0; i < sizeof(uring_feat_flags) / sizeof(uring_feat_flags[0]); i++) {
+        bool on = features & uring_feat_flags[i].bits;
+        print_uring_status(on ? SC_PRESENT : SC_ABSENT, uring_feat_flags[i].name,
+                           on ? "yes" : "no");
+    }
+}
+
+#define URING_OP_NAMES ((int)(sizeof(uring_op_name) / sizeof(uring_op_name[0])))
+
+/* Opcodes we have names for but the kernel does not know count as unsupported */
+static void print_op_list(const struct io_uring_probe *probe, bool supported) {
+    int last = probe->last_op > URING_OP_NAMES - 1 ? probe->last_op : URING_OP_NAMES - 1;
+    int col = 8, n = 0;
+
+    printf("    %s:\n       ", supported ? "supported" : "unsupported");
+    for (int op = 0; op <= last; op++) {
+        bool ok = op < probe->ops_len && op <= probe->last_op &&
+                  (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+        char name[24];
+
+        if (ok != supported)
+            continue;
+        if (op < URING_OP_NAMES)
+            snprintf(name, sizeof(name), "%s", uring_op_name[op]);
+        else
+            snprintf(name, sizeof(name), "op%d", op);
+        if (col + (int)strlen(name) + 1 > 78) {
+            printf("\n       ");
+            col = 8;
+        }
+        col += printf(" %s", name);
+        n++;
+    }
+    if (!n)
+        printf(" (none)");
+    putchar('\n');
+}
+
+static void probe_opcodes(struct uring *r) {
+    size_t len = sizeof(struct io_uring_probe) + URING_PROBE_OPS * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, len);
+
+    printf("\n[+] Opcodes (IORING_REGISTER_PROBE)\n");
+    if (!probe || uring_register(r->fd, IORING_REGISTER_PROBE, probe, URING_PROBE_OPS) < 0) {
+        print_uring_status(errno_status(errno), "REGISTER_PROBE", "%s (pre-5.6 kernel?)",
+                           strerror(errno));
+        free(probe);
+        return;
+    }
+
+    int supported = 0;
+    for (int op = 0; op <= probe->last_op && op < probe->ops_len; op++)
+        supported += !!(probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+    printf("    last_op %d, %d supported\n", probe->last_op, supported);
+    print_op_list(probe, true);
+    print_op_list(probe, false);
+    free(probe);
+}
+
+/* Submit one SQE prepared by the caller and return its first CQE */
+static bool uring_one_shot(struct uring *r, struct io_uring_cqe *out) {
+    struct io_uring_cqe *cqe;
+
+    if (uring_submit(r, 1) < 0 || !(cqe = uring_wait_cqe(r)))
+        return false;
+    *out = *cqe;
+    uring_cqe_seen(r);
+    return true;
+}
+
+static void report_multishot(const char *name, bool ran, const struct io_uring_cqe *cqe) {
+    if (!ran)
+        print_uring_status(SC_ERROR, name, "submit failed: %s", strerror(errno));
+    else if (cqe->res < 0)
+        print_uring_status(errno_status(-cqe->res), name, "%s", strerror(-cqe->res));
+    else if (cqe->flags & IORING_CQE_F_MORE)
+        print_uring_status(SC_PRESENT, name, "CQE_F_MORE set");
+    else
+        print_uring_status(SC_ABSENT, name, "completed single-shot");
+}
+
+static void probe_multishot_accept(void) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    socklen_t alen = sizeof(sa_family_t);
+    struct io_uring_cqe cqe;
+    struct uring r;
+    int ls, cs = -1;
+
+    if (uring_init(&r, 0)) {
+        print_uring_status(SC_ERROR, "multishot accept", "no ring");
+        return;
+    }
+
+    /* An autobound abstract socket: nothing to clean up on disk */
+    ls = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (ls < 0 || bind(ls, (struct sockaddr *)&addr, alen) || listen(ls, 4) ||
+        (alen = sizeof(addr), getsockname(ls, (struct sockaddr *)&addr, &alen)) ||
+        (cs = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 ||
+        connect(cs, (struct sockaddr *)&addr, alen)) {
+        print_uring_status(SC_ERROR, "multishot accept", "socket setup: %s", strerror(errno));
+        goto out;
+    }
+
+    struct io_uring_sqe *sqe = uring_get_sqe(&r);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = ls;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    bool ran = uring_one_shot(&r, &cqe);
+    report_multishot("multishot accept", ran, &cqe);
+    if (ran && cqe.res >= 0)
+        close(cqe.res);
+
+out:
+    /* Tearing down the ring cancels the armed request */
+    uring_exit(&r);
+    if (cs >= 0)
+        close(cs);
+    if (ls >= 0)
+        close(ls);
+}
+
+static void probe_buffers_and_recv(void) {
+    struct io_uring_buf_reg reg;
+    struct io_uring_cqe cqe;
+    struct uring r;
+    char data[64];
+    int sv[2] = { -1, -1 };
+
+    if (uring_init(&r, 0)) {
+        print_uring_status(SC_ERROR, "provided buffer ring", "no ring");
+        return;
+    }
+
+    struct io_uring_buf_ring *br = mmap(NULL, (size_t)sysconf(_SC_PAGESIZE), PROT_READ | PROT_WRITE,
+                                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (br == MAP_FAILED) {
+        perror("mmap");
+        uring_exit(&r);
+        return;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t)br;
+    reg.ring_entries = 1;
+    reg.bgid = URING_BGID;
+    if (uring_register(r.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        print_uring_status(errno_status(errno), "provided buffer ring", "%s", strerror(errno));
+        print_uring_status(SC_ABSENT, "multishot recv", "needs a provided buffer ring");
+        goto out;
+    }
+    print_uring_status(SC_PRESENT, "provided buffer ring", "IORING_REGISTER_PBUF_RING");
+
+    br->bufs[0].addr = (uintptr_t)data;
+    br->bufs[0].len = sizeof(data);
+    br->bufs[0].bid = 0;
+    __atomic_store_n(&br->tail, 1, __ATOMIC_RELEASE);
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) || write(sv[1], "x", 1) != 1) {
+        print_uring_status(SC_ERROR, "multishot recv", "socketpair: %s", strerror(errno));
+        goto out;
+    }
+
+    struct io_uring_sqe *sqe = uring_get_sqe(&r);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sv[0];
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    report_multishot("multishot recv", uring_one_shot(&r, &cqe), &cqe);
+
+out:
+    uring_exit(&r);
+    munmap(br, (size_t)sysconf(_SC_PAGESIZE));
+    if (sv[0] >= 0) {
+        close(sv[0]);
+        close(sv[1]);
+    }
+}
+
+static void probe_ring_features(void) {
+    struct uring r;
+    int err;
+
+    printf("\n[+] Ring features\n");
+    if ((err = uring_init(&r, 0))) {
+        print_uring_status(SC_ERROR, "registered ring fd", "no ring: %s", strerror(-err));
+        return;
+    }
+    if ((err = uring_register_ring_fd(&r)))
+        print_uring_status(errno_status(-err), "registered ring fd", "%s", strerror(-err));
+    else
+        print_uring_status(SC_PRESENT, "registered ring fd", "IORING_REGISTER_RING_FDS, index %d",
+                           r.enter_fd);
+    uring_exit(&r);
+
+    probe_buffers_and_recv();
+    probe_multishot_accept();
+}
+
+struct nop_mode {
+    const char *name;
+    unsigned int flags;
+    bool registered;
+};
+
+static const struct nop_mode nop_modes[] = {
+    { "default", 0, false },
+    { "coop_taskrun", IORING_SETUP_COOP_TASKRUN, false },
+    { "single_issuer", IORING_SETUP_SINGLE_ISSUER, false },
+    { "defer_taskrun", IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN, false },
+    { "registered fd", 0, true },
+    { "defer+reg fd", IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN, true },
+    { "sqpoll", IORING_SETUP_SQPOLL, false },
+};
+
+static long long nop_round_trip(struct uring *r) {
+    struct io_uring_sqe *sqe = uring_get_sqe(r);
+    long long t0 = bench_now_ns();
+
+    sqe->opcode = IORING_OP_NOP;
+    if (uring_submit(r, 1) < 0 || !uring_wait_cqe(r))
+        return -1;
+    uring_cqe_seen(r);
+    return bench_now_ns() - t0;
+}
+
+/* Best per-NOP time over `loops` runs of `calls` NOPs, URING_BATCH per enter */
+static long long nop_batched(struct uring *r, int calls, int loops) {
+    long long best = -1;
+
+    for (int l = 0; l < loops; l++) {
+        long long t0 = bench_now_ns();
+        for (int done = 0; done < calls; ) {
+            int n = calls - done < URING_BATCH ? calls - done : URING_BATCH;
+            for (int i = 0; i < n; i++)
+                uring_get_sqe(r)->opcode = IORING_OP_NOP;
+            if (uring_submit(r, n) < 0)
+                return -1;
+            for (int i = 0; i < n; i++) {
+                if (!uring_wait_cqe(r))
+                    return -1;
+                uring_cqe_seen(r);
+            }
+            done += n;
+        }
+        long long per = (bench_now_ns() - t0) / calls;
+        if (best < 0 || per < best)
+            best = per;
+    }
+    return best;
+}
+
+static void print_nop_row(const char *name, long long *buf, int n, long long batched) {
+    struct bench_stats st;
+
+    bench_stats_compute(buf, n, &st);
+    printf("  %-15s %8.0f %8.0f %8.0f %8.0f", name, st.min, st.p50, st.p99, st.max);
+    if (batched >= 0)
+        printf(" %10lld\n", batched);
+    else
+        printf(" %10s\n", "-");
+}
+
+static void bench_nops(int calls, int loops) {
+    int n = calls * loops;
+    long long *buf = calloc(n, sizeof(long long));
+
+    if (!buf) {
+        perror("calloc");
+        return;
+    }
+
+    printf("\n[+] NOP round trip per setup mode, %d samples (ns)\n", n);
+    printf("    batch = per-NOP cost with %d NOPs per io_uring_enter; sqpoll only enters\n"
+           "    to wake its thread or after polling in vain, and needs a spare CPU\n",
+           URING_BATCH);
+    printf("  %-15s %8s %8s %8s %8s %10s\n", "mode", "min", "p50", "p99", "max", "batch");
+
+    /* The same clock overhead on a plain syscall, for scale */
+    for (int i = 0; i < n; i++) {
+        long long t0 = bench_now_ns();
+        syscall(__NR_getppid);
+        buf[i] = bench_now_ns() - t0;
+    }
+    print_nop_row("getppid", buf, n, -1);
 
-        /* Pass NULL events to check syscall existence */
-        ret = syscall(__NR_epoll_pwait2, epfd, NULL, 0, &ts, NULL, 0);
+    for (size_t m = 0; m < sizeof(nop_modes) / sizeof(nop_modes[0]); m++) {
+        const struct nop_mode *mode = &nop_modes[m];
+        struct uring r;
+        int err = uring_init(&r, mode->flags);
 
-        if (ret == 0) {
-            printf("    [PASS] epoll_pwait2 works! (Return: 0)\n");
-        } else if (errno == ENOSYS) {
-            printf("    [FAIL] epoll_pwait2 NOT FOUND (ENOSYS).\n");
+        if (!err && mode->registered)
+            err = uring_register_ring_fd(&r);
+        if (err) {
+            printf("  %-15s %8s (%s)\n", mode->name, "n/a", strerror(-err));
+            if (r.fd >= 0)
+                uring_exit(&r);
+            continue;
+        }
+
+        int got = 0;
+        for (int i = 0; i < n; i++) {
+            long long t = nop_round_trip(&r);
+            if (t < 0)
+                break;
+            buf[got++] = t;
+        }
+        if (got < n) {
+            printf("  %-15s %8s (%s)\n", mode->name, "failed", strerror(errno));
         } else {
-            printf("    [PASS] epoll_pwait2 detected (Response: %s)\n", strerror(errno));
+            print_nop_row(mode->name, buf, n, nop_batched(&r, calls, loops));
+        }
+        fflush(stdout);
+        uring_exit(&r);
+    }
+    free(buf);
+}
+
+static int run_uring(int calls, int loops) {
+    struct utsname uts;
+    struct uring r;
+    int err;
+
+    uname(&uts);
+    printf("[*] io_uring capabilities on %s %s (%s)\n", uts.sysname, uts.release, uts.machine);
+
+    /* The probe table caught a seccomp SIGSYS; calling it directly would not */
+    if (!sc_has(SC_IO_URING_SETUP)) {
+        printf("[FAIL] io_uring_setup unavailable (absent or blocked), see -m probe\n");
+        return 1;
+    }
+    if ((err = uring_init(&r, 0))) {
+        printf("[FAIL] io_uring_setup: %s%s\n", strerror(-err),
+               -err == EPERM ? " (kernel.io_uring_disabled?)" : "");
+        return 1;
+    }
+
+    probe_setup_flags();
+    probe_features(r.features);
+    probe_opcodes(&r);
+    uring_exit(&r);
+    probe_ring_features();
+    bench_nops(calls, loops);
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Mode: vdso                                                          */
+/* ------------------------------------------------------------------ */
+
+/* A vDSO call this much cheaper than the raw syscall did not enter the kernel */
+#define VDSO_FAST_RATIO 2.0
+
+/* st_info packs binding and type the same way in ELF32 and ELF64 */
+#define SYM_BIND(info) ELF32_ST_BIND(info)
+#define SYM_TYPE(info) ELF32_ST_TYPE(info)
+
+/* The vDSO as the kernel mapped it, located through its dynamic section */
+struct vdso {
+    uintptr_t base;
+    uintptr_t load_offset;  /* add to link-time addresses */
+    const ElfW(Sym) *symtab;
+    const char *strtab;
+    const ElfW(Half) *versym;
+    const ElfW(Verdef) *verdef;
+    unsigned int nsyms;
+};
+
+static unsigned int gnu_hash_nsyms(const uint32_t *gnu_hash) {
+    uint32_t nbuckets = gnu_hash[0], symoffset = gnu_hash[1], bloom_size = gnu_hash[2];
+    const uint32_t *buckets = gnu_hash + 4 + bloom_size * (sizeof(ElfW(Addr)) / 4);
+    const uint32_t *chain = buckets + nbuckets;
+    uint32_t last = 0;
+
+    for (uint32_t b = 0; b < nbuckets; b++)
+        if (buckets[b] > last)
+            last = buckets[b];
+    if (last < symoffset)
+        return symoffset;
+    /* The last chain ends with its low bit set */
+    while (!(chain[last - symoffset] & 1))
+        last++;
+    return last + 1;
+}
+
+static bool vdso_load(struct vdso *v) {
+    memset(v, 0, sizeof(*v));
+    v->base = getauxval(AT_SYSINFO_EHDR);
+    if (!v->base)
+        return false;
+
+    const ElfW(Ehdr) *eh = (const ElfW(Ehdr) *)v->base;
+    const ElfW(Phdr) *ph = (const ElfW(Phdr) *)(v->base + eh->e_phoff);
+    const ElfW(Dyn) *dyn = NULL;
+    bool have_load = false;
+
+    if (memcmp(eh->e_ident, ELFMAG, SELFMAG))
+        return false;
+
+    for (int i = 0; i < eh->e_phnum; i++) {
+        if (ph[i].p_type == PT_LOAD && !have_load) {
+            v->load_offset = v->base + ph[i].p_offset - ph[i].p_vaddr;
+            have_load = true;
+        } else if (ph[i].p_type == PT_DYNAMIC) {
+            dyn = (const ElfW(Dyn) *)(v->base + ph[i].p_offset);
+        }
+    }
+    if (!have_load || !dyn)
+        return false;
+
+    const uint32_t *hash = NULL, *gnu_hash = NULL;
+    for (; dyn->d_tag != DT_NULL; dyn++) {
+        uintptr_t addr = v->load_offset + dyn->d_un.d_ptr;
+        switch (dyn->d_tag) {
+        case DT_SYMTAB:
+            v->symtab = (const ElfW(Sym) *)addr;
+            break;
+        case DT_STRTAB:
+            v->strtab = (const char *)addr;
+            break;
+        case DT_HASH:
+            hash = (const uint32_t *)addr;
+            break;
+        case DT_GNU_HASH:
+            gnu_hash = (const uint32_t *)addr;
+            break;
+        case DT_VERSYM:
+            v->versym = (const ElfW(Half) *)addr;
+            break;
+        case DT_VERDEF:
+            v->verdef = (const ElfW(Verdef) *)addr;
+            break;
+        }
+    }
+    if (!v->symtab || !v->strtab || (!hash && !gnu_hash))
+        return false;
+
+    /* DT_HASH's nchain is the symbol count; DT_GNU_HASH must be walked */
+    v->nsyms = hash ? hash[1] : gnu_hash_nsyms(gnu_hash);
+    return true;
+}
+
+static const char *vdso_sym_version(const struct vdso *v, unsigned int i) {
+    if (!v->versym || !v->verdef)
+        return "";
+
+    ElfW(Half) ndx = v->versym[i] & 0x7fff;
+    const ElfW(Verdef) *vd = v->verdef;
+    while (1) {
+        if (vd->vd_ndx == ndx && !(vd->vd_flags & VER_FLG_BASE)) {
+            const ElfW(Verdaux) *aux = (const ElfW(Verdaux) *)((const char *)vd + vd->vd_aux);
+            return v->strtab + aux->vda_name;
+        }
+        if (!vd->vd_next)
+            return "";
+        vd = (const ElfW(Verdef) *)((const char *)vd + vd->vd_next);
+    }
+}
+
+/* Exported = defined, global or weak; SHN_ABS entries only name a version */
+static bool vdso_sym_exported(const ElfW(Sym) *sym) {
+    int bind = SYM_BIND(sym->st_info), type = SYM_TYPE(sym->st_info);
+
+    return sym->st_shndx != SHN_UNDEF && sym->st_shndx != SHN_ABS && sym->st_name &&
+           (bind == STB_GLOBAL || bind == STB_WEAK) &&
+           (type == STT_FUNC || type == STT_OBJECT || type == STT_NOTYPE);
+}
+
+/* __vdso_clock_gettime and __kernel_clock_gettime (arm64) are both clock_gettime */
+static const char *vdso_base_name(const char *name) {
+    if (!strncmp(name, "__vdso_", 7))
+        return name + 7;
+    if (!strncmp(name, "__kernel_", 9))
+        return name + 9;
+    return name;
+}
+
+static void *vdso_lookup(const struct vdso *v, const char *base_name) {
+    for (unsigned int i = 1; i < v->nsyms; i++) {
+        const ElfW(Sym) *sym = &v->symtab[i];
+        if (vdso_sym_exported(sym) && SYM_TYPE(sym->st_info) == STT_FUNC &&
+            !strcmp(vdso_base_name(v->strtab + sym->st_name), base_name))
+            return (void *)(v->load_offset + sym->st_value);
+    }
+    return NULL;
+}
+
+static const char *sym_type_name(const ElfW(Sym) *sym) {
+    switch (SYM_TYPE(sym->st_info)) {
+    case STT_FUNC:
+        return "FUNC";
+    case STT_OBJECT:
+        return "OBJECT";
+    default:
+        return "NOTYPE";
+    }
+}
+
+static void print_vdso_exports(const struct vdso *v) {
+    printf("\n[+] Exports\n");
+    printf("    %-28s %-14s %-6s %-6s %6s\n", "symbol", "version", "type", "bind", "size");
+    for (unsigned int i = 1; i < v->nsyms; i++) {
+        const ElfW(Sym) *sym = &v->symtab[i];
+        if (!vdso_sym_exported(sym))
+            continue;
+        printf("    %-28s %-14s %-6s %-6s %6lu\n", v->strtab + sym->st_name,
+               vdso_sym_version(v, i), sym_type_name(sym),
+               SYM_BIND(sym->st_info) == STB_WEAK ? "WEAK" : "GLOBAL",
+               (unsigned long)sym->st_size);
+    }
+}
+
+/* time64 entry points on 32-bit arches take the kernel's 64-bit timespec */
+struct vdso_timespec64 {
+    int64_t tv_sec;
+    int64_t tv_nsec;
+};
+
+typedef int (*vdso_clock_fn)(clockid_t, void *);
+typedef int (*vdso_tod_fn)(struct timeval *, void *);
+typedef long (*vdso_time_fn)(long *);
+typedef int (*vdso_getcpu_fn)(unsigned int *, unsigned int *, void *);
+
+enum vdso_call { VC_CLOCK, VC_TOD, VC_TIME, VC_GETCPU };
+
+/* One time-related export and the raw syscall it stands in for */
+struct vdso_timed {
+    const char *name;       /* without __vdso_/__kernel_ */
+    enum vdso_call call;
+    long nr;
+    bool per_clock;
+    bool ts64;
+};
+
+#ifndef __NR_gettimeofday
+  #define __NR_gettimeofday SC_NO_NR
+#endif
+#ifndef __NR_time
+  #define __NR_time SC_NO_NR
+#endif
+#ifndef __NR_clock_gettime64
+  #define __NR_clock_gettime64 SC_NO_NR
+#endif
+#ifndef __NR_clock_getres_time64
+  #define __NR_clock_getres_time64 SC_NO_NR
+#endif
+
+static const struct vdso_timed vdso_timed[] = {
+    { "clock_gettime", VC_CLOCK, __NR_clock_gettime, true, false },
+    { "clock_gettime64", VC_CLOCK, __NR_clock_gettime64, true, true },
+    { "clock_getres", VC_CLOCK, __NR_clock_getres, true, false },
+    { "clock_getres_time64", VC_CLOCK, __NR_clock_getres_time64, true, true },
+    { "gettimeofday", VC_TOD, __NR_gettimeofday, false, false },
+    { "time", VC_TIME, __NR_time, false, false },
+    { "getcpu", VC_GETCPU, __NR_getcpu, false, false },
+};
+
+struct clock_name {
+    clockid_t id;
+    const char *name;
+};
+
+static const struct clock_name vdso_clocks[] = {
+    { CLOCK_REALTIME, "REALTIME" },
+    { CLOCK_MONOTONIC, "MONOTONIC" },
+    { CLOCK_MONOTONIC_RAW, "MONOTONIC_RAW" },
+    { CLOCK_BOOTTIME, "BOOTTIME" },
+    { CLOCK_TAI, "TAI" },
+    { CLOCK_REALTIME_COARSE, "REALTIME_COARSE" },
+    { CLOCK_MONOTONIC_COARSE, "MONOTONIC_COARSE" },
+    { CLOCK_PROCESS_CPUTIME_ID, "PROCESS_CPUTIME" },
+    { CLOCK_THREAD_CPUTIME_ID, "THREAD_CPUTIME" },
+};
+
+/* Issue one call through the vDSO (fn) or as a raw syscall (fn == NULL) */
+static int vdso_call_once(const struct vdso_timed *t, void *fn, clockid_t clk) {
+    struct vdso_timespec64 ts64;
+    struct timespec ts;
+    struct timeval tv;
+    unsigned int cpu, node;
+    void *tsp = t->ts64 ? (void *)&ts64 : (void *)&ts;
+
+    switch (t->call) {
+    case VC_CLOCK:
+        return fn ? ((vdso_clock_fn)fn)(clk, tsp) : syscall(t->nr, clk, tsp);
+    case VC_TOD:
+        return fn ? ((vdso_tod_fn)fn)(&tv, NULL) : syscall(t->nr, &tv, NULL);
+    case VC_TIME:
+        return (fn ? ((vdso_time_fn)fn)(NULL) : syscall(t->nr, NULL)) < 0 ? -1 : 0;
+    case VC_GETCPU:
+        return fn ? ((vdso_getcpu_fn)fn)(&cpu, &node, NULL) : syscall(t->nr, &cpu, &node, NULL);
+    }
+    return -1;
+}
+
+/* Best per-call ns over `loops` runs, or -1 if the call fails */
+static long long vdso_cost(const struct vdso_timed *t, void *fn, clockid_t clk,
+                           int calls, int loops) {
+    long long best = -1;
+
+    if (vdso_call_once(t, fn, clk))
+        return -1;
+    for (int l = 0; l < loops; l++) {
+        long long t0 = bench_now_ns();
+        for (int i = 0; i < calls; i++)
+            vdso_call_once(t, fn, clk);
+        long long per = (bench_now_ns() - t0) / calls;
+        if (best < 0 || per < best)
+            best = per;
+    }
+    return best;
+}
+
+enum vdso_verdict { VV_FAST, VV_FALLBACK, VV_FAILED, VV_UNKNOWN };
+
+static const char *vdso_verdict_name[] = {
+    [VV_FAST] = "fast",
+    [VV_FALLBACK] = "syscall",
+    [VV_FAILED] = "failed",
+    [VV_UNKNOWN] = "unknown",
+};
+
+/* One timed (function, clock) pair */
+struct vdso_sample {
+    const char *function;
+    const char *clock;      /* "-" unless timed per clock */
+    long long vdso_ns;      /* -1: the vDSO call failed */
+    long long sys_ns;       /* -1: no raw syscall to compare with */
+};
+
+static enum vdso_verdict vdso_classify(const struct vdso_sample *s) {
+    if (s->vdso_ns < 0)
+        return VV_FAILED;
+    if (s->sys_ns <= 0)
+        return VV_UNKNOWN;
+    return (double)s->sys_ns / (s->vdso_ns ? s->vdso_ns : 1) >= VDSO_FAST_RATIO ? VV_FAST
+                                                                              : VV_FALLBACK;
+}
+
+typedef void (*vdso_sample_fn)(const struct vdso_sample *s, void *arg);
+
+/* Time every exported time function; returns how many were exported */
+static int measure_vdso_calls(const struct vdso *v, int calls, int loops,
+                              vdso_sample_fn report, void *arg) {
+    int found = 0;
+
+    for (size_t i = 0; i < sizeof(vdso_timed) / sizeof(vdso_timed[0]); i++) {
+        const struct vdso_timed *t = &vdso_timed[i];
+        size_t nclocks = t->per_clock ? sizeof(vdso_clocks) / sizeof(vdso_clocks[0]) : 1;
+        void *fn = vdso_lookup(v, t->name);
+
+        if (!fn)
+            continue;
+        found++;
+        for (size_t c = 0; c < nclocks; c++) {
+            clockid_t clk = t->per_clock ? vdso_clocks[c].id : 0;
+            struct vdso_sample s = {
+                .function = t->name,
+                .clock = t->per_clock ? vdso_clocks[c].name : "-",
+                .vdso_ns = vdso_cost(t, fn, clk, calls, loops),
+                .sys_ns = t->nr == SC_NO_NR ? -1 : vdso_cost(t, NULL, clk, calls, loops),
+            };
+            report(&s, arg);
+        }
+    }
+    return found;
+}
+
+static void print_vdso_timing(const struct vdso_sample *s, void *arg) {
+    (void)arg;
+
+    printf("    %-20s %-17s", s->function, s->clock);
+    switch (vdso_classify(s)) {
+    case VV_FAILED:
+        printf(" %8s %8s  %6s  %s\n", "fail", "-", "-", "[WARN] vDSO call failed");
+        break;
+    case VV_UNKNOWN:
+        /* No raw syscall to compare with (e.g. time on arm64) */
+        printf(" %8lld %8s  %6s  %s\n", s->vdso_ns, "-", "-", "[ -- ] no syscall to compare");
+        break;
+    default:
+        printf(" %8lld %8lld  %5.1fx  %s\n", s->vdso_ns, s->sys_ns,
+               (double)s->sys_ns / (s->vdso_ns ? s->vdso_ns : 1),
+               vdso_classify(s) == VV_FAST ? "[PASS] fast" : "[WARN] syscall fallback");
+        break;
+    }
+    fflush(stdout);
+}
+
+static void time_vdso_calls(const struct vdso *v, int calls, int loops) {
+    printf("\n[+] Time functions: vDSO vs raw syscall (ns per call, best of %d x %d)\n",
+           loops, calls);
+    printf("    fast = at least %.0fx cheaper than the syscall; fallback = the vDSO\n"
+           "    entered the kernel anyway (CPU-time clocks, or no usable clocksource)\n",
+           VDSO_FAST_RATIO);
+    printf("    %-20s %-17s %8s %8s  %6s  %s\n", "function", "clock", "vdso", "syscall",
+           "ratio", "verdict");
+
+    if (!measure_vdso_calls(v, calls, loops, print_vdso_timing, NULL))
+        printf("    [FAIL] no time functions exported: every time call is a syscall\n");
+}
+
+static int run_vdso(int calls, int loops) {
+    struct utsname uts;
+    struct vdso v;
+
+    uname(&uts);
+    printf("[*] vDSO on %s %s (%s)\n", uts.sysname, uts.release, uts.machine);
+    if (!vdso_load(&v)) {
+        printf("[FAIL] no usable vDSO (AT_SYSINFO_EHDR %s)\n",
+               getauxval(AT_SYSINFO_EHDR) ? "does not parse" : "is 0");
+        return 1;
+    }
+    printf("    mapped at %#lx, %u dynamic symbols, ELF%d\n", (unsigned long)v.base, v.nsyms,
+           (int)sizeof(void *) * 8);
+
+    print_vdso_exports(&v);
+    time_vdso_calls(&v, calls, loops);
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* JSON report and compare                                             */
+/* ------------------------------------------------------------------ */
+
+#define REPORT_FORMAT "syscall-check/1"
+#define COMPARE_THRESHOLD_DEFAULT 20
+/* Cost changes below this are noise whatever the percentage */
+#define COMPARE_MIN_DELTA_NS 10
+
+#if defined(__aarch64__)
+  #define BUILD_ARCH "arm64"
+#elif defined(__arm__)
+  #define BUILD_ARCH "arm"
+#elif defined(__x86_64__)
+  #define BUILD_ARCH "x86_64"
+#elif defined(__i386__)
+  #define BUILD_ARCH "x86"
+#else
+  #define BUILD_ARCH "unknown"
+#endif
+
+/* Status names in reports are stable identifiers, not display text */
+static const char *status_id[] = {
+    [SC_PRESENT] = "present",
+    [SC_ABSENT] = "absent",
+    [SC_ERROR] = "error",
+    [SC_UNDEFINED] = "undefined",
+};
+
+/* Knobs that decide whether the probed features are usable at all */
+static const char *report_sysctls[] = {
+    "kernel.io_uring_disabled",
+    "kernel.io_uring_group",
+    "kernel.perf_event_paranoid",
+    "kernel.unprivileged_bpf_disabled",
+    "kernel.kptr_restrict",
+    "kernel.dmesg_restrict",
+    "kernel.randomize_va_space",
+    "kernel.yama.ptrace_scope",
+    "kernel.seccomp.actions_avail",
+    "kernel.pid_max",
+    "kernel.timer_migration",
+    "kernel.sched_rt_runtime_us",
+    "kernel.sched_util_clamp_min",
+    "vm.overcommit_memory",
+    "vm.max_map_count",
+    "vm.mmap_min_addr",
+    "vm.unprivileged_userfaultfd",
+    "fs.nr_open",
+    "fs.file-max",
+    "user.max_user_namespaces",
+};
+
+/* errno names are portable across libcs, strerror() text is not */
+static const char *errno_id(int err) {
+    switch (err) {
+    case 0: return "";
+    case EPERM: return "EPERM";
+    case ENOENT: return "ENOENT";
+    case ESRCH: return "ESRCH";
+    case EBADF: return "EBADF";
+    case EAGAIN: return "EAGAIN";
+    case ENOMEM: return "ENOMEM";
+    case EACCES: return "EACCES";
+    case EFAULT: return "EFAULT";
+    case EINVAL: return "EINVAL";
+    case E2BIG: return "E2BIG";
+    case ENOSYS: return "ENOSYS";
+    case EOPNOTSUPP: return "EOPNOTSUPP";
+    default: return "other";
+    }
+}
+
+/* Read /proc/sys/<name with dots as slashes>; false if unreadable */
+static bool read_sysctl(const char *name, char *buf, size_t len) {
+    char path[PATH_MAX];
+    ssize_t n;
+    int fd;
+
+    snprintf(path, sizeof(path), "/proc/sys/%s", name);
+    for (char *c = path + strlen("/proc/sys/"); *c; c++)
+        if (*c == '.')
+            *c = '/';
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    n = read(fd, buf, len - 1);
+    close(fd);
+    if (n < 0)
+        return false;
+    while (n > 0 && (buf[n - 1] == '\n' || buf[n - 1] == ' '))
+        n--;
+    buf[n] = '\0';
+    for (char *c = buf; *c; c++)
+        if (*c == '\t' || *c == '\n')
+            *c = ' ';
+    return true;
+}
+
+struct json_ctx {
+    FILE *f;
+    bool first;
+};
+
+static void json_sep(struct json_ctx *jc) {
+    fputs(jc->first ? "\n" : ",\n", jc->f);
+    jc->first = false;
+}
+
+static void json_vdso_sample(const struct vdso_sample *s, void *arg) {
+    struct json_ctx *jc = arg;
+
+    json_sep(jc);
+    fprintf(jc->f, "      {\"function\": ");
+    json_put_str(jc->f, s->function);
+    fprintf(jc->f, ", \"clock\": ");
+    json_put_str(jc->f, s->clock);
+    fprintf(jc->f, ", \"vdso_ns\": %lld, \"syscall_ns\": %lld, \"verdict\": \"%s\"}",
+            s->vdso_ns, s->sys_ns, vdso_verdict_name[vdso_classify(s)]);
+}
+
+static void json_write_syscalls(FILE *f, int calls, int loops) {
+    struct sc_probe_result res;
+
+    fprintf(f, "  \"syscalls\": [");
+    sc_probe_begin();
+    for (int i = 0; i < SC_NR_CAPS; i++) {
+        const struct sc_probe *p = &sc_probes[i];
+
+        sc_probe_run(p, &res);
+        fprintf(f, "%s\n    {\"name\": \"%s\", \"nr\": %ld, \"status\": \"%s\", "
+                   "\"errno\": %d, \"errno_name\": \"%s\", \"sigsys\": %s, \"cost_ns\": ",
+                i ? "," : "", p->name, p->nr, status_id[res.status],
+                res.ret < 0 ? res.err : 0, res.ret < 0 ? errno_id(res.err) : "",
+                res.sigsys ? "true" : "false");
+        if (res.status == SC_PRESENT)
+            fprintf(f, "%ld}", sc_probe_cost(p, calls, loops));
+        else
+            fprintf(f, "null}");
+    }
+    sc_probe_end();
+    fprintf(f, "\n  ],\n  \"caps\": \"0x%016llx\",\n", (unsigned long long)sc_init());
+}
+
+static void json_write_vdso(FILE *f, int calls, int loops) {
+    struct json_ctx jc = { f, true };
+    struct vdso v;
+
+    if (!vdso_load(&v)) {
+        fprintf(f, "  \"vdso\": {\"present\": false, \"exports\": [], \"timing\": []},\n");
+        return;
+    }
+
+    fprintf(f, "  \"vdso\": {\n    \"present\": true,\n    \"exports\": [");
+    for (unsigned int i = 1; i < v.nsyms; i++) {
+        const ElfW(Sym) *sym = &v.symtab[i];
+        if (!vdso_sym_exported(sym))
+            continue;
+        json_sep(&jc);
+        fprintf(f, "      {\"name\": ");
+        json_put_str(f, v.strtab + sym->st_name);
+        fprintf(f, ", \"version\": ");
+        json_put_str(f, vdso_sym_version(&v, i));
+        fprintf(f, ", \"type\": \"%s\", \"size\": %lu}", sym_type_name(sym),
+                (unsigned long)sym->st_size);
+    }
+    fprintf(f, "\n    ],\n    \"timing\": [");
+    jc.first = true;
+    measure_vdso_calls(&v, calls, loops, json_vdso_sample, &jc);
+    fprintf(f, "\n    ]\n  },\n");
+}
+
+static int write_json_report(const char *path, int calls, int loops) {
+    FILE *f = strcmp(path, "-") ? fopen(path, "we") : stdout;
+    struct utsname uts;
+    char value[256];
+    time_t now = time(NULL);
+    char stamp[32];
+
+    if (!f) {
+        fprintf(stderr, "fopen(%s): %s\n", path, strerror(errno));
+        return 1;
+    }
+    uname(&uts);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    fprintf(f, "{\n  \"format\": \"%s\",\n  \"timestamp\": \"%s\",\n", REPORT_FORMAT, stamp);
+    fprintf(f, "  \"kernel\": {\"sysname\": ");
+    json_put_str(f, uts.sysname);
+    fprintf(f, ", \"release\": ");
+    json_put_str(f, uts.release);
+    fprintf(f, ", \"version\": ");
+    json_put_str(f, uts.version);
+    fprintf(f, ", \"machine\": ");
+    json_put_str(f, uts.machine);
+    fprintf(f, "},\n  \"arch\": \"%s\",\n", BUILD_ARCH);
+    fprintf(f, "  \"env\": ");
+    bench_env_write_json(bench_env_self(), f, "  ");
+    fprintf(f, ",\n");
+    fprintf(f, "  \"cost\": {\"calls\": %d, \"loops\": %d},\n", calls, loops);
+
+    json_write_syscalls(f, calls, loops);
+    json_write_vdso(f, calls, loops);
+
+    fprintf(f, "  \"sysctl\": {");
+    for (size_t i = 0; i < sizeof(report_sysctls) / sizeof(report_sysctls[0]); i++) {
+        fprintf(f, "%s\n    \"%s\": ", i ? "," : "", report_sysctls[i]);
+        if (read_sysctl(report_sysctls[i], value, sizeof(value)))
+            json_put_str(f, value);
+        else
+            fprintf(f, "null");
+    }
+    fprintf(f, "\n  }\n}\n");
+
+    if (f != stdout) {
+        if (fclose(f)) {
+            fprintf(stderr, "write(%s): %s\n", path, strerror(errno));
+            return 1;
+        }
+        printf("[*] Wrote %s\n", path);
+    }
+    return 0;
+}
+
+/* Members of a report array whose `key` (and `key2`, if set) match */
+static const struct json *find_entry(const struct json *arr, const char *key, const char *val,
+                                     const char *key2, const char *val2) {
+    if (!arr || arr->type != JSON_ARRAY)
+        return NULL;
+    for (const struct json *e = arr->child; e; e = e->next) {
+        const char *v = json_get_str(e, key, NULL);
+        if (v && !strcmp(v, val) &&
+            (!key2 || !strcmp(json_get_str(e, key2, ""), val2)))
+            return e;
+    }
+    return NULL;
+}
+
+struct compare_stats {
+    int lost;
+    int slower;
+    int gained;
+    int changed;            /* sysctls */
+    int env_changed;
+};
+
+/* Flag b slower than a by more than threshold percent (and the noise floor) */
+static bool cost_regressed(double a, double b, int threshold) {
+    return a > 0 && b > 0 && b - a >= COMPARE_MIN_DELTA_NS && (b - a) * 100 > a * threshold;
+}
+
+static void compare_syscalls(const struct json *a, const struct json *b, int threshold,
+                             struct compare_stats *st) {
+    const struct json *arr_a = json_get(a, "syscalls"), *arr_b = json_get(b, "syscalls");
+
+    printf("\n[+] Syscalls\n");
+    if (!arr_a || !arr_b)
+        return;
+    for (const struct json *ea = arr_a->child; ea; ea = ea->next) {
+        const char *name = json_get_str(ea, "name", "?");
+        const struct json *eb = find_entry(arr_b, "name", name, NULL, NULL);
+        const char *sa = json_get_str(ea, "status", "?");
+        const char *sb = eb ? json_get_str(eb, "status", "?") : "missing";
+
+        if (!strcmp(sa, "present") && strcmp(sb, "present")) {
+            printf("    [FAIL] %-24s %s -> %s %s  capability lost\n", name, sa, sb,
+                   eb ? json_get_str(eb, "errno_name", "") : "");
+            st->lost++;
+        } else if (strcmp(sa, "present") && !strcmp(sb, "present")) {
+            printf("    [PASS] %-24s %s -> %s  gained\n", name, sa, sb);
+            st->gained++;
+        } else if (eb && !strcmp(sa, "present")) {
+            double ca = json_get_num(ea, "cost_ns", 0), cb = json_get_num(eb, "cost_ns", 0);
+            if (cost_regressed(ca, cb, threshold)) {
+                printf("    [WARN] %-24s %.0f -> %.0f ns (%+.0f%%)  slower\n", name, ca, cb,
+                       (cb - ca) * 100 / ca);
+                st->slower++;
+            }
         }
-        close(epfd);
     }
-    #else
-    printf("[!] __NR_epoll_pwait2 undefined for this arch.\n");
-    #endif
+    for (const struct json *eb = arr_b->child; eb; eb = eb->next) {
+        const char *name = json_get_str(eb, "name", "?");
+        if (!find_entry(arr_a, "name", name, NULL, NULL) &&
+            !strcmp(json_get_str(eb, "status", ""), "present")) {
+            printf("    [PASS] %-24s new in b  gained\n", name);
+            st->gained++;
+        }
+    }
+}
+
+static void compare_vdso(const struct json *a, const struct json *b, int threshold,
+                         struct compare_stats *st) {
+    const struct json *va = json_get(a, "vdso"), *vb = json_get(b, "vdso");
+    const struct json *xa = json_get(va, "exports"), *xb = json_get(vb, "exports");
+    const struct json *ta = json_get(va, "timing"), *tb = json_get(vb, "timing");
+
+    printf("\n[+] vDSO\n");
+    if (json_get_bool(va, "present", false) && !json_get_bool(vb, "present", false)) {
+        printf("    [FAIL] vDSO no longer mapped\n");
+        st->lost++;
+        return;
+    }
+    for (const struct json *e = xa ? xa->child : NULL; e; e = e->next) {
+        const char *name = json_get_str(e, "name", "?");
+        if (!find_entry(xb, "name", name, NULL, NULL)) {
+            printf("    [FAIL] export %-30s lost\n", name);
+            st->lost++;
+        }
+    }
+    for (const struct json *e = xb ? xb->child : NULL; e; e = e->next) {
+        const char *name = json_get_str(e, "name", "?");
+        if (!find_entry(xa, "name", name, NULL, NULL)) {
+            printf("    [PASS] export %-30s gained\n", name);
+            st->gained++;
+        }
+    }
+
+    for (const struct json *ea = ta ? ta->child : NULL; ea; ea = ea->next) {
+        const char *fn = json_get_str(ea, "function", "?"), *clk = json_get_str(ea, "clock", "-");
+        const struct json *eb = find_entry(tb, "function", fn, "clock", clk);
+        const char *da = json_get_str(ea, "verdict", "?");
+
+        if (!eb)
+            continue;
+        const char *db = json_get_str(eb, "verdict", "?");
+        double ca = json_get_num(ea, "vdso_ns", 0), cb = json_get_num(eb, "vdso_ns", 0);
+        if (!strcmp(da, "fast") && strcmp(db, "fast")) {
+            printf("    [FAIL] %-20s %-17s fast -> %s\n", fn, clk, db);
+            st->lost++;
+        } else if (strcmp(da, "fast") && !strcmp(db, "fast")) {
+            printf("    [PASS] %-20s %-17s %s -> fast\n", fn, clk, da);
+            st->gained++;
+        } else if (cost_regressed(ca, cb, threshold)) {
+            printf("    [WARN] %-20s %-17s %.0f -> %.0f ns (%+.0f%%)  slower\n", fn, clk, ca, cb,
+                   (cb - ca) * 100 / ca);
+            st->slower++;
+        }
+    }
+}
+
+/* Knob changes explain differences; they are not failures by themselves */
+static void compare_sysctls(const struct json *a, const struct json *b,
+                            struct compare_stats *st) {
+    const struct json *sa = json_get(a, "sysctl"), *sb = json_get(b, "sysctl");
+
+    printf("\n[+] sysctl\n");
+    for (const struct json *e = sa ? sa->child : NULL; e; e = e->next) {
+        const char *va = e->type == JSON_STRING ? e->str : "(none)";
+        const char *vb = json_get_str(sb, e->key, "(none)");
+        if (strcmp(va, vb)) {
+            printf("    [ -- ] %-34s %s -> %s\n", e->key, va, vb);
+            st->changed++;
+        }
+    }
+}
+
+/* Fingerprint differences explain cost changes; they do not fail the compare */
+static void compare_env(const struct json *a, const struct json *b, struct compare_stats *st) {
+    const struct json *ea = json_get(a, "env"), *eb = json_get(b, "env");
+    struct bench_env env_a = { 0 }, env_b = { 0 };
+
+    for (const struct json *e = ea ? ea->child : NULL; e; e = e->next)
+        if (e->type == JSON_STRING)
+            bench_env_set(&env_a, e->key, e->str);
+    for (const struct json *e = eb ? eb->child : NULL; e; e = e->next)
+        if (e->type == JSON_STRING)
+            bench_env_set(&env_b, e->key, e->str);
+
+    printf("\n[+] environment\n");
+    st->env_changed = bench_env_diff(&env_a, &env_b, stdout, "    [ -- ] ");
+    bench_env_free(&env_a);
+    bench_env_free(&env_b);
+}
+
+/* Exit status: 0 no regressions, 1 losses or slowdowns, 2 unreadable input */
+static int run_compare(const char *path_a, const char *path_b, int threshold) {
+    struct json *a = json_parse_file(path_a), *b = json_parse_file(path_b);
+    struct compare_stats st = { 0 };
+    int ret = 2;
+
+    if (!a || !b) {
+        fprintf(stderr, "%s: cannot read or parse as JSON\n", !a ? path_a : path_b);
+        goto out;
+    }
+    if (strcmp(json_get_str(a, "format", ""), REPORT_FORMAT) ||
+        strcmp(json_get_str(b, "format", ""), REPORT_FORMAT)) {
+        fprintf(stderr, "not a %s report: %s\n", REPORT_FORMAT,
+                strcmp(json_get_str(a, "format", ""), REPORT_FORMAT) ? path_a : path_b);
+        goto out;
+    }
+
+    const struct json *ka = json_get(a, "kernel"), *kb = json_get(b, "kernel");
+    printf("[*] a: %s  %s %s (%s)\n", path_a, json_get_str(ka, "release", "?"),
+           json_get_str(a, "arch", "?"), json_get_str(a, "timestamp", "?"));
+    printf("[*] b: %s  %s %s (%s)\n", path_b, json_get_str(kb, "release", "?"),
+           json_get_str(b, "arch", "?"), json_get_str(b, "timestamp", "?"));
+    printf("    slower = cost up more than %d%% and %d ns\n", threshold, COMPARE_MIN_DELTA_NS);
+    if (strcmp(json_get_str(a, "arch", ""), json_get_str(b, "arch", "")))
+        printf("    [WARN] different build archs: costs are not comparable\n");
+
+    compare_syscalls(a, b, threshold, &st);
+    compare_vdso(a, b, threshold, &st);
+    compare_sysctls(a, b, &st);
+    compare_env(a, b, &st);
+
+    printf("\n[*] %d lost, %d slower, %d gained, %d sysctl changes, %d environment changes\n",
+           st.lost, st.slower, st.gained, st.changed, st.env_changed);
+    ret = st.lost || st.slower;
+
+out:
+    json_free(a);
+    json_free(b);
+    return ret;
+}
+
+static char *short_options = "hm:c:l:n:r:j:C:t:";
+static struct option long_options[] = {
+        {"help", no_argument, 0, 'h'},
+        {"mode", required_argument, 0, 'm'},
+        {"calls", required_argument, 0, 'c'},
+        {"loops", required_argument, 0, 'l'},
+        {"samples", required_argument, 0, 'n'},
+        {"reps", required_argument, 0, 'r'},
+        {"json", required_argument, 0, 'j'},
+        {"compare", required_argument, 0, 'C'},
+        {"threshold", required_argument, 0, 't'},
+        {0, 0, 0, 0}
+};
+
+static void print_help(char *prog_name, int status) {
+    printf("Usage: %s [options]\n"
+           "\n"
+           "Verify backported syscalls and measure their cost\n"
+           "\n"
+           "Options:\n"
+           "  -h, --help\tshow usage help\n"
+           "  -m, --mode\tprobe, timeout, close, uring or vdso (default: probe)\n"
+           "  -c, --calls\tcalls per cost loop, NOP or vDSO run (default: %d)\n"
+           "  -l, --loops\tcost loops, NOP or vDSO runs (default: %d)\n"
+           "  -n, --samples\tsleeps per timeout point (default: %d)\n"
+           "  -r, --reps\trepetitions per close point (default: %d)\n"
+           "  -j, --json\twrite a JSON capability report to FILE (- for stdout)\n"
+           "  -C, --compare\tA.json B.json: diff two reports, exit 1 on losses or\n"
+           "\t\tslowdowns, 2 on unreadable reports or bad arguments\n"
+           "  -t, --threshold\tcost regression threshold in percent (default: %d)\n",
+           prog_name, COST_CALLS_DEFAULT, COST_LOOPS_DEFAULT, TIMEOUT_SAMPLES_DEFAULT,
+           CLOSE_REPS_DEFAULT, COMPARE_THRESHOLD_DEFAULT);
+
+    exit(status);
+}
+
+int main(int argc, char **argv) {
+    const char *mode = "probe";
+    int calls = COST_CALLS_DEFAULT;
+    int loops = COST_LOOPS_DEFAULT;
+    int samples = TIMEOUT_SAMPLES_DEFAULT;
+    int reps = CLOSE_REPS_DEFAULT;
+    int threshold = COMPARE_THRESHOLD_DEFAULT;
+    const char *json_path = NULL;
+    const char *compare_path = NULL;
+
+    if (argc > 1 && !strcmp(argv[1], EXEC_NOOP_ARG))
+        return 0;
+
+    while (1) {
+        int c = getopt_long(argc, argv, short_options, long_options, NULL);
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case 'm':
+                mode = optarg;
+                break;
+            case 'c':
+                calls = atoi(optarg);
+                break;
+            case 'l':
+                loops = atoi(optarg);
+                break;
+            case 'n':
+                samples = atoi(optarg);
+                break;
+            case 'r':
+                reps = atoi(optarg);
+                break;
+            case 'j':
+                json_path = optarg;
+                break;
+            case 'C':
+                compare_path = optarg;
+                break;
+            case 't':
+                threshold = atoi(optarg);
+                break;
+            case '?':
+                /* --compare without its argument gets its own exit status */
+                print_help(argv[0], optopt == 'C' ? 2 : 1);
+                break;
+            case 'h':
+            default:
+                print_help(argv[0], 1);
+                break;
+        }
+    }
+
+    if (calls <= 0 || loops <= 0 || samples <= 0 || reps <= 0) {
+        fprintf(stderr, "%s: --calls, --loops, --samples and --reps must be positive\n", argv[0]);
+        return 1;
+    }
+
+    if (compare_path) {
+        if (optind != argc - 1 || threshold < 0) {
+            fprintf(stderr, "%s: --compare needs two reports and a threshold >= 0\n", argv[0]);
+            print_help(argv[0], 2);
+        }
+        return run_compare(compare_path, argv[optind], threshold);
+    }
+    bench_clock_init();
+    if (json_path)
+        return write_json_report(json_path, calls, loops);
+
+    if (!strcmp(mode, "probe")) {
+        run_probe_table(calls, loops);
+    } else if (!strcmp(mode, "timeout")) {
+        return run_timeout(samples);
+    } else if (!strcmp(mode, "close")) {
+        return run_close(reps);
+    } else if (!strcmp(mode, "uring")) {
+        return run_uring(calls, loops);
+    } else if (!strcmp(mode, "vdso")) {
+        return run_vdso(calls, loops);
+    } else {
+        fprintf(stderr, "%s: invalid mode -- '%s'\n", argv[0], mode);
+        print_help(argv[0], 1);
+    }
 
     return 0;
 }
@@ -0,0 +1,467 @@
+/*
+ * syscompat.c
+ *
+ * Syscall probe table, the one-time capability probe behind sc_caps,
+ * and the out-of-line fallbacks used by the wrappers in syscompat.h.
+ */
+
+#define _GNU_SOURCE
+
+#include "syscompat.h"
+#include "../common/bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+
+_Atomic uint64_t sc_caps;
+
+/* Constants that older uapi headers lack */
+#define PROBE_MADV_COLD 20
+#define PROBE_LANDLOCK_CREATE_RULESET_VERSION (1U << 0)
+#define PROBE_LANDLOCK_RULE_PATH_BENEATH 1
+
+#define NS_PER_SEC 1000000000LL
+#define NS_PER_MSEC 1000000LL
+
+struct probe_open_how {
+    uint64_t flags;
+    uint64_t mode;
+    uint64_t resolve;
+};
+
+struct probe_cachestat_range {
+    uint64_t off;
+    uint64_t len;
+};
+
+struct probe_cachestat {
+    uint64_t nr_cache;
+    uint64_t nr_dirty;
+    uint64_t nr_writeback;
+    uint64_t nr_evicted;
+    uint64_t nr_recently_evicted;
+};
+
+/* State shared by the probes, set up in sc_probe_begin() */
+static int exe_fd = -1;
+static int epoll_fd = -1;
+static volatile sig_atomic_t sigsys_caught;
+static struct sigaction old_sigsys;
+
+/* ------------------------------------------------------------------ */
+/* Probes                                                              */
+/* ------------------------------------------------------------------ */
+
+static long probe_pidfd_open(long nr) {
+    return syscall(nr, getpid(), 0);
+}
+
+static long probe_pidfd_send_signal(long nr) {
+    return syscall(nr, -1, 0, NULL, 0);
+}
+
+static long probe_pidfd_getfd(long nr) {
+    return syscall(nr, -1, 0, 0);
+}
+
+static long probe_clone3(long nr) {
+    /* A NULL clone_args of size 0 is rejected before anything is cloned */
+    return syscall(nr, NULL, 0);
+}
+
+static long probe_openat2(long nr) {
+    struct probe_open_how how = { .flags = O_RDONLY | O_CLOEXEC };
+    return syscall(nr, AT_FDCWD, "/dev/null", &how, sizeof(how));
+}
+
+static long probe_faccessat2(long nr) {
+    return syscall(nr, AT_FDCWD, "/", F_OK, 0);
+}
+
+static long probe_fchmodat2(long nr) {
+    /* Nonexistent path: exercises lookup without changing anything */
+    return syscall(nr, AT_FDCWD, "/nonexistent/syscall-check", 0644, 0);
+}
+
+static long probe_process_madvise(long nr) {
+    return syscall(nr, -1, NULL, 0, PROBE_MADV_COLD, 0);
+}
+
+static long probe_epoll_pwait2(long nr) {
+    struct epoll_event ev;
+    struct timespec ts = { 0, 0 };
+    return syscall(nr, epoll_fd, &ev, 1, &ts, NULL, 0);
+}
+
+static long probe_close_range(long nr) {
+    /* A range above every possible fd closes nothing */
+    return syscall(nr, INT_MAX - 1, ~0U, 0);
+}
+
+static long probe_futex_waitv(long nr) {
+    return syscall(nr, NULL, 0, 0, NULL, 0);
+}
+
+static long probe_memfd_secret(long nr) {
+    return syscall(nr, O_CLOEXEC);
+}
+
+static long probe_landlock_create_ruleset(long nr) {
+    /* Returns the Landlock ABI version instead of creating a ruleset */
+    return syscall(nr, NULL, 0, PROBE_LANDLOCK_CREATE_RULESET_VERSION);
+}
+
+static long probe_landlock_add_rule(long nr) {
+    return syscall(nr, -1, PROBE_LANDLOCK_RULE_PATH_BENEATH, NULL, 0);
+}
+
+static long probe_landlock_restrict_self(long nr) {
+    /* Never pass a real ruleset: that would sandbox this process */
+    return syscall(nr, -1, 0);
+}
+
+static long probe_process_mrelease(long nr) {
+    return syscall(nr, -1, 0);
+}
+
+static long probe_set_mempolicy_home_node(long nr) {
+    /* An empty range is accepted without touching any VMA */
+    return syscall(nr, 0, 0, 0, 0);
+}
+
+static long probe_cachestat(long nr) {
+    struct probe_cachestat_range range = { 0, 4096 };
+    struct probe_cachestat cs;
+    return syscall(nr, exe_fd, &range, &cs, 0);
+}
+
+static long probe_io_uring_setup(long nr) {
+    /* Zero entries is rejected before a ring is allocated */
+    char params[120];
+    memset(params, 0, sizeof(params));
+    return syscall(nr, 0, params);
+}
+
+static long probe_rseq(long nr) {
+    /* Zero length never registers, even when libc has not registered yet */
+    return syscall(nr, NULL, 0, 0, 0);
+}
+
+static long probe_mseal(long nr) {
+    /* An empty range is accepted and seals nothing */
+    return syscall(nr, 0, 0, 0);
+}
+
+static long probe_getppid(long nr) {
+    return syscall(nr);
+}
+
+#define PROBE(cap, sys, ...) \
+    [cap] = { #sys, __NR_##sys, probe_##sys, { __VA_ARGS__ }, false }
+#define PROBE_FD(cap, sys, ...) \
+    [cap] = { #sys, __NR_##sys, probe_##sys, { __VA_ARGS__ }, true }
+
+const struct sc_probe sc_probes[SC_NR_CAPS] = {
+    PROBE(SC_GETPPID, getppid, 0),
+    PROBE(SC_RSEQ, rseq, EINVAL),
+    PROBE(SC_PIDFD_SEND_SIGNAL, pidfd_send_signal, EBADF),
+    PROBE(SC_IO_URING_SETUP, io_uring_setup, EINVAL),
+    PROBE_FD(SC_PIDFD_OPEN, pidfd_open, 0),
+    PROBE(SC_CLONE3, clone3, EINVAL),
+    PROBE(SC_CLOSE_RANGE, close_range, 0),
+    PROBE_FD(SC_OPENAT2, openat2, 0),
+    PROBE(SC_PIDFD_GETFD, pidfd_getfd, EBADF),
+    PROBE(SC_FACCESSAT2, faccessat2, 0),
+    PROBE(SC_PROCESS_MADVISE, process_madvise, EBADF),
+    PROBE(SC_EPOLL_PWAIT2, epoll_pwait2, 0),
+    PROBE(SC_LANDLOCK_CREATE_RULESET, landlock_create_ruleset, 0),
+    PROBE(SC_LANDLOCK_ADD_RULE, landlock_add_rule, EBADF),
+    PROBE(SC_LANDLOCK_RESTRICT_SELF, landlock_restrict_self, EBADF, EPERM),
+    PROBE_FD(SC_MEMFD_SECRET, memfd_secret, 0),
+    PROBE(SC_PROCESS_MRELEASE, process_mrelease, EBADF),
+    PROBE(SC_FUTEX_WAITV, futex_waitv, EINVAL),
+    PROBE(SC_SET_MEMPOLICY_HOME_NODE, set_mempolicy_home_node, 0),
+    PROBE(SC_CACHESTAT, cachestat, 0),
+    PROBE(SC_FCHMODAT2, fchmodat2, ENOENT),
+    PROBE(SC_MSEAL, mseal, 0),
+};
+
+static void sigsys_handler(int sig) {
+    (void)sig;
+    sigsys_caught = 1;
+}
+
+void sc_probe_begin(void) {
+    /* Seccomp filters that trap (Android's app filter does) deliver SIGSYS */
+    struct sigaction sa = { .sa_handler = sigsys_handler };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSYS, &sa, &old_sigsys);
+
+    exe_fd = open("/proc/self/exe", O_RDONLY | O_CLOEXEC);
+    epoll_fd = sc_epoll_create1(EPOLL_CLOEXEC);
+}
+
+void sc_probe_end(void) {
+    if (exe_fd >= 0)
+        close(exe_fd);
+    if (epoll_fd >= 0)
+        close(epoll_fd);
+    exe_fd = epoll_fd = -1;
+    sigaction(SIGSYS, &old_sigsys, NULL);
+}
+
+static bool errno_expected(const struct sc_probe *p, int err) {
+    for (size_t i = 0; i < sizeof(p->ok_errno) / sizeof(p->ok_errno[0]); i++) {
+        if (!p->ok_errno[i])
+            break;
+        if (p->ok_errno[i] == err)
+            return true;
+    }
+    return false;
+}
+
+void sc_probe_run(const struct sc_probe *p, struct sc_probe_result *res) {
+    memset(res, 0, sizeof(*res));
+    if (p->nr == SC_NO_NR) {
+        res->status = SC_UNDEFINED;
+        return;
+    }
+
+    sigsys_caught = 0;
+    errno = 0;
+    res->ret = p->call(p->nr);
+    res->err = res->ret < 0 ? errno : 0;
+    res->sigsys = sigsys_caught;
+
+    if (p->returns_fd && res->ret >= 0 && !res->sigsys)
+        close(res->ret);
+
+    if (res->sigsys)
+        res->status = SC_ERROR;
+    else if (res->ret >= 0 || errno_expected(p, res->err))
+        res->status = SC_PRESENT;
+    else if (res->err == ENOSYS)
+        res->status = SC_ABSENT;
+    else
+        res->status = SC_ERROR;
+}
+
+long sc_probe_cost(const struct sc_probe *p, int calls, int loops) {
+    long best = LONG_MAX;
+
+    for (int loop = 0; loop < loops; loop++) {
+        long long t0 = bench_now_ns();
+        for (int i = 0; i < calls; i++) {
+            long ret = p->call(p->nr);
+            if (p->returns_fd && ret >= 0)
+                close(ret);
+        }
+        long long t1 = bench_now_ns();
+
+        long per_call = (long)((t1 - t0) / calls);
+        if (per_call < best)
+            best = per_call;
+    }
+    return best;
+}
+
+uint64_t sc_init(void) {
+    struct sc_probe_result res;
+    uint64_t caps = atomic_load_explicit(&sc_caps, memory_order_acquire);
+
+    if (caps & SC_CAPS_READY)
+        return caps;
+
+    /* Racing callers compute the same bitmap, so the last store wins harmlessly */
+    caps = 0;
+    sc_probe_begin();
+    for (int i = 0; i < SC_NR_CAPS; i++) {
+        sc_probe_run(&sc_probes[i], &res);
+        if (res.status == SC_PRESENT)
+            caps |= 1ULL << i;
+    }
+    sc_probe_end();
+
+    caps |= SC_CAPS_READY;
+    atomic_store_explicit(&sc_caps, caps, memory_order_release);
+    return caps;
+}
+
+/* ------------------------------------------------------------------ */
+/* Fallbacks                                                           */
+/* ------------------------------------------------------------------ */
+
+int sc_epoll_create1(int flags) {
+    int fd = -1;
+
+    /* Try epoll_create1 first (modern standard) */
+    #ifdef __NR_epoll_create1
+        fd = syscall(__NR_epoll_create1, flags);
+    #endif
+
+    /* Fallback to legacy epoll_create ONLY if defined (missing on arm64) */
+    if (fd < 0) {
+        #ifdef __NR_epoll_create
+            fd = syscall(__NR_epoll_create, 1);
+            if (fd >= 0 && (flags & EPOLL_CLOEXEC))
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+        #endif
+    }
+    return fd;
+}
+
+static int close_or_mark(int fd, unsigned int flags) {
+    if (flags & CLOSE_RANGE_CLOEXEC)
+        return fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+    return close(fd);
+}
+
+int sc_close_range_fallback(unsigned int first, unsigned int last, unsigned int flags) {
+    struct rlimit rl;
+
+    if (first > last || (flags & ~(CLOSE_RANGE_UNSHARE | CLOSE_RANGE_CLOEXEC))) {
+        errno = EINVAL;
+        return -1;
+    }
+    if ((flags & CLOSE_RANGE_UNSHARE) && unshare(CLONE_FILES))
+        return -1;
+
+    /* Only visit fds that are actually open */
+    DIR *dir = opendir("/proc/self/fd");
+    if (dir) {
+        int dir_fd = dirfd(dir);
+        struct dirent *de;
+
+        while ((de = readdir(dir))) {
+            char *end;
+            long fd = strtol(de->d_name, &end, 10);
+            if (*end || end == de->d_name || fd == dir_fd)
+                continue;
+            if ((unsigned long)fd >= first && (unsigned long)fd <= last)
+                close_or_mark(fd, flags);
+        }
+        closedir(dir);
+        return 0;
+    }
+
+    /* No /proc: try every fd the process could have */
+    if (!getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur != RLIM_INFINITY &&
+        rl.rlim_cur - 1 < last)
+        last = rl.rlim_cur - 1;
+    for (unsigned int fd = first; fd <= last; fd++) {
+        close_or_mark(fd, flags);
+        if (fd == UINT_MAX)
+            break;
+    }
+    return 0;
+}
+
+/*
+ * Each thread waits on a private epoll set holding its timerfd and, for
+ * the duration of a call, the caller's epfd. The caller's set is never
+ * modified, so other threads waiting on it see none of these timers.
+ */
+static __thread int wait_epfd = -1, wait_timerfd = -1;
+
+static int wait_set_init(void) {
+    struct epoll_event tev = { .events = EPOLLIN };
+
+    if (wait_epfd >= 0)
+        return 0;
+    wait_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (wait_timerfd < 0)
+        return -1;
+    wait_epfd = epoll_create1(EPOLL_CLOEXEC);
+    tev.data.fd = wait_timerfd;
+    if (wait_epfd < 0 || epoll_ctl(wait_epfd, EPOLL_CTL_ADD, wait_timerfd, &tev)) {
+        int saved_errno = errno;
+
+        if (wait_epfd >= 0)
+            close(wait_epfd);
+        close(wait_timerfd);
+        wait_epfd = wait_timerfd = -1;
+        errno = saved_errno;
+        return -1;
+    }
+    return 0;
+}
+
+int sc_epoll_pwait_timerfd(int epfd, struct epoll_event *events, int maxevents,
+                           const struct timespec *timeout, const sigset_t *sigmask) {
+    if (timeout && (timeout->tv_sec < 0 || timeout->tv_nsec < 0 || timeout->tv_nsec >= NS_PER_SEC)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Infinite, zero or whole-millisecond timeouts need no timer */
+    if (!timeout)
+        return epoll_pwait(epfd, events, maxevents, -1, sigmask);
+    if (timeout->tv_nsec % NS_PER_MSEC == 0 && timeout->tv_sec < INT_MAX / 1000)
+        return epoll_pwait(epfd, events, maxevents,
+                           (int)(timeout->tv_sec * 1000 + timeout->tv_nsec / NS_PER_MSEC),
+                           sigmask);
+
+    if (maxevents <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (wait_set_init())
+        return -1;
+
+    struct itimerspec its = { .it_value = *timeout };
+    struct epoll_event uev = { .events = EPOLLIN, .data.fd = epfd };
+    if (epoll_ctl(wait_epfd, EPOLL_CTL_ADD, epfd, &uev))
+        return -1;
+    if (timerfd_settime(wait_timerfd, 0, &its, NULL)) {
+        int saved_errno = errno;
+
+        epoll_ctl(wait_epfd, EPOLL_CTL_DEL, epfd, &uev);
+        errno = saved_errno;
+        return -1;
+    }
+
+    /*
+     * epfd reads as ready while it has events; collect them from epfd
+     * itself. Another thread may take them first, then keep waiting.
+     */
+    int n, out = 0, saved_errno = 0;
+    bool expired = false;
+    do {
+        struct epoll_event ready[2];
+
+        n = epoll_pwait(wait_epfd, ready, 2, -1, sigmask);
+        if (n < 0) {
+            saved_errno = errno;
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (ready[i].data.fd == wait_timerfd) {
+                expired = true;
+            } else {
+                out = epoll_wait(epfd, events, maxevents, 0);
+                if (out < 0) {
+                    saved_errno = errno;
+                    n = -1;
+                    break;
+                }
+            }
+        }
+    } while (n >= 0 && !out && !expired);
+
+    struct itimerspec disarm = { { 0, 0 }, { 0, 0 } };
+    epoll_ctl(wait_epfd, EPOLL_CTL_DEL, epfd, &uev);
+    timerfd_settime(wait_timerfd, 0, &disarm, NULL);
+
+    if (n < 0) {
+        errno = saved_errno;
+        return -1;
+    }
+    return out;
+}
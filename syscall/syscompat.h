@@ -0,0 +1,306 @@
+/*
+ * syscompat.h
+ *
+ * Runtime syscall capability probing with cached results, and wrappers
+ * that pick the native syscall or a fallback without probing again.
+ *
+ * The first call to any wrapper (or sc_init()) probes every syscall in
+ * sc_probes[] once and publishes a bitmap, much like the vDSO publishes
+ * clock data: after that a capability check is one relaxed load and a
+ * bit test. Call sc_init() from the main thread before starting others
+ * so the probes (which briefly install a SIGSYS handler) do not race.
+ */
+
+#ifndef SYSCOMPAT_H
+#define SYSCOMPAT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+
+/*
+ * Arch-specific definitions for older NDK/libc headers.
+ * Since 5.1 every architecture shares the numbers of new syscalls.
+ */
+#if defined(__aarch64__) || defined(__arm__) || defined(__x86_64__) || defined(__i386__)
+  #define HAVE_COMMON_SYSCALL_NRS
+#endif
+
+#ifdef HAVE_COMMON_SYSCALL_NRS
+  #ifndef __NR_pidfd_send_signal
+    #define __NR_pidfd_send_signal 424
+  #endif
+  #ifndef __NR_io_uring_setup
+    #define __NR_io_uring_setup 425
+  #endif
+  #ifndef __NR_io_uring_enter
+    #define __NR_io_uring_enter 426
+  #endif
+  #ifndef __NR_io_uring_register
+    #define __NR_io_uring_register 427
+  #endif
+  #ifndef __NR_pidfd_open
+    #define __NR_pidfd_open 434
+  #endif
+  #ifndef __NR_clone3
+    #define __NR_clone3 435
+  #endif
+  #ifndef __NR_close_range
+    #define __NR_close_range 436
+  #endif
+  #ifndef __NR_openat2
+    #define __NR_openat2 437
+  #endif
+  #ifndef __NR_pidfd_getfd
+    #define __NR_pidfd_getfd 438
+  #endif
+  #ifndef __NR_faccessat2
+    #define __NR_faccessat2 439
+  #endif
+  #ifndef __NR_process_madvise
+    #define __NR_process_madvise 440
+  #endif
+  #ifndef __NR_epoll_pwait2
+    #define __NR_epoll_pwait2 441
+  #endif
+  #ifndef __NR_landlock_create_ruleset
+    #define __NR_landlock_create_ruleset 444
+  #endif
+  #ifndef __NR_landlock_add_rule
+    #define __NR_landlock_add_rule 445
+  #endif
+  #ifndef __NR_landlock_restrict_self
+    #define __NR_landlock_restrict_self 446
+  #endif
+  #ifndef __NR_memfd_secret
+    #define __NR_memfd_secret 447
+  #endif
+  #ifndef __NR_process_mrelease
+    #define __NR_process_mrelease 448
+  #endif
+  #ifndef __NR_futex_waitv
+    #define __NR_futex_waitv 449
+  #endif
+  #ifndef __NR_set_mempolicy_home_node
+    #define __NR_set_mempolicy_home_node 450
+  #endif
+  #ifndef __NR_cachestat
+    #define __NR_cachestat 451
+  #endif
+  #ifndef __NR_fchmodat2
+    #define __NR_fchmodat2 452
+  #endif
+  #ifndef __NR_mseal
+    #define __NR_mseal 462
+  #endif
+#endif
+
+/* rseq (4.18) predates the common numbering */
+#ifndef __NR_rseq
+  #if defined(__aarch64__)
+    #define __NR_rseq 293
+  #elif defined(__arm__)
+    #define __NR_rseq 398
+  #elif defined(__x86_64__)
+    #define __NR_rseq 334
+  #elif defined(__i386__)
+    #define __NR_rseq 386
+  #else
+    #define __NR_rseq SC_NO_NR
+  #endif
+#endif
+
+/* ARM64 requires epoll_create1 (syscall 20) */
+#ifndef __NR_epoll_create1
+  #if defined(__aarch64__)
+    #define __NR_epoll_create1 20
+  #endif
+#endif
+
+#if !defined(HAVE_COMMON_SYSCALL_NRS) && !defined(__NR_mseal)
+  #error Unsupported architecture: add the post-5.1 syscall numbers above
+#endif
+
+#define SC_NO_NR -1
+
+#ifndef CLOSE_RANGE_UNSHARE
+  #define CLOSE_RANGE_UNSHARE (1U << 1)
+#endif
+#ifndef CLOSE_RANGE_CLOEXEC
+  #define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
+
+/* One capability bit per probed syscall, in sc_probes[] order */
+enum sc_cap {
+    SC_GETPPID,
+    SC_RSEQ,
+    SC_PIDFD_SEND_SIGNAL,
+    SC_IO_URING_SETUP,
+    SC_PIDFD_OPEN,
+    SC_CLONE3,
+    SC_CLOSE_RANGE,
+    SC_OPENAT2,
+    SC_PIDFD_GETFD,
+    SC_FACCESSAT2,
+    SC_PROCESS_MADVISE,
+    SC_EPOLL_PWAIT2,
+    SC_LANDLOCK_CREATE_RULESET,
+    SC_LANDLOCK_ADD_RULE,
+    SC_LANDLOCK_RESTRICT_SELF,
+    SC_MEMFD_SECRET,
+    SC_PROCESS_MRELEASE,
+    SC_FUTEX_WAITV,
+    SC_SET_MEMPOLICY_HOME_NODE,
+    SC_CACHESTAT,
+    SC_FCHMODAT2,
+    SC_MSEAL,
+    SC_NR_CAPS
+};
+
+/* Set in sc_caps once probing has finished */
+#define SC_CAPS_READY (1ULL << 63)
+
+extern _Atomic uint64_t sc_caps;
+
+/* Probe every syscall once (idempotent); returns the capability bitmap */
+uint64_t sc_init(void);
+
+static inline uint64_t sc_caps_get(void) {
+    uint64_t caps = atomic_load_explicit(&sc_caps, memory_order_relaxed);
+    if (__builtin_expect(!(caps & SC_CAPS_READY), 0))
+        caps = sc_init();
+    return caps;
+}
+
+static inline bool sc_has(enum sc_cap cap) {
+    return sc_caps_get() & (1ULL << cap);
+}
+
+/* ------------------------------------------------------------------ */
+/* Probe table                                                         */
+/* ------------------------------------------------------------------ */
+
+enum sc_status { SC_PRESENT, SC_ABSENT, SC_ERROR, SC_UNDEFINED };
+
+/*
+ * One row of the probe table. call() issues the syscall once with safe
+ * arguments and returns the raw syscall() result; ok_errno lists the
+ * failures a working implementation gives for those arguments (0 ends
+ * the list, and success always counts). Calls returning an fd close it.
+ */
+struct sc_probe {
+    const char *name;
+    long nr;
+    long (*call)(long nr);
+    int ok_errno[3];
+    bool returns_fd;
+};
+
+struct sc_probe_result {
+    enum sc_status status;
+    long ret;
+    int err;
+    bool sigsys;
+};
+
+extern const struct sc_probe sc_probes[SC_NR_CAPS];
+
+/*
+ * Probes share an epoll fd and an open file, and need a SIGSYS handler
+ * so that seccomp traps are reported instead of killing the process.
+ * Bracket sc_probe_run()/sc_probe_cost() with these two.
+ */
+void sc_probe_begin(void);
+void sc_probe_end(void);
+
+void sc_probe_run(const struct sc_probe *p, struct sc_probe_result *res);
+
+/* Best per-call time in ns over several loops, including close() for fds */
+long sc_probe_cost(const struct sc_probe *p, int calls, int loops);
+
+/* ------------------------------------------------------------------ */
+/* Wrappers                                                            */
+/* ------------------------------------------------------------------ */
+
+/* epoll_create1, else epoll_create + FD_CLOEXEC (there is none on arm64) */
+int sc_epoll_create1(int flags);
+
+/*
+ * close_range, else close every open fd in [first, last] found through
+ * /proc/self/fd, else a close() loop up to RLIMIT_NOFILE. CLOEXEC and
+ * UNSHARE are emulated. Also used when a backport predates CLOEXEC.
+ */
+int sc_close_range_fallback(unsigned int first, unsigned int last, unsigned int flags);
+
+static inline int sc_close_range(unsigned int first, unsigned int last, unsigned int flags) {
+    if (sc_has(SC_CLOSE_RANGE)) {
+        long ret = syscall(__NR_close_range, first, last, flags);
+        if (!ret || !(flags & CLOSE_RANGE_CLOEXEC))
+            return ret;
+    }
+    return sc_close_range_fallback(first, last, flags);
+}
+
+/*
+ * epoll_pwait2 emulation. Timeouts that are whole milliseconds (or
+ * infinite) go straight to epoll_pwait; finer ones arm a per-thread
+ * timerfd and wait on a private epoll set holding it and epfd, so epfd
+ * itself is left untouched and other threads waiting on it see nothing.
+ */
+int sc_epoll_pwait_timerfd(int epfd, struct epoll_event *events, int maxevents,
+                           const struct timespec *timeout, const sigset_t *sigmask);
+
+static inline int sc_epoll_pwait2(int epfd, struct epoll_event *events, int maxevents,
+                                  const struct timespec *timeout, const sigset_t *sigmask) {
+    if (sc_has(SC_EPOLL_PWAIT2)) {
+        /* The kernel wants its own 64-bit mask; libc sigset_t sizes vary */
+        uint64_t kmask = 0;
+        if (sigmask)
+            memcpy(&kmask, sigmask, sizeof(*sigmask) < sizeof(kmask) ? sizeof(*sigmask)
+                                                                     : sizeof(kmask));
+        return syscall(__NR_epoll_pwait2, epfd, events, maxevents, timeout,
+                       sigmask ? &kmask : NULL, sizeof(kmask));
+    }
+    return sc_epoll_pwait_timerfd(epfd, events, maxevents, timeout, sigmask);
+}
+
+/*
+ * Process handle: a pidfd where the kernel has one, otherwise just the
+ * pid. The fallback keeps working but loses pidfd's immunity to pid reuse.
+ */
+struct sc_pid {
+    pid_t pid;
+    int fd;
+};
+
+static inline int sc_pid_open(pid_t pid, struct sc_pid *h) {
+    h->pid = pid;
+    h->fd = -1;
+    if (sc_has(SC_PIDFD_OPEN)) {
+        h->fd = syscall(__NR_pidfd_open, pid, 0);
+        if (h->fd < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static inline int sc_pid_send_signal(const struct sc_pid *h, int sig) {
+    if (h->fd >= 0 && sc_has(SC_PIDFD_SEND_SIGNAL))
+        return syscall(__NR_pidfd_send_signal, h->fd, sig, NULL, 0);
+    return kill(h->pid, sig);
+}
+
+static inline void sc_pid_close(struct sc_pid *h) {
+    if (h->fd >= 0)
+        close(h->fd);
+    h->fd = -1;
+}
+
+#endif /* SYSCOMPAT_H */